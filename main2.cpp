@@ -1,10 +1,33 @@
 // https://www.nayuki.io/page/montgomery-reduction-algorithm
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
 #include <random>
 #include <cstdio>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#if defined(__unix__)
+#include <sys/mman.h>
+#endif
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 uint32_t bit_length(uint32_t n)
 {
@@ -16,9 +39,9 @@ uint32_t bit_length(uint32_t n)
   return result;
 }
 
-uint32_t mod(const int32_t x, const int32_t n)
+uint32_t mod(const int64_t x, const int64_t n)
 {
-  int32_t result = x % n;
+  int64_t result = x % n;
   if (result < 0) {
     result += n;
   }
@@ -31,13 +54,14 @@ uint32_t mod_mult_inv(const uint32_t n, const uint32_t r)
 {
   uint32_t x = n;
   uint32_t y = r % n;
-  int32_t a = 0;
-  int32_t b = 1;
+  // Bezout coefficients reach n in magnitude, 32 bits are not enough once n >= 2^31
+  int64_t a = 0;
+  int64_t b = 1;
   // std::cout << "a=" << a << ", b=" << b << ", x=" << x << ", y=" << y << "\n";
 
   while (y != 0) {
     const auto tmp_b = b;
-    b = a - static_cast<int32_t>(x / y) * b;
+    b = a - static_cast<int64_t>(x / y) * b;
     a = tmp_b;
 
     const auto tmp_y = y;
@@ -92,80 +116,10607 @@ uint64_t HenselLemma2adicRoot(uint32_t r, uint64_t q) {
   return a_prev;
 }
 
+// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3"), ctr is replaced by the block that
+// the key maps it to. Counter-based, so block i of a sequence is computed without the ones before it.
+void philox4x32(uint32_t ctr[4], uint32_t key0, uint32_t key1)
+{
+  for (int round = 0; round < 10; ++round) {
+    const uint64_t p0 = uint64_t(0xD2511F53) * ctr[0];
+    const uint64_t p1 = uint64_t(0xCD9E8D57) * ctr[2];
+    const uint32_t x1 = uint32_t(p1);
+    const uint32_t x3 = uint32_t(p0);
+    ctr[0] = uint32_t(p1 >> 32) ^ ctr[1] ^ key0;
+    ctr[2] = uint32_t(p0 >> 32) ^ ctr[3] ^ key1;
+    ctr[1] = x1;
+    ctr[3] = x3;
+    key0 += 0x9E3779B9;
+    key1 += 0xBB67AE85;
+  }
+}
+
+// Build with -DMONTGOMERY_STATS to record, per modulus, how often the conditional corrections of the scalar Montgomery
+// operations fire and the bit lengths of what reaches them. Without it MONT_STATS() expands to nothing.
+#ifdef MONTGOMERY_STATS
+#define MONT_STATS(...) __VA_ARGS__
+
+// Counters of one modulus in one thread. Only the owning thread writes, with relaxed load-add-store instead of an
+// atomic read-modify-write, the atomics only let montgomery_stats_dump() read them while it runs.
+struct MontStats {
+  std::atomic<uint64_t> redc;
+  std::atomic<uint64_t> redc_corrections;
+  std::atomic<uint64_t> add;
+  std::atomic<uint64_t> add_corrections;
+  std::atomic<uint64_t> sub;
+  std::atomic<uint64_t> sub_corrections;
+  // Elements handed to the batch kernels, which are not instrumented themselves
+  std::atomic<uint64_t> batch;
+  std::atomic<uint64_t> operand_bits[33];
+  std::atomic<uint64_t> redc_input_bits[65];
+
+  static void bump(std::atomic<uint64_t>& counter, const uint64_t v = 1)
+  {
+    counter.store(counter.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+  }
+
+  void record_redc(const uint64_t x, const bool corrected)
+  {
+    bump(redc);
+    bump(redc_corrections, corrected);
+    bump(redc_input_bits[x ? 64 - __builtin_clzll(x) : 0]);
+  }
+
+  void record_operands(const uint32_t a, const uint32_t b)
+  {
+    bump(operand_bits[a ? 32 - __builtin_clz(a) : 0]);
+    bump(operand_bits[b ? 32 - __builtin_clz(b) : 0]);
+  }
+};
+
+// The tables of one thread. The owner looks up without locking, inserts and readers from other threads take the lock.
+struct MontStatsThread {
+  std::mutex lock;
+  std::unordered_map<uint32_t, MontStats> by_modulus;
+  uint32_t last_n = 0;
+  MontStats* last = nullptr;
+};
+
+// Owns every thread's tables, so the counts of threads that have exited stay in the dump
+struct MontStatsRegistry {
+  std::mutex lock;
+  std::vector<std::unique_ptr<MontStatsThread>> threads;
+};
+
+MontStatsRegistry& mont_stats_registry()
+{
+  static MontStatsRegistry registry;
+  return registry;
+}
+
+MontStats& mont_stats(const uint32_t n)
+{
+  thread_local MontStatsThread* local = []() {
+    auto& registry = mont_stats_registry();
+    std::lock_guard<std::mutex> guard(registry.lock);
+    registry.threads.push_back(std::make_unique<MontStatsThread>());
+    return registry.threads.back().get();
+  }();
+  if (local->last_n != n || !local->last) {
+    auto it = local->by_modulus.find(n);
+    if (it == local->by_modulus.end()) {
+      std::lock_guard<std::mutex> guard(local->lock);
+      // Value-initialized, all counters start at zero
+      it = local->by_modulus.try_emplace(n).first;
+    }
+    local->last_n = n;
+    local->last = &it->second;
+  }
+  return *local->last;
+}
+
+// One line per modulus, threads merged, histograms as bits:count for the non-empty buckets:
+// n=998244353 redc=... redc_corrections=... add=... add_corrections=... sub=... sub_corrections=... batch=...
+//   operand_bits=29:...,30:... redc_input_bits=...
+void montgomery_stats_dump(std::ostream& out)
+{
+  struct Totals {
+    uint64_t counts[7] = {};
+    uint64_t operand_bits[33] = {};
+    uint64_t redc_input_bits[65] = {};
+  };
+  std::map<uint32_t, Totals> totals;
+  auto& registry = mont_stats_registry();
+  std::lock_guard<std::mutex> guard(registry.lock);
+  for (const auto& thread : registry.threads) {
+    std::lock_guard<std::mutex> thread_guard(thread->lock);
+    for (const auto& [n, s] : thread->by_modulus) {
+      Totals& t = totals[n];
+      const std::atomic<uint64_t>* counts[7] = {&s.redc, &s.redc_corrections, &s.add,  &s.add_corrections,
+                                                &s.sub,  &s.sub_corrections,  &s.batch};
+      for (size_t i = 0; i < 7; ++i) {
+        t.counts[i] += counts[i]->load(std::memory_order_relaxed);
+      }
+      for (size_t i = 0; i < 33; ++i) {
+        t.operand_bits[i] += s.operand_bits[i].load(std::memory_order_relaxed);
+      }
+      for (size_t i = 0; i < 65; ++i) {
+        t.redc_input_bits[i] += s.redc_input_bits[i].load(std::memory_order_relaxed);
+      }
+    }
+  }
+  const char* names[7] = {"redc", "redc_corrections", "add", "add_corrections", "sub", "sub_corrections", "batch"};
+  const auto histogram = [&out](const char* name, const uint64_t* buckets, const size_t len) {
+    out << " " << name << "=";
+    const char* sep = "";
+    for (size_t i = 0; i < len; ++i) {
+      if (buckets[i] > 0) {
+        out << sep << i << ":" << buckets[i];
+        sep = ",";
+      }
+    }
+  };
+  for (const auto& [n, t] : totals) {
+    out << "n=" << n;
+    for (size_t i = 0; i < 7; ++i) {
+      out << " " << names[i] << "=" << t.counts[i];
+    }
+    histogram("operand_bits", t.operand_bits, 33);
+    histogram("redc_input_bits", t.redc_input_bits, 65);
+    out << "\n";
+  }
+}
+
+// Zeroes the counters, meant for between phases when no other thread is computing
+void montgomery_stats_reset()
+{
+  auto& registry = mont_stats_registry();
+  std::lock_guard<std::mutex> guard(registry.lock);
+  for (const auto& thread : registry.threads) {
+    std::lock_guard<std::mutex> thread_guard(thread->lock);
+    for (auto& [n, s] : thread->by_modulus) {
+      for (auto* c : {&s.redc, &s.redc_corrections, &s.add, &s.add_corrections, &s.sub, &s.sub_corrections,
+                      &s.batch}) {
+        c->store(0, std::memory_order_relaxed);
+      }
+      for (auto& c : s.operand_bits) {
+        c.store(0, std::memory_order_relaxed);
+      }
+      for (auto& c : s.redc_input_bits) {
+        c.store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+}
+
+// MONTGOMERY_STATS_DUMP=path writes the dump there when the program exits. Built after the registry, so destroyed
+// before it.
+struct MontStatsExitDump {
+  MontStatsExitDump()
+  {
+    mont_stats_registry();
+  }
+
+  ~MontStatsExitDump()
+  {
+    const char* path = std::getenv("MONTGOMERY_STATS_DUMP");
+    if (path && *path) {
+      std::ofstream out(path);
+      montgomery_stats_dump(out);
+    }
+  }
+} mont_stats_exit_dump;
+#else
+#define MONT_STATS(...)
+#endif
+
+class Montgomery;
+
+// Constants the SIMD kernels broadcast into vector registers
+struct MontParams {
+  uint32_t n;
+  uint32_t n_inv_mod;
+  uint32_t r_bit_len;
+  uint32_t r_mask;
+  uint32_t r2_mod_n;
+  uint64_t lazy_bound;
+  uint64_t lazy_terms;
+};
+
+// Batch kernels of one instruction set, picked once at startup by montgomery_kernels()
+struct MontKernels {
+  const char* isa;
+  void (*multiply_batch)(Montgomery&, const uint32_t*, const uint32_t*, uint32_t*, size_t);
+  void (*convert_in_batch)(Montgomery&, const uint32_t*, uint32_t*, size_t);
+  void (*mul_add_batch)(Montgomery&, const uint32_t*, const uint32_t*, const uint32_t*, uint32_t*, size_t);
+  void (*mul_sub_batch)(Montgomery&, const uint32_t*, const uint32_t*, const uint32_t*, uint32_t*, size_t);
+  uint32_t (*dot)(Montgomery&, const uint32_t*, const uint32_t*, size_t);
+  // Radix-2 butterflies between x[0, len) and y[0, len) with twiddles w[0, len)
+  void (*ntt_dif)(Montgomery&, uint32_t*, uint32_t*, const uint32_t*, size_t);
+  void (*ntt_dit)(Montgomery&, uint32_t*, uint32_t*, const uint32_t*, size_t);
+  // All stages of an in-cache transform of a[0, size), roots[half + j] the twiddles of the stage with span half.
+  // roots[1] must be one, the vector kernels skip that multiply. The portable table runs split-radix, which also
+  // needs roots[half + j] = w_(2*half)^j for real roots of unity as NTT builds them.
+  void (*ntt_dif_block)(Montgomery&, uint32_t*, size_t, const uint32_t*);
+  void (*ntt_dit_block)(Montgomery&, uint32_t*, size_t, const uint32_t*);
+  // c -= a b for a (m x k) and b (k x n) row-major with leading dimensions, deferred reduction inside
+  void (*matmul_sub)(Montgomery&, const uint32_t*, size_t, const uint32_t*, size_t, uint32_t*, size_t, size_t, size_t,
+                     size_t);
+  // out[t] = sum_j c[j] src[j][offset + t] R^-1 over k separate rows, deferred reduction along j
+  void (*combine_rows)(Montgomery&, const uint32_t*, const uint32_t* const*, size_t, size_t, uint32_t*, size_t);
+  // y[0, 16 num_slices) = A x for a matrix in 16-row sliced ELL layout, see sell_matvec_portable()
+  void (*sell_matvec)(Montgomery&, const uint32_t*, const uint32_t*, const size_t*, size_t, const uint32_t*, uint32_t*);
+  void (*pow_batch)(Montgomery&, const uint32_t*, uint64_t, uint32_t*, size_t);
+  // Residues below n out of Philox blocks [counter, counter + 16 groups) of (seed, stream), see
+  // random_residues_portable(). Writes at most 64 per group and returns how many.
+  size_t (*random_residues)(Montgomery&, uint64_t, uint64_t, uint64_t, size_t, uint32_t*);
+};
+
+const MontKernels& montgomery_kernels();
+const MontKernels& portable_montgomery_kernels();
+
 class Montgomery {
 public:
-  Montgomery(const uint32_t _n) : n(_n)
+  Montgomery(const uint32_t _n) : n(_n)
+  {
+    if (n < 3) {
+      std::cout << "n=" << n << "\n";
+      throw std::invalid_argument("Modulus must be >= 3.");
+    }
+    if (n % 2 == 0) {
+      std::cout << "n=" << n << "\n";
+      throw std::invalid_argument("Modulus must be odd.");
+    }
+
+    r_bit_len = bit_length(n);
+    assert(r_bit_len <= 32);
+
+    // R = 2^32 does not fit in 32 bits
+    const uint64_t r = uint64_t(1) << r_bit_len;
+    r_mask = r - 1;
+    r_mod_n = r % n;
+    r_inv_mod = mod_mult_inv(n, r_mod_n); // r^-1 mod n
+
+    n_inv_mod = (r * static_cast<uint64_t>(r_inv_mod) - 1) / n; // -n^-1 mod r
+    n_inv_pos = r - n_inv_mod; // n^-1 mod r
+
+    r2_mod_n = (static_cast<uint64_t>(r_mod_n) * static_cast<uint64_t>(r_mod_n)) % n;
+
+    // Deferred reduction: sums of products are kept below lazy_bound (a multiple of n just above 2^63),
+    // lazy_terms products can be added before one conditional subtraction is needed.
+    // Above about 2^31.5 a single product no longer fits next to lazy_bound and lazy_terms is 0.
+    nr = static_cast<uint64_t>(n) << r_bit_len;
+    lazy_bound = ((uint64_t(1) << 63) / n + 1) * n;
+    lazy_terms = (UINT64_MAX - lazy_bound) / (static_cast<uint64_t>(n - 1) * (n - 1));
+
+    // The SIMD kernels keep REDC results below 2n in 32-bit lanes, which needs n < 2^31
+    kernels = n > INT32_MAX ? &portable_montgomery_kernels() : &montgomery_kernels();
+
+    // std::cout << "r_bit_len=" << r_bit_len << "\n";
+    // std::cout << "r=" << r << "\n";
+    // std::cout << "r_inv_mod=" << r_inv_mod << "\n";
+    // std::cout << "r_mask=" << r_mask << "\n";
+    // std::cout << "k=" << k << "\n\n";
+  }
+
+  uint32_t convert_in(uint32_t x)
+  {
+    if (x >= n) {
+      x %= n; // Maybe this should be a warning or an error...
+    }
+    return REDC(static_cast<uint64_t>(x) * static_cast<uint64_t>(r2_mod_n));
+  }
+
+  uint32_t convert_out(const uint32_t x)
+  {
+    return REDC(x);
+  }
+
+  uint32_t multiply(const uint32_t a, const uint32_t b)
+  {
+    MONT_STATS(mont_stats(n).record_operands(a, b));
+    return REDC(static_cast<uint64_t>(a) * static_cast<uint64_t>(b));
+  }
+
+  // a * b * R^-1 + c. Folding c into the REDC (a*b + c*R, one shared correction of a quotient in (-n, 2n)) was
+  // measured and lost: the REDC fix-up and the add are each a single cmov, while the folded form puts the c*R add
+  // and a two-sided correction on the chain, about 20% slower in Horner. The gain is in the batch versions.
+  uint32_t mul_add(const uint32_t a, const uint32_t b, const uint32_t c)
+  {
+    return add(multiply(a, b), c);
+  }
+
+  uint32_t mul_sub(const uint32_t a, const uint32_t b, const uint32_t c)
+  {
+    return sub(multiply(a, b), c);
+  }
+
+  // The batch operations below go through the kernel table, no per-call dispatch
+  void multiply_batch(const uint32_t* a, const uint32_t* b, uint32_t* out, const size_t len)
+  {
+    MONT_STATS(MontStats::bump(mont_stats(n).batch, len));
+    kernels->multiply_batch(*this, a, b, out, len);
+  }
+
+  void convert_in_batch(const uint32_t* x, uint32_t* out, const size_t len)
+  {
+    MONT_STATS(MontStats::bump(mont_stats(n).batch, len));
+    kernels->convert_in_batch(*this, x, out, len);
+  }
+
+  // out[i] = a[i] * b[i] * R^-1 + c[i], one pass, out may alias any input
+  void mul_add_batch(const uint32_t* a, const uint32_t* b, const uint32_t* c, uint32_t* out, const size_t len)
+  {
+    MONT_STATS(MontStats::bump(mont_stats(n).batch, len));
+    kernels->mul_add_batch(*this, a, b, c, out, len);
+  }
+
+  // out[i] = a[i] * b[i] * R^-1 - c[i], one pass
+  void mul_sub_batch(const uint32_t* a, const uint32_t* b, const uint32_t* c, uint32_t* out, const size_t len)
+  {
+    MONT_STATS(MontStats::bump(mont_stats(n).batch, len));
+    kernels->mul_sub_batch(*this, a, b, c, out, len);
+  }
+
+  void convert_out_batch(const uint32_t* x, uint32_t* out, const size_t len)
+  {
+    for (size_t i = 0; i < len; ++i) {
+      out[i] = convert_out(x[i]);
+    }
+  }
+
+  // sum(a[i] * b[i]) * R^-1
+  uint32_t dot(const uint32_t* a, const uint32_t* b, const size_t len)
+  {
+    return kernels->dot(*this, a, b, len);
+  }
+
+  // out[i] = a[i]^e, Montgomery form in and out
+  void pow_batch(const uint32_t* a, const uint64_t e, uint32_t* out, const size_t len)
+  {
+    MONT_STATS(MontStats::bump(mont_stats(n).batch, len));
+    kernels->pow_batch(*this, a, e, out, len);
+  }
+
+  const MontKernels& batch_kernels()
+  {
+    return *kernels;
+  }
+
+  MontParams params()
+  {
+    return {n, n_inv_mod, r_bit_len, r_mask, r2_mod_n, lazy_bound, lazy_terms};
+  }
+
+  uint64_t lazy_fold(const uint64_t acc)
+  {
+    return acc >= lazy_bound ? acc - lazy_bound : acc;
+  }
+
+  uint64_t lazy_max_terms()
+  {
+    return lazy_terms;
+  }
+
+  // a + b can wrap 32 bits when n >= 2^31, compare against n - b instead
+  uint32_t add(const uint32_t a, const uint32_t b)
+  {
+    const uint32_t t = n - b;
+    MONT_STATS(MontStats& s = mont_stats(n); MontStats::bump(s.add); MontStats::bump(s.add_corrections, a >= t));
+    return a >= t ? a - t : a + b;
+  }
+
+  uint32_t sub(const uint32_t a, const uint32_t b)
+  {
+    MONT_STATS(MontStats& s = mont_stats(n); MontStats::bump(s.sub); MontStats::bump(s.sub_corrections, a < b));
+    return a >= b ? a - b : a + (n - b);
+  }
+
+  // Square-and-multiply, a and the result are in Montgomery form
+  uint32_t pow(const uint32_t a, uint64_t e)
+  {
+    uint32_t result = one();
+    uint32_t base = a;
+    while (e > 0) {
+      if (e & 1) {
+        result = multiply(result, base);
+      }
+      base = multiply(base, base);
+      e >>= 1;
+    }
+    return result;
+  }
+
+  // (aR)^-1 = a^-1 R^-1, two conversions bring it back to a^-1 R
+  uint32_t inverse(const uint32_t a)
+  {
+    return convert_in(convert_in(mod_mult_inv(n, a)));
+  }
+
+  uint32_t one()
+  {
+    return r_mod_n;
+  }
+
+  uint32_t modulus()
+  {
+    return n;
+  }
+
+  // Subtractive form: with m = x * n^-1 mod R the low bits of x - m*n cancel and the quotient lies in (-n, n).
+  // Unlike x + s*n it never needs a 65th bit, so n up to 2^32 works. A borrow out of x - m*n only changes bits
+  // of the quotient above 32 (R <= 2^32), which the truncation drops, and adding n then brings it into [0, n).
+  uint32_t REDC(const uint64_t x)
+  {
+    const uint32_t m = (static_cast<uint32_t>(x) * n_inv_pos) & r_mask;
+    const uint64_t mn = m * static_cast<uint64_t>(n);
+    const uint32_t u = (x - mn) >> r_bit_len;
+    MONT_STATS(mont_stats(n).record_redc(x, x < mn));
+    return x < mn ? u + n : u;
+  }
+
+  // x * R^-1 mod n for any 64-bit x. Each step divides by R without overflowing until x < n*R,
+  // the extra R^-1 factors are multiplied back afterwards.
+  uint32_t REDC_wide(uint64_t x)
+  {
+    uint32_t steps = 0;
+    while (x >= nr) {
+      const uint64_t x_low = x & r_mask;
+      const uint64_t s = (x_low * static_cast<uint64_t>(n_inv_mod)) & r_mask;
+      x = (x >> r_bit_len) + ((x_low + s * static_cast<uint64_t>(n)) >> r_bit_len);
+      ++steps;
+    }
+    uint32_t u = REDC(x);
+    for (; steps > 0; --steps) {
+      u = multiply(u, r2_mod_n);
+    }
+    return u;
+  }
+
+private:
+  uint32_t n;
+  uint32_t r_bit_len;
+  uint32_t r_inv_mod;
+  uint32_t r_mask;
+  uint32_t n_inv_mod;
+  uint32_t n_inv_pos;
+  uint32_t r_mod_n;
+  uint32_t r2_mod_n;
+  uint64_t nr;
+  uint64_t lazy_bound;
+  uint64_t lazy_terms;
+  const MontKernels* kernels;
+};
+
+/// @brief Per-machine knobs, the defaults are safe everywhere and autotune() measures better ones for the host.
+/// Loaded once from the file named by MONTGOMERY_TUNING (montgomery_tuning.cfg by default), one key=value per line.
+struct TuningConfig {
+  std::string isa;                  // Montgomery batch kernels, empty picks the widest the CPU supports
+  uint32_t pow_window = 5;          // MontgomeryMulti::pow
+  uint32_t batch_pow_window = 5;    // MontgomeryBatch52::pow
+  size_t karatsuba_threshold = 32;  // limbs, Karatsuba recursion bottoms out in schoolbook at this size
+  size_t ntt_threshold = 8192;      // limbs of the smaller operand, bigint_mul switches from Karatsuba to the NTT
+  uint32_t ntt_chunk_bits = 20;     // 16 or 20, bigint_mul digit size
+  size_t poly_schoolbook = 32;      // terms of the smaller operand, poly_multiply skips the NTT up to this size
+  size_t crt_block = 1024;          // tuples per CRT mixed radix block
+  size_t ntt_block = 4096;          // NTT elements finished in cache after the radix-8/4 passes, a power of two
+};
+
+const char* tuning_path()
+{
+  const char* path = std::getenv("MONTGOMERY_TUNING");
+  return path && *path ? path : "montgomery_tuning.cfg";
+}
+
+// Missing file means defaults, unknown keys and out of range values are skipped with a warning
+TuningConfig load_tuning(const std::string& path)
+{
+  TuningConfig cfg;
+  std::ifstream in(path);
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    const size_t eq = line.find('=');
+    const std::string key = line.substr(0, eq);
+    const std::string value = eq == std::string::npos ? "" : line.substr(eq + 1);
+    const uint64_t number = std::strtoull(value.c_str(), nullptr, 10);
+    bool ok = true;
+    if (key == "isa") {
+      ok = value == "portable" || value == "avx2" || value == "avx512";
+      if (ok) {
+        cfg.isa = value;
+      }
+    } else if (key == "pow_window" || key == "batch_pow_window") {
+      ok = number >= 1 && number <= 8;
+      if (ok) {
+        (key == "pow_window" ? cfg.pow_window : cfg.batch_pow_window) = number;
+      }
+    } else if (key == "karatsuba_threshold") {
+      ok = number >= 4 && number <= 4096;
+      if (ok) {
+        cfg.karatsuba_threshold = number;
+      }
+    } else if (key == "ntt_threshold") {
+      ok = number >= 64;
+      if (ok) {
+        cfg.ntt_threshold = number;
+      }
+    } else if (key == "ntt_chunk_bits") {
+      ok = number == 16 || number == 20;
+      if (ok) {
+        cfg.ntt_chunk_bits = number;
+      }
+    } else if (key == "poly_schoolbook") {
+      ok = number <= 4096;
+      if (ok) {
+        cfg.poly_schoolbook = number;
+      }
+    } else if (key == "crt_block") {
+      ok = number >= 16 && number <= (1 << 20);
+      if (ok) {
+        cfg.crt_block = number;
+      }
+    } else if (key == "ntt_block") {
+      ok = number >= 128 && number <= (1 << 20) && (number & (number - 1)) == 0;
+      if (ok) {
+        cfg.ntt_block = number;
+      }
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      std::cerr << "Ignoring tuning entry '" << line << "' in " << path << "\n";
+    }
+  }
+  return cfg;
+}
+
+void save_tuning(const TuningConfig& cfg, const std::string& path)
+{
+  std::ofstream out(path);
+  out << "# Written by main2 tune, delete to go back to the built-in defaults\n";
+  if (!cfg.isa.empty()) {
+    out << "isa=" << cfg.isa << "\n";
+  }
+  out << "pow_window=" << cfg.pow_window << "\n";
+  out << "batch_pow_window=" << cfg.batch_pow_window << "\n";
+  out << "karatsuba_threshold=" << cfg.karatsuba_threshold << "\n";
+  out << "ntt_threshold=" << cfg.ntt_threshold << "\n";
+  out << "ntt_chunk_bits=" << cfg.ntt_chunk_bits << "\n";
+  out << "poly_schoolbook=" << cfg.poly_schoolbook << "\n";
+  out << "crt_block=" << cfg.crt_block << "\n";
+  out << "ntt_block=" << cfg.ntt_block << "\n";
+  if (!out) {
+    std::cout << "path=" << path << "\n";
+    throw std::runtime_error("Could not write the tuning file.");
+  }
+}
+
+// Process wide configuration, read on first use. autotune() updates it in place while measuring.
+TuningConfig& tuning()
+{
+  static TuningConfig cfg = load_tuning(tuning_path());
+  return cfg;
+}
+
+// Portable kernels, the reference for every SIMD table
+
+void multiply_batch_portable(Montgomery& mont, const uint32_t* a, const uint32_t* b, uint32_t* out, const size_t len)
+{
+  for (size_t i = 0; i < len; ++i) {
+    out[i] = mont.multiply(a[i], b[i]);
+  }
+}
+
+void mul_add_batch_portable(Montgomery& mont, const uint32_t* a, const uint32_t* b, const uint32_t* c, uint32_t* out,
+                            const size_t len)
+{
+  for (size_t i = 0; i < len; ++i) {
+    out[i] = mont.mul_add(a[i], b[i], c[i]);
+  }
+}
+
+void mul_sub_batch_portable(Montgomery& mont, const uint32_t* a, const uint32_t* b, const uint32_t* c, uint32_t* out,
+                            const size_t len)
+{
+  for (size_t i = 0; i < len; ++i) {
+    out[i] = mont.mul_sub(a[i], b[i], c[i]);
+  }
+}
+
+void convert_in_batch_portable(Montgomery& mont, const uint32_t* x, uint32_t* out, const size_t len)
+{
+  for (size_t i = 0; i < len; ++i) {
+    out[i] = mont.convert_in(x[i]);
+  }
+}
+
+// sum(a[i] * b[i]) * R^-1, one conditional subtraction every lazy_terms products and a single reduction at the end
+uint32_t dot_portable(Montgomery& mont, const uint32_t* a, const uint32_t* b, const size_t len)
+{
+  const uint64_t lazy_terms = mont.lazy_max_terms();
+  if (lazy_terms == 0) {
+    // No headroom above about 2^31.5, every product is reduced on its own
+    uint32_t result = 0;
+    for (size_t i = 0; i < len; ++i) {
+      result = mont.add(result, mont.multiply(a[i], b[i]));
+    }
+    return result;
+  }
+  uint64_t acc = 0;
+  size_t i = 0;
+  while (i < len) {
+    const size_t end = std::min<size_t>(len, i + lazy_terms);
+    for (; i < end; ++i) {
+      acc += static_cast<uint64_t>(a[i]) * static_cast<uint64_t>(b[i]);
+    }
+    acc = mont.lazy_fold(acc);
+  }
+  return mont.REDC_wide(acc);
+}
+
+// NTT butterflies over len pairs, decimation in frequency: x, y = x + y, (x - y) w
+void ntt_dif_portable(Montgomery& mont, uint32_t* x, uint32_t* y, const uint32_t* w, const size_t len)
+{
+  for (size_t j = 0; j < len; ++j) {
+    const uint32_t u = x[j];
+    const uint32_t v = y[j];
+    x[j] = mont.add(u, v);
+    y[j] = mont.multiply(mont.sub(u, v), w[j]);
+  }
+}
+
+// Decimation in time: x, y = x + y w, x - y w
+void ntt_dit_portable(Montgomery& mont, uint32_t* x, uint32_t* y, const uint32_t* w, const size_t len)
+{
+  for (size_t j = 0; j < len; ++j) {
+    const uint32_t u = x[j];
+    const uint32_t v = mont.multiply(y[j], w[j]);
+    x[j] = mont.add(u, v);
+    y[j] = mont.sub(u, v);
+  }
+}
+
+// Every stage of a length size transform held in cache, roots[half + j] = w_(2*half)^j as in NTT
+void ntt_dif_block_portable(Montgomery& mont, uint32_t* a, const size_t size, const uint32_t* roots)
+{
+  for (size_t half = size / 2; half >= 1; half >>= 1) {
+    for (size_t i = 0; i < size; i += 2 * half) {
+      ntt_dif_portable(mont, a + i, a + i + half, roots + half, half);
+    }
+  }
+}
+
+void ntt_dit_block_portable(Montgomery& mont, uint32_t* a, const size_t size, const uint32_t* roots)
+{
+  for (size_t half = 1; half < size; half <<= 1) {
+    for (size_t i = 0; i < size; i += 2 * half) {
+      ntt_dit_portable(mont, a + i, a + i + half, roots + half, half);
+    }
+  }
+}
+
+// Split-radix (Duhamel-Hollmann) DIF, same scrambled output as ntt_dif_block_portable. An L-shaped butterfly
+// runs the first two radix-2 stages of the odd half together: with i = w^(size/4) its outputs are
+// ((a - c) + i (b - d)) w^j and ((a - c) - i (b - d)) w^3j, three products per four points instead of four.
+// w^3j past size/2 is -w^(3j - size/2), roots[3j] in the table.
+void ntt_dif_block_split_radix_portable(Montgomery& mont, uint32_t* a, const size_t size, const uint32_t* roots)
+{
+  if (size <= 2) {
+    ntt_dif_block_portable(mont, a, size, roots);
+    return;
+  }
+  const size_t half = size / 2;
+  const size_t quarter = size / 4;
+  const uint32_t i = roots[half + quarter];
+  for (size_t j = 0; j < quarter; ++j) {
+    const uint32_t a0 = a[j], a1 = a[j + quarter], a2 = a[j + half], a3 = a[j + half + quarter];
+    const uint32_t t1 = mont.sub(a0, a2);
+    const uint32_t t2 = mont.multiply(mont.sub(a1, a3), i);
+    a[j] = mont.add(a0, a2);
+    a[j + quarter] = mont.add(a1, a3);
+    a[j + half] = mont.multiply(mont.add(t1, t2), roots[half + j]);
+    a[j + half + quarter] = 3 * j < half ? mont.multiply(mont.sub(t1, t2), roots[half + 3 * j])
+                                         : mont.multiply(mont.sub(t2, t1), roots[3 * j]);
+  }
+  ntt_dif_block_split_radix_portable(mont, a, half, roots);
+  ntt_dif_block_split_radix_portable(mont, a + half, quarter, roots);
+  ntt_dif_block_split_radix_portable(mont, a + half + quarter, quarter, roots);
+}
+
+// Inverse of the split-radix DIF, same result as ntt_dit_block_portable: u = a_2 w^j, v = a_3 w^3j,
+// then a_0 +- (u + v) and a_1 +- i (u - v)
+void ntt_dit_block_split_radix_portable(Montgomery& mont, uint32_t* a, const size_t size, const uint32_t* roots)
+{
+  if (size <= 2) {
+    ntt_dit_block_portable(mont, a, size, roots);
+    return;
+  }
+  const size_t half = size / 2;
+  const size_t quarter = size / 4;
+  ntt_dit_block_split_radix_portable(mont, a, half, roots);
+  ntt_dit_block_split_radix_portable(mont, a + half, quarter, roots);
+  ntt_dit_block_split_radix_portable(mont, a + half + quarter, quarter, roots);
+  const uint32_t i = roots[half + quarter];
+  for (size_t j = 0; j < quarter; ++j) {
+    const uint32_t a0 = a[j], a1 = a[j + quarter];
+    const uint32_t u = mont.multiply(a[j + half], roots[half + j]);
+    const uint32_t v = 3 * j < half ? mont.multiply(a[j + half + quarter], roots[half + 3 * j])
+                                    : mont.sub(0, mont.multiply(a[j + half + quarter], roots[3 * j]));
+    const uint32_t s = mont.add(u, v);
+    const uint32_t d = mont.multiply(mont.sub(u, v), i);
+    a[j] = mont.add(a0, s);
+    a[j + half] = mont.sub(a0, s);
+    a[j + quarter] = mont.add(a1, d);
+    a[j + half + quarter] = mont.sub(a1, d);
+  }
+}
+
+// c[i][j] -= sum_t a[i][t] b[t][j] for an m x k times k x n product, row-major with leading dimensions.
+// Deferred reduction along t, one REDC per element of c.
+void matmul_sub_portable(Montgomery& mont, const uint32_t* a, const size_t lda, const uint32_t* b, const size_t ldb,
+                         uint32_t* c, const size_t ldc, const size_t m, const size_t n, const size_t k)
+{
+  const uint64_t lazy_terms = mont.lazy_max_terms();
+  uint64_t acc[64];
+  for (size_t j0 = 0; j0 < n; j0 += 64) {
+    const size_t width = std::min<size_t>(64, n - j0);
+    for (size_t i = 0; i < m; ++i) {
+      std::fill(acc, acc + width, 0);
+      uint64_t terms = 0;
+      for (size_t t = 0; t < k; ++t) {
+        const uint64_t x = a[i * lda + t];
+        const uint32_t* row = b + t * ldb + j0;
+        for (size_t j = 0; j < width; ++j) {
+          acc[j] += x * row[j];
+        }
+        if (++terms == lazy_terms) {
+          for (size_t j = 0; j < width; ++j) {
+            acc[j] = mont.lazy_fold(acc[j]);
+          }
+          terms = 0;
+        }
+      }
+      uint32_t* out = c + i * ldc + j0;
+      for (size_t j = 0; j < width; ++j) {
+        out[j] = mont.sub(out[j], mont.REDC_wide(acc[j]));
+      }
+    }
+  }
+}
+
+// out[t] = sum_j c[j] src[j][offset + t] * R^-1 for t < len, the k rows in separate buffers (erasure code
+// shards). Deferred reduction along j in blocks of 256 outputs, one REDC per output.
+void combine_rows_portable(Montgomery& mont, const uint32_t* c, const uint32_t* const* src, const size_t k,
+                           const size_t offset, uint32_t* out, const size_t len)
+{
+  const uint64_t lazy_terms = mont.lazy_max_terms();
+  if (lazy_terms == 0) {
+    // No headroom above about 2^31.5, every product is reduced on its own
+    for (size_t t = 0; t < len; ++t) {
+      uint32_t result = 0;
+      for (size_t j = 0; j < k; ++j) {
+        result = mont.add(result, mont.multiply(c[j], src[j][offset + t]));
+      }
+      out[t] = result;
+    }
+    return;
+  }
+  uint64_t acc[256];
+  for (size_t t0 = 0; t0 < len; t0 += 256) {
+    const size_t width = std::min<size_t>(256, len - t0);
+    std::fill(acc, acc + width, 0);
+    uint64_t terms = 0;
+    for (size_t j = 0; j < k; ++j) {
+      const uint64_t x = c[j];
+      const uint32_t* row = src[j] + offset + t0;
+      for (size_t t = 0; t < width; ++t) {
+        acc[t] += x * row[t];
+      }
+      if (++terms == lazy_terms) {
+        for (size_t t = 0; t < width; ++t) {
+          acc[t] = mont.lazy_fold(acc[t]);
+        }
+        terms = 0;
+      }
+    }
+    for (size_t t = 0; t < width; ++t) {
+      out[t0 + t] = mont.REDC_wide(acc[t]);
+    }
+  }
+}
+
+// Sliced ELL mat-vec: slice s holds rows [16s, 16s + 16), entry j of its lane l at slice_ptr[s] + 16j + l.
+// Padding entries are zero. Every row accumulates in 64 bits with deferred reduction, one REDC per row.
+void sell_matvec_portable(Montgomery& mont, const uint32_t* values, const uint32_t* cols, const size_t* slice_ptr,
+                          const size_t num_slices, const uint32_t* x, uint32_t* y)
+{
+  const uint64_t lazy_terms = mont.lazy_max_terms();
+  for (size_t s = 0; s < num_slices; ++s) {
+    uint64_t acc[16] = {};
+    uint64_t terms = 0;
+    for (size_t e = slice_ptr[s]; e < slice_ptr[s + 1]; e += 16) {
+      for (size_t l = 0; l < 16; ++l) {
+        acc[l] += static_cast<uint64_t>(values[e + l]) * x[cols[e + l]];
+      }
+      if (++terms == lazy_terms) {
+        for (size_t l = 0; l < 16; ++l) {
+          acc[l] = mont.lazy_fold(acc[l]);
+        }
+        terms = 0;
+      }
+    }
+    for (size_t l = 0; l < 16; ++l) {
+      y[16 * s + l] = mont.REDC_wide(acc[l]);
+    }
+  }
+}
+
+void pow_batch_portable(Montgomery& mont, const uint32_t* a, const uint64_t e, uint32_t* out, const size_t len)
+{
+  for (size_t i = 0; i < len; ++i) {
+    out[i] = mont.pow(a[i], e);
+  }
+}
+
+// Block counter + j of a group is the counter word pair, stream the other pair and seed the key. Candidates are the
+// words of the 16 blocks taken word-major (word 0 of blocks 0 to 15, then word 1, ...), the order SIMD lanes produce
+// them in, masked to the bit length of n. The ones below n are kept in order.
+size_t random_residues_portable(Montgomery& mont, const uint64_t seed, const uint64_t stream, const uint64_t counter,
+                                const size_t groups, uint32_t* out)
+{
+  const MontParams p = mont.params();
+  size_t count = 0;
+  for (size_t g = 0; g < groups; ++g) {
+    uint32_t blocks[16][4];
+    for (size_t j = 0; j < 16; ++j) {
+      const uint64_t c = counter + 16 * g + j;
+      blocks[j][0] = uint32_t(c);
+      blocks[j][1] = uint32_t(c >> 32);
+      blocks[j][2] = uint32_t(stream);
+      blocks[j][3] = uint32_t(stream >> 32);
+      philox4x32(blocks[j], uint32_t(seed), uint32_t(seed >> 32));
+    }
+    for (size_t w = 0; w < 4; ++w) {
+      for (size_t j = 0; j < 16; ++j) {
+        // Branch-free, a rejected candidate is overwritten by the next one
+        const uint32_t v = blocks[j][w] & p.r_mask;
+        out[count] = v;
+        count += v < p.n;
+      }
+    }
+  }
+  return count;
+}
+
+#if defined(__x86_64__)
+// AVX2, 8 lanes of 32 bits. Products of even and odd lanes go through vpmuludq separately.
+
+struct MontAvx2 {
+  __m256i n;
+  __m256i n_inv_mod;
+  __m256i r_mask;
+  __m128i r_bit_len;
+
+  __attribute__((target("avx2"))) MontAvx2(Montgomery& mont)
+  {
+    const MontParams p = mont.params();
+    n = _mm256_set1_epi32(p.n);
+    n_inv_mod = _mm256_set1_epi32(p.n_inv_mod);
+    r_mask = _mm256_set1_epi32(p.r_mask);
+    r_bit_len = _mm_cvtsi32_si128(p.r_bit_len);
+  }
+
+  __attribute__((target("avx2"))) __m256i multiply(const __m256i a, const __m256i b) const
+  {
+    const __m256i x_even = _mm256_mul_epu32(a, b);
+    const __m256i x_odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32));
+    const __m256i x_low = _mm256_blend_epi32(x_even, _mm256_slli_epi64(x_odd, 32), 0xAA);
+    const __m256i s = _mm256_and_si256(_mm256_mullo_epi32(_mm256_and_si256(x_low, r_mask), n_inv_mod), r_mask);
+    const __m256i t_even = _mm256_add_epi64(x_even, _mm256_mul_epu32(s, n));
+    const __m256i t_odd = _mm256_add_epi64(x_odd, _mm256_mul_epu32(_mm256_srli_epi64(s, 32), n));
+    const __m256i u = _mm256_blend_epi32(_mm256_srl_epi64(t_even, r_bit_len),
+                                         _mm256_slli_epi64(_mm256_srl_epi64(t_odd, r_bit_len), 32), 0xAA);
+    return _mm256_min_epu32(u, _mm256_sub_epi32(u, n));
+  }
+
+  __attribute__((target("avx2"))) __m256i add(const __m256i a, const __m256i b) const
+  {
+    const __m256i c = _mm256_add_epi32(a, b);
+    return _mm256_min_epu32(c, _mm256_sub_epi32(c, n));
+  }
+
+  __attribute__((target("avx2"))) __m256i sub(const __m256i a, const __m256i b) const
+  {
+    const __m256i c = _mm256_sub_epi32(a, b);
+    return _mm256_min_epu32(c, _mm256_add_epi32(c, n));
+  }
+};
+
+__attribute__((target("avx2")))
+void multiply_batch_avx2(Montgomery& mont, const uint32_t* a, const uint32_t* b, uint32_t* out, const size_t len)
+{
+  const MontAvx2 m(mont);
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    const __m256i a_ = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+    const __m256i b_ = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), m.multiply(a_, b_));
+  }
+  multiply_batch_portable(mont, a + i, b + i, out + i, len - i);
+}
+
+// One pass instead of multiply_batch() followed by an add loop, the product never leaves the register
+__attribute__((target("avx2")))
+void mul_add_batch_avx2(Montgomery& mont, const uint32_t* a, const uint32_t* b, const uint32_t* c, uint32_t* out,
+                        const size_t len)
+{
+  const MontAvx2 m(mont);
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    const __m256i a_ = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+    const __m256i b_ = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+    const __m256i c_ = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), m.add(m.multiply(a_, b_), c_));
+  }
+  mul_add_batch_portable(mont, a + i, b + i, c + i, out + i, len - i);
+}
+
+__attribute__((target("avx2")))
+void mul_sub_batch_avx2(Montgomery& mont, const uint32_t* a, const uint32_t* b, const uint32_t* c, uint32_t* out,
+                        const size_t len)
+{
+  const MontAvx2 m(mont);
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    const __m256i a_ = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+    const __m256i b_ = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+    const __m256i c_ = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), m.sub(m.multiply(a_, b_), c_));
+  }
+  mul_sub_batch_portable(mont, a + i, b + i, c + i, out + i, len - i);
+}
+
+__attribute__((target("avx2")))
+void convert_in_batch_avx2(Montgomery& mont, const uint32_t* x, uint32_t* out, const size_t len)
+{
+  const MontAvx2 m(mont);
+  const __m256i r2 = _mm256_set1_epi32(mont.params().r2_mod_n);
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    const __m256i x_ = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + i));
+    // x >= n needs a division, left to the scalar path
+    if (!_mm256_testc_si256(_mm256_cmpeq_epi32(_mm256_min_epu32(x_, _mm256_sub_epi32(m.n, _mm256_set1_epi32(1))),
+                                               x_), _mm256_set1_epi32(-1))) {
+      convert_in_batch_portable(mont, x + i, out + i, 8);
+      continue;
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), m.multiply(x_, r2));
+  }
+  convert_in_batch_portable(mont, x + i, out + i, len - i);
+}
+
+__attribute__((target("avx2")))
+uint32_t dot_avx2(Montgomery& mont, const uint32_t* a, const uint32_t* b, const size_t len)
+{
+  const MontParams p = mont.params();
+  // Unsigned 64-bit compare through the signed one with the sign bit flipped
+  const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+  const __m256i bound = _mm256_set1_epi64x(p.lazy_bound);
+  const __m256i bound_flipped = _mm256_xor_si256(bound, sign);
+  auto fold = [&](const __m256i acc) __attribute__((target("avx2"))) {
+    const __m256i below = _mm256_cmpgt_epi64(bound_flipped, _mm256_xor_si256(acc, sign));
+    return _mm256_sub_epi64(acc, _mm256_andnot_si256(below, bound));
+  };
+  __m256i acc_even = _mm256_setzero_si256();
+  __m256i acc_odd = _mm256_setzero_si256();
+  size_t i = 0;
+  uint64_t terms = 0;
+  for (; i + 8 <= len; i += 8) {
+    const __m256i a_ = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+    const __m256i b_ = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+    acc_even = _mm256_add_epi64(acc_even, _mm256_mul_epu32(a_, b_));
+    acc_odd = _mm256_add_epi64(acc_odd, _mm256_mul_epu32(_mm256_srli_epi64(a_, 32), _mm256_srli_epi64(b_, 32)));
+    if (++terms == p.lazy_terms) {
+      acc_even = fold(acc_even);
+      acc_odd = fold(acc_odd);
+      terms = 0;
+    }
+  }
+  acc_even = fold(acc_even);
+  acc_odd = fold(acc_odd);
+  uint64_t lanes[8];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc_even);
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes + 4), acc_odd);
+  uint32_t result = dot_portable(mont, a + i, b + i, len - i);
+  for (const uint64_t lane : lanes) {
+    result = mont.add(result, mont.REDC_wide(lane));
+  }
+  return result;
+}
+
+__attribute__((target("avx2")))
+void ntt_dif_avx2(Montgomery& mont, uint32_t* x, uint32_t* y, const uint32_t* w, const size_t len)
+{
+  const MontAvx2 m(mont);
+  size_t j = 0;
+  for (; j + 8 <= len; j += 8) {
+    const __m256i u = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + j));
+    const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(y + j));
+    const __m256i w_ = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w + j));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(x + j), m.add(u, v));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(y + j), m.multiply(m.sub(u, v), w_));
+  }
+  ntt_dif_portable(mont, x + j, y + j, w + j, len - j);
+}
+
+__attribute__((target("avx2")))
+void ntt_dit_avx2(Montgomery& mont, uint32_t* x, uint32_t* y, const uint32_t* w, const size_t len)
+{
+  const MontAvx2 m(mont);
+  size_t j = 0;
+  for (; j + 8 <= len; j += 8) {
+    const __m256i u = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + j));
+    const __m256i v = m.multiply(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(y + j)),
+                                 _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w + j)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(x + j), m.add(u, v));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(y + j), m.sub(u, v));
+  }
+  ntt_dit_portable(mont, x + j, y + j, w + j, len - j);
+}
+
+// Whole in-cache transform. Stages with half >= 8 pair whole registers; the last three pair lanes of two
+// registers A, B (two groups of 8) after a shuffle into X (first of each pair) and Y (second), then shuffle back.
+__attribute__((target("avx2")))
+void ntt_dif_block_avx2(Montgomery& mont, uint32_t* a, const size_t size, const uint32_t* roots)
+{
+  if (size < 16) {
+    ntt_dif_block_portable(mont, a, size, roots);
+    return;
+  }
+  const MontAvx2 m(mont);
+  for (size_t half = size / 2; half >= 8; half >>= 1) {
+    for (size_t i = 0; i < size; i += 2 * half) {
+      for (size_t j = 0; j < half; j += 8) {
+        const __m256i u = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i + j));
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i + j + half));
+        const __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(roots + half + j));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(a + i + j), m.add(u, v));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(a + i + j + half), m.multiply(m.sub(u, v), w));
+      }
+    }
+  }
+  // Lane twiddles: half 4 -> w_8^(0..3) twice, half 2 -> w_4^(0, 1) four times, half 1 -> 1
+  const __m256i w4 = _mm256_setr_epi32(roots[4], roots[5], roots[6], roots[7], roots[4], roots[5], roots[6], roots[7]);
+  const __m256i w2 = _mm256_setr_epi32(roots[2], roots[3], roots[2], roots[3], roots[2], roots[3], roots[2], roots[3]);
+  for (size_t i = 0; i < size; i += 16) {
+    __m256i ra = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+    __m256i rb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i + 8));
+    // half 4: X = [A0-3, B0-3], Y = [A4-7, B4-7]
+    __m256i x = _mm256_permute2x128_si256(ra, rb, 0x20);
+    __m256i y = _mm256_permute2x128_si256(ra, rb, 0x31);
+    __m256i u = m.add(x, y);
+    __m256i v = m.multiply(m.sub(x, y), w4);
+    ra = _mm256_permute2x128_si256(u, v, 0x20);
+    rb = _mm256_permute2x128_si256(u, v, 0x31);
+    // half 2: X = [A0 A1 B0 B1 | A4 A5 B4 B5], Y = [A2 A3 B2 B3 | A6 A7 B6 B7]
+    x = _mm256_unpacklo_epi64(ra, rb);
+    y = _mm256_unpackhi_epi64(ra, rb);
+    u = m.add(x, y);
+    v = m.multiply(m.sub(x, y), w2);
+    ra = _mm256_unpacklo_epi64(u, v);
+    rb = _mm256_unpackhi_epi64(u, v);
+    // half 1: X = even lanes, Y = odd lanes, the twiddle is 1
+    x = _mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(ra), _mm256_castsi256_ps(rb), 0x88));
+    y = _mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(ra), _mm256_castsi256_ps(rb), 0xDD));
+    u = m.add(x, y);
+    v = m.sub(x, y);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(a + i), _mm256_unpacklo_epi32(u, v));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(a + i + 8), _mm256_unpackhi_epi32(u, v));
+  }
+}
+
+__attribute__((target("avx2")))
+void ntt_dit_block_avx2(Montgomery& mont, uint32_t* a, const size_t size, const uint32_t* roots)
+{
+  if (size < 16) {
+    ntt_dit_block_portable(mont, a, size, roots);
+    return;
+  }
+  const MontAvx2 m(mont);
+  const __m256i w4 = _mm256_setr_epi32(roots[4], roots[5], roots[6], roots[7], roots[4], roots[5], roots[6], roots[7]);
+  const __m256i w2 = _mm256_setr_epi32(roots[2], roots[3], roots[2], roots[3], roots[2], roots[3], roots[2], roots[3]);
+  for (size_t i = 0; i < size; i += 16) {
+    __m256i ra = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+    __m256i rb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i + 8));
+    // half 1
+    __m256i x = _mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(ra), _mm256_castsi256_ps(rb), 0x88));
+    __m256i y = _mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(ra), _mm256_castsi256_ps(rb), 0xDD));
+    __m256i u = m.add(x, y);
+    __m256i v = m.sub(x, y);
+    ra = _mm256_unpacklo_epi32(u, v);
+    rb = _mm256_unpackhi_epi32(u, v);
+    // half 2
+    x = _mm256_unpacklo_epi64(ra, rb);
+    y = m.multiply(_mm256_unpackhi_epi64(ra, rb), w2);
+    u = m.add(x, y);
+    v = m.sub(x, y);
+    ra = _mm256_unpacklo_epi64(u, v);
+    rb = _mm256_unpackhi_epi64(u, v);
+    // half 4
+    x = _mm256_permute2x128_si256(ra, rb, 0x20);
+    y = m.multiply(_mm256_permute2x128_si256(ra, rb, 0x31), w4);
+    u = m.add(x, y);
+    v = m.sub(x, y);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(a + i), _mm256_permute2x128_si256(u, v, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(a + i + 8), _mm256_permute2x128_si256(u, v, 0x31));
+  }
+  for (size_t half = 8; half < size; half <<= 1) {
+    for (size_t i = 0; i < size; i += 2 * half) {
+      for (size_t j = 0; j < half; j += 8) {
+        const __m256i u = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i + j));
+        const __m256i v = m.multiply(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i + j + half)),
+                                     _mm256_loadu_si256(reinterpret_cast<const __m256i*>(roots + half + j)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(a + i + j), m.add(u, v));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(a + i + j + half), m.sub(u, v));
+      }
+    }
+  }
+}
+
+// rows x 8 tile of matmul_sub, even and odd columns in separate 64-bit accumulators
+template <size_t rows>
+__attribute__((target("avx2")))
+void matmul_sub_tile_avx2(Montgomery& mont, const uint32_t* a, const size_t lda, const uint32_t* b, const size_t ldb,
+                          uint32_t* c, const size_t ldc, const size_t k)
+{
+  const MontParams p = mont.params();
+  const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+  const __m256i bound = _mm256_set1_epi64x(p.lazy_bound);
+  const __m256i bound_flipped = _mm256_xor_si256(bound, sign);
+  auto fold = [&](const __m256i acc) __attribute__((target("avx2"))) {
+    const __m256i below = _mm256_cmpgt_epi64(bound_flipped, _mm256_xor_si256(acc, sign));
+    return _mm256_sub_epi64(acc, _mm256_andnot_si256(below, bound));
+  };
+  __m256i even[rows], odd[rows];
+  // Unrolled so the accumulators live in registers, GCC keeps the arrays in memory otherwise
+#pragma GCC unroll 8
+  for (size_t r = 0; r < rows; ++r) {
+    even[r] = odd[r] = _mm256_setzero_si256();
+  }
+  uint64_t terms = 0;
+  for (size_t t = 0; t < k; ++t) {
+    const __m256i b_ = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + t * ldb));
+    const __m256i b_odd = _mm256_srli_epi64(b_, 32);
+#pragma GCC unroll 8
+    for (size_t r = 0; r < rows; ++r) {
+      // vpmuludq reads the low half of each 64-bit lane, a 32-bit broadcast serves both
+      const __m256i a_ = _mm256_set1_epi32(a[r * lda + t]);
+      even[r] = _mm256_add_epi64(even[r], _mm256_mul_epu32(a_, b_));
+      odd[r] = _mm256_add_epi64(odd[r], _mm256_mul_epu32(a_, b_odd));
+    }
+    if (++terms == p.lazy_terms) {
+#pragma GCC unroll 8
+      for (size_t r = 0; r < rows; ++r) {
+        even[r] = fold(even[r]);
+        odd[r] = fold(odd[r]);
+      }
+      terms = 0;
+    }
+  }
+  for (size_t r = 0; r < rows; ++r) {
+    uint64_t lanes[8];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), fold(even[r]));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes + 4), fold(odd[r]));
+    uint32_t* out = c + r * ldc;
+    for (size_t l = 0; l < 4; ++l) {
+      out[2 * l] = mont.sub(out[2 * l], mont.REDC_wide(lanes[l]));
+      out[2 * l + 1] = mont.sub(out[2 * l + 1], mont.REDC_wide(lanes[4 + l]));
+    }
+  }
+}
+
+__attribute__((target("avx2")))
+void matmul_sub_avx2(Montgomery& mont, const uint32_t* a, const size_t lda, const uint32_t* b, const size_t ldb,
+                     uint32_t* c, const size_t ldc, const size_t m, const size_t n, const size_t k)
+{
+  size_t j = 0;
+  for (; j + 8 <= n; j += 8) {
+    size_t i = 0;
+    for (; i + 4 <= m; i += 4) {
+      matmul_sub_tile_avx2<4>(mont, a + i * lda, lda, b + j, ldb, c + i * ldc + j, ldc, k);
+    }
+    for (; i < m; ++i) {
+      matmul_sub_tile_avx2<1>(mont, a + i * lda, lda, b + j, ldb, c + i * ldc + j, ldc, k);
+    }
+  }
+  matmul_sub_portable(mont, a, lda, b + j, ldb, c + j, ldc, m, n - j, k);
+}
+
+// 16 outputs at a time in two registers, even and odd outputs in separate 64-bit accumulators
+__attribute__((target("avx2")))
+void combine_rows_avx2(Montgomery& mont, const uint32_t* c, const uint32_t* const* src, const size_t k,
+                       const size_t offset, uint32_t* out, const size_t len)
+{
+  const MontParams p = mont.params();
+  const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+  const __m256i bound = _mm256_set1_epi64x(p.lazy_bound);
+  const __m256i bound_flipped = _mm256_xor_si256(bound, sign);
+  auto fold = [&](const __m256i acc) __attribute__((target("avx2"))) {
+    const __m256i below = _mm256_cmpgt_epi64(bound_flipped, _mm256_xor_si256(acc, sign));
+    return _mm256_sub_epi64(acc, _mm256_andnot_si256(below, bound));
+  };
+  size_t t = 0;
+  for (; p.lazy_terms > 0 && t + 16 <= len; t += 16) {
+    __m256i even0 = _mm256_setzero_si256(), odd0 = _mm256_setzero_si256();
+    __m256i even1 = _mm256_setzero_si256(), odd1 = _mm256_setzero_si256();
+    uint64_t terms = 0;
+    for (size_t j = 0; j < k; ++j) {
+      // vpmuludq reads the low half of each 64-bit lane, a 32-bit broadcast serves both
+      const __m256i x = _mm256_set1_epi32(c[j]);
+      const __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src[j] + offset + t));
+      const __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src[j] + offset + t + 8));
+      even0 = _mm256_add_epi64(even0, _mm256_mul_epu32(x, v0));
+      odd0 = _mm256_add_epi64(odd0, _mm256_mul_epu32(x, _mm256_srli_epi64(v0, 32)));
+      even1 = _mm256_add_epi64(even1, _mm256_mul_epu32(x, v1));
+      odd1 = _mm256_add_epi64(odd1, _mm256_mul_epu32(x, _mm256_srli_epi64(v1, 32)));
+      if (++terms == p.lazy_terms) {
+        even0 = fold(even0);
+        odd0 = fold(odd0);
+        even1 = fold(even1);
+        odd1 = fold(odd1);
+        terms = 0;
+      }
+    }
+    uint64_t lanes[16];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), fold(even0));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes + 4), fold(odd0));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes + 8), fold(even1));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes + 12), fold(odd1));
+    for (size_t l = 0; l < 4; ++l) {
+      out[t + 2 * l] = mont.REDC_wide(lanes[l]);
+      out[t + 2 * l + 1] = mont.REDC_wide(lanes[4 + l]);
+      out[t + 8 + 2 * l] = mont.REDC_wide(lanes[8 + l]);
+      out[t + 8 + 2 * l + 1] = mont.REDC_wide(lanes[12 + l]);
+    }
+  }
+  combine_rows_portable(mont, c, src, k, offset + t, out + t, len - t);
+}
+
+__attribute__((target("avx2")))
+void sell_matvec_avx2(Montgomery& mont, const uint32_t* values, const uint32_t* cols, const size_t* slice_ptr,
+                      const size_t num_slices, const uint32_t* x, uint32_t* y)
+{
+  const MontParams p = mont.params();
+  const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+  const __m256i bound = _mm256_set1_epi64x(p.lazy_bound);
+  const __m256i bound_flipped = _mm256_xor_si256(bound, sign);
+  auto fold = [&](const __m256i acc) __attribute__((target("avx2"))) {
+    const __m256i below = _mm256_cmpgt_epi64(bound_flipped, _mm256_xor_si256(acc, sign));
+    return _mm256_sub_epi64(acc, _mm256_andnot_si256(below, bound));
+  };
+  const int* x_ = reinterpret_cast<const int*>(x);
+  for (size_t s = 0; s < num_slices; ++s) {
+    // Rows 0-7 and 8-15 of the slice, even and odd rows in separate accumulators
+    __m256i even0 = _mm256_setzero_si256(), odd0 = _mm256_setzero_si256();
+    __m256i even1 = _mm256_setzero_si256(), odd1 = _mm256_setzero_si256();
+    uint64_t terms = 0;
+    for (size_t e = slice_ptr[s]; e < slice_ptr[s + 1]; e += 16) {
+      const __m256i x0 =
+          _mm256_i32gather_epi32(x_, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cols + e)), 4);
+      const __m256i x1 =
+          _mm256_i32gather_epi32(x_, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cols + e + 8)), 4);
+      const __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + e));
+      const __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + e + 8));
+      even0 = _mm256_add_epi64(even0, _mm256_mul_epu32(v0, x0));
+      odd0 = _mm256_add_epi64(odd0, _mm256_mul_epu32(_mm256_srli_epi64(v0, 32), _mm256_srli_epi64(x0, 32)));
+      even1 = _mm256_add_epi64(even1, _mm256_mul_epu32(v1, x1));
+      odd1 = _mm256_add_epi64(odd1, _mm256_mul_epu32(_mm256_srli_epi64(v1, 32), _mm256_srli_epi64(x1, 32)));
+      if (++terms == p.lazy_terms) {
+        even0 = fold(even0);
+        odd0 = fold(odd0);
+        even1 = fold(even1);
+        odd1 = fold(odd1);
+        terms = 0;
+      }
+    }
+    uint64_t lanes[16];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), fold(even0));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes + 4), fold(odd0));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes + 8), fold(even1));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes + 12), fold(odd1));
+    uint32_t* out = y + 16 * s;
+    for (size_t l = 0; l < 4; ++l) {
+      out[2 * l] = mont.REDC_wide(lanes[l]);
+      out[2 * l + 1] = mont.REDC_wide(lanes[4 + l]);
+      out[8 + 2 * l] = mont.REDC_wide(lanes[8 + l]);
+      out[8 + 2 * l + 1] = mont.REDC_wide(lanes[12 + l]);
+    }
+  }
+}
+
+__attribute__((target("avx2")))
+void pow_batch_avx2(Montgomery& mont, const uint32_t* a, const uint64_t e, uint32_t* out, const size_t len)
+{
+  const MontAvx2 m(mont);
+  const __m256i one = _mm256_set1_epi32(mont.one());
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    __m256i base = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+    __m256i result = one;
+    for (uint64_t k = e; k > 0; k >>= 1) {
+      if (k & 1) {
+        result = m.multiply(result, base);
+      }
+      base = m.multiply(base, base);
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), result);
+  }
+  pow_batch_portable(mont, a + i, e, out + i, len - i);
+}
+
+// One Philox round on 8 blocks side by side, x[k] holds word k of each
+__attribute__((target("avx2")))
+inline void philox_round_avx2(__m256i x[4], const __m256i key0, const __m256i key1)
+{
+  const __m256i m0 = _mm256_set1_epi32(0xD2511F53);
+  const __m256i m1 = _mm256_set1_epi32(0xCD9E8D57);
+  const __m256i p0_even = _mm256_mul_epu32(x[0], m0);
+  const __m256i p0_odd = _mm256_mul_epu32(_mm256_srli_epi64(x[0], 32), m0);
+  const __m256i p1_even = _mm256_mul_epu32(x[2], m1);
+  const __m256i p1_odd = _mm256_mul_epu32(_mm256_srli_epi64(x[2], 32), m1);
+  const __m256i hi0 = _mm256_blend_epi32(_mm256_srli_epi64(p0_even, 32), p0_odd, 0xAA);
+  const __m256i hi1 = _mm256_blend_epi32(_mm256_srli_epi64(p1_even, 32), p1_odd, 0xAA);
+  x[0] = _mm256_xor_si256(_mm256_xor_si256(hi1, x[1]), key0);
+  x[1] = _mm256_blend_epi32(p1_even, _mm256_slli_epi64(p1_odd, 32), 0xAA);
+  x[2] = _mm256_xor_si256(_mm256_xor_si256(hi0, x[3]), key1);
+  x[3] = _mm256_blend_epi32(p0_even, _mm256_slli_epi64(p0_odd, 32), 0xAA);
+}
+
+// Rejection through a permutation that packs the accepted lanes first, full 8-lane stores past the count are
+// overwritten later or fall inside the 64 slots of the group
+__attribute__((target("avx2")))
+size_t random_residues_avx2(Montgomery& mont, const uint64_t seed, const uint64_t stream, const uint64_t counter,
+                            const size_t groups, uint32_t* out)
+{
+  // pack[mask] lists the set bits of mask, lowest first
+  static const auto pack = []() {
+    std::vector<uint32_t> table(256 * 8);
+    for (uint32_t mask = 0; mask < 256; ++mask) {
+      uint32_t k = 0;
+      for (uint32_t lane = 0; lane < 8; ++lane) {
+        if (mask >> lane & 1) {
+          table[mask * 8 + k++] = lane;
+        }
+      }
+    }
+    return table;
+  }();
+  const MontParams p = mont.params();
+  const __m256i n = _mm256_set1_epi32(p.n);
+  const __m256i r_mask = _mm256_set1_epi32(p.r_mask);
+  const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  size_t count = 0;
+  for (size_t g = 0; g < groups; ++g) {
+    const uint64_t c = counter + 16 * g;
+    // Blocks 0 to 7 of the group in a, 8 to 15 in b. The counter is a multiple of 16, adding j never carries.
+    __m256i a[4], b[4];
+    a[0] = _mm256_add_epi32(_mm256_set1_epi32(uint32_t(c)), lanes);
+    b[0] = _mm256_add_epi32(a[0], _mm256_set1_epi32(8));
+    a[1] = b[1] = _mm256_set1_epi32(uint32_t(c >> 32));
+    a[2] = b[2] = _mm256_set1_epi32(uint32_t(stream));
+    a[3] = b[3] = _mm256_set1_epi32(uint32_t(stream >> 32));
+    uint32_t key0 = uint32_t(seed), key1 = uint32_t(seed >> 32);
+    for (int round = 0; round < 10; ++round) {
+      const __m256i k0 = _mm256_set1_epi32(key0), k1 = _mm256_set1_epi32(key1);
+      philox_round_avx2(a, k0, k1);
+      philox_round_avx2(b, k0, k1);
+      key0 += 0x9E3779B9;
+      key1 += 0xBB67AE85;
+    }
+    for (size_t w = 0; w < 8; ++w) {
+      // n < 2^31 here, the signed compare is exact
+      const __m256i v = _mm256_and_si256(w % 2 == 0 ? a[w / 2] : b[w / 2], r_mask);
+      const uint32_t accept = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(n, v)));
+      const __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pack.data() + accept * 8));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + count), _mm256_permutevar8x32_epi32(v, idx));
+      count += __builtin_popcount(accept);
+    }
+  }
+  return count;
+}
+
+// AVX-512, 16 lanes of 32 bits. Shifts, products and min use the maskz forms, the unmasked ones trip
+// -Wmaybe-uninitialized in the GCC 12 headers.
+
+struct MontAvx512 {
+  __m512i n;
+  __m512i n_inv_mod;
+  __m512i r_mask;
+  __m128i r_bit_len;
+
+  __attribute__((target("avx512f"))) MontAvx512(Montgomery& mont)
+  {
+    const MontParams p = mont.params();
+    n = _mm512_set1_epi32(p.n);
+    n_inv_mod = _mm512_set1_epi32(p.n_inv_mod);
+    r_mask = _mm512_set1_epi32(p.r_mask);
+    r_bit_len = _mm_cvtsi32_si128(p.r_bit_len);
+  }
+
+  __attribute__((target("avx512f"))) __m512i multiply(const __m512i a, const __m512i b) const
+  {
+    const __m512i x_even = _mm512_maskz_mul_epu32(0xFF, a, b);
+    const __m512i x_odd =
+      _mm512_maskz_mul_epu32(0xFF, _mm512_maskz_srli_epi64(0xFF, a, 32), _mm512_maskz_srli_epi64(0xFF, b, 32));
+    const __m512i x_low = _mm512_mask_blend_epi32(0xAAAA, x_even, _mm512_maskz_slli_epi64(0xFF, x_odd, 32));
+    const __m512i s = _mm512_and_si512(_mm512_mullo_epi32(_mm512_and_si512(x_low, r_mask), n_inv_mod), r_mask);
+    const __m512i t_even = _mm512_add_epi64(x_even, _mm512_maskz_mul_epu32(0xFF, s, n));
+    const __m512i t_odd =
+      _mm512_add_epi64(x_odd, _mm512_maskz_mul_epu32(0xFF, _mm512_maskz_srli_epi64(0xFF, s, 32), n));
+    const __m512i u = _mm512_mask_blend_epi32(
+      0xAAAA, _mm512_maskz_srl_epi64(0xFF, t_even, r_bit_len),
+      _mm512_maskz_slli_epi64(0xFF, _mm512_maskz_srl_epi64(0xFF, t_odd, r_bit_len), 32));
+    return _mm512_maskz_min_epu32(0xFFFF, u, _mm512_sub_epi32(u, n));
+  }
+
+  __attribute__((target("avx512f"))) __m512i add(const __m512i a, const __m512i b) const
+  {
+    const __m512i c = _mm512_add_epi32(a, b);
+    return _mm512_maskz_min_epu32(0xFFFF, c, _mm512_sub_epi32(c, n));
+  }
+
+  __attribute__((target("avx512f"))) __m512i sub(const __m512i a, const __m512i b) const
+  {
+    const __m512i c = _mm512_sub_epi32(a, b);
+    return _mm512_maskz_min_epu32(0xFFFF, c, _mm512_add_epi32(c, n));
+  }
+};
+
+__attribute__((target("avx512f")))
+void multiply_batch_avx512(Montgomery& mont, const uint32_t* a, const uint32_t* b, uint32_t* out, const size_t len)
+{
+  const MontAvx512 m(mont);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    _mm512_storeu_si512(out + i, m.multiply(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i)));
+  }
+  multiply_batch_portable(mont, a + i, b + i, out + i, len - i);
+}
+
+__attribute__((target("avx512f")))
+void mul_add_batch_avx512(Montgomery& mont, const uint32_t* a, const uint32_t* b, const uint32_t* c, uint32_t* out,
+                          const size_t len)
+{
+  const MontAvx512 m(mont);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    const __m512i x = m.multiply(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+    _mm512_storeu_si512(out + i, m.add(x, _mm512_loadu_si512(c + i)));
+  }
+  mul_add_batch_portable(mont, a + i, b + i, c + i, out + i, len - i);
+}
+
+__attribute__((target("avx512f")))
+void mul_sub_batch_avx512(Montgomery& mont, const uint32_t* a, const uint32_t* b, const uint32_t* c, uint32_t* out,
+                          const size_t len)
+{
+  const MontAvx512 m(mont);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    const __m512i x = m.multiply(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+    _mm512_storeu_si512(out + i, m.sub(x, _mm512_loadu_si512(c + i)));
+  }
+  mul_sub_batch_portable(mont, a + i, b + i, c + i, out + i, len - i);
+}
+
+__attribute__((target("avx512f")))
+void convert_in_batch_avx512(Montgomery& mont, const uint32_t* x, uint32_t* out, const size_t len)
+{
+  const MontAvx512 m(mont);
+  const __m512i r2 = _mm512_set1_epi32(mont.params().r2_mod_n);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    const __m512i x_ = _mm512_loadu_si512(x + i);
+    // x >= n needs a division, left to the scalar path
+    if (_mm512_cmpge_epu32_mask(x_, m.n)) {
+      convert_in_batch_portable(mont, x + i, out + i, 16);
+      continue;
+    }
+    _mm512_storeu_si512(out + i, m.multiply(x_, r2));
+  }
+  convert_in_batch_portable(mont, x + i, out + i, len - i);
+}
+
+__attribute__((target("avx512f")))
+uint32_t dot_avx512(Montgomery& mont, const uint32_t* a, const uint32_t* b, const size_t len)
+{
+  const MontParams p = mont.params();
+  const __m512i bound = _mm512_set1_epi64(p.lazy_bound);
+  auto fold = [&](const __m512i acc) __attribute__((target("avx512f"))) {
+    return _mm512_mask_sub_epi64(acc, _mm512_cmpge_epu64_mask(acc, bound), acc, bound);
+  };
+  __m512i acc_even = _mm512_setzero_si512();
+  __m512i acc_odd = _mm512_setzero_si512();
+  size_t i = 0;
+  uint64_t terms = 0;
+  for (; i + 16 <= len; i += 16) {
+    const __m512i a_ = _mm512_loadu_si512(a + i);
+    const __m512i b_ = _mm512_loadu_si512(b + i);
+    acc_even = _mm512_add_epi64(acc_even, _mm512_maskz_mul_epu32(0xFF, a_, b_));
+    acc_odd = _mm512_add_epi64(
+      acc_odd,
+      _mm512_maskz_mul_epu32(0xFF, _mm512_maskz_srli_epi64(0xFF, a_, 32), _mm512_maskz_srli_epi64(0xFF, b_, 32)));
+    if (++terms == p.lazy_terms) {
+      acc_even = fold(acc_even);
+      acc_odd = fold(acc_odd);
+      terms = 0;
+    }
+  }
+  acc_even = fold(acc_even);
+  acc_odd = fold(acc_odd);
+  uint64_t lanes[16];
+  _mm512_storeu_si512(lanes, acc_even);
+  _mm512_storeu_si512(lanes + 8, acc_odd);
+  uint32_t result = dot_portable(mont, a + i, b + i, len - i);
+  for (const uint64_t lane : lanes) {
+    result = mont.add(result, mont.REDC_wide(lane));
+  }
+  return result;
+}
+
+__attribute__((target("avx512f")))
+void ntt_dif_avx512(Montgomery& mont, uint32_t* x, uint32_t* y, const uint32_t* w, const size_t len)
+{
+  const MontAvx512 m(mont);
+  size_t j = 0;
+  for (; j + 16 <= len; j += 16) {
+    const __m512i u = _mm512_loadu_si512(x + j);
+    const __m512i v = _mm512_loadu_si512(y + j);
+    _mm512_storeu_si512(x + j, m.add(u, v));
+    _mm512_storeu_si512(y + j, m.multiply(m.sub(u, v), _mm512_loadu_si512(w + j)));
+  }
+  ntt_dif_portable(mont, x + j, y + j, w + j, len - j);
+}
+
+__attribute__((target("avx512f")))
+void ntt_dit_avx512(Montgomery& mont, uint32_t* x, uint32_t* y, const uint32_t* w, const size_t len)
+{
+  const MontAvx512 m(mont);
+  size_t j = 0;
+  for (; j + 16 <= len; j += 16) {
+    const __m512i u = _mm512_loadu_si512(x + j);
+    const __m512i v = m.multiply(_mm512_loadu_si512(y + j), _mm512_loadu_si512(w + j));
+    _mm512_storeu_si512(x + j, m.add(u, v));
+    _mm512_storeu_si512(y + j, m.sub(u, v));
+  }
+  ntt_dit_portable(mont, x + j, y + j, w + j, len - j);
+}
+
+// Lane shuffles for the stages with half < 16 on a pair of registers A = a[0, 16), B = a[16, 32). take[s] gathers
+// the first element of each butterfly into X (lanes 0-15 of the result) and its partner into Y, give[s] maps the
+// outputs U, V back to A and B, twiddle[s] lists the root offset of each butterfly. s = log2(half).
+struct NttShuffle512 {
+  uint32_t take_x[4][16], take_y[4][16], give_a[4][16], give_b[4][16], twiddle[4][16];
+
+  NttShuffle512()
+  {
+    for (size_t s = 0; s < 4; ++s) {
+      const uint32_t half = 1u << s;
+      uint32_t give[32];
+      uint32_t k = 0;
+      for (uint32_t p = 0; p < 32; ++p) {
+        if (p % (2 * half) < half) {
+          take_x[s][k] = p;
+          take_y[s][k] = p + half;
+          twiddle[s][k] = half + p % (2 * half);
+          give[p] = k;
+          give[p + half] = 16 + k;
+          ++k;
+        }
+      }
+      for (size_t i = 0; i < 16; ++i) {
+        give_a[s][i] = give[i];
+        give_b[s][i] = give[16 + i];
+      }
+    }
+  }
+};
+
+__attribute__((target("avx512f")))
+void ntt_dif_block_avx512(Montgomery& mont, uint32_t* a, const size_t size, const uint32_t* roots)
+{
+  if (size < 32) {
+    ntt_dif_block_portable(mont, a, size, roots);
+    return;
+  }
+  static const NttShuffle512 shuffle;
+  const MontAvx512 m(mont);
+  for (size_t half = size / 2; half >= 16; half >>= 1) {
+    for (size_t i = 0; i < size; i += 2 * half) {
+      for (size_t j = 0; j < half; j += 16) {
+        const __m512i u = _mm512_loadu_si512(a + i + j);
+        const __m512i v = _mm512_loadu_si512(a + i + j + half);
+        _mm512_storeu_si512(a + i + j, m.add(u, v));
+        _mm512_storeu_si512(a + i + j + half, m.multiply(m.sub(u, v), _mm512_loadu_si512(roots + half + j)));
+      }
+    }
+  }
+  __m512i take_x[4], take_y[4], give_a[4], give_b[4], w[4];
+  for (size_t s = 0; s < 4; ++s) {
+    take_x[s] = _mm512_loadu_si512(shuffle.take_x[s]);
+    take_y[s] = _mm512_loadu_si512(shuffle.take_y[s]);
+    give_a[s] = _mm512_loadu_si512(shuffle.give_a[s]);
+    give_b[s] = _mm512_loadu_si512(shuffle.give_b[s]);
+    w[s] = _mm512_maskz_permutexvar_epi32(0xFFFF, _mm512_loadu_si512(shuffle.twiddle[s]), _mm512_loadu_si512(roots));
+  }
+  for (size_t i = 0; i < size; i += 32) {
+    __m512i ra = _mm512_loadu_si512(a + i);
+    __m512i rb = _mm512_loadu_si512(a + i + 16);
+    for (size_t s = 4; s-- > 0;) {
+      const __m512i x = _mm512_permutex2var_epi32(ra, take_x[s], rb);
+      const __m512i y = _mm512_permutex2var_epi32(ra, take_y[s], rb);
+      const __m512i u = m.add(x, y);
+      const __m512i v = s == 0 ? m.sub(x, y) : m.multiply(m.sub(x, y), w[s]);
+      ra = _mm512_permutex2var_epi32(u, give_a[s], v);
+      rb = _mm512_permutex2var_epi32(u, give_b[s], v);
+    }
+    _mm512_storeu_si512(a + i, ra);
+    _mm512_storeu_si512(a + i + 16, rb);
+  }
+}
+
+__attribute__((target("avx512f")))
+void ntt_dit_block_avx512(Montgomery& mont, uint32_t* a, const size_t size, const uint32_t* roots)
+{
+  if (size < 32) {
+    ntt_dit_block_portable(mont, a, size, roots);
+    return;
+  }
+  static const NttShuffle512 shuffle;
+  const MontAvx512 m(mont);
+  __m512i take_x[4], take_y[4], give_a[4], give_b[4], w[4];
+  for (size_t s = 0; s < 4; ++s) {
+    take_x[s] = _mm512_loadu_si512(shuffle.take_x[s]);
+    take_y[s] = _mm512_loadu_si512(shuffle.take_y[s]);
+    give_a[s] = _mm512_loadu_si512(shuffle.give_a[s]);
+    give_b[s] = _mm512_loadu_si512(shuffle.give_b[s]);
+    w[s] = _mm512_maskz_permutexvar_epi32(0xFFFF, _mm512_loadu_si512(shuffle.twiddle[s]), _mm512_loadu_si512(roots));
+  }
+  for (size_t i = 0; i < size; i += 32) {
+    __m512i ra = _mm512_loadu_si512(a + i);
+    __m512i rb = _mm512_loadu_si512(a + i + 16);
+    for (size_t s = 0; s < 4; ++s) {
+      const __m512i x = _mm512_permutex2var_epi32(ra, take_x[s], rb);
+      const __m512i y = _mm512_permutex2var_epi32(ra, take_y[s], rb);
+      const __m512i v = s == 0 ? y : m.multiply(y, w[s]);
+      const __m512i sum = m.add(x, v);
+      const __m512i diff = m.sub(x, v);
+      ra = _mm512_permutex2var_epi32(sum, give_a[s], diff);
+      rb = _mm512_permutex2var_epi32(sum, give_b[s], diff);
+    }
+    _mm512_storeu_si512(a + i, ra);
+    _mm512_storeu_si512(a + i + 16, rb);
+  }
+  for (size_t half = 16; half < size; half <<= 1) {
+    for (size_t i = 0; i < size; i += 2 * half) {
+      for (size_t j = 0; j < half; j += 16) {
+        const __m512i u = _mm512_loadu_si512(a + i + j);
+        const __m512i v = m.multiply(_mm512_loadu_si512(a + i + j + half), _mm512_loadu_si512(roots + half + j));
+        _mm512_storeu_si512(a + i + j, m.add(u, v));
+        _mm512_storeu_si512(a + i + j + half, m.sub(u, v));
+      }
+    }
+  }
+}
+
+// rows x 16 tile of matmul_sub, even and odd columns in separate 64-bit accumulators
+template <size_t rows>
+__attribute__((target("avx512f")))
+void matmul_sub_tile_avx512(Montgomery& mont, const uint32_t* a, const size_t lda, const uint32_t* b,
+                            const size_t ldb, uint32_t* c, const size_t ldc, const size_t k)
+{
+  const MontParams p = mont.params();
+  const __m512i bound = _mm512_set1_epi64(p.lazy_bound);
+  auto fold = [&](const __m512i acc) __attribute__((target("avx512f"))) {
+    return _mm512_mask_sub_epi64(acc, _mm512_cmpge_epu64_mask(acc, bound), acc, bound);
+  };
+  __m512i even[rows], odd[rows];
+  // Unrolled so the accumulators live in registers, GCC keeps the arrays in memory otherwise
+#pragma GCC unroll 8
+  for (size_t r = 0; r < rows; ++r) {
+    even[r] = odd[r] = _mm512_setzero_si512();
+  }
+  uint64_t terms = 0;
+  for (size_t t = 0; t < k; ++t) {
+    const __m512i b_ = _mm512_loadu_si512(b + t * ldb);
+    const __m512i b_odd = _mm512_maskz_srli_epi64(0xFF, b_, 32);
+#pragma GCC unroll 8
+    for (size_t r = 0; r < rows; ++r) {
+      const __m512i a_ = _mm512_set1_epi32(a[r * lda + t]);
+      even[r] = _mm512_add_epi64(even[r], _mm512_maskz_mul_epu32(0xFF, a_, b_));
+      odd[r] = _mm512_add_epi64(odd[r], _mm512_maskz_mul_epu32(0xFF, a_, b_odd));
+    }
+    if (++terms == p.lazy_terms) {
+#pragma GCC unroll 8
+      for (size_t r = 0; r < rows; ++r) {
+        even[r] = fold(even[r]);
+        odd[r] = fold(odd[r]);
+      }
+      terms = 0;
+    }
+  }
+  for (size_t r = 0; r < rows; ++r) {
+    uint64_t lanes[16];
+    _mm512_storeu_si512(lanes, fold(even[r]));
+    _mm512_storeu_si512(lanes + 8, fold(odd[r]));
+    uint32_t* out = c + r * ldc;
+    for (size_t l = 0; l < 8; ++l) {
+      out[2 * l] = mont.sub(out[2 * l], mont.REDC_wide(lanes[l]));
+      out[2 * l + 1] = mont.sub(out[2 * l + 1], mont.REDC_wide(lanes[8 + l]));
+    }
+  }
+}
+
+__attribute__((target("avx512f")))
+void matmul_sub_avx512(Montgomery& mont, const uint32_t* a, const size_t lda, const uint32_t* b, const size_t ldb,
+                       uint32_t* c, const size_t ldc, const size_t m, const size_t n, const size_t k)
+{
+  size_t j = 0;
+  for (; j + 16 <= n; j += 16) {
+    size_t i = 0;
+    for (; i + 8 <= m; i += 8) {
+      matmul_sub_tile_avx512<8>(mont, a + i * lda, lda, b + j, ldb, c + i * ldc + j, ldc, k);
+    }
+    for (; i < m; ++i) {
+      matmul_sub_tile_avx512<1>(mont, a + i * lda, lda, b + j, ldb, c + i * ldc + j, ldc, k);
+    }
+  }
+  matmul_sub_portable(mont, a, lda, b + j, ldb, c + j, ldc, m, n - j, k);
+}
+
+__attribute__((target("avx512f")))
+void combine_rows_avx512(Montgomery& mont, const uint32_t* c, const uint32_t* const* src, const size_t k,
+                         const size_t offset, uint32_t* out, const size_t len)
+{
+  const MontParams p = mont.params();
+  const __m512i bound = _mm512_set1_epi64(p.lazy_bound);
+  auto fold = [&](const __m512i acc) __attribute__((target("avx512f"))) {
+    return _mm512_mask_sub_epi64(acc, _mm512_cmpge_epu64_mask(acc, bound), acc, bound);
+  };
+  size_t t = 0;
+  for (; p.lazy_terms > 0 && t + 32 <= len; t += 32) {
+    __m512i even0 = _mm512_setzero_si512(), odd0 = _mm512_setzero_si512();
+    __m512i even1 = _mm512_setzero_si512(), odd1 = _mm512_setzero_si512();
+    uint64_t terms = 0;
+    for (size_t j = 0; j < k; ++j) {
+      const __m512i x = _mm512_set1_epi32(c[j]);
+      const __m512i v0 = _mm512_loadu_si512(src[j] + offset + t);
+      const __m512i v1 = _mm512_loadu_si512(src[j] + offset + t + 16);
+      even0 = _mm512_add_epi64(even0, _mm512_maskz_mul_epu32(0xFF, x, v0));
+      odd0 = _mm512_add_epi64(odd0, _mm512_maskz_mul_epu32(0xFF, x, _mm512_maskz_srli_epi64(0xFF, v0, 32)));
+      even1 = _mm512_add_epi64(even1, _mm512_maskz_mul_epu32(0xFF, x, v1));
+      odd1 = _mm512_add_epi64(odd1, _mm512_maskz_mul_epu32(0xFF, x, _mm512_maskz_srli_epi64(0xFF, v1, 32)));
+      if (++terms == p.lazy_terms) {
+        even0 = fold(even0);
+        odd0 = fold(odd0);
+        even1 = fold(even1);
+        odd1 = fold(odd1);
+        terms = 0;
+      }
+    }
+    uint64_t lanes[32];
+    _mm512_storeu_si512(lanes, fold(even0));
+    _mm512_storeu_si512(lanes + 8, fold(odd0));
+    _mm512_storeu_si512(lanes + 16, fold(even1));
+    _mm512_storeu_si512(lanes + 24, fold(odd1));
+    for (size_t l = 0; l < 8; ++l) {
+      out[t + 2 * l] = mont.REDC_wide(lanes[l]);
+      out[t + 2 * l + 1] = mont.REDC_wide(lanes[8 + l]);
+      out[t + 16 + 2 * l] = mont.REDC_wide(lanes[16 + l]);
+      out[t + 16 + 2 * l + 1] = mont.REDC_wide(lanes[24 + l]);
+    }
+  }
+  combine_rows_portable(mont, c, src, k, offset + t, out + t, len - t);
+}
+
+__attribute__((target("avx512f")))
+void sell_matvec_avx512(Montgomery& mont, const uint32_t* values, const uint32_t* cols, const size_t* slice_ptr,
+                        const size_t num_slices, const uint32_t* x, uint32_t* y)
+{
+  const MontParams p = mont.params();
+  const __m512i bound = _mm512_set1_epi64(p.lazy_bound);
+  auto fold = [&](const __m512i acc) __attribute__((target("avx512f"))) {
+    return _mm512_mask_sub_epi64(acc, _mm512_cmpge_epu64_mask(acc, bound), acc, bound);
+  };
+  for (size_t s = 0; s < num_slices; ++s) {
+    __m512i even = _mm512_setzero_si512();
+    __m512i odd = _mm512_setzero_si512();
+    uint64_t terms = 0;
+    for (size_t e = slice_ptr[s]; e < slice_ptr[s + 1]; e += 16) {
+      const __m512i x_ =
+          _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), 0xFFFF, _mm512_loadu_si512(cols + e), x, 4);
+      const __m512i v = _mm512_loadu_si512(values + e);
+      even = _mm512_add_epi64(even, _mm512_maskz_mul_epu32(0xFF, v, x_));
+      odd = _mm512_add_epi64(
+        odd,
+        _mm512_maskz_mul_epu32(0xFF, _mm512_maskz_srli_epi64(0xFF, v, 32), _mm512_maskz_srli_epi64(0xFF, x_, 32)));
+      if (++terms == p.lazy_terms) {
+        even = fold(even);
+        odd = fold(odd);
+        terms = 0;
+      }
+    }
+    uint64_t lanes[16];
+    _mm512_storeu_si512(lanes, fold(even));
+    _mm512_storeu_si512(lanes + 8, fold(odd));
+    uint32_t* out = y + 16 * s;
+    for (size_t l = 0; l < 8; ++l) {
+      out[2 * l] = mont.REDC_wide(lanes[l]);
+      out[2 * l + 1] = mont.REDC_wide(lanes[8 + l]);
+    }
+  }
+}
+
+__attribute__((target("avx512f")))
+void pow_batch_avx512(Montgomery& mont, const uint32_t* a, const uint64_t e, uint32_t* out, const size_t len)
+{
+  const MontAvx512 m(mont);
+  const __m512i one = _mm512_set1_epi32(mont.one());
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m512i base = _mm512_loadu_si512(a + i);
+    __m512i result = one;
+    for (uint64_t k = e; k > 0; k >>= 1) {
+      if (k & 1) {
+        result = m.multiply(result, base);
+      }
+      base = m.multiply(base, base);
+    }
+    _mm512_storeu_si512(out + i, result);
+  }
+  pow_batch_portable(mont, a + i, e, out + i, len - i);
+}
+
+// The 16 blocks of a group fill the 16 lanes. Accepted lanes are packed with vpcompressd into a register and stored
+// whole, the memory form of the instruction is microcoded on some cores.
+__attribute__((target("avx512f")))
+size_t random_residues_avx512(Montgomery& mont, const uint64_t seed, const uint64_t stream, const uint64_t counter,
+                              const size_t groups, uint32_t* out)
+{
+  const MontParams p = mont.params();
+  const __m512i n = _mm512_set1_epi32(p.n);
+  const __m512i r_mask = _mm512_set1_epi32(p.r_mask);
+  const __m512i m0 = _mm512_set1_epi32(0xD2511F53);
+  const __m512i m1 = _mm512_set1_epi32(0xCD9E8D57);
+  const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  size_t count = 0;
+  for (size_t g = 0; g < groups; ++g) {
+    const uint64_t c = counter + 16 * g;
+    __m512i x[4];
+    x[0] = _mm512_add_epi32(_mm512_set1_epi32(uint32_t(c)), lanes);
+    x[1] = _mm512_set1_epi32(uint32_t(c >> 32));
+    x[2] = _mm512_set1_epi32(uint32_t(stream));
+    x[3] = _mm512_set1_epi32(uint32_t(stream >> 32));
+    uint32_t key0 = uint32_t(seed), key1 = uint32_t(seed >> 32);
+    for (int round = 0; round < 10; ++round) {
+      const __m512i p0_even = _mm512_maskz_mul_epu32(0xFF, x[0], m0);
+      const __m512i p0_odd = _mm512_maskz_mul_epu32(0xFF, _mm512_maskz_srli_epi64(0xFF, x[0], 32), m0);
+      const __m512i p1_even = _mm512_maskz_mul_epu32(0xFF, x[2], m1);
+      const __m512i p1_odd = _mm512_maskz_mul_epu32(0xFF, _mm512_maskz_srli_epi64(0xFF, x[2], 32), m1);
+      const __m512i hi0 = _mm512_mask_blend_epi32(0xAAAA, _mm512_maskz_srli_epi64(0xFF, p0_even, 32), p0_odd);
+      const __m512i hi1 = _mm512_mask_blend_epi32(0xAAAA, _mm512_maskz_srli_epi64(0xFF, p1_even, 32), p1_odd);
+      x[0] = _mm512_ternarylogic_epi32(hi1, x[1], _mm512_set1_epi32(key0), 0x96);
+      x[1] = _mm512_mask_blend_epi32(0xAAAA, p1_even, _mm512_maskz_slli_epi64(0xFF, p1_odd, 32));
+      x[2] = _mm512_ternarylogic_epi32(hi0, x[3], _mm512_set1_epi32(key1), 0x96);
+      x[3] = _mm512_mask_blend_epi32(0xAAAA, p0_even, _mm512_maskz_slli_epi64(0xFF, p0_odd, 32));
+      key0 += 0x9E3779B9;
+      key1 += 0xBB67AE85;
+    }
+    for (size_t w = 0; w < 4; ++w) {
+      const __m512i v = _mm512_and_si512(x[w], r_mask);
+      const __mmask16 accept = _mm512_cmplt_epu32_mask(v, n);
+      _mm512_storeu_si512(out + count, _mm512_maskz_compress_epi32(accept, v));
+      count += __builtin_popcount(accept);
+    }
+  }
+  return count;
+}
+#endif
+
+// Always available, and the only table valid for moduli of 2^31 and above
+const MontKernels& portable_montgomery_kernels()
+{
+  static const MontKernels portable = {"portable", multiply_batch_portable, convert_in_batch_portable,
+                                       mul_add_batch_portable, mul_sub_batch_portable, dot_portable,
+                                       ntt_dif_portable, ntt_dit_portable, ntt_dif_block_split_radix_portable,
+                                       ntt_dit_block_split_radix_portable, matmul_sub_portable, combine_rows_portable,
+                                       sell_matvec_portable,
+                                       pow_batch_portable, random_residues_portable};
+  return portable;
+}
+
+// Kernel tables the running CPU supports, best first
+std::vector<const MontKernels*> available_montgomery_kernels()
+{
+  std::vector<const MontKernels*> kernels;
+#if defined(__x86_64__)
+  static const MontKernels avx2 = {"avx2", multiply_batch_avx2, convert_in_batch_avx2, mul_add_batch_avx2,
+                                   mul_sub_batch_avx2, dot_avx2,
+                                   ntt_dif_avx2, ntt_dit_avx2, ntt_dif_block_avx2, ntt_dit_block_avx2,
+                                   matmul_sub_avx2, combine_rows_avx2, sell_matvec_avx2, pow_batch_avx2,
+                                   random_residues_avx2};
+  static const MontKernels avx512 = {"avx512", multiply_batch_avx512, convert_in_batch_avx512,
+                                     mul_add_batch_avx512, mul_sub_batch_avx512, dot_avx512,
+                                     ntt_dif_avx512, ntt_dit_avx512, ntt_dif_block_avx512, ntt_dit_block_avx512,
+                                     matmul_sub_avx512, combine_rows_avx512, sell_matvec_avx512, pow_batch_avx512,
+                                     random_residues_avx512};
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    kernels.push_back(&avx512);
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    kernels.push_back(&avx2);
+  }
+#endif
+  kernels.push_back(&portable_montgomery_kernels());
+  return kernels;
+}
+
+// CPUID is probed once, MONTGOMERY_ISA=portable|avx2|avx512 forces a table, otherwise the tuned one if supported.
+// Off x86 only the portable table is built and every request falls back to it.
+const MontKernels& montgomery_kernels()
+{
+  static const MontKernels* selected = []() {
+    const auto kernels = available_montgomery_kernels();
+    const char* isa = std::getenv("MONTGOMERY_ISA");
+    if (!isa || !*isa) {
+      // The tuned choice is only a preference, a config copied from a wider machine falls back to the best here
+      for (const auto* k : kernels) {
+        if (tuning().isa == k->isa) {
+          return k;
+        }
+      }
+      return kernels[0];
+    }
+    for (const auto* k : kernels) {
+      if (std::string(isa) == k->isa) {
+        return k;
+      }
+    }
+#if defined(__x86_64__)
+    std::cout << "MONTGOMERY_ISA=" << isa << "\n";
+    throw std::runtime_error("Requested ISA is not supported by this CPU.");
+#else
+    return kernels.back();
+#endif
+  }();
+  return *selected;
+}
+
+class Montgomery16;
+
+// Batch kernels of Montgomery16, one table per instruction set like MontKernels
+struct MontKernels16 {
+  const char* isa;
+  void (*multiply_batch)(Montgomery16&, const uint16_t*, const uint16_t*, uint16_t*, size_t);
+  void (*convert_in_batch)(Montgomery16&, const uint16_t*, uint16_t*, size_t);
+  uint16_t (*dot)(Montgomery16&, const uint16_t*, const uint16_t*, size_t);
+  void (*pow_batch)(Montgomery16&, const uint16_t*, uint64_t, uint16_t*, size_t);
+};
+
+const MontKernels16& montgomery16_kernels();
+const MontKernels16& portable_montgomery16_kernels();
+
+/// @brief Montgomery arithmetic for small odd moduli n < 2^16 with R = 2^16 fixed.
+/// Products fit in 32 bits and residues in 16, so vector kernels fit twice as many lanes as with Montgomery.
+class Montgomery16 {
+public:
+  Montgomery16(const uint32_t _n) : n(_n)
+  {
+    if (n < 3) {
+      std::cout << "n=" << n << "\n";
+      throw std::invalid_argument("Modulus must be >= 3.");
+    }
+    if (n % 2 == 0) {
+      std::cout << "n=" << n << "\n";
+      throw std::invalid_argument("Modulus must be odd.");
+    }
+    if (n > UINT16_MAX) {
+      std::cout << "n=" << n << "\n";
+      throw std::invalid_argument("Modulus must be less than 2^16.");
+    }
+
+    n_inv_pos = (uint32_t(1) << 16) - HenselLemma2adicRoot(16, n); // n^-1 mod R
+    r_mod_n = (uint32_t(1) << 16) % n;
+    r2_mod_n = (r_mod_n * r_mod_n) % n;
+
+    // The SIMD kernels keep REDC results below 2n in 16-bit lanes and use signed products, which needs n < 2^15
+    kernels = n > INT16_MAX ? &portable_montgomery16_kernels() : &montgomery16_kernels();
+  }
+
+  uint16_t convert_in(uint16_t x)
+  {
+    if (x >= n) {
+      x %= n;
+    }
+    return REDC(static_cast<uint32_t>(x) * r2_mod_n);
+  }
+
+  uint16_t convert_out(const uint16_t x)
+  {
+    return REDC(x);
+  }
+
+  uint16_t multiply(const uint16_t a, const uint16_t b)
+  {
+    return REDC(static_cast<uint32_t>(a) * b);
+  }
+
+  // The batch operations below go through the kernel table, no per-call dispatch
+  void multiply_batch(const uint16_t* a, const uint16_t* b, uint16_t* out, const size_t len)
+  {
+    kernels->multiply_batch(*this, a, b, out, len);
+  }
+
+  void convert_in_batch(const uint16_t* x, uint16_t* out, const size_t len)
+  {
+    kernels->convert_in_batch(*this, x, out, len);
+  }
+
+  void convert_out_batch(const uint16_t* x, uint16_t* out, const size_t len)
+  {
+    for (size_t i = 0; i < len; ++i) {
+      out[i] = convert_out(x[i]);
+    }
+  }
+
+  // sum(a[i] * b[i]) * R^-1, len below 2^32
+  uint16_t dot(const uint16_t* a, const uint16_t* b, const size_t len)
+  {
+    return kernels->dot(*this, a, b, len);
+  }
+
+  // out[i] = a[i]^e, Montgomery form in and out
+  void pow_batch(const uint16_t* a, const uint64_t e, uint16_t* out, const size_t len)
+  {
+    kernels->pow_batch(*this, a, e, out, len);
+  }
+
+  const MontKernels16& batch_kernels()
+  {
+    return *kernels;
+  }
+
+  uint16_t add(const uint16_t a, const uint16_t b)
+  {
+    const uint32_t c = static_cast<uint32_t>(a) + b;
+    return c >= n ? c - n : c;
+  }
+
+  uint16_t sub(const uint16_t a, const uint16_t b)
+  {
+    return a >= b ? a - b : a + (n - b);
+  }
+
+  // Square-and-multiply, a and the result are in Montgomery form
+  uint16_t pow(const uint16_t a, uint64_t e)
+  {
+    uint16_t result = one();
+    uint16_t base = a;
+    while (e > 0) {
+      if (e & 1) {
+        result = multiply(result, base);
+      }
+      base = multiply(base, base);
+      e >>= 1;
+    }
+    return result;
+  }
+
+  // (aR)^-1 = a^-1 R^-1, two conversions bring it back to a^-1 R
+  uint16_t inverse(const uint16_t a)
+  {
+    return convert_in(convert_in(mod_mult_inv(n, a)));
+  }
+
+  uint16_t one()
+  {
+    return r_mod_n;
+  }
+
+  uint16_t modulus()
+  {
+    return n;
+  }
+
+  uint16_t inverse_modulus()
+  {
+    return n_inv_pos;
+  }
+
+  // Subtractive form as in Montgomery::REDC, valid for x < n*R
+  uint16_t REDC(const uint32_t x)
+  {
+    const uint16_t m = static_cast<uint16_t>(x * n_inv_pos);
+    const uint32_t mn = static_cast<uint32_t>(m) * n;
+    const uint16_t u = (x - mn) >> 16;
+    return x < mn ? u + n : u;
+  }
+
+  // x * R^-1 mod n for any 64-bit x, one division, used once per dot product
+  uint16_t REDC_wide(const uint64_t x)
+  {
+    return REDC(x % n);
+  }
+
+private:
+  uint32_t n;
+  uint32_t n_inv_pos;
+  uint32_t r_mod_n;
+  uint32_t r2_mod_n;
+  const MontKernels16* kernels;
+};
+
+void multiply16_batch_portable(Montgomery16& mont, const uint16_t* a, const uint16_t* b, uint16_t* out,
+                               const size_t len)
+{
+  for (size_t i = 0; i < len; ++i) {
+    out[i] = mont.multiply(a[i], b[i]);
+  }
+}
+
+void convert16_in_batch_portable(Montgomery16& mont, const uint16_t* x, uint16_t* out, const size_t len)
+{
+  for (size_t i = 0; i < len; ++i) {
+    out[i] = mont.convert_in(x[i]);
+  }
+}
+
+// Products below 2^32 add up in 64 bits without any folding
+uint16_t dot16_portable(Montgomery16& mont, const uint16_t* a, const uint16_t* b, const size_t len)
+{
+  uint64_t acc = 0;
+  for (size_t i = 0; i < len; ++i) {
+    acc += static_cast<uint32_t>(a[i]) * b[i];
+  }
+  return mont.REDC_wide(acc);
+}
+
+void pow16_batch_portable(Montgomery16& mont, const uint16_t* a, const uint64_t e, uint16_t* out, const size_t len)
+{
+  for (size_t i = 0; i < len; ++i) {
+    out[i] = mont.pow(a[i], e);
+  }
+}
+
+#if defined(__x86_64__)
+// AVX2, 16 lanes of 16 bits. vpmullw gives the low half of every product and vpmulhuw the high half, so REDC
+// is hi(a b) - hi(m n) with m = lo(a b) * n^-1, the low halves cancel exactly.
+
+struct Mont16Avx2 {
+  __m256i n;
+  __m256i n_inv_pos;
+
+  __attribute__((target("avx2"))) Mont16Avx2(Montgomery16& mont)
+  {
+    n = _mm256_set1_epi16(mont.modulus());
+    n_inv_pos = _mm256_set1_epi16(mont.inverse_modulus());
+  }
+
+  __attribute__((target("avx2"))) __m256i multiply(const __m256i a, const __m256i b) const
+  {
+    const __m256i m = _mm256_mullo_epi16(_mm256_mullo_epi16(a, b), n_inv_pos);
+    const __m256i u = _mm256_sub_epi16(_mm256_mulhi_epu16(a, b), _mm256_mulhi_epu16(m, n));
+    return _mm256_min_epu16(u, _mm256_add_epi16(u, n));
+  }
+};
+
+__attribute__((target("avx2")))
+void multiply16_batch_avx2(Montgomery16& mont, const uint16_t* a, const uint16_t* b, uint16_t* out, const size_t len)
+{
+  const Mont16Avx2 m(mont);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    const __m256i a_ = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+    const __m256i b_ = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), m.multiply(a_, b_));
+  }
+  multiply16_batch_portable(mont, a + i, b + i, out + i, len - i);
+}
+
+__attribute__((target("avx2")))
+void convert16_in_batch_avx2(Montgomery16& mont, const uint16_t* x, uint16_t* out, const size_t len)
+{
+  const Mont16Avx2 m(mont);
+  const __m256i r2 = _mm256_set1_epi16(mont.convert_in(mont.one()));
+  const __m256i n_minus_1 = _mm256_sub_epi16(m.n, _mm256_set1_epi16(1));
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    const __m256i x_ = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + i));
+    // x >= n needs a division, left to the scalar path
+    if (!_mm256_testc_si256(_mm256_cmpeq_epi16(_mm256_min_epu16(x_, n_minus_1), x_), _mm256_set1_epi16(-1))) {
+      convert16_in_batch_portable(mont, x + i, out + i, 16);
+      continue;
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), m.multiply(x_, r2));
+  }
+  convert16_in_batch_portable(mont, x + i, out + i, len - i);
+}
+
+// vpmaddwd sums pairs of signed products, exact for residues below 2^15, then widens into 64-bit lanes
+__attribute__((target("avx2")))
+uint16_t dot16_avx2(Montgomery16& mont, const uint16_t* a, const uint16_t* b, const size_t len)
+{
+  const __m256i low32 = _mm256_set1_epi64x(UINT32_MAX);
+  __m256i acc = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    const __m256i a_ = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+    const __m256i b_ = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+    const __m256i pairs = _mm256_madd_epi16(a_, b_);
+    acc = _mm256_add_epi64(acc, _mm256_add_epi64(_mm256_and_si256(pairs, low32), _mm256_srli_epi64(pairs, 32)));
+  }
+  uint64_t lanes[4];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+  uint64_t sum = 0;
+  for (; i < len; ++i) {
+    sum += static_cast<uint32_t>(a[i]) * b[i];
+  }
+  for (const uint64_t lane : lanes) {
+    sum += lane;
+  }
+  return mont.REDC_wide(sum);
+}
+
+__attribute__((target("avx2")))
+void pow16_batch_avx2(Montgomery16& mont, const uint16_t* a, const uint64_t e, uint16_t* out, const size_t len)
+{
+  const Mont16Avx2 m(mont);
+  const __m256i one = _mm256_set1_epi16(mont.one());
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m256i base = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+    __m256i result = one;
+    for (uint64_t k = e; k > 0; k >>= 1) {
+      if (k & 1) {
+        result = m.multiply(result, base);
+      }
+      base = m.multiply(base, base);
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), result);
+  }
+  pow16_batch_portable(mont, a + i, e, out + i, len - i);
+}
+
+// AVX-512BW, 32 lanes of 16 bits, same REDC as the AVX2 kernels. Products and min use the maskz forms against
+// the GCC 12 -Wmaybe-uninitialized false positives.
+
+struct Mont16Avx512 {
+  __m512i n;
+  __m512i n_inv_pos;
+
+  __attribute__((target("avx512bw"))) Mont16Avx512(Montgomery16& mont)
+  {
+    n = _mm512_set1_epi16(mont.modulus());
+    n_inv_pos = _mm512_set1_epi16(mont.inverse_modulus());
+  }
+
+  __attribute__((target("avx512bw"))) __m512i multiply(const __m512i a, const __m512i b) const
+  {
+    const __mmask32 all = 0xFFFFFFFF;
+    const __m512i m = _mm512_maskz_mullo_epi16(all, _mm512_maskz_mullo_epi16(all, a, b), n_inv_pos);
+    const __m512i u = _mm512_sub_epi16(_mm512_maskz_mulhi_epu16(all, a, b), _mm512_maskz_mulhi_epu16(all, m, n));
+    return _mm512_maskz_min_epu16(all, u, _mm512_add_epi16(u, n));
+  }
+};
+
+__attribute__((target("avx512bw")))
+void multiply16_batch_avx512(Montgomery16& mont, const uint16_t* a, const uint16_t* b, uint16_t* out,
+                             const size_t len)
+{
+  const Mont16Avx512 m(mont);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    _mm512_storeu_si512(out + i, m.multiply(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i)));
+  }
+  multiply16_batch_portable(mont, a + i, b + i, out + i, len - i);
+}
+
+__attribute__((target("avx512bw")))
+void convert16_in_batch_avx512(Montgomery16& mont, const uint16_t* x, uint16_t* out, const size_t len)
+{
+  const Mont16Avx512 m(mont);
+  const __m512i r2 = _mm512_set1_epi16(mont.convert_in(mont.one()));
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    const __m512i x_ = _mm512_loadu_si512(x + i);
+    // x >= n needs a division, left to the scalar path
+    if (_mm512_cmpge_epu16_mask(x_, m.n)) {
+      convert16_in_batch_portable(mont, x + i, out + i, 32);
+      continue;
+    }
+    _mm512_storeu_si512(out + i, m.multiply(x_, r2));
+  }
+  convert16_in_batch_portable(mont, x + i, out + i, len - i);
+}
+
+__attribute__((target("avx512bw")))
+uint16_t dot16_avx512(Montgomery16& mont, const uint16_t* a, const uint16_t* b, const size_t len)
+{
+  const __m512i low32 = _mm512_set1_epi64(UINT32_MAX);
+  __m512i acc = _mm512_setzero_si512();
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    const __m512i pairs = _mm512_maskz_madd_epi16(0xFFFF, _mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+    acc = _mm512_add_epi64(
+      acc, _mm512_add_epi64(_mm512_and_si512(pairs, low32), _mm512_maskz_srli_epi64(0xFF, pairs, 32)));
+  }
+  uint64_t lanes[8];
+  _mm512_storeu_si512(lanes, acc);
+  uint64_t sum = 0;
+  for (; i < len; ++i) {
+    sum += static_cast<uint32_t>(a[i]) * b[i];
+  }
+  for (const uint64_t lane : lanes) {
+    sum += lane;
+  }
+  return mont.REDC_wide(sum);
+}
+
+__attribute__((target("avx512bw")))
+void pow16_batch_avx512(Montgomery16& mont, const uint16_t* a, const uint64_t e, uint16_t* out, const size_t len)
+{
+  const Mont16Avx512 m(mont);
+  const __m512i one = _mm512_set1_epi16(mont.one());
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m512i base = _mm512_loadu_si512(a + i);
+    __m512i result = one;
+    for (uint64_t k = e; k > 0; k >>= 1) {
+      if (k & 1) {
+        result = m.multiply(result, base);
+      }
+      base = m.multiply(base, base);
+    }
+    _mm512_storeu_si512(out + i, result);
+  }
+  pow16_batch_portable(mont, a + i, e, out + i, len - i);
+}
+#endif
+
+// Always available, and the only table valid for moduli of 2^15 and above
+const MontKernels16& portable_montgomery16_kernels()
+{
+  static const MontKernels16 portable = {"portable", multiply16_batch_portable, convert16_in_batch_portable,
+                                         dot16_portable, pow16_batch_portable};
+  return portable;
+}
+
+// Kernel tables the running CPU supports, best first
+std::vector<const MontKernels16*> available_montgomery16_kernels()
+{
+  std::vector<const MontKernels16*> kernels;
+#if defined(__x86_64__)
+  static const MontKernels16 avx2 = {"avx2", multiply16_batch_avx2, convert16_in_batch_avx2, dot16_avx2,
+                                     pow16_batch_avx2};
+  static const MontKernels16 avx512 = {"avx512", multiply16_batch_avx512, convert16_in_batch_avx512, dot16_avx512,
+                                       pow16_batch_avx512};
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512bw")) {
+    kernels.push_back(&avx512);
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    kernels.push_back(&avx2);
+  }
+#endif
+  kernels.push_back(&portable_montgomery16_kernels());
+  return kernels;
+}
+
+// Follows the instruction set picked for Montgomery, so MONTGOMERY_ISA and the tuned choice apply here too
+const MontKernels16& montgomery16_kernels()
+{
+  static const MontKernels16* selected = []() {
+    const std::string isa = montgomery_kernels().isa;
+    for (const auto* k : available_montgomery16_kernels()) {
+      if (isa == "avx512" || isa == k->isa || k == &portable_montgomery16_kernels()) {
+        return k;
+      }
+    }
+    return &portable_montgomery16_kernels();
+  }();
+  return *selected;
+}
+
+// Residues of Montgomery16 in Montgomery form
+using MontVector16 = std::vector<uint16_t>;
+
+// Residues kept in Montgomery form
+using MontVector = std::vector<uint32_t>;
+
+// Split [begin, end) in contiguous chunks and run fn(chunk_begin, chunk_end) on each one in its own thread
+template <typename F>
+void parallel_for(const size_t begin, const size_t end, F fn, size_t num_threads = 0)
+{
+  if (num_threads == 0) {
+    num_threads = std::max(1U, std::thread::hardware_concurrency());
+  }
+  const size_t len = end > begin ? end - begin : 0;
+  num_threads = std::min(num_threads, std::max<size_t>(len, 1));
+  if (num_threads == 1) {
+    fn(begin, end);
+    return;
+  }
+  std::vector<std::thread> threads;
+  const size_t chunk = (len + num_threads - 1) / num_threads;
+  for (size_t chunk_begin = begin; chunk_begin < end; chunk_begin += chunk) {
+    threads.emplace_back(fn, chunk_begin, std::min(end, chunk_begin + chunk));
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+}
+
+double elapsed_ms(const std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Fastest of reps runs, in milliseconds
+template <typename F>
+double best_ms(F fn, const size_t reps = 3)
+{
+  double best = 1e300;
+  for (size_t r = 0; r < reps; ++r) {
+    const auto start = std::chrono::steady_clock::now();
+    fn();
+    best = std::min(best, elapsed_ms(start));
+  }
+  return best;
+}
+
+// Every kernel table the CPU supports against the scalar code, odd lengths exercise the scalar tails
+void test_montgomery_kernels(std::mt19937& gen)
+{
+  const std::vector<uint32_t> moduli = {3,          5,          17,         65537,      998244353, 2013265921,
+                                        2147483629, INT32_MAX,  2147483649, 3221225473, 4294967291, UINT32_MAX};
+  for (const uint32_t n : moduli) {
+    Montgomery mont(n);
+    std::uniform_int_distribution<uint32_t> distr(0, n - 1);
+    const size_t len = 1000 + 37;
+    MontVector a(len), b(len), raw(len);
+    for (size_t i = 0; i < len; ++i) {
+      a[i] = distr(gen);
+      b[i] = distr(gen);
+      // Mostly reduced inputs, with a few chunks that need the scalar fallback
+      raw[i] = i % 100 == 7 ? gen() : distr(gen);
+    }
+    a[0] = b[0] = n - 1;
+
+    MontVector expected_mul(len), expected_in(len), expected_pow(len);
+    for (size_t i = 0; i < len; ++i) {
+      expected_mul[i] = mont.multiply(a[i], b[i]);
+      expected_in[i] = mont.convert_in(raw[i]);
+      expected_pow[i] = mont.pow(a[i], 1000003);
+    }
+    uint32_t expected_dot = 0;
+    for (size_t i = 0; i < len; ++i) {
+      expected_dot = mont.add(expected_dot, mont.multiply(a[i], b[i]));
+    }
+    MontVector expected_dif_x(len), expected_dif_y(len), expected_dit_x(len), expected_dit_y(len);
+    for (size_t i = 0; i < len; ++i) {
+      expected_dif_x[i] = mont.add(a[i], b[i]);
+      expected_dif_y[i] = mont.multiply(mont.sub(a[i], b[i]), raw[i] % n);
+      const uint32_t v = mont.multiply(b[i], raw[i] % n);
+      expected_dit_x[i] = mont.add(a[i], v);
+      expected_dit_y[i] = mont.sub(a[i], v);
+    }
+    MontVector w(len);
+    for (size_t i = 0; i < len; ++i) {
+      w[i] = raw[i] % n;
+    }
+    MontVector expected_mul_add(len), expected_mul_sub(len);
+    for (size_t i = 0; i < len; ++i) {
+      expected_mul_add[i] = mont.add(expected_mul[i], w[i]);
+      expected_mul_sub[i] = mont.sub(expected_mul[i], w[i]);
+    }
+    // 13 x 23 times 23 x 37 out of the flat vectors, odd leading dimensions to leave partial tiles everywhere
+    const size_t mm = 13, mn = 37, mk = 23, ld = 41;
+    MontVector expected_matmul(mm * ld);
+    for (size_t i = 0; i < mm; ++i) {
+      for (size_t j = 0; j < ld; ++j) {
+        expected_matmul[i * ld + j] = w[i * ld + j];
+        for (size_t t = 0; j < mn && t < mk; ++t) {
+          expected_matmul[i * ld + j] =
+              mont.sub(expected_matmul[i * ld + j], mont.multiply(a[i * ld + t], b[t * ld + j]));
+        }
+      }
+    }
+    // Three slices of widths 3, 0 and 5, columns from raw into b
+    const std::vector<size_t> slice_ptr = {0, 48, 48, 128};
+    std::vector<uint32_t> sell_cols(128);
+    for (size_t e = 0; e < 128; ++e) {
+      sell_cols[e] = raw[e] % len;
+    }
+    // 13 rows b + 3j of 996 symbols combined with coefficients a[0, 13), from offset 5
+    // The last row reads up to b[3 * (comb_k - 1) + comb_offset + comb_len - 1], which must stay below len
+    const size_t comb_k = 13, comb_len = 996, comb_offset = 5;
+    std::vector<const uint32_t*> comb_rows;
+    for (size_t j = 0; j < comb_k; ++j) {
+      comb_rows.push_back(b.data() + 3 * j);
+    }
+    MontVector expected_combine(comb_len);
+    for (size_t t = 0; t < comb_len; ++t) {
+      for (size_t j = 0; j < comb_k; ++j) {
+        expected_combine[t] = mont.add(expected_combine[t], mont.multiply(a[j], comb_rows[j][comb_offset + t]));
+      }
+    }
+    MontVector expected_sell(48);
+    for (size_t s = 0; s < 3; ++s) {
+      for (size_t e = slice_ptr[s]; e < slice_ptr[s + 1]; ++e) {
+        const size_t row = 16 * s + e % 16;
+        expected_sell[row] = mont.add(expected_sell[row], mont.multiply(a[e], b[sell_cols[e]]));
+      }
+    }
+
+    for (const auto* k : available_montgomery_kernels()) {
+      // Only the portable table handles n >= 2^31, Montgomery itself never binds the others there
+      if (n > INT32_MAX && k != &portable_montgomery_kernels()) {
+        continue;
+      }
+      MontVector out(len);
+      k->multiply_batch(mont, a.data(), b.data(), out.data(), len);
+      bool ok = out == expected_mul;
+      k->convert_in_batch(mont, raw.data(), out.data(), len);
+      ok = ok && out == expected_in;
+      k->mul_add_batch(mont, a.data(), b.data(), w.data(), out.data(), len);
+      ok = ok && out == expected_mul_add;
+      k->mul_sub_batch(mont, a.data(), b.data(), w.data(), out.data(), len);
+      ok = ok && out == expected_mul_sub;
+      k->pow_batch(mont, a.data(), 1000003, out.data(), len);
+      ok = ok && out == expected_pow;
+      ok = ok && k->dot(mont, a.data(), b.data(), len) == expected_dot;
+      MontVector x = a, y = b;
+      k->ntt_dif(mont, x.data(), y.data(), w.data(), len);
+      ok = ok && x == expected_dif_x && y == expected_dif_y;
+      x = a, y = b;
+      k->ntt_dit(mont, x.data(), y.data(), w.data(), len);
+      ok = ok && x == expected_dit_x && y == expected_dit_y;
+      // The block kernels only index roots[1, size) and take roots[1] to be one, other residues serve as twiddles.
+      // The portable split-radix kernel relies on real roots of unity, test_ntt checks it.
+      MontVector roots = w;
+      roots[1] = mont.one();
+      for (size_t size = 1; k != &portable_montgomery_kernels() && size <= 512; size <<= 1) {
+        MontVector expected = a, got = a;
+        expected.resize(size), got.resize(size);
+        ntt_dif_block_portable(mont, expected.data(), size, roots.data());
+        k->ntt_dif_block(mont, got.data(), size, roots.data());
+        ok = ok && got == expected;
+        ntt_dit_block_portable(mont, expected.data(), size, roots.data());
+        k->ntt_dit_block(mont, got.data(), size, roots.data());
+        ok = ok && got == expected;
+      }
+      MontVector combined(comb_len);
+      k->combine_rows(mont, a.data(), comb_rows.data(), comb_k, comb_offset, combined.data(), comb_len);
+      ok = ok && combined == expected_combine;
+      // The deferred reduction needs room for at least one product, only the widest moduli lack it
+      if (mont.lazy_max_terms() > 0) {
+        MontVector c(w.begin(), w.begin() + mm * ld);
+        k->matmul_sub(mont, a.data(), ld, b.data(), ld, c.data(), ld, mm, mn, mk);
+        ok = ok && c == expected_matmul;
+        MontVector sell_out(48);
+        k->sell_matvec(mont, a.data(), sell_cols.data(), slice_ptr.data(), 3, b.data(), sell_out.data());
+        ok = ok && sell_out == expected_sell;
+      }
+      // Groups on both sides of a carry into the high counter word
+      MontVector expected_random(5 * 64), random(5 * 64);
+      const uint64_t counter = (uint64_t(1) << 32) - 32;
+      const size_t random_count = random_residues_portable(mont, n, ~uint64_t(n), counter, 5, expected_random.data());
+      ok = ok && k->random_residues(mont, n, ~uint64_t(n), counter, 5, random.data()) == random_count;
+      ok = ok && std::equal(random.begin(), random.begin() + random_count, expected_random.begin());
+      if (!ok) {
+        std::cout << "isa=" << k->isa << ", n=" << n << "\n";
+        throw std::runtime_error("Montgomery batch kernel test failed.");
+      }
+    }
+  }
+}
+
+void bench_montgomery_kernels(std::mt19937& gen)
+{
+  const uint32_t n = 2013265921;
+  const size_t len = size_t(1) << 16;
+  const size_t reps = 1000;
+  Montgomery mont(n);
+  std::uniform_int_distribution<uint32_t> distr(0, n - 1);
+  MontVector a(len), b(len), out(len);
+  for (size_t i = 0; i < len; ++i) {
+    a[i] = distr(gen);
+    b[i] = distr(gen);
+  }
+  std::cout << "selected isa=" << montgomery_kernels().isa << "\n";
+  for (const auto* k : available_montgomery_kernels()) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < reps; ++r) {
+      k->multiply_batch(mont, a.data(), b.data(), out.data(), len);
+    }
+    std::cout << "isa=" << k->isa << ", multiply_batch_mops=" << len * reps / elapsed_ms(start) / 1000;
+    uint32_t sink = 0;
+    start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < reps; ++r) {
+      sink += k->dot(mont, a.data(), b.data(), len);
+    }
+    std::cout << ", dot_mops=" << len * reps / elapsed_ms(start) / 1000;
+    start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < reps; ++r) {
+      k->ntt_dif(mont, a.data(), out.data(), b.data(), len);
+    }
+    std::cout << ", butterfly_mops=" << len * reps / elapsed_ms(start) / 1000;
+    start = std::chrono::steady_clock::now();
+    k->pow_batch(mont, a.data(), n - 2, out.data(), len);
+    std::cout << ", pow_batch_mops=" << len / elapsed_ms(start) / 1000 << (sink == 1 ? " " : "") << "\n";
+  }
+}
+
+// Same checks as the Montgomery sweep in main() and test_montgomery_kernels(), for every modulus size up to 16 bits
+void test_montgomery16(std::mt19937& gen)
+{
+  for (uint32_t bitlen = 1; bitlen <= 15; ++bitlen) {
+    const uint32_t min_n = (1U << bitlen) + 1;
+    const uint32_t max_n = UINT16_MAX >> (15 - bitlen);
+    std::uniform_int_distribution<uint32_t> distr_n(min_n, max_n);
+    for (size_t i = 0; i < 200; ++i) {
+      uint32_t n = 0;
+      while (n % 2 == 0) {
+        n = distr_n(gen);
+      }
+      Montgomery16 mont(n);
+      std::uniform_int_distribution<uint32_t> distr_ops(0, n - 1);
+      const uint16_t a = distr_ops(gen);
+      const uint16_t b = distr_ops(gen);
+      const uint16_t a_ = mont.convert_in(a);
+      const uint16_t b_ = mont.convert_in(b);
+      if (mont.convert_out(mont.multiply(a_, b_)) != static_cast<uint32_t>(a) * b % n ||
+          mont.convert_out(mont.add(a_, b_)) != (a + b) % n || mont.convert_out(mont.sub(a_, b_)) != (a + n - b) % n ||
+          mont.convert_out(mont.pow(a_, n + 5)) != mont.convert_out(mont.multiply(mont.pow(a_, n), mont.pow(a_, 5)))) {
+        std::cout << "a=" << a << ", b=" << b << ", n=" << n << "\n";
+        throw std::runtime_error("Montgomery16 arithmetic test failed.");
+      }
+      if (std::gcd(a, static_cast<uint16_t>(n)) == 1 && mont.multiply(mont.inverse(a_), a_) != mont.one()) {
+        std::cout << "a=" << a << ", n=" << n << "\n";
+        throw std::runtime_error("Montgomery16 inverse test failed.");
+      }
+    }
+  }
+
+  for (const uint32_t n : {3, 257, 3329, 7681, 12289, 32749, INT16_MAX, 32769, 65521, UINT16_MAX}) {
+    Montgomery16 mont(n);
+    std::uniform_int_distribution<uint32_t> distr(0, n - 1);
+    std::uniform_int_distribution<uint32_t> distr_raw(0, UINT16_MAX);
+    const size_t len = 1000 + 29;
+    MontVector16 a(len), b(len), raw(len);
+    for (size_t i = 0; i < len; ++i) {
+      a[i] = distr(gen);
+      b[i] = distr(gen);
+      // Mostly reduced inputs, with a few chunks that need the scalar fallback
+      raw[i] = i % 100 == 7 ? distr_raw(gen) : distr(gen);
+    }
+    a[0] = b[0] = n - 1;
+    MontVector16 expected_mul(len), expected_in(len), expected_pow(len);
+    uint16_t expected_dot = 0;
+    for (size_t i = 0; i < len; ++i) {
+      expected_mul[i] = mont.multiply(a[i], b[i]);
+      expected_in[i] = mont.convert_in(raw[i]);
+      expected_pow[i] = mont.pow(a[i], 1000003);
+      expected_dot = mont.add(expected_dot, expected_mul[i]);
+    }
+    for (const auto* k : available_montgomery16_kernels()) {
+      // Only the portable table handles n >= 2^15, Montgomery16 itself never binds the others there
+      if (n > INT16_MAX && k != &portable_montgomery16_kernels()) {
+        continue;
+      }
+      MontVector16 out(len);
+      k->multiply_batch(mont, a.data(), b.data(), out.data(), len);
+      bool ok = out == expected_mul;
+      k->convert_in_batch(mont, raw.data(), out.data(), len);
+      ok = ok && out == expected_in;
+      k->pow_batch(mont, a.data(), 1000003, out.data(), len);
+      ok = ok && out == expected_pow;
+      ok = ok && k->dot(mont, a.data(), b.data(), len) == expected_dot;
+      if (!ok) {
+        std::cout << "isa=" << k->isa << ", n=" << n << "\n";
+        throw std::runtime_error("Montgomery16 batch kernel test failed.");
+      }
+    }
+  }
+}
+
+// 16-bit lanes against the 32-bit kernels on the same small modulus
+void bench_montgomery16(std::mt19937& gen)
+{
+  const uint32_t n = 3329;
+  const size_t len = size_t(1) << 16;
+  const size_t reps = 1000;
+  Montgomery16 mont16(n);
+  Montgomery mont(n);
+  std::uniform_int_distribution<uint32_t> distr(0, n - 1);
+  MontVector16 a16(len), b16(len), out16(len);
+  MontVector a(len), b(len), out(len);
+  for (size_t i = 0; i < len; ++i) {
+    a[i] = a16[i] = distr(gen);
+    b[i] = b16[i] = distr(gen);
+  }
+  for (const auto* k : available_montgomery16_kernels()) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < reps; ++r) {
+      k->multiply_batch(mont16, a16.data(), b16.data(), out16.data(), len);
+    }
+    std::cout << "n=" << n << ", isa=" << k->isa << ", multiply16_batch_mops=" << len * reps / elapsed_ms(start) / 1000;
+    uint32_t sink = 0;
+    start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < reps; ++r) {
+      sink += k->dot(mont16, a16.data(), b16.data(), len);
+    }
+    std::cout << ", dot16_mops=" << len * reps / elapsed_ms(start) / 1000 << (sink == 1 ? " " : "") << "\n";
+  }
+  for (const auto* k : available_montgomery_kernels()) {
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < reps; ++r) {
+      k->multiply_batch(mont, a.data(), b.data(), out.data(), len);
+    }
+    std::cout << "n=" << n << ", isa=" << k->isa << ", multiply32_batch_mops=" << len * reps / elapsed_ms(start) / 1000
+              << "\n";
+  }
+}
+
+/// @brief Uniform random residues mod n, drawn directly in Montgomery form
+/// x -> x R mod n permutes [0, n), so a uniform value below n already is a uniform Montgomery residue and nothing
+/// is converted. Candidates are Philox4x32-10 words masked to the bit length of n, fewer than half of them are
+/// rejected. Philox being counter-based, each (seed, stream) pair is an independent sequence, one stream per thread
+/// needs no coordination, and the sequence does not depend on how it is split between next() and fill().
+class MontRandom {
+public:
+  MontRandom(Montgomery& _mont, const uint64_t _seed, const uint64_t _stream = 0)
+      : mont(_mont), seed(_seed), stream(_stream)
+  {
+  }
+
+  uint32_t next()
+  {
+    while (pending_begin == pending_end) {
+      refill();
+    }
+    return pending[pending_begin++];
+  }
+
+  void fill(uint32_t* out, size_t len)
+  {
+    const size_t leftover = std::min(len, pending_end - pending_begin);
+    std::copy(pending + pending_begin, pending + pending_begin + leftover, out);
+    pending_begin += leftover;
+    out += leftover;
+    len -= leftover;
+    // A group yields at most 64 residues, whole groups go straight to out while they cannot overrun it
+    while (len >= 64) {
+      const size_t groups = len / 64;
+      const size_t count = mont.batch_kernels().random_residues(mont, seed, stream, counter, groups, out);
+      counter += 16 * groups;
+      out += count;
+      len -= count;
+    }
+    while (len > 0) {
+      refill();
+      const size_t count = std::min(len, pending_end);
+      std::copy(pending, pending + count, out);
+      pending_begin = count;
+      out += count;
+      len -= count;
+    }
+  }
+
+  MontVector generate(const size_t len)
+  {
+    MontVector out(len);
+    fill(out.data(), len);
+    return out;
+  }
+
+private:
+  void refill()
+  {
+    pending_begin = 0;
+    pending_end = mont.batch_kernels().random_residues(mont, seed, stream, counter, 1, pending);
+    counter += 16;
+  }
+
+  Montgomery& mont;
+  const uint64_t seed;
+  const uint64_t stream;
+  // Next Philox block, always a multiple of 16
+  uint64_t counter = 0;
+  uint32_t pending[64];
+  size_t pending_begin = 0;
+  size_t pending_end = 0;
+};
+
+void test_mont_random(std::mt19937& gen)
+{
+  // Known answers of the Random123 distribution
+  const uint32_t kat[3][10] = {
+      {0, 0, 0, 0, 0, 0, 0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8},
+      {UINT32_MAX, UINT32_MAX, UINT32_MAX, UINT32_MAX, UINT32_MAX, UINT32_MAX, 0x408f276d, 0x41c83b0e, 0xa20bc7c6,
+       0x6d5451fd},
+      {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344, 0xa4093822, 0x299f31d0, 0xd16cfe09, 0x94fdcceb, 0x5001e420,
+       0x24126ea1}};
+  for (const auto& v : kat) {
+    uint32_t ctr[4] = {v[0], v[1], v[2], v[3]};
+    philox4x32(ctr, v[4], v[5]);
+    if (!std::equal(ctr, ctr + 4, v + 6)) {
+      std::cout << "ctr[0]=" << v[0] << "\n";
+      throw std::runtime_error("Philox known answer test failed.");
+    }
+  }
+
+  const std::vector<uint32_t> moduli = {3, 17, 65537, 998244353, INT32_MAX, 2147483649, UINT32_MAX};
+  for (const uint32_t n : moduli) {
+    Montgomery mont(n);
+    const uint64_t seed = uint64_t(gen()) << 32 | gen();
+    const size_t len = 5000 + 13;
+    MontRandom whole(mont, seed, 7);
+    const MontVector expected = whole.generate(len);
+    bool ok = std::all_of(expected.begin(), expected.end(), [n](const uint32_t x) { return x < n; });
+    // The same sequence out of an arbitrary mix of next() and fills, some long enough to skip the buffer
+    MontRandom split(mont, seed, 7);
+    MontVector got(len);
+    std::uniform_int_distribution<size_t> distr_len(0, 300);
+    for (size_t i = 0; i < len;) {
+      const size_t chunk = std::min(len - i, distr_len(gen));
+      if (chunk == 1) {
+        got[i] = split.next();
+      } else {
+        split.fill(got.data() + i, chunk);
+      }
+      i += chunk;
+    }
+    ok = ok && got == expected;
+    MontRandom other(mont, seed, 8);
+    ok = ok && other.generate(len) != expected;
+    if (!ok) {
+      std::cout << "n=" << n << ", seed=" << seed << "\n";
+      throw std::runtime_error("MontRandom sequence test failed.");
+    }
+  }
+
+  // Chi-squared over the residues of a small modulus, 16 degrees of freedom: mean 16, sd 5.7
+  const uint32_t n = 17;
+  Montgomery mont(n);
+  MontRandom random(mont, gen());
+  std::vector<size_t> counts(n);
+  for (const uint32_t x : random.generate(n * 10000)) {
+    ++counts[mont.convert_out(x)];
+  }
+  double chi2 = 0;
+  for (const size_t c : counts) {
+    chi2 += (c - 10000.0) * (c - 10000.0) / 10000.0;
+  }
+  if (chi2 > 80) {
+    std::cout << "n=" << n << ", chi2=" << chi2 << "\n";
+    throw std::runtime_error("MontRandom uniformity test failed.");
+  }
+}
+
+// Philox with rejection against mt19937 with uniform_int_distribution and convert_in, the path main() takes
+void bench_mont_random(std::mt19937& gen)
+{
+  const uint32_t n = 2013265921;
+  const size_t len = size_t(1) << 24;
+  Montgomery mont(n);
+  MontVector out(len);
+  std::uniform_int_distribution<uint32_t> distr(0, n - 1);
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < len; ++i) {
+    out[i] = mont.convert_in(distr(gen));
+  }
+  std::cout << "n=" << n << ", mt19937 convert_in_mops=" << len / elapsed_ms(start) / 1000 << "\n";
+  for (const auto* k : available_montgomery_kernels()) {
+    start = std::chrono::steady_clock::now();
+    const size_t count = k->random_residues(mont, gen(), 0, 0, len / 64, out.data());
+    const double ms = elapsed_ms(start);
+    std::cout << "isa=" << k->isa << ", random_residues_mops=" << count / ms / 1000
+              << ", gbps=" << count * sizeof(uint32_t) / (ms * 1e6) << "\n";
+  }
+  MontRandom random(mont, gen());
+  start = std::chrono::steady_clock::now();
+  random.fill(out.data(), len);
+  std::cout << "MontRandom fill_mops=" << len / elapsed_ms(start) / 1000 << "\n";
+}
+
+// Carry-less (GF(2)[x]) product of two 64-bit polynomials, the 128-bit result as two words
+struct Clmul {
+  uint64_t lo;
+  uint64_t hi;
+};
+
+// One shift-and-xor per set bit of b
+Clmul clmul64_portable(const uint64_t a, uint64_t b)
+{
+  Clmul r = {0, 0};
+  for (; b; b &= b - 1) {
+    const int bit = __builtin_ctzll(b);
+    r.lo ^= a << bit;
+    r.hi ^= bit ? a >> (64 - bit) : 0;
+  }
+  return r;
+}
+
+// Bits [shift, shift + 64) of hi x^64 + lo, 1 <= shift <= 64
+uint64_t shift_right128(const uint64_t lo, const uint64_t hi, const uint32_t shift)
+{
+  return shift == 64 ? hi : (lo >> shift) | (hi << (64 - shift));
+}
+
+// Constants the GF(2^m) kernels need, P = x^m + poly
+struct GF2mParams {
+  uint32_t m;
+  uint64_t mask;
+  uint64_t poly;
+  uint64_t poly_inv;
+  uint64_t r2;
+};
+
+class MontgomeryGF2m;
+
+// Kernels of MontgomeryGF2m. The scalar multiply is in the table too: PCLMULQDQ needs a target attribute, which
+// keeps it from being inlined into the class anyway.
+struct MontKernelsGF2m {
+  const char* isa;
+  uint64_t (*multiply)(const MontgomeryGF2m&, uint64_t, uint64_t);
+  void (*multiply_batch)(const MontgomeryGF2m&, const uint64_t*, const uint64_t*, uint64_t*, size_t);
+  void (*convert_in_batch)(const MontgomeryGF2m&, const uint64_t*, uint64_t*, size_t);
+};
+
+const MontKernelsGF2m& gf2m_kernels();
+
+/// @brief Montgomery multiplication in GF(2^m) = GF(2)[x] / P for 1 <= m <= 64, R = x^m
+/// Elements are polynomials of degree < m, bit i the coefficient of x^i. The integer REDC carries over with XOR
+/// for addition and carry-less products: q = (T mod x^m) P^-1 mod x^m clears the low m coefficients of T + q P,
+/// and without carries (T + q P) / x^m already has degree < m, so there is no final correction. P needs a nonzero
+/// constant term for x^m to be invertible, and must be irreducible for the ring to be a field.
+class MontgomeryGF2m {
+public:
+  // P = x^m + poly
+  MontgomeryGF2m(const uint32_t _m, const uint64_t _poly) : m(_m), poly(_poly)
+  {
+    if (m < 1 || m > 64) {
+      std::cout << "m=" << m << "\n";
+      throw std::invalid_argument("Degree must be in [1, 64].");
+    }
+    mask = m == 64 ? UINT64_MAX : (uint64_t(1) << m) - 1;
+    if ((poly & ~mask) || !(poly & 1)) {
+      std::cout << "m=" << m << ", poly=" << poly << "\n";
+      throw std::invalid_argument("Polynomial must have degree < m and a nonzero constant term.");
+    }
+
+    // Newton over GF(2)[x]: y P = 1 + e gives (P y^2) P = 1 + e^2, doubling the correct low coefficients
+    poly_inv = 1;
+    for (uint32_t bits = 1; bits < m; bits *= 2) {
+      poly_inv = clmul64_portable(clmul64_portable(poly_inv, poly_inv).lo, poly).lo & mask;
+    }
+
+    // x^2m mod P, one shift by x at a time
+    r2 = 1;
+    for (uint32_t i = 0; i < 2 * m; ++i) {
+      const bool carry = r2 >> (m - 1) & 1;
+      r2 = (r2 << 1) & mask;
+      r2 ^= carry ? poly : 0;
+    }
+
+    kernels = &gf2m_kernels();
+  }
+
+  uint64_t convert_in(const uint64_t x) const
+  {
+    return multiply(x & mask, r2);
+  }
+
+  uint64_t convert_out(const uint64_t x) const
+  {
+    return REDC(x, 0);
+  }
+
+  uint64_t multiply(const uint64_t a, const uint64_t b) const
+  {
+    return kernels->multiply(*this, a, b);
+  }
+
+  // T x^-m mod P for T = hi x^64 + lo of degree < 2m
+  uint64_t REDC(const uint64_t lo, const uint64_t hi) const
+  {
+    const uint64_t q = clmul64_portable(lo & mask, poly_inv).lo & mask;
+    const Clmul c = clmul64_portable(q, poly);
+    // T + q P = T + q x^m + q poly, whose low m coefficients cancel
+    return shift_right128(lo, hi, m) ^ q ^ shift_right128(c.lo, c.hi, m);
+  }
+
+  // Addition and subtraction are both XOR, in and out of Montgomery form
+  uint64_t add(const uint64_t a, const uint64_t b) const
+  {
+    return a ^ b;
+  }
+
+  uint64_t one() const
+  {
+    return convert_in(1);
+  }
+
+  // Square-and-multiply, a and the result are in Montgomery form
+  uint64_t pow(const uint64_t a, uint64_t e) const
+  {
+    uint64_t result = one();
+    uint64_t base = a;
+    while (e > 0) {
+      if (e & 1) {
+        result = multiply(result, base);
+      }
+      base = multiply(base, base);
+      e >>= 1;
+    }
+    return result;
+  }
+
+  void multiply_batch(const uint64_t* a, const uint64_t* b, uint64_t* out, const size_t len) const
+  {
+    kernels->multiply_batch(*this, a, b, out, len);
+  }
+
+  void convert_in_batch(const uint64_t* x, uint64_t* out, const size_t len) const
+  {
+    kernels->convert_in_batch(*this, x, out, len);
+  }
+
+  void convert_out_batch(const uint64_t* x, uint64_t* out, const size_t len) const
+  {
+    for (size_t i = 0; i < len; ++i) {
+      out[i] = convert_out(x[i]);
+    }
+  }
+
+  const MontKernelsGF2m& batch_kernels() const
+  {
+    return *kernels;
+  }
+
+  GF2mParams params() const
+  {
+    return {m, mask, poly, poly_inv, r2};
+  }
+
+  uint32_t degree() const
+  {
+    return m;
+  }
+
+private:
+  uint32_t m;
+  uint64_t mask;
+  uint64_t poly;
+  uint64_t poly_inv;
+  uint64_t r2;
+  const MontKernelsGF2m* kernels;
+};
+
+uint64_t gf2m_multiply_portable(const MontgomeryGF2m& mont, const uint64_t a, const uint64_t b)
+{
+  const Clmul t = clmul64_portable(a, b);
+  return mont.REDC(t.lo, t.hi);
+}
+
+void gf2m_multiply_batch_portable(const MontgomeryGF2m& mont, const uint64_t* a, const uint64_t* b, uint64_t* out,
+                                  const size_t len)
+{
+  for (size_t i = 0; i < len; ++i) {
+    out[i] = gf2m_multiply_portable(mont, a[i], b[i]);
+  }
+}
+
+void gf2m_convert_in_batch_portable(const MontgomeryGF2m& mont, const uint64_t* x, uint64_t* out, const size_t len)
+{
+  for (size_t i = 0; i < len; ++i) {
+    out[i] = mont.convert_in(x[i]);
+  }
+}
+
+#if defined(__x86_64__)
+__attribute__((target("pclmul,sse4.1")))
+inline Clmul clmul64_pclmul(const uint64_t a, const uint64_t b)
+{
+  const __m128i t = _mm_clmulepi64_si128(_mm_cvtsi64_si128(a), _mm_cvtsi64_si128(b), 0x00);
+  return {uint64_t(_mm_cvtsi128_si64(t)), uint64_t(_mm_extract_epi64(t, 1))};
+}
+
+// Three carry-less products: a b, the low half of (T mod x^m) P^-1, then q poly
+__attribute__((target("pclmul,sse4.1")))
+inline uint64_t gf2m_multiply_pclmul_inline(const GF2mParams& p, const uint64_t a, const uint64_t b)
+{
+  const Clmul t = clmul64_pclmul(a, b);
+  const uint64_t q = clmul64_pclmul(t.lo & p.mask, p.poly_inv).lo & p.mask;
+  const Clmul c = clmul64_pclmul(q, p.poly);
+  return shift_right128(t.lo, t.hi, p.m) ^ q ^ shift_right128(c.lo, c.hi, p.m);
+}
+
+__attribute__((target("pclmul,sse4.1")))
+uint64_t gf2m_multiply_pclmul(const MontgomeryGF2m& mont, const uint64_t a, const uint64_t b)
+{
+  return gf2m_multiply_pclmul_inline(mont.params(), a, b);
+}
+
+__attribute__((target("pclmul,sse4.1")))
+void gf2m_multiply_batch_pclmul(const MontgomeryGF2m& mont, const uint64_t* a, const uint64_t* b, uint64_t* out,
+                                const size_t len)
+{
+  const GF2mParams p = mont.params();
+  for (size_t i = 0; i < len; ++i) {
+    out[i] = gf2m_multiply_pclmul_inline(p, a[i], b[i]);
+  }
+}
+
+__attribute__((target("pclmul,sse4.1")))
+void gf2m_convert_in_batch_pclmul(const MontgomeryGF2m& mont, const uint64_t* x, uint64_t* out, const size_t len)
+{
+  const GF2mParams p = mont.params();
+  for (size_t i = 0; i < len; ++i) {
+    out[i] = gf2m_multiply_pclmul_inline(p, x[i] & p.mask, p.r2);
+  }
+}
+
+// 8 products per step: selectors 0x00 and 0x11 multiply the even and odd qwords of each 128-bit lane, and the
+// unpacks put the low and high halves back in element order
+struct GF2mAvx512 {
+  __m512i mask;
+  __m512i poly;
+  __m512i poly_inv;
+  __m128i shift;
+  __m128i shift_back;
+
+  __attribute__((target("avx512f,vpclmulqdq")))
+  GF2mAvx512(const GF2mParams& p)
+  {
+    mask = _mm512_set1_epi64(p.mask);
+    poly = _mm512_set1_epi64(p.poly);
+    poly_inv = _mm512_set1_epi64(p.poly_inv);
+    shift = _mm_cvtsi32_si128(p.m);
+    shift_back = _mm_cvtsi32_si128(64 - p.m);
+  }
+
+  __attribute__((target("avx512f,vpclmulqdq")))
+  static void clmul(const __m512i a, const __m512i b, __m512i& lo, __m512i& hi)
+  {
+    const __m512i even = _mm512_clmulepi64_epi128(a, b, 0x00);
+    const __m512i odd = _mm512_clmulepi64_epi128(a, b, 0x11);
+    lo = _mm512_maskz_unpacklo_epi64(0xFF, even, odd);
+    hi = _mm512_maskz_unpackhi_epi64(0xFF, even, odd);
+  }
+
+  // Variable shifts by 64 or more give zero, so m = 64 needs no special case
+  __attribute__((target("avx512f,vpclmulqdq")))
+  __m512i shift_right(const __m512i lo, const __m512i hi) const
+  {
+    return _mm512_or_si512(_mm512_maskz_srl_epi64(0xFF, lo, shift), _mm512_maskz_sll_epi64(0xFF, hi, shift_back));
+  }
+
+  __attribute__((target("avx512f,vpclmulqdq")))
+  __m512i multiply(const __m512i a, const __m512i b) const
+  {
+    __m512i t_lo, t_hi, q, unused, c_lo, c_hi;
+    clmul(a, b, t_lo, t_hi);
+    clmul(_mm512_and_si512(t_lo, mask), poly_inv, q, unused);
+    q = _mm512_and_si512(q, mask);
+    clmul(q, poly, c_lo, c_hi);
+    return _mm512_ternarylogic_epi64(shift_right(t_lo, t_hi), q, shift_right(c_lo, c_hi), 0x96);
+  }
+};
+
+__attribute__((target("avx512f,vpclmulqdq")))
+void gf2m_multiply_batch_avx512(const MontgomeryGF2m& mont, const uint64_t* a, const uint64_t* b, uint64_t* out,
+                                const size_t len)
+{
+  const GF2mAvx512 g(mont.params());
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    _mm512_storeu_si512(out + i, g.multiply(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i)));
+  }
+  gf2m_multiply_batch_pclmul(mont, a + i, b + i, out + i, len - i);
+}
+
+__attribute__((target("avx512f,vpclmulqdq")))
+void gf2m_convert_in_batch_avx512(const MontgomeryGF2m& mont, const uint64_t* x, uint64_t* out, const size_t len)
+{
+  const GF2mParams p = mont.params();
+  const GF2mAvx512 g(p);
+  const __m512i r2 = _mm512_set1_epi64(p.r2);
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    _mm512_storeu_si512(out + i, g.multiply(_mm512_and_si512(_mm512_loadu_si512(x + i), g.mask), r2));
+  }
+  gf2m_convert_in_batch_pclmul(mont, x + i, out + i, len - i);
+}
+#endif
+
+const MontKernelsGF2m& portable_gf2m_kernels()
+{
+  static const MontKernelsGF2m portable = {"portable", gf2m_multiply_portable, gf2m_multiply_batch_portable,
+                                           gf2m_convert_in_batch_portable};
+  return portable;
+}
+
+// Kernel tables the running CPU supports, best first
+std::vector<const MontKernelsGF2m*> available_gf2m_kernels()
+{
+  std::vector<const MontKernelsGF2m*> kernels;
+#if defined(__x86_64__)
+  static const MontKernelsGF2m pclmul = {"pclmul", gf2m_multiply_pclmul, gf2m_multiply_batch_pclmul,
+                                         gf2m_convert_in_batch_pclmul};
+  static const MontKernelsGF2m avx512 = {"avx512", gf2m_multiply_pclmul, gf2m_multiply_batch_avx512,
+                                         gf2m_convert_in_batch_avx512};
+  __builtin_cpu_init();
+  const bool has_pclmul = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+  if (has_pclmul && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("vpclmulqdq")) {
+    kernels.push_back(&avx512);
+  }
+  if (has_pclmul) {
+    kernels.push_back(&pclmul);
+  }
+#endif
+  kernels.push_back(&portable_gf2m_kernels());
+  return kernels;
+}
+
+// Follows the instruction set picked for Montgomery like montgomery16_kernels(), avx2 meaning scalar PCLMULQDQ
+const MontKernelsGF2m& gf2m_kernels()
+{
+  static const MontKernelsGF2m* selected = []() {
+    const std::string isa = montgomery_kernels().isa;
+    for (const auto* k : available_gf2m_kernels()) {
+      if (isa == "avx512" || (isa == "avx2" && k->isa != std::string("avx512")) || k == &portable_gf2m_kernels()) {
+        return k;
+      }
+    }
+    return &portable_gf2m_kernels();
+  }();
+  return *selected;
+}
+
+// Low 128 bits of the carry-less product of two 128-bit polynomials
+unsigned __int128 clmul128_low_portable(const unsigned __int128 a, const unsigned __int128 b)
+{
+  const Clmul z0 = clmul64_portable(uint64_t(a), uint64_t(b));
+  const uint64_t mid = clmul64_portable(uint64_t(a), uint64_t(b >> 64)).lo ^
+                       clmul64_portable(uint64_t(a >> 64), uint64_t(b)).lo;
+  return (static_cast<unsigned __int128>(z0.hi ^ mid) << 64) | z0.lo;
+}
+
+// High 128 bits of the same product
+unsigned __int128 clmul128_high_portable(const unsigned __int128 a, const unsigned __int128 b)
+{
+  // Without carries a0 b0 stays in the low half
+  const Clmul z1a = clmul64_portable(uint64_t(a), uint64_t(b >> 64));
+  const Clmul z1b = clmul64_portable(uint64_t(a >> 64), uint64_t(b));
+  const Clmul z2 = clmul64_portable(uint64_t(a >> 64), uint64_t(b >> 64));
+  return (static_cast<unsigned __int128>(z2.hi) << 64) | (z2.lo ^ z1a.hi ^ z1b.hi);
+}
+
+class MontgomeryGF2_128;
+
+// Kernels of MontgomeryGF2_128, same layout as MontKernelsGF2m
+struct MontKernelsGF2_128 {
+  const char* isa;
+  unsigned __int128 (*multiply)(const MontgomeryGF2_128&, unsigned __int128, unsigned __int128);
+  void (*multiply_batch)(const MontgomeryGF2_128&, const unsigned __int128*, const unsigned __int128*,
+                         unsigned __int128*, size_t);
+};
+
+const MontKernelsGF2_128& gf2_128_kernels();
+
+/// @brief Montgomery multiplication in GF(2^128) = GF(2)[x] / (x^128 + poly), R = x^128
+/// MontgomeryGF2m on two-word elements, the field size of GCM-style hashes. Degrees between 64 and 128 are not
+/// supported, the shifts by m would cross words at arbitrary offsets for no use case we have.
+class MontgomeryGF2_128 {
+public:
+  MontgomeryGF2_128(const unsigned __int128 _poly) : poly(_poly)
+  {
+    if (!(poly & 1)) {
+      std::cout << "poly=" << uint64_t(poly >> 64) << ":" << uint64_t(poly) << "\n";
+      throw std::invalid_argument("Polynomial must have a nonzero constant term.");
+    }
+
+    // Same Newton iteration as MontgomeryGF2m
+    poly_inv = 1;
+    for (uint32_t bits = 1; bits < 128; bits *= 2) {
+      poly_inv = clmul128_low_portable(clmul128_low_portable(poly_inv, poly_inv), poly);
+    }
+
+    r2 = 1;
+    for (uint32_t i = 0; i < 256; ++i) {
+      const bool carry = r2 >> 127;
+      r2 <<= 1;
+      r2 ^= carry ? poly : 0;
+    }
+
+    kernels = &gf2_128_kernels();
+  }
+
+  unsigned __int128 convert_in(const unsigned __int128 x) const
+  {
+    return multiply(x, r2);
+  }
+
+  unsigned __int128 convert_out(const unsigned __int128 x) const
+  {
+    return REDC(x, 0);
+  }
+
+  unsigned __int128 multiply(const unsigned __int128 a, const unsigned __int128 b) const
+  {
+    return kernels->multiply(*this, a, b);
+  }
+
+  // T x^-128 mod P for T = hi x^128 + lo
+  unsigned __int128 REDC(const unsigned __int128 lo, const unsigned __int128 hi) const
+  {
+    const unsigned __int128 q = clmul128_low_portable(lo, poly_inv);
+    return hi ^ q ^ clmul128_high_portable(q, poly);
+  }
+
+  unsigned __int128 add(const unsigned __int128 a, const unsigned __int128 b) const
+  {
+    return a ^ b;
+  }
+
+  unsigned __int128 one() const
+  {
+    return convert_in(1);
+  }
+
+  void multiply_batch(const unsigned __int128* a, const unsigned __int128* b, unsigned __int128* out,
+                      const size_t len) const
+  {
+    kernels->multiply_batch(*this, a, b, out, len);
+  }
+
+  const MontKernelsGF2_128& batch_kernels() const
+  {
+    return *kernels;
+  }
+
+  unsigned __int128 polynomial() const
+  {
+    return poly;
+  }
+
+  unsigned __int128 polynomial_inverse() const
+  {
+    return poly_inv;
+  }
+
+private:
+  unsigned __int128 poly;
+  unsigned __int128 poly_inv;
+  unsigned __int128 r2;
+  const MontKernelsGF2_128* kernels;
+};
+
+unsigned __int128 gf2_128_multiply_portable(const MontgomeryGF2_128& mont, const unsigned __int128 a,
+                                            const unsigned __int128 b)
+{
+  return mont.REDC(clmul128_low_portable(a, b), clmul128_high_portable(a, b));
+}
+
+void gf2_128_multiply_batch_portable(const MontgomeryGF2_128& mont, const unsigned __int128* a,
+                                     const unsigned __int128* b, unsigned __int128* out, const size_t len)
+{
+  for (size_t i = 0; i < len; ++i) {
+    out[i] = gf2_128_multiply_portable(mont, a[i], b[i]);
+  }
+}
+
+#if defined(__x86_64__)
+// Schoolbook on words: a0 b0, the cross terms a0 b1 + a1 b0 shifted by one word, a1 b1. The reduction only needs
+// the low half of one product and the high half of the other, three multiplies each.
+__attribute__((target("pclmul,sse4.1")))
+inline __m128i clmul128_low_pclmul(const __m128i a, const __m128i b)
+{
+  const __m128i mid = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x01), _mm_clmulepi64_si128(a, b, 0x10));
+  return _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x00), _mm_slli_si128(mid, 8));
+}
+
+__attribute__((target("pclmul,sse4.1")))
+inline __m128i clmul128_high_pclmul(const __m128i a, const __m128i b)
+{
+  const __m128i mid = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x01), _mm_clmulepi64_si128(a, b, 0x10));
+  return _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x11), _mm_srli_si128(mid, 8));
+}
+
+__attribute__((target("pclmul,sse4.1")))
+inline __m128i gf2_128_multiply_pclmul_inline(const __m128i a, const __m128i b, const __m128i poly,
+                                              const __m128i poly_inv)
+{
+  const __m128i z0 = _mm_clmulepi64_si128(a, b, 0x00);
+  const __m128i mid = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x01), _mm_clmulepi64_si128(a, b, 0x10));
+  const __m128i t_lo = _mm_xor_si128(z0, _mm_slli_si128(mid, 8));
+  const __m128i t_hi = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x11), _mm_srli_si128(mid, 8));
+  const __m128i q = clmul128_low_pclmul(t_lo, poly_inv);
+  return _mm_xor_si128(_mm_xor_si128(t_hi, q), clmul128_high_pclmul(q, poly));
+}
+
+__attribute__((target("pclmul,sse4.1")))
+unsigned __int128 gf2_128_multiply_pclmul(const MontgomeryGF2_128& mont, const unsigned __int128 a,
+                                          const unsigned __int128 b)
+{
+  const unsigned __int128 poly = mont.polynomial(), poly_inv = mont.polynomial_inverse();
+  unsigned __int128 result;
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(&result),
+                   gf2_128_multiply_pclmul_inline(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&a)),
+                                                  _mm_loadu_si128(reinterpret_cast<const __m128i*>(&b)),
+                                                  _mm_loadu_si128(reinterpret_cast<const __m128i*>(&poly)),
+                                                  _mm_loadu_si128(reinterpret_cast<const __m128i*>(&poly_inv))));
+  return result;
+}
+
+__attribute__((target("pclmul,sse4.1")))
+void gf2_128_multiply_batch_pclmul(const MontgomeryGF2_128& mont, const unsigned __int128* a,
+                                   const unsigned __int128* b, unsigned __int128* out, const size_t len)
+{
+  const unsigned __int128 p = mont.polynomial(), p_inv = mont.polynomial_inverse();
+  const __m128i poly = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&p));
+  const __m128i poly_inv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&p_inv));
+  for (size_t i = 0; i < len; ++i) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                     gf2_128_multiply_pclmul_inline(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+                                                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)),
+                                                    poly, poly_inv));
+  }
+}
+
+// a0 b1 + a1 b0 in every 128-bit lane
+__attribute__((target("avx512f,vpclmulqdq")))
+inline __m512i clmul128_cross_avx512(const __m512i a, const __m512i b)
+{
+  return _mm512_xor_si512(_mm512_clmulepi64_epi128(a, b, 0x01), _mm512_clmulepi64_epi128(a, b, 0x10));
+}
+
+// The pclmul kernel with one element per 128-bit lane, 4 at a time
+__attribute__((target("avx512f,vpclmulqdq")))
+void gf2_128_multiply_batch_avx512(const MontgomeryGF2_128& mont, const unsigned __int128* a,
+                                   const unsigned __int128* b, unsigned __int128* out, const size_t len)
+{
+  const unsigned __int128 p = mont.polynomial(), p_inv = mont.polynomial_inverse();
+  const __m512i poly = _mm512_maskz_broadcast_i32x4(0xFFFF, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&p)));
+  const __m512i poly_inv =
+      _mm512_maskz_broadcast_i32x4(0xFFFF, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&p_inv)));
+  // Word shifts inside the 128-bit lanes through unpacks, the byte shifts would need AVX-512BW
+  const __m512i zero = _mm512_setzero_si512();
+  size_t i = 0;
+  for (; i + 4 <= len; i += 4) {
+    const __m512i x = _mm512_loadu_si512(a + i);
+    const __m512i y = _mm512_loadu_si512(b + i);
+    __m512i mid = clmul128_cross_avx512(x, y);
+    const __m512i t_lo =
+        _mm512_xor_si512(_mm512_clmulepi64_epi128(x, y, 0x00), _mm512_maskz_unpacklo_epi64(0xFF, zero, mid));
+    const __m512i t_hi =
+        _mm512_xor_si512(_mm512_clmulepi64_epi128(x, y, 0x11), _mm512_maskz_unpackhi_epi64(0xFF, mid, zero));
+    mid = clmul128_cross_avx512(t_lo, poly_inv);
+    const __m512i q = _mm512_xor_si512(_mm512_clmulepi64_epi128(t_lo, poly_inv, 0x00),
+                                       _mm512_maskz_unpacklo_epi64(0xFF, zero, mid));
+    mid = clmul128_cross_avx512(q, poly);
+    const __m512i c_hi =
+        _mm512_xor_si512(_mm512_clmulepi64_epi128(q, poly, 0x11), _mm512_maskz_unpackhi_epi64(0xFF, mid, zero));
+    _mm512_storeu_si512(out + i, _mm512_ternarylogic_epi64(t_hi, q, c_hi, 0x96));
+  }
+  gf2_128_multiply_batch_pclmul(mont, a + i, b + i, out + i, len - i);
+}
+#endif
+
+const MontKernelsGF2_128& portable_gf2_128_kernels()
+{
+  static const MontKernelsGF2_128 portable = {"portable", gf2_128_multiply_portable, gf2_128_multiply_batch_portable};
+  return portable;
+}
+
+// Kernel tables the running CPU supports, best first
+std::vector<const MontKernelsGF2_128*> available_gf2_128_kernels()
+{
+  std::vector<const MontKernelsGF2_128*> kernels;
+#if defined(__x86_64__)
+  static const MontKernelsGF2_128 pclmul = {"pclmul", gf2_128_multiply_pclmul, gf2_128_multiply_batch_pclmul};
+  static const MontKernelsGF2_128 avx512 = {"avx512", gf2_128_multiply_pclmul, gf2_128_multiply_batch_avx512};
+  __builtin_cpu_init();
+  const bool has_pclmul = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+  if (has_pclmul && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("vpclmulqdq")) {
+    kernels.push_back(&avx512);
+  }
+  if (has_pclmul) {
+    kernels.push_back(&pclmul);
+  }
+#endif
+  kernels.push_back(&portable_gf2_128_kernels());
+  return kernels;
+}
+
+// Same choice as gf2m_kernels()
+const MontKernelsGF2_128& gf2_128_kernels()
+{
+  static const MontKernelsGF2_128* selected = []() {
+    const std::string choice = gf2m_kernels().isa;
+    for (const auto* k : available_gf2_128_kernels()) {
+      if (choice == k->isa) {
+        return k;
+      }
+    }
+    return &portable_gf2_128_kernels();
+  }();
+  return *selected;
+}
+
+// a b mod P one coefficient of b at a time, from the top, as a reference for MontgomeryGF2m
+uint64_t gf2m_multiply_reference(const uint64_t a, const uint64_t b, const uint32_t m, const uint64_t poly)
+{
+  const uint64_t mask = m == 64 ? UINT64_MAX : (uint64_t(1) << m) - 1;
+  uint64_t r = 0;
+  for (uint32_t i = m; i-- > 0;) {
+    const bool carry = r >> (m - 1) & 1;
+    r = ((r << 1) & mask) ^ (carry ? poly : 0);
+    r ^= (b >> i & 1) ? a : 0;
+  }
+  return r;
+}
+
+unsigned __int128 gf2_128_multiply_reference(const unsigned __int128 a, const unsigned __int128 b,
+                                             const unsigned __int128 poly)
+{
+  unsigned __int128 r = 0;
+  for (uint32_t i = 128; i-- > 0;) {
+    const bool carry = r >> 127;
+    r = (r << 1) ^ (carry ? poly : 0);
+    r ^= (b >> i & 1) ? a : 0;
+  }
+  return r;
+}
+
+// Every kernel table against the reference: exhaustively over all polynomials and operands for m <= 6 and over
+// all operands of the AES field, on random operands up to m = 64 and for GF(2^128)
+void test_gf2m(std::mt19937& gen)
+{
+  std::vector<std::pair<uint32_t, uint64_t>> exhaustive;
+  for (uint32_t m = 1; m <= 6; ++m) {
+    for (uint64_t poly = 1; poly < (uint64_t(1) << m); poly += 2) {
+      exhaustive.emplace_back(m, poly);
+    }
+  }
+  // x^8 + x^4 + x^3 + x + 1
+  exhaustive.emplace_back(8, 0x1B);
+  for (const auto& [m, poly] : exhaustive) {
+    MontgomeryGF2m field(m, poly);
+    for (const auto* k : available_gf2m_kernels()) {
+      const uint64_t size = uint64_t(1) << m;
+      for (uint64_t a = 0; a < size; ++a) {
+        const uint64_t a_ = field.convert_in(a);
+        for (uint64_t b = 0; b < size; ++b) {
+          const uint64_t c = field.convert_out(k->multiply(field, a_, field.convert_in(b)));
+          if (c != gf2m_multiply_reference(a, b, m, poly)) {
+            std::cout << "isa=" << k->isa << ", m=" << m << ", poly=" << poly << ", a=" << a << ", b=" << b << "\n";
+            throw std::runtime_error("GF(2^m) Montgomery exhaustive test failed.");
+          }
+        }
+      }
+    }
+  }
+
+  // Odd random polynomials, irreducible or not the ring identities hold
+  for (const uint32_t m : {7U, 13U, 31U, 32U, 33U, 63U, 64U}) {
+    const uint64_t mask = m == 64 ? UINT64_MAX : (uint64_t(1) << m) - 1;
+    const uint64_t poly = ((uint64_t(gen()) << 32 | gen()) & mask) | 1;
+    MontgomeryGF2m field(m, poly);
+    const size_t len = 1000 + 13;
+    std::vector<uint64_t> a(len), b(len), expected(len);
+    for (size_t i = 0; i < len; ++i) {
+      a[i] = (uint64_t(gen()) << 32 | gen()) & mask;
+      b[i] = (uint64_t(gen()) << 32 | gen()) & mask;
+      expected[i] = field.convert_in(gf2m_multiply_reference(a[i], b[i], m, poly));
+    }
+    std::vector<uint64_t> a_(len), b_(len), out(len);
+    for (const auto* k : available_gf2m_kernels()) {
+      k->convert_in_batch(field, a.data(), a_.data(), len);
+      k->convert_in_batch(field, b.data(), b_.data(), len);
+      k->multiply_batch(field, a_.data(), b_.data(), out.data(), len);
+      bool ok = out == expected;
+      field.convert_out_batch(a_.data(), out.data(), len);
+      ok = ok && out == a;
+      if (!ok) {
+        std::cout << "isa=" << k->isa << ", m=" << m << ", poly=" << poly << "\n";
+        throw std::runtime_error("GF(2^m) Montgomery batch kernel test failed.");
+      }
+    }
+  }
+
+  // The GCM polynomial x^128 + x^7 + x^2 + x + 1 and a random one
+  const unsigned __int128 random_poly = (static_cast<unsigned __int128>(uint64_t(gen()) << 32 | gen()) << 64) |
+                                        (uint64_t(gen()) << 32 | gen()) | 1;
+  for (const unsigned __int128 poly : {static_cast<unsigned __int128>(0x87), random_poly}) {
+    MontgomeryGF2_128 field(poly);
+    const size_t len = 200 + 3;
+    std::vector<unsigned __int128> a(len), b(len), expected(len);
+    for (size_t i = 0; i < len; ++i) {
+      a[i] = field.convert_in((static_cast<unsigned __int128>(uint64_t(gen()) << 32 | gen()) << 64) | gen());
+      b[i] = field.convert_in((static_cast<unsigned __int128>(gen()) << 96) | (uint64_t(gen()) << 32 | gen()));
+      expected[i] = field.convert_in(
+          gf2_128_multiply_reference(field.convert_out(a[i]), field.convert_out(b[i]), poly));
+    }
+    for (const auto* k : available_gf2_128_kernels()) {
+      std::vector<unsigned __int128> out(len);
+      k->multiply_batch(field, a.data(), b.data(), out.data(), len);
+      bool ok = out == expected;
+      for (size_t i = 0; i < len; ++i) {
+        ok = ok && k->multiply(field, a[i], b[i]) == expected[i];
+      }
+      if (!ok) {
+        std::cout << "isa=" << k->isa << ", poly=" << uint64_t(poly >> 64) << ":" << uint64_t(poly) << "\n";
+        throw std::runtime_error("GF(2^128) Montgomery test failed.");
+      }
+    }
+  }
+}
+
+void bench_gf2m(std::mt19937& gen)
+{
+  const size_t len = size_t(1) << 16;
+  const size_t reps = 200;
+  // x^64 + x^4 + x^3 + x + 1
+  MontgomeryGF2m field(64, 0x1B);
+  std::vector<uint64_t> a(len), b(len), out(len);
+  for (size_t i = 0; i < len; ++i) {
+    a[i] = uint64_t(gen()) << 32 | gen();
+    b[i] = uint64_t(gen()) << 32 | gen();
+  }
+  for (const auto* k : available_gf2m_kernels()) {
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < reps; ++r) {
+      k->multiply_batch(field, a.data(), b.data(), out.data(), len);
+    }
+    std::cout << "m=64, isa=" << k->isa << ", multiply_batch_mops=" << len * reps / elapsed_ms(start) / 1000 << "\n";
+  }
+  MontgomeryGF2_128 field128(0x87);
+  std::vector<unsigned __int128> a128(len), b128(len), out128(len);
+  for (size_t i = 0; i < len; ++i) {
+    a128[i] = (static_cast<unsigned __int128>(a[i]) << 64) | b[i];
+    b128[i] = (static_cast<unsigned __int128>(b[i]) << 64) | a[i];
+  }
+  for (const auto* k : available_gf2_128_kernels()) {
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < reps; ++r) {
+      k->multiply_batch(field128, a128.data(), b128.data(), out128.data(), len);
+    }
+    std::cout << "m=128, isa=" << k->isa << ", multiply_batch_mops=" << len * reps / elapsed_ms(start) / 1000 << "\n";
+  }
+}
+
+// x86-64 encodings of the few instruction forms the JIT emits. Registers by number, rax = 0 to r15 = 15, rsp, rbp,
+// r12 and r13 are never used as a base so every memory operand fits the short forms.
+class X86Emitter {
+public:
+  enum Reg { rax = 0, rcx = 1, rdx = 2, rsi = 6, rdi = 7, r8 = 8, r9 = 9, r10 = 10, r11 = 11 };
+
+  std::vector<uint8_t> code;
+
+  // op reg, rm or op rm, reg depending on the opcode, both registers
+  void op_rr(const bool wide, const std::vector<uint8_t>& opcode, const int reg, const int rm)
+  {
+    rex(wide, reg, 0, rm);
+    code.insert(code.end(), opcode.begin(), opcode.end());
+    code.push_back(0xC0 | (reg & 7) << 3 | (rm & 7));
+  }
+
+  // 32-bit load or store (opcode 8B or 89) of reg at [base + index * 4 + disp]
+  void op_index4(const uint8_t opcode, const int reg, const int base, const int index, const int8_t disp = 0)
+  {
+    rex(false, reg, index, base);
+    code.push_back(opcode);
+    code.push_back((disp ? 0x40 : 0) | (reg & 7) << 3 | 4);
+    code.push_back(0x80 | (index & 7) << 3 | (base & 7));
+    if (disp) {
+      code.push_back(uint8_t(disp));
+    }
+  }
+
+  // 32-bit lea dst, [base + disp]
+  void lea_disp(const int dst, const int base, const uint32_t disp)
+  {
+    rex(false, dst, 0, base);
+    code.push_back(0x8D);
+    code.push_back(0x80 | (dst & 7) << 3 | (base & 7));
+    imm32(disp);
+  }
+
+  // 32-bit lea dst, [base + index]
+  void lea_sum(const int dst, const int base, const int index)
+  {
+    rex(false, dst, index, base);
+    code.push_back(0x8D);
+    code.push_back((dst & 7) << 3 | 4);
+    code.push_back((index & 7) << 3 | (base & 7));
+  }
+
+  // /ext group opcodes with an immediate: 81 /0 add, 81 /4 and, 81 /7 cmp, C1 /4 shl, C1 /5 shr
+  void op_imm(const bool wide, const uint8_t opcode, const int ext, const int rm, const uint32_t imm, const bool imm8)
+  {
+    rex(wide, 0, 0, rm);
+    code.push_back(opcode);
+    code.push_back(0xC0 | ext << 3 | (rm & 7));
+    if (imm8) {
+      code.push_back(uint8_t(imm));
+    } else {
+      imm32(imm);
+    }
+  }
+
+  // imul dst, src, imm32, the immediate sign-extended when wide
+  void imul_imm(const bool wide, const int dst, const int src, const uint32_t imm)
+  {
+    op_rr(wide, {0x69}, dst, src);
+    imm32(imm);
+  }
+
+  void mov_imm(const bool wide, const int dst, const uint64_t imm)
+  {
+    rex(wide, 0, 0, dst);
+    code.push_back(0xB8 | (dst & 7));
+    imm32(uint32_t(imm));
+    if (wide) {
+      imm32(uint32_t(imm >> 32));
+    }
+  }
+
+  // Jumps with a 32-bit displacement, patched by bind() when the target comes later
+  size_t jump(const std::vector<uint8_t>& opcode, const size_t target = 0)
+  {
+    code.insert(code.end(), opcode.begin(), opcode.end());
+    imm32(uint32_t(target - (code.size() + 4)));
+    return code.size() - 4;
+  }
+
+  void bind(const size_t displacement)
+  {
+    const uint32_t rel = uint32_t(code.size() - (displacement + 4));
+    for (size_t i = 0; i < 4; ++i) {
+      code[displacement + i] = uint8_t(rel >> (8 * i));
+    }
+  }
+
+  void imm32(const uint32_t v)
+  {
+    for (size_t i = 0; i < 4; ++i) {
+      code.push_back(uint8_t(v >> (8 * i)));
+    }
+  }
+
+private:
+  void rex(const bool wide, const int reg, const int index, const int base)
+  {
+    const uint8_t prefix = 0x40 | wide << 3 | (reg >= 8) << 2 | (index >= 8) << 1 | (base >= 8);
+    if (prefix != 0x40) {
+      code.push_back(prefix);
+    }
+  }
+};
+
+// Read-execute pages holding the code of one MontJit, mapped writable only while it is copied in
+class JitPages {
+public:
+  JitPages(const std::vector<uint8_t>& code)
+  {
+#if defined(__unix__)
+    size = (code.size() + 4095) / 4096 * 4096;
+    void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+      throw std::runtime_error("Could not map memory for generated code.");
+    }
+    std::copy(code.begin(), code.end(), static_cast<uint8_t*>(mem));
+    if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+      munmap(mem, size);
+      throw std::runtime_error("Could not make generated code executable.");
+    }
+    base = static_cast<uint8_t*>(mem);
+#else
+    static_cast<void>(code);
+    throw std::runtime_error("Generated code is not supported on this platform.");
+#endif
+  }
+
+  ~JitPages()
+  {
+#if defined(__unix__)
+    munmap(base, size);
+#endif
+  }
+
+  JitPages(const JitPages&) = delete;
+  JitPages& operator=(const JitPages&) = delete;
+
+  const uint8_t* at(const size_t offset) const
+  {
+    return base + offset;
+  }
+
+private:
+  uint8_t* base = nullptr;
+  size_t size = 0;
+};
+
+/// @brief multiply_batch and ntt_dif compiled at runtime for one modulus
+/// The vector kernels broadcast n, n_inv_mod and the shift into registers once per call, so only scalar loops gain
+/// from baking them in: that is the portable table, which is the only one for n >= 2^31. The emitted REDC is
+/// Montgomery::REDC with n, n^-1 mod R, R - 1 and the shift as immediates, plus shortcuts the constants allow: no
+/// mask for R = 2^32, a shift and add instead of imul when n or n^-1 mod R is 2^k + 1, and a 64-bit immediate
+/// load for n >= 2^31. Kernels are cached by modulus for the life of the process, one page each. Where code cannot
+/// be generated (not x86-64, no executable mappings) every call falls back to the kernel table of mont.
+class MontJit {
+public:
+  MontJit(Montgomery& _mont) : mont(_mont)
+  {
+    code = compiled_for(mont);
+  }
+
+  void multiply_batch(const uint32_t* a, const uint32_t* b, uint32_t* out, const size_t len)
+  {
+    if (code) {
+      reinterpret_cast<void (*)(const uint32_t*, const uint32_t*, uint32_t*, size_t)>(code->at(0))(a, b, out, len);
+    } else {
+      mont.multiply_batch(a, b, out, len);
+    }
+  }
+
+  // Same butterflies as the ntt_dif kernels: x, y = x + y, (x - y) w
+  void ntt_dif(uint32_t* x, uint32_t* y, const uint32_t* w, const size_t len)
+  {
+    if (code) {
+      reinterpret_cast<void (*)(uint32_t*, uint32_t*, const uint32_t*, size_t)>(code->at(ntt_dif_offset))(x, y, w,
+                                                                                                         len);
+    } else {
+      mont.batch_kernels().ntt_dif(mont, x, y, w, len);
+    }
+  }
+
+  bool compiled() const
+  {
+    return code != nullptr;
+  }
+
+private:
+  static constexpr size_t ntt_dif_offset = 2048;
+
+  static std::shared_ptr<const JitPages> compiled_for(Montgomery& mont)
+  {
+#if defined(__x86_64__)
+    static std::mutex lock;
+    static std::unordered_map<uint32_t, std::shared_ptr<const JitPages>> cache;
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = cache.find(mont.modulus());
+    if (it == cache.end()) {
+      std::shared_ptr<const JitPages> pages;
+      try {
+        pages = std::make_shared<const JitPages>(generate(mont.params()));
+      } catch (const std::runtime_error&) {
+        // Cached as well, a platform that refused once refuses again
+      }
+      it = cache.emplace(mont.modulus(), pages).first;
+    }
+    return it->second;
+#else
+    static_cast<void>(mont);
+    return nullptr;
+#endif
+  }
+
+  static bool is_power_of_two_plus_one(const uint64_t c, uint32_t& k)
+  {
+    k = c > 2 ? __builtin_ctzll(c - 1) : 0;
+    return c > 2 && c - 1 == uint64_t(1) << k;
+  }
+
+  // dst = src * c, clobbers tmp
+  static void multiply_const(X86Emitter& e, const bool wide, const int dst, const int src, const uint64_t c,
+                             const int tmp)
+  {
+    uint32_t k = 0;
+    if (is_power_of_two_plus_one(c, k)) {
+      e.op_rr(wide, {0x89}, src, tmp);
+      e.op_imm(wide, 0xC1, 4, tmp, k, true);
+      if (dst != src) {
+        e.op_rr(wide, {0x89}, src, dst);
+      }
+      e.op_rr(wide, {0x01}, tmp, dst);
+    } else if (!wide || c <= INT32_MAX) {
+      e.imul_imm(wide, dst, src, uint32_t(c));
+    } else {
+      e.mov_imm(true, tmp, c);
+      if (dst != src) {
+        e.op_rr(true, {0x89}, src, dst);
+      }
+      e.op_rr(true, {0x0F, 0xAF}, dst, tmp);
+    }
+  }
+
+  // r11d = REDC(rax), clobbers r9 and r10
+  static void emit_redc(X86Emitter& e, const MontParams& p)
+  {
+    using R = X86Emitter;
+    const uint32_t n_inv_pos = (p.r_bit_len == 32 ? 0 : uint32_t(1) << p.r_bit_len) - p.n_inv_mod;
+    multiply_const(e, false, R::r10, R::rax, n_inv_pos, R::r9);
+    if (p.r_bit_len < 32) {
+      e.op_imm(false, 0x81, 4, R::r10, p.r_mask, false);
+    }
+    multiply_const(e, true, R::r10, R::r10, p.n, R::r9);
+    e.op_rr(true, {0x89}, R::rax, R::r11);
+    e.op_rr(true, {0x29}, R::r10, R::r11);
+    e.op_imm(true, 0xC1, 5, R::r11, p.r_bit_len, true);
+    e.lea_disp(R::r9, R::r11, p.n);
+    e.op_rr(true, {0x39}, R::r10, R::rax);
+    e.op_rr(false, {0x0F, 0x42}, R::r11, R::r9);
+  }
+
+  // One element at [r8 + offset], the butterfly one as Montgomery::add, sub and multiply
+  static void emit_element(X86Emitter& e, const MontParams& p, const bool butterfly, const int8_t offset)
+  {
+    using R = X86Emitter;
+    e.op_index4(0x8B, R::rax, R::rdi, R::r8, offset);
+    e.op_index4(0x8B, R::r9, R::rsi, R::r8, offset);
+    if (!butterfly) {
+      e.op_rr(true, {0x0F, 0xAF}, R::rax, R::r9);
+      emit_redc(e, p);
+      e.op_index4(0x89, R::r11, R::rdx, R::r8, offset);
+      return;
+    }
+    // x = u - (n - v), or u + v when that borrows
+    e.mov_imm(false, R::r10, p.n);
+    e.op_rr(false, {0x29}, R::r9, R::r10);
+    e.op_rr(false, {0x89}, R::rax, R::r11);
+    e.op_rr(false, {0x29}, R::r10, R::r11);
+    e.lea_sum(R::r10, R::rax, R::r9);
+    e.op_rr(false, {0x0F, 0x42}, R::r11, R::r10);
+    e.op_index4(0x89, R::r11, R::rdi, R::r8, offset);
+    // y = (u - v, plus n when that borrows) w
+    e.op_rr(false, {0x89}, R::rax, R::r10);
+    e.op_rr(false, {0x29}, R::r9, R::r10);
+    e.lea_disp(R::r11, R::r10, p.n);
+    e.op_rr(false, {0x0F, 0x42}, R::r10, R::r11);
+    e.op_index4(0x8B, R::r9, R::rdx, R::r8, offset);
+    e.op_rr(true, {0x0F, 0xAF}, R::r10, R::r9);
+    e.op_rr(true, {0x89}, R::r10, R::rax);
+    emit_redc(e, p);
+    e.op_index4(0x89, R::r11, R::rsi, R::r8, offset);
+  }
+
+  // Both loops take their arguments in rdi, rsi, rdx, rcx and keep the index in r8. Four elements per iteration
+  // while they last, then one at a time.
+  static std::vector<uint8_t> generate(const MontParams& p)
+  {
+    using R = X86Emitter;
+    X86Emitter e;
+    for (const bool butterfly : {false, true}) {
+      if (butterfly) {
+        // Padding must not cut into the multiply loop, compiled_for() then falls back to the kernel table
+        if (e.code.size() > ntt_dif_offset) {
+          std::cout << "size=" << e.code.size() << ", ntt_dif_offset=" << ntt_dif_offset << "\n";
+          throw std::runtime_error("Generated multiply_batch does not fit before ntt_dif.");
+        }
+        e.code.resize(ntt_dif_offset, 0xCC);
+      }
+      e.op_rr(false, {0x31}, R::r8, R::r8);
+      // while (r8 + 4 <= rcx)
+      const size_t unrolled = e.code.size();
+      e.op_rr(true, {0x89}, R::r8, R::r9);
+      e.op_imm(true, 0x81, 0, R::r9, 4, false);
+      e.op_rr(true, {0x39}, R::rcx, R::r9);
+      const size_t to_tail = e.jump({0x0F, 0x87});
+      for (int8_t offset = 0; offset < 16; offset += 4) {
+        emit_element(e, p, butterfly, offset);
+      }
+      e.op_imm(true, 0x81, 0, R::r8, 4, false);
+      e.jump({0xE9}, unrolled);
+      // while (r8 < rcx)
+      e.bind(to_tail);
+      const size_t tail = e.code.size();
+      e.op_rr(true, {0x39}, R::rcx, R::r8);
+      const size_t to_done = e.jump({0x0F, 0x83});
+      emit_element(e, p, butterfly, 0);
+      e.op_rr(true, {0xFF}, 0, R::r8);
+      e.jump({0xE9}, tail);
+      e.bind(to_done);
+      e.code.push_back(0xC3);
+    }
+    return e.code;
+  }
+
+  Montgomery& mont;
+  std::shared_ptr<const JitPages> code;
+};
+
+// Every modulus class the emitter special-cases, against the portable kernels
+void test_mont_jit(std::mt19937& gen)
+{
+  const std::vector<uint32_t> moduli = {3,          5,          17,         257,        65537,      998244353,
+                                        2013265921, INT32_MAX,  2147483649, 3221225473, 4294967291, UINT32_MAX};
+  for (const uint32_t n : moduli) {
+    Montgomery mont(n);
+    MontJit jit(mont);
+    std::uniform_int_distribution<uint32_t> distr(0, n - 1);
+    const size_t len = 1000 + 37;
+    MontVector a(len), b(len), w(len);
+    for (size_t i = 0; i < len; ++i) {
+      a[i] = distr(gen);
+      b[i] = distr(gen);
+      w[i] = distr(gen);
+    }
+    a[0] = b[0] = w[0] = n - 1;
+    a[1] = b[2] = 0;
+    MontVector expected(len), out(len);
+    multiply_batch_portable(mont, a.data(), b.data(), expected.data(), len);
+    jit.multiply_batch(a.data(), b.data(), out.data(), len);
+    bool ok = out == expected;
+    MontVector x = a, y = b, expected_x = a, expected_y = b;
+    ntt_dif_portable(mont, expected_x.data(), expected_y.data(), w.data(), len);
+    jit.ntt_dif(x.data(), y.data(), w.data(), len);
+    ok = ok && x == expected_x && y == expected_y;
+    // Empty calls return at once, a second instance takes the cached code
+    jit.multiply_batch(a.data(), b.data(), nullptr, 0);
+    MontJit cached(mont);
+    cached.multiply_batch(a.data(), b.data(), out.data(), len);
+    ok = ok && out == expected && cached.compiled() == jit.compiled();
+    if (!ok) {
+      std::cout << "n=" << n << ", compiled=" << jit.compiled() << "\n";
+      throw std::runtime_error("MontJit test failed.");
+    }
+  }
+}
+
+// Generated code against the generic scalar loop it replaces, and the vector kernels for scale. Best of 5, the
+// difference is small next to run-to-run noise.
+void bench_mont_jit(std::mt19937& gen)
+{
+  const size_t len = size_t(1) << 14;
+  const size_t reps = 1000;
+  for (const uint32_t n : {uint32_t(65537), uint32_t(2013265921), uint32_t(4294967291)}) {
+    Montgomery mont(n);
+    MontJit jit(mont);
+    std::uniform_int_distribution<uint32_t> distr(0, n - 1);
+    MontVector a(len), b(len), out(len);
+    for (size_t i = 0; i < len; ++i) {
+      a[i] = distr(gen);
+      b[i] = distr(gen);
+    }
+    const auto mops = [&](const auto& fn) {
+      return len * reps / best_ms([&]() {
+        for (size_t r = 0; r < reps; ++r) {
+          fn();
+        }
+      }, 5) / 1000;
+    };
+    std::cout << "n=" << n << ", portable multiply_batch_mops="
+              << mops([&]() { multiply_batch_portable(mont, a.data(), b.data(), out.data(), len); })
+              << ", jit multiply_batch_mops="
+              << mops([&]() { jit.multiply_batch(a.data(), b.data(), out.data(), len); })
+              << ", portable butterfly_mops="
+              << mops([&]() { ntt_dif_portable(mont, a.data(), b.data(), out.data(), len); })
+              << ", jit butterfly_mops=" << mops([&]() { jit.ntt_dif(a.data(), b.data(), out.data(), len); }) << ", "
+              << mont.batch_kernels().isa << " multiply_batch_mops="
+              << mops([&]() { mont.multiply_batch(a.data(), b.data(), out.data(), len); })
+              << (jit.compiled() ? "" : " (not compiled)") << "\n";
+  }
+}
+
+// Shapes of modulus that admit a cheaper reduction than Montgomery::REDC, see classify_modulus()
+enum class ModulusForm { generic, montgomery_friendly, pseudo_mersenne, solinas, mersenne };
+
+const char* modulus_form_name(const ModulusForm form)
+{
+  switch (form) {
+  case ModulusForm::montgomery_friendly:
+    return "montgomery_friendly";
+  case ModulusForm::pseudo_mersenne:
+    return "pseudo_mersenne";
+  case ModulusForm::solinas:
+    return "solinas";
+  case ModulusForm::mersenne:
+    return "mersenne";
+  default:
+    return "generic";
+  }
+}
+
+// With k = bit_length(n) and n = 2^k - c: Mersenne for c = 1, Solinas for c = 2^j +- 1 (n = 2^k - 2^j -+ 1),
+// pseudo-Mersenne for other c, as long as c (c + 2) <= 2^k so that two folds and one subtraction reduce a product.
+// Otherwise Montgomery-friendly when n = -1 mod 2^w with 2w > bit_length(n), else generic. Forms 2^k + c are not
+// handled, folding them goes through signed intermediates.
+ModulusForm classify_modulus(const uint32_t n)
+{
+  const uint32_t k = bit_length(n);
+  const uint64_t c = (uint64_t(1) << k) - n;
+  if (n >= 3 && n % 2 == 1 && c * (c + 2) <= (uint64_t(1) << k)) {
+    if (c == 1) {
+      return ModulusForm::mersenne;
+    }
+    if (__builtin_popcountll(c - 1) == 1 || __builtin_popcountll(c + 1) == 1) {
+      return ModulusForm::solinas;
+    }
+    return ModulusForm::pseudo_mersenne;
+  }
+  const uint32_t w = __builtin_ctz(~n);
+  if (n >= 3 && 2 * w > k) {
+    return ModulusForm::montgomery_friendly;
+  }
+  return ModulusForm::generic;
+}
+
+// Constants of a FoldReduction, c = 2^j + 1 or 2^j - 1 in the Solinas form, c_neg all ones for the latter
+struct FoldParams {
+  uint32_t n;
+  uint32_t k;
+  uint64_t mask;
+  uint64_t c;
+  uint32_t j;
+  uint64_t c_neg;
+};
+
+template <ModulusForm form>
+uint64_t fold_times_c(const FoldParams& p, const uint64_t h)
+{
+  if constexpr (form == ModulusForm::mersenne) {
+    return h;
+  } else if constexpr (form == ModulusForm::solinas) {
+    return (h << p.j) + ((h ^ p.c_neg) - p.c_neg);
+  } else {
+    return h * p.c;
+  }
+}
+
+// x < n^2: the first fold stays below (c + 1) 2^k, the second below n + c (c + 1) <= 2n
+template <ModulusForm form>
+uint32_t fold_reduce(const FoldParams& p, const uint64_t x)
+{
+  uint64_t t = fold_times_c<form>(p, x >> p.k) + (x & p.mask);
+  t = fold_times_c<form>(p, t >> p.k) + (t & p.mask);
+  return t >= p.n ? t - p.n : t;
+}
+
+template <ModulusForm form>
+void fold_multiply_batch_portable(const FoldParams& p, const uint32_t* a, const uint32_t* b, uint32_t* out,
+                                  const size_t len)
+{
+  for (size_t i = 0; i < len; ++i) {
+    out[i] = fold_reduce<form>(p, static_cast<uint64_t>(a[i]) * b[i]);
+  }
+}
+
+#if defined(__x86_64__)
+// The folds on 4 products in 64-bit lanes. Values stay below 2^63, so signed compares are exact.
+template <ModulusForm form>
+__attribute__((target("avx2")))
+inline __m256i fold_reduce_avx2(const FoldParams& p, const __m256i x)
+{
+  const __m128i k = _mm_cvtsi32_si128(p.k);
+  const __m256i mask = _mm256_set1_epi64x(p.mask);
+  const __m256i n = _mm256_set1_epi64x(p.n);
+  __m256i t = x;
+  for (int fold = 0; fold < 2; ++fold) {
+    const __m256i h = _mm256_srl_epi64(t, k);
+    // One vpmuludq beats the Solinas shift, xor and two adds in vector registers
+    const __m256i hc = form == ModulusForm::mersenne ? h : _mm256_mul_epu32(h, _mm256_set1_epi64x(p.c));
+    t = _mm256_add_epi64(hc, _mm256_and_si256(t, mask));
+  }
+  const __m256i below = _mm256_cmpgt_epi64(n, t);
+  return _mm256_blendv_epi8(_mm256_sub_epi64(t, n), t, below);
+}
+
+template <ModulusForm form>
+__attribute__((target("avx2")))
+void fold_multiply_batch_avx2(const FoldParams& p, const uint32_t* a, const uint32_t* b, uint32_t* out,
+                              const size_t len)
+{
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+    const __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+    const __m256i even = fold_reduce_avx2<form>(p, _mm256_mul_epu32(x, y));
+    const __m256i odd =
+        fold_reduce_avx2<form>(p, _mm256_mul_epu32(_mm256_srli_epi64(x, 32), _mm256_srli_epi64(y, 32)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i),
+                        _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA));
+  }
+  fold_multiply_batch_portable<form>(p, a + i, b + i, out + i, len - i);
+}
+
+template <ModulusForm form>
+__attribute__((target("avx512f")))
+inline __m512i fold_reduce_avx512(const FoldParams& p, const __m512i x)
+{
+  const __m128i k = _mm_cvtsi32_si128(p.k);
+  const __m512i mask = _mm512_set1_epi64(p.mask);
+  __m512i t = x;
+  for (int fold = 0; fold < 2; ++fold) {
+    const __m512i h = _mm512_maskz_srl_epi64(0xFF, t, k);
+    const __m512i hc = form == ModulusForm::mersenne ? h : _mm512_maskz_mul_epu32(0xFF, h, _mm512_set1_epi64(p.c));
+    t = _mm512_add_epi64(hc, _mm512_and_si512(t, mask));
+  }
+  // t - n wraps above t exactly when t < n
+  return _mm512_maskz_min_epu64(0xFF, t, _mm512_sub_epi64(t, _mm512_set1_epi64(p.n)));
+}
+
+template <ModulusForm form>
+__attribute__((target("avx512f")))
+void fold_multiply_batch_avx512(const FoldParams& p, const uint32_t* a, const uint32_t* b, uint32_t* out,
+                                const size_t len)
+{
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    const __m512i x = _mm512_loadu_si512(a + i);
+    const __m512i y = _mm512_loadu_si512(b + i);
+    const __m512i even = fold_reduce_avx512<form>(p, _mm512_maskz_mul_epu32(0xFF, x, y));
+    const __m512i odd = fold_reduce_avx512<form>(
+        p, _mm512_maskz_mul_epu32(0xFF, _mm512_maskz_srli_epi64(0xFF, x, 32), _mm512_maskz_srli_epi64(0xFF, y, 32)));
+    _mm512_storeu_si512(out + i, _mm512_mask_blend_epi32(0xAAAA, even, _mm512_maskz_slli_epi64(0xFF, odd, 32)));
+  }
+  fold_multiply_batch_portable<form>(p, a + i, b + i, out + i, len - i);
+}
+#endif
+
+/// @brief Reduction by folding 2^k = c mod n for n = 2^k - c, residues kept as plain values (no Montgomery form)
+/// A product x < n^2 becomes (x >> k) c + (x mod 2^k) twice, then one conditional subtraction. The multiply by c
+/// is a shift and an add or subtract in the Solinas form and disappears for Mersenne moduli. The batch kernel
+/// follows the instruction set picked for Montgomery.
+template <ModulusForm form>
+class FoldReduction {
+public:
+  FoldReduction(const uint32_t n)
+  {
+    if (classify_modulus(n) != form) {
+      std::cout << "n=" << n << ", form=" << modulus_form_name(form) << "\n";
+      throw std::invalid_argument("Modulus does not have the requested form.");
+    }
+    p.n = n;
+    p.k = bit_length(n);
+    p.mask = (uint64_t(1) << p.k) - 1;
+    p.c = (uint64_t(1) << p.k) - n;
+    p.j = 0;
+    p.c_neg = 0;
+    if (__builtin_popcountll(p.c - 1) == 1) {
+      p.j = __builtin_ctzll(p.c - 1);
+    } else if (__builtin_popcountll(p.c + 1) == 1) {
+      p.j = __builtin_ctzll(p.c + 1);
+      p.c_neg = UINT64_MAX;
+    }
+#if defined(__x86_64__)
+    const std::string isa = montgomery_kernels().isa;
+    batch = isa == "avx512" ? fold_multiply_batch_avx512<form>
+            : isa == "avx2" ? fold_multiply_batch_avx2<form>
+                            : fold_multiply_batch_portable<form>;
+#else
+    batch = fold_multiply_batch_portable<form>;
+#endif
+  }
+
+  uint32_t convert_in(const uint32_t x)
+  {
+    return x % p.n;
+  }
+
+  uint32_t convert_out(const uint32_t x)
+  {
+    return x;
+  }
+
+  uint32_t multiply(const uint32_t a, const uint32_t b)
+  {
+    return fold_reduce<form>(p, static_cast<uint64_t>(a) * b);
+  }
+
+  void multiply_batch(const uint32_t* a, const uint32_t* b, uint32_t* out, const size_t len)
+  {
+    batch(p, a, b, out, len);
+  }
+
+  uint32_t add(const uint32_t a, const uint32_t b)
+  {
+    const uint32_t t = p.n - b;
+    return a >= t ? a - t : a + b;
+  }
+
+  uint32_t sub(const uint32_t a, const uint32_t b)
+  {
+    return a >= b ? a - b : a + (p.n - b);
+  }
+
+  uint32_t one()
+  {
+    return 1;
+  }
+
+  uint32_t modulus()
+  {
+    return p.n;
+  }
+
+private:
+  FoldParams p;
+  void (*batch)(const FoldParams&, const uint32_t*, const uint32_t*, uint32_t*, size_t);
+};
+
+/// @brief Montgomery reduction for n = -1 mod 2^w, with 2w > bit_length(n) and R = 2^2w
+/// -n^-1 = 1 mod 2^w, so a step's quotient is just the low w bits x_l of x, and with n + 1 = q 2^w the step
+/// (x + x_l n) / 2^w is (x >> w) + x_l q: one multiply by a small q instead of the two of REDC, and no 65-bit
+/// intermediate. Two steps divide by R, the result is below 2n.
+class FriendlyMontgomery {
+public:
+  FriendlyMontgomery(const uint32_t _n) : n(_n)
+  {
+    if (classify_modulus(n) != ModulusForm::montgomery_friendly) {
+      std::cout << "n=" << n << "\n";
+      throw std::invalid_argument("Modulus is not Montgomery-friendly.");
+    }
+    w = __builtin_ctz(~n);
+    w_mask = (uint64_t(1) << w) - 1;
+    q = (uint64_t(n) + 1) >> w;
+    // R mod n and R^2 mod n by doubling, R = 2^2w can be 2^64
+    uint64_t r = 1;
+    for (uint32_t i = 0; i < 2 * w; ++i) {
+      r = (2 * r) % n;
+    }
+    r_mod_n = r;
+    r2_mod_n = (r * r) % n;
+  }
+
+  uint32_t convert_in(const uint32_t x)
+  {
+    return REDC(static_cast<uint64_t>(x % n) * r2_mod_n);
+  }
+
+  uint32_t convert_out(const uint32_t x)
+  {
+    return REDC(x);
+  }
+
+  uint32_t multiply(const uint32_t a, const uint32_t b)
+  {
+    return REDC(static_cast<uint64_t>(a) * b);
+  }
+
+  void multiply_batch(const uint32_t* a, const uint32_t* b, uint32_t* out, const size_t len)
+  {
+    for (size_t i = 0; i < len; ++i) {
+      out[i] = multiply(a[i], b[i]);
+    }
+  }
+
+  uint32_t add(const uint32_t a, const uint32_t b)
+  {
+    const uint32_t t = n - b;
+    return a >= t ? a - t : a + b;
+  }
+
+  uint32_t sub(const uint32_t a, const uint32_t b)
+  {
+    return a >= b ? a - b : a + (n - b);
+  }
+
+  uint32_t one()
+  {
+    return r_mod_n;
+  }
+
+  uint32_t modulus()
+  {
+    return n;
+  }
+
+  // x R^-1 mod n for x < n^2: the first step leaves at most n^2 / 2^w + n, the second less than 2n
+  uint32_t REDC(const uint64_t x)
+  {
+    const uint64_t x1 = (x >> w) + (x & w_mask) * q;
+    const uint64_t x2 = (x1 >> w) + (x1 & w_mask) * q;
+    return x2 >= n ? x2 - n : x2;
+  }
+
+private:
+  uint32_t n;
+  uint32_t w;
+  uint64_t w_mask;
+  uint64_t q;
+  uint32_t r_mod_n;
+  uint32_t r2_mod_n;
+};
+
+// The reduction with_modulus() uses for n, as measured by bench_special_moduli(). Mersenne folds win dependent chains
+// by about 40% and stay within 15% of REDC in vector kernels. Solinas and pseudo-Mersenne folds lose about 10% to
+// REDC on chains and tie in vector kernels, but above 2^31 they keep vector kernels where Montgomery only has the
+// portable table, two to three times faster in batches. The Montgomery-friendly steps never beat REDC with a single
+// word: the multiply they save comes back as a second dependent step.
+ModulusForm fastest_reduction(const uint32_t n)
+{
+  const ModulusForm form = classify_modulus(n);
+  if (form == ModulusForm::mersenne) {
+    return form;
+  }
+  if ((form == ModulusForm::solinas || form == ModulusForm::pseudo_mersenne) && n > INT32_MAX) {
+    return form;
+  }
+  return ModulusForm::generic;
+}
+
+// Runs fn on a context for n backed by the given reduction, which must be generic or classify_modulus(n). All of
+// them share the convert_in / convert_out / multiply / multiply_batch / add / sub / one interface, and fn is
+// instantiated once per reduction so the choice costs nothing per product.
+template <typename F>
+void with_reduction(const uint32_t n, const ModulusForm form, F fn)
+{
+  switch (form) {
+  case ModulusForm::mersenne: {
+    FoldReduction<ModulusForm::mersenne> ctx(n);
+    fn(ctx);
+    break;
+  }
+  case ModulusForm::solinas: {
+    FoldReduction<ModulusForm::solinas> ctx(n);
+    fn(ctx);
+    break;
+  }
+  case ModulusForm::pseudo_mersenne: {
+    FoldReduction<ModulusForm::pseudo_mersenne> ctx(n);
+    fn(ctx);
+    break;
+  }
+  case ModulusForm::montgomery_friendly: {
+    FriendlyMontgomery ctx(n);
+    fn(ctx);
+    break;
+  }
+  default: {
+    Montgomery ctx(n);
+    fn(ctx);
+    break;
+  }
+  }
+}
+
+// fn on the cheapest context for n
+template <typename F>
+void with_modulus(const uint32_t n, F fn)
+{
+  with_reduction(n, fastest_reduction(n), fn);
+}
+
+// Every form against % on products of random residues, including the 32-bit edge of each
+void test_special_moduli(std::mt19937& gen)
+{
+  const std::vector<std::pair<uint32_t, ModulusForm>> known = {
+      {7, ModulusForm::mersenne},
+      {INT32_MAX, ModulusForm::mersenne},
+      {UINT32_MAX, ModulusForm::mersenne},
+      {4294967291, ModulusForm::solinas},          // 2^32 - 2^2 - 1
+      {4294967265, ModulusForm::solinas},          // 2^32 - 2^5 + 1
+      {2147483629, ModulusForm::pseudo_mersenne},  // 2^31 - 19
+      {4294967197, ModulusForm::pseudo_mersenne},  // 2^32 - 99
+      {2147418111, ModulusForm::montgomery_friendly},  // 2^31 - 2^16 - 1
+      {3221225471, ModulusForm::montgomery_friendly},  // 3 2^30 - 1
+      {998244353, ModulusForm::generic},
+      {2013265921, ModulusForm::generic},
+  };
+  std::vector<uint32_t> moduli;
+  for (const auto& [n, form] : known) {
+    if (classify_modulus(n) != form) {
+      std::cout << "n=" << n << ", form=" << modulus_form_name(classify_modulus(n)) << "\n";
+      throw std::runtime_error("Modulus classification test failed.");
+    }
+    moduli.push_back(n);
+  }
+  // And random odd moduli of every size, most of the small ones land in some special form
+  for (uint32_t bits = 2; bits <= 32; ++bits) {
+    std::uniform_int_distribution<uint32_t> distr_n(uint32_t(1) << (bits - 1), uint32_t((uint64_t(1) << bits) - 1));
+    for (size_t i = 0; i < 4; ++i) {
+      moduli.push_back(distr_n(gen) | 1);
+    }
+  }
+  for (const uint32_t n : moduli) {
+    if (n < 3) {
+      continue;
+    }
+    const auto check = [&](auto& ctx) {
+      std::uniform_int_distribution<uint32_t> distr(0, n - 1);
+      for (size_t i = 0; i < 200; ++i) {
+        const uint32_t a = i == 0 ? n - 1 : distr(gen);
+        const uint32_t b = i == 0 ? n - 1 : distr(gen);
+        const uint32_t a_ = ctx.convert_in(a), b_ = ctx.convert_in(b);
+        const bool ok = ctx.convert_out(ctx.multiply(a_, b_)) == static_cast<uint64_t>(a) * b % n &&
+                        ctx.convert_out(ctx.add(a_, b_)) == (static_cast<uint64_t>(a) + b) % n &&
+                        ctx.convert_out(ctx.sub(a_, b_)) == (static_cast<uint64_t>(a) + n - b) % n &&
+                        ctx.convert_out(ctx.one()) == 1;
+        if (!ok) {
+          std::cout << "n=" << n << ", form=" << modulus_form_name(classify_modulus(n)) << ", a=" << a
+                    << ", b=" << b << "\n";
+          throw std::runtime_error("Special modulus reduction test failed.");
+        }
+      }
+      MontVector a(37), b(37), expected(37), out(37);
+      for (size_t i = 0; i < 37; ++i) {
+        a[i] = ctx.convert_in(distr(gen));
+        b[i] = ctx.convert_in(distr(gen));
+        expected[i] = ctx.multiply(a[i], b[i]);
+      }
+      ctx.multiply_batch(a.data(), b.data(), out.data(), 37);
+      if (out != expected) {
+        std::cout << "n=" << n << ", form=" << modulus_form_name(classify_modulus(n)) << "\n";
+        throw std::runtime_error("Special modulus batch test failed.");
+      }
+    };
+    with_reduction(n, classify_modulus(n), check);
+    with_modulus(n, check);
+  }
+}
+
+// Each form's reduction against generic Montgomery on the same modulus, scalar loops on both sides
+void bench_special_moduli(std::mt19937& gen)
+{
+  const size_t len = size_t(1) << 14;
+  const size_t reps = 1000;
+  // One of each form on both sides of 2^31, where the generic vector kernels stop
+  const std::vector<uint32_t> moduli = {INT32_MAX,  UINT32_MAX, 2147483641, 4294967291, 2147483629,
+                                        4294967197, 2147418111, 3221225471, 998244353};
+  for (const uint32_t n : moduli) {
+    std::uniform_int_distribution<uint32_t> distr(0, n - 1);
+    MontVector a(len), b(len), out(len);
+    for (size_t i = 0; i < len; ++i) {
+      a[i] = distr(gen);
+      b[i] = distr(gen);
+    }
+    // A dependent chain as well, latency is where the reductions differ most
+    const auto mops = [&](auto& ctx) {
+      const double batch = len * reps / best_ms([&]() {
+        for (size_t r = 0; r < reps; ++r) {
+          ctx.multiply_batch(a.data(), b.data(), out.data(), len);
+        }
+      }, 5) / 1000;
+      uint32_t x = a[0];
+      const double chain = len * reps / best_ms([&]() {
+        for (size_t r = 0; r < len * reps; ++r) {
+          x = ctx.multiply(x, b[r % len]);
+        }
+      }, 5) / 1000;
+      return std::make_pair(batch, chain + (x == n ? 1 : 0));
+    };
+    Montgomery generic(n);
+    const auto [generic_batch, generic_chain] = mops(generic);
+    with_reduction(n, classify_modulus(n), [&](auto& ctx) {
+      const auto [batch, chain] = mops(ctx);
+      std::cout << "n=" << n << ", form=" << modulus_form_name(classify_modulus(n)) << ", multiply_batch_mops=" << batch
+                << ", chain_mops=" << chain << ", generic multiply_batch_mops=" << generic_batch
+                << ", generic chain_mops=" << generic_chain
+                << ", picked=" << modulus_form_name(fastest_reduction(n)) << "\n";
+    });
+  }
+}
+
+// Extension tower over Fp for p = 7 mod 12, every coefficient in Montgomery form:
+// Fp2 = Fp[u] / (u^2 + 1), Fp6 = Fp2[v] / (v^3 - xi), Fp12 = Fp6[w] / (w^2 - v), xi = xi0 + u
+struct Fp2 {
+  uint32_t c0;
+  uint32_t c1;
+
+  bool operator==(const Fp2& other) const
+  {
+    return c0 == other.c0 && c1 == other.c1;
+  }
+};
+
+struct Fp6 {
+  Fp2 c0;
+  Fp2 c1;
+  Fp2 c2;
+
+  bool operator==(const Fp6& other) const
+  {
+    return c0 == other.c0 && c1 == other.c1 && c2 == other.c2;
+  }
+};
+
+struct Fp12 {
+  Fp6 c0;
+  Fp6 c1;
+
+  bool operator==(const Fp12& other) const
+  {
+    return c0 == other.c0 && c1 == other.c1;
+  }
+};
+
+// An Fp2 value before reduction, sums of products kept non-negative by adding multiples of p^2
+struct Fp2Wide {
+  uint64_t c0;
+  uint64_t c1;
+};
+
+/// @brief Fp2 / Fp6 / Fp12 arithmetic over a Montgomery base field with lazy reduction
+/// Products are accumulated unreduced in 64 bits and reduced once per output coefficient: Karatsuba Fp2 products
+/// take 3 multiplies and 2 REDCs, Karatsuba Fp6 products 18 multiplies and 6 REDCs, Chung-Hasan Fp6 squares
+/// 10 multiplies and 6 REDCs. REDC takes inputs below p R only, larger sums lose a multiple of p R first (REDC maps
+/// it to 0). The sums must fit in 64 bits, which limits p to about 2^29.8.
+class ExtensionTower {
+public:
+  ExtensionTower(Montgomery& _mont) : mont(_mont)
+  {
+    p = mont.modulus();
+    if (p % 12 != 7) {
+      std::cout << "p=" << p << "\n";
+      throw std::invalid_argument("The tower needs p = 7 mod 12 (u^2 = -1 and sixth roots of unity in Fp).");
+    }
+    p2 = static_cast<uint64_t>(p) * p;
+    pr = static_cast<uint64_t>(p) << mont.params().r_bit_len;
+    pr_inv = UINT64_MAX / pr;
+
+    // xi is neither a square nor a cube in Fp2, so v^3 - xi and w^2 - v are irreducible
+    const uint64_t order = p2 - 1;
+    for (xi0 = 1; xi0 < p; ++xi0) {
+      const Fp2 xi = {mont.convert_in(xi0), mont.one()};
+      if (!(pow(xi, order / 2) == one2()) && !(pow(xi, order / 3) == one2())) {
+        break;
+      }
+    }
+    xi0_mont = mont.convert_in(xi0);
+
+    // Fp6 products reach (3 + 9 (xi0 + 1)) p^2 before their reduction, see multiply(Fp6, Fp6)
+    if (p2 > UINT64_MAX / (3 + 9 * (static_cast<uint64_t>(xi0) + 1))) {
+      std::cout << "p=" << p << ", xi0=" << xi0 << "\n";
+      throw std::invalid_argument("Modulus too large for lazy reduction in the tower.");
+    }
+
+    // Frobenius: v^p = xi^((p - 1) / 3) v and w^p = xi^((p - 1) / 6) w
+    const Fp2 xi = {xi0_mont, mont.one()};
+    gamma_v = pow(xi, (p - 1) / 3);
+    gamma_v2 = square(gamma_v);
+    gamma_w = pow(xi, (p - 1) / 6);
+  }
+
+  Montgomery& base()
+  {
+    return mont;
+  }
+
+  uint32_t nonresidue()
+  {
+    return xi0;
+  }
+
+  Fp2 one2()
+  {
+    return {mont.one(), 0};
+  }
+
+  Fp6 one6()
+  {
+    return {one2(), {0, 0}, {0, 0}};
+  }
+
+  Fp12 one12()
+  {
+    return {one6(), {}};
+  }
+
+  Fp2 add(const Fp2& a, const Fp2& b)
+  {
+    return {mont.add(a.c0, b.c0), mont.add(a.c1, b.c1)};
+  }
+
+  Fp2 sub(const Fp2& a, const Fp2& b)
+  {
+    return {mont.sub(a.c0, b.c0), mont.sub(a.c1, b.c1)};
+  }
+
+  Fp2 negate(const Fp2& a)
+  {
+    return {mont.sub(0, a.c0), mont.sub(0, a.c1)};
+  }
+
+  Fp2 conjugate(const Fp2& a)
+  {
+    return {a.c0, mont.sub(0, a.c1)};
+  }
+
+  Fp2 multiply(const Fp2& a, const Fp2& b)
+  {
+    return reduce(multiply_wide(a, b));
+  }
+
+  Fp2 square(const Fp2& a)
+  {
+    return reduce(square_wide(a));
+  }
+
+  // (a0 + a1 u)^-1 = (a0 - a1 u) / (a0^2 + a1^2), a != 0
+  Fp2 inverse(const Fp2& a)
+  {
+    const uint64_t norm = static_cast<uint64_t>(a.c0) * a.c0 + static_cast<uint64_t>(a.c1) * a.c1;
+    const uint32_t norm_inv = mont.inverse(reduce(norm));
+    return {mont.multiply(a.c0, norm_inv), mont.sub(0, mont.multiply(a.c1, norm_inv))};
+  }
+
+  Fp2 frobenius(const Fp2& a)
+  {
+    return conjugate(a);
+  }
+
+  // (xi0 + u) a
+  Fp2 multiply_by_nonresidue(const Fp2& a)
+  {
+    return {mont.sub(mont.multiply(xi0_mont, a.c0), a.c1), mont.add(mont.multiply(xi0_mont, a.c1), a.c0)};
+  }
+
+  Fp2 pow(Fp2 a, uint64_t e)
+  {
+    Fp2 result = one2();
+    while (e > 0) {
+      if (e & 1) {
+        result = multiply(result, a);
+      }
+      a = square(a);
+      e >>= 1;
+    }
+    return result;
+  }
+
+  Fp6 add(const Fp6& a, const Fp6& b)
+  {
+    return {add(a.c0, b.c0), add(a.c1, b.c1), add(a.c2, b.c2)};
+  }
+
+  Fp6 sub(const Fp6& a, const Fp6& b)
+  {
+    return {sub(a.c0, b.c0), sub(a.c1, b.c1), sub(a.c2, b.c2)};
+  }
+
+  Fp6 negate(const Fp6& a)
+  {
+    return {negate(a.c0), negate(a.c1), negate(a.c2)};
+  }
+
+  // Karatsuba with v0 = a0 b0, v1 = a1 b1, v2 = a2 b2:
+  // c0 = v0 + xi ((a1 + a2)(b1 + b2) - v1 - v2), c1 = (a0 + a1)(b0 + b1) - v0 - v1 + xi v2,
+  // c2 = (a0 + a2)(b0 + b2) - v0 - v2 + v1. Bounds in units of p^2 are noted as the sums build up.
+  Fp6 multiply(const Fp6& a, const Fp6& b)
+  {
+    const Fp2Wide v0 = multiply_wide(a.c0, b.c0); // < 3
+    const Fp2Wide v1 = multiply_wide(a.c1, b.c1);
+    const Fp2Wide v2 = multiply_wide(a.c2, b.c2);
+    const Fp2Wide t0 = sub_wide(sub_wide(multiply_wide(add(a.c1, a.c2), add(b.c1, b.c2)), v1, 3), v2, 3); // < 9
+    const Fp2Wide c0 = add_wide(v0, nonresidue_wide(t0, 9)); // < 3 + 9 (xi0 + 1)
+    const Fp2Wide t1 = sub_wide(sub_wide(multiply_wide(add(a.c0, a.c1), add(b.c0, b.c1)), v0, 3), v1, 3);
+    const Fp2Wide c1 = add_wide(t1, nonresidue_wide(v2, 3)); // < 9 + 3 (xi0 + 1)
+    const Fp2Wide t2 = sub_wide(sub_wide(multiply_wide(add(a.c0, a.c2), add(b.c0, b.c2)), v0, 3), v2, 3);
+    const Fp2Wide c2 = add_wide(t2, v1); // < 12
+    return {reduce(c0), reduce(c1), reduce(c2)};
+  }
+
+  // Chung-Hasan SQR2: s0 = a0^2, s1 = 2 a0 a1, s2 = (a0 - a1 + a2)^2, s3 = 2 a1 a2, s4 = a2^2,
+  // c0 = s0 + xi s3, c1 = s1 + xi s4, c2 = s1 + s2 + s3 - s0 - s4
+  Fp6 square(const Fp6& a)
+  {
+    const Fp2Wide s0 = square_wide(a.c0); // < 1
+    const Fp2Wide s1 = multiply_wide(a.c0, add(a.c1, a.c1)); // < 3
+    const Fp2Wide s2 = square_wide(add(sub(a.c0, a.c1), a.c2));
+    const Fp2Wide s3 = multiply_wide(a.c1, add(a.c2, a.c2));
+    const Fp2Wide s4 = square_wide(a.c2);
+    const Fp2Wide c0 = add_wide(s0, nonresidue_wide(s3, 3)); // < 1 + 3 (xi0 + 1)
+    const Fp2Wide c1 = add_wide(s1, nonresidue_wide(s4, 1)); // < 3 + (xi0 + 1)
+    const Fp2Wide c2 = sub_wide(sub_wide(add_wide(add_wide(s1, s2), s3), s0, 1), s4, 1); // < 9
+    return {reduce(c0), reduce(c1), reduce(c2)};
+  }
+
+  // v a
+  Fp6 multiply_by_nonresidue(const Fp6& a)
+  {
+    return {multiply_by_nonresidue(a.c2), a.c0, a.c1};
+  }
+
+  // The adjugate over the norm: t0 = a0^2 - xi a1 a2, t1 = xi a2^2 - a0 a1, t2 = a1^2 - a0 a2,
+  // a^-1 = (t0 + t1 v + t2 v^2) / (a0 t0 + xi (a2 t1 + a1 t2)), a != 0
+  Fp6 inverse(const Fp6& a)
+  {
+    const Fp2 t0 = sub(square(a.c0), multiply_by_nonresidue(multiply(a.c1, a.c2)));
+    const Fp2 t1 = sub(multiply_by_nonresidue(square(a.c2)), multiply(a.c0, a.c1));
+    const Fp2 t2 = sub(square(a.c1), multiply(a.c0, a.c2));
+    const Fp2 d = add(multiply(a.c0, t0), multiply_by_nonresidue(add(multiply(a.c2, t1), multiply(a.c1, t2))));
+    const Fp2 d_inv = inverse(d);
+    return {multiply(t0, d_inv), multiply(t1, d_inv), multiply(t2, d_inv)};
+  }
+
+  Fp6 frobenius(const Fp6& a)
+  {
+    return {conjugate(a.c0), multiply(conjugate(a.c1), gamma_v), multiply(conjugate(a.c2), gamma_v2)};
+  }
+
+  Fp12 add(const Fp12& a, const Fp12& b)
+  {
+    return {add(a.c0, b.c0), add(a.c1, b.c1)};
+  }
+
+  Fp12 sub(const Fp12& a, const Fp12& b)
+  {
+    return {sub(a.c0, b.c0), sub(a.c1, b.c1)};
+  }
+
+  // a^(p^6), the inverse of a in the cyclotomic subgroup
+  Fp12 conjugate(const Fp12& a)
+  {
+    return {a.c0, negate(a.c1)};
+  }
+
+  // Karatsuba over Fp6, three lazy Fp6 products
+  Fp12 multiply(const Fp12& a, const Fp12& b)
+  {
+    const Fp6 t0 = multiply(a.c0, b.c0);
+    const Fp6 t1 = multiply(a.c1, b.c1);
+    const Fp6 t2 = multiply(add(a.c0, a.c1), add(b.c0, b.c1));
+    return {add(t0, multiply_by_nonresidue(t1)), sub(sub(t2, t0), t1)};
+  }
+
+  // Complex squaring: (a0 + a1 w)^2 = (a0 + a1)(a0 + v a1) - t - v t + 2 t w with t = a0 a1
+  Fp12 square(const Fp12& a)
+  {
+    const Fp6 t = multiply(a.c0, a.c1);
+    const Fp6 s = multiply(add(a.c0, a.c1), add(a.c0, multiply_by_nonresidue(a.c1)));
+    return {sub(sub(s, t), multiply_by_nonresidue(t)), add(t, t)};
+  }
+
+  // (a0 + a1 w)^-1 = (a0 - a1 w) / (a0^2 - v a1^2), a != 0
+  Fp12 inverse(const Fp12& a)
+  {
+    const Fp6 d_inv = inverse(sub(square(a.c0), multiply_by_nonresidue(square(a.c1))));
+    return {multiply(a.c0, d_inv), negate(multiply(a.c1, d_inv))};
+  }
+
+  // a^(p^power)
+  Fp12 frobenius(Fp12 a, const uint32_t power = 1)
+  {
+    for (uint32_t i = 0; i < power % 12; ++i) {
+      const Fp6 c1 = frobenius(a.c1);
+      a = {frobenius(a.c0), {multiply(c1.c0, gamma_w), multiply(c1.c1, gamma_w), multiply(c1.c2, gamma_w)}};
+    }
+    return a;
+  }
+
+  // Granger-Scott squaring, valid only for a in the cyclotomic subgroup (a^(p^4 - p^2 + 1) = 1), such as the
+  // result of the easy part of a final exponentiation. Three Fp4 squarings, 18 multiplies and 12 REDCs
+  // against 36 multiplies and 12 REDCs for square().
+  Fp12 cyclotomic_square(const Fp12& a)
+  {
+    const auto [t0, t1] = fp4_square(a.c0.c0, a.c1.c1);
+    const auto [t2, t3] = fp4_square(a.c1.c0, a.c0.c2);
+    const auto [t4, t5] = fp4_square(a.c0.c1, a.c1.c2);
+    // 3 t - 2 z for the first halves and 3 t + 2 z for the second
+    const auto minus = [&](const Fp2& t, const Fp2& z) {
+      const Fp2 d = sub(t, z);
+      return add(add(d, d), t);
+    };
+    const auto plus = [&](const Fp2& t, const Fp2& z) {
+      const Fp2 s = add(t, z);
+      return add(add(s, s), t);
+    };
+    return {{minus(t0, a.c0.c0), minus(t2, a.c0.c1), minus(t4, a.c0.c2)},
+            {plus(multiply_by_nonresidue(t5), a.c1.c0), plus(t1, a.c1.c1), plus(t3, a.c1.c2)}};
+  }
+
+  Fp12 pow(Fp12 a, uint64_t e)
+  {
+    Fp12 result = one12();
+    while (e > 0) {
+      if (e & 1) {
+        result = multiply(result, a);
+      }
+      a = square(a);
+      e >>= 1;
+    }
+    return result;
+  }
+
+  // pow() with cyclotomic squarings, a in the cyclotomic subgroup
+  Fp12 cyclotomic_pow(Fp12 a, uint64_t e)
+  {
+    Fp12 result = one12();
+    while (e > 0) {
+      if (e & 1) {
+        result = multiply(result, a);
+      }
+      a = cyclotomic_square(a);
+      e >>= 1;
+    }
+    return result;
+  }
+
+private:
+  // x * R^-1 for any 64-bit x. The Barrett quotient by p R is at most one short, which one subtraction fixes.
+  // Measured about twice as fast on Fp6 products as subtracting p R 2^i for each bit of the bound.
+  uint32_t reduce(const uint64_t x)
+  {
+    const uint64_t q = static_cast<uint64_t>((static_cast<unsigned __int128>(x) * pr_inv) >> 64);
+    const uint64_t t = x - q * pr;
+    return mont.REDC(t >= pr ? t - pr : t);
+  }
+
+  Fp2 reduce(const Fp2Wide& x)
+  {
+    return {reduce(x.c0), reduce(x.c1)};
+  }
+
+  // Karatsuba, c0 = a0 b0 - a1 b1 < 2 p^2 and c1 = (a0 + a1)(b0 + b1) - a0 b0 - a1 b1 < 3 p^2
+  Fp2Wide multiply_wide(const Fp2& a, const Fp2& b)
+  {
+    const uint64_t t0 = static_cast<uint64_t>(a.c0) * b.c0;
+    const uint64_t t1 = static_cast<uint64_t>(a.c1) * b.c1;
+    const uint64_t t2 = static_cast<uint64_t>(mont.add(a.c0, a.c1)) * mont.add(b.c0, b.c1);
+    return {t0 + p2 - t1, t2 + 2 * p2 - t0 - t1};
+  }
+
+  // (a0 + a1)(a0 - a1) + 2 a0 a1 u, both below p^2
+  Fp2Wide square_wide(const Fp2& a)
+  {
+    return {static_cast<uint64_t>(mont.add(a.c0, a.c1)) * mont.sub(a.c0, a.c1),
+            static_cast<uint64_t>(a.c0) * mont.add(a.c1, a.c1)};
+  }
+
+  Fp2Wide add_wide(const Fp2Wide& a, const Fp2Wide& b)
+  {
+    return {a.c0 + b.c0, a.c1 + b.c1};
+  }
+
+  // a - b for b below b_bound p^2
+  Fp2Wide sub_wide(const Fp2Wide& a, const Fp2Wide& b, const uint64_t b_bound)
+  {
+    return {a.c0 + b_bound * p2 - b.c0, a.c1 + b_bound * p2 - b.c1};
+  }
+
+  // (xi0 + u) a for a below a_bound p^2, the result stays below (xi0 + 1) a_bound p^2
+  Fp2Wide nonresidue_wide(const Fp2Wide& a, const uint64_t a_bound)
+  {
+    return {xi0 * a.c0 + a_bound * p2 - a.c1, xi0 * a.c1 + a.c0};
+  }
+
+  // (a + b y)^2 in Fp4 = Fp2[y] / (y^2 - xi): a^2 + xi b^2 and (a + b)^2 - a^2 - b^2
+  std::pair<Fp2, Fp2> fp4_square(const Fp2& a, const Fp2& b)
+  {
+    const Fp2Wide sa = square_wide(a);
+    const Fp2Wide sb = square_wide(b);
+    const Fp2Wide sab = square_wide(add(a, b));
+    return {reduce(add_wide(sa, nonresidue_wide(sb, 1))), reduce(sub_wide(sub_wide(sab, sa, 1), sb, 1))};
+  }
+
+  Montgomery& mont;
+  uint32_t p;
+  uint64_t p2;
+  uint64_t pr;
+  uint64_t pr_inv;
+  uint32_t xi0;
+  uint32_t xi0_mont;
+  Fp2 gamma_v;
+  Fp2 gamma_v2;
+  Fp2 gamma_w;
+};
+
+// Schoolbook product in Fp2[w] / (w^6 - xi) with every Fp product reduced, w^(2i) = v^i
+Fp12 fp12_multiply_reference(ExtensionTower& tower, const Fp12& a, const Fp12& b)
+{
+  Montgomery& mont = tower.base();
+  const auto coefficients = [](const Fp12& x) {
+    return std::array<Fp2, 6>{x.c0.c0, x.c1.c0, x.c0.c1, x.c1.c1, x.c0.c2, x.c1.c2};
+  };
+  const auto fp2_multiply = [&](const Fp2& x, const Fp2& y) {
+    return Fp2{mont.sub(mont.multiply(x.c0, y.c0), mont.multiply(x.c1, y.c1)),
+               mont.add(mont.multiply(x.c0, y.c1), mont.multiply(x.c1, y.c0))};
+  };
+  const Fp2 xi = {mont.convert_in(tower.nonresidue()), mont.one()};
+  const std::array<Fp2, 6> x = coefficients(a), y = coefficients(b);
+  std::array<Fp2, 6> c = {};
+  for (size_t i = 0; i < 6; ++i) {
+    for (size_t j = 0; j < 6; ++j) {
+      Fp2 t = fp2_multiply(x[i], y[j]);
+      if (i + j >= 6) {
+        t = fp2_multiply(t, xi);
+      }
+      c[(i + j) % 6] = tower.add(c[(i + j) % 6], t);
+    }
+  }
+  return {{c[0], c[2], c[4]}, {c[1], c[3], c[5]}};
+}
+
+void test_extension_tower(std::mt19937& gen)
+{
+  // Small fields, xi0 of 1 to 4, and the largest p with xi0 = 1 the lazy bounds allow
+  for (const uint32_t p : {19U, 31U, 43U, 67U, 1048627U, 937238299U}) {
+    Montgomery mont(p);
+    ExtensionTower tower(mont);
+    std::uniform_int_distribution<uint32_t> distr(0, p - 1);
+    const auto random12 = [&]() {
+      Fp12 a;
+      for (Fp6* c : {&a.c0, &a.c1}) {
+        for (Fp2* d : {&c->c0, &c->c1, &c->c2}) {
+          *d = {mont.convert_in(distr(gen)), mont.convert_in(distr(gen))};
+        }
+      }
+      return a;
+    };
+    // All coefficients p - 1 drives every unreduced sum to its bound
+    const Fp2 top = {mont.convert_in(p - 1), mont.convert_in(p - 1)};
+    const Fp12 extreme = {{top, top, top}, {top, top, top}};
+    for (size_t i = 0; i < 200; ++i) {
+      const Fp12 a = i == 0 ? extreme : random12();
+      const Fp12 b = i < 2 ? extreme : random12();
+      if (!(tower.multiply(a, b) == fp12_multiply_reference(tower, a, b)) ||
+          !(tower.square(a) == tower.multiply(a, a)) || !(tower.square(a.c0) == tower.multiply(a.c0, a.c0)) ||
+          !(tower.square(a.c0.c0) == tower.multiply(a.c0.c0, a.c0.c0))) {
+        std::cout << "p=" << p << ", i=" << i << "\n";
+        throw std::runtime_error("Extension tower multiplication test failed.");
+      }
+      if (!(tower.multiply(a, tower.inverse(a)) == tower.one12()) ||
+          !(tower.multiply(a.c1, tower.inverse(a.c1)) == tower.one6())) {
+        std::cout << "p=" << p << ", i=" << i << "\n";
+        throw std::runtime_error("Extension tower inverse test failed.");
+      }
+      if (i < 20 && (!(tower.frobenius(a) == tower.pow(a, p)) ||
+                     !(tower.frobenius(a, 2) == tower.pow(a, static_cast<uint64_t>(p) * p)) ||
+                     !(tower.frobenius(a, 12) == a))) {
+        std::cout << "p=" << p << ", i=" << i << "\n";
+        throw std::runtime_error("Extension tower Frobenius test failed.");
+      }
+      // The easy part of a final exponentiation, f = a^((p^6 - 1)(p^2 + 1)), lands in the cyclotomic subgroup
+      Fp12 f = tower.multiply(tower.conjugate(a), tower.inverse(a));
+      f = tower.multiply(tower.frobenius(f, 2), f);
+      const uint64_t e = (static_cast<uint64_t>(distr(gen)) << 32) | distr(gen);
+      if (!(tower.cyclotomic_square(f) == tower.square(f)) || !(tower.cyclotomic_pow(f, e) == tower.pow(f, e)) ||
+          !(tower.multiply(f, tower.conjugate(f)) == tower.one12())) {
+        std::cout << "p=" << p << ", i=" << i << "\n";
+        throw std::runtime_error("Extension tower cyclotomic squaring test failed.");
+      }
+    }
+  }
+}
+
+// Lazy Fp6 products against the same Karatsuba with every Fp2 product reduced, then the Fp12 operations
+void bench_extension_tower(std::mt19937& gen)
+{
+  const size_t len = 1024;
+  const size_t reps = 200;
+  for (const uint32_t p : {1048627U, 937238299U}) {
+    Montgomery mont(p);
+    ExtensionTower tower(mont);
+    std::uniform_int_distribution<uint32_t> distr(0, p - 1);
+    std::vector<Fp12> a(len), b(len), out(len);
+    for (size_t i = 0; i < len; ++i) {
+      for (Fp12* x : {&a[i], &b[i]}) {
+        for (Fp6* c : {&x->c0, &x->c1}) {
+          for (Fp2* d : {&c->c0, &c->c1, &c->c2}) {
+            *d = {mont.convert_in(distr(gen)), mont.convert_in(distr(gen))};
+          }
+        }
+      }
+    }
+    const auto eager6 = [&](const Fp6& x, const Fp6& y) {
+      const Fp2 v0 = tower.multiply(x.c0, y.c0), v1 = tower.multiply(x.c1, y.c1), v2 = tower.multiply(x.c2, y.c2);
+      const Fp2 t0 = tower.sub(tower.sub(tower.multiply(tower.add(x.c1, x.c2), tower.add(y.c1, y.c2)), v1), v2);
+      const Fp2 t1 = tower.sub(tower.sub(tower.multiply(tower.add(x.c0, x.c1), tower.add(y.c0, y.c1)), v0), v1);
+      const Fp2 t2 = tower.sub(tower.sub(tower.multiply(tower.add(x.c0, x.c2), tower.add(y.c0, y.c2)), v0), v2);
+      return Fp6{tower.add(v0, tower.multiply_by_nonresidue(t0)), tower.add(t1, tower.multiply_by_nonresidue(v2)),
+                 tower.add(t2, v1)};
+    };
+    const auto mops = [&](auto fn) {
+      return len * reps / best_ms([&]() {
+        for (size_t r = 0; r < reps; ++r) {
+          for (size_t i = 0; i < len; ++i) {
+            fn(i);
+          }
+        }
+      }, 5) / 1000;
+    };
+    const double lazy6 = mops([&](size_t i) { out[i].c0 = tower.multiply(a[i].c0, b[i].c0); });
+    const double eager = mops([&](size_t i) { out[i].c0 = eager6(a[i].c0, b[i].c0); });
+    const double square6 = mops([&](size_t i) { out[i].c0 = tower.square(a[i].c0); });
+    const double mul12 = mops([&](size_t i) { out[i] = tower.multiply(a[i], b[i]); });
+    const double square12 = mops([&](size_t i) { out[i] = tower.square(a[i]); });
+    // The formula is only meaningful on the cyclotomic subgroup, its cost does not depend on the input
+    const double cyclotomic = mops([&](size_t i) { out[i] = tower.cyclotomic_square(a[i]); });
+    const double reference = mops([&](size_t i) { out[i] = fp12_multiply_reference(tower, a[i], b[i]); });
+    std::cout << "p=" << p << ", fp6 lazy multiply_mops=" << lazy6 << ", fp6 eager multiply_mops=" << eager
+              << ", fp6 square_mops=" << square6 << ", fp12 multiply_mops=" << mul12
+              << ", fp12 square_mops=" << square12 << ", fp12 cyclotomic_square_mops=" << cyclotomic
+              << ", fp12 schoolbook multiply_mops=" << reference << (out[0].c0.c0.c0 == p ? "!" : "") << "\n";
+  }
+}
+
+// Open addressing hash table (linear probing) keyed directly on Montgomery form residues.
+// Key and value share one 64-bit slot so a probe touches a single cache line.
+class MontHashTable {
+public:
+  MontHashTable(const size_t entries)
+  {
+    log_capacity = 4;
+    while ((size_t(1) << log_capacity) < 2 * entries) {
+      ++log_capacity;
+    }
+    mask = (size_t(1) << log_capacity) - 1;
+    slots.assign(mask + 1, EMPTY);
+  }
+
+  // Keeps the first value inserted for a key
+  void insert(const uint32_t key, const uint32_t value)
+  {
+    size_t i = slot(key);
+    while (slots[i] != EMPTY) {
+      if (static_cast<uint32_t>(slots[i]) == key) {
+        return;
+      }
+      i = (i + 1) & mask;
+    }
+    slots[i] = (static_cast<uint64_t>(value) << 32) | key;
+  }
+
+  std::optional<uint32_t> find(const uint32_t key) const
+  {
+    size_t i = slot(key);
+    while (slots[i] != EMPTY) {
+      if (static_cast<uint32_t>(slots[i]) == key) {
+        return static_cast<uint32_t>(slots[i] >> 32);
+      }
+      i = (i + 1) & mask;
+    }
+    return std::nullopt;
+  }
+
+  size_t memory_bytes() const
+  {
+    return slots.size() * sizeof(uint64_t);
+  }
+
+private:
+  // A residue is always < n <= UINT32_MAX, so this key is never used
+  static constexpr uint64_t EMPTY = UINT32_MAX;
+
+  size_t slot(const uint32_t key) const
+  {
+    // Fibonacci hashing in 64 bits, tables past 2^32 slots (baby_steps > 2^31) keep a valid shift
+    return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> (64 - log_capacity)) & mask;
+  }
+
+  std::vector<uint64_t> slots;
+  uint32_t log_capacity;
+  size_t mask;
+};
+
+struct DlogStats {
+  uint64_t baby_steps = 0;
+  uint64_t giant_steps = 0;
+  size_t table_bytes = 0;
+  double baby_ms = 0;
+  double giant_ms = 0;
+};
+
+/// @brief Baby-step giant-step discrete logarithm
+/// @param[in] g generator in Montgomery form
+/// @param[in] h target in Montgomery form
+/// @param[in] order order of g (or an upper bound of it), e.g. n - 1 for prime n
+/// @param[in] baby_steps table size, 0 for ceil(sqrt(order)). Larger tables trade memory for fewer giant steps.
+/// @return x in [0, order) such that g^x = h, if it exists
+std::optional<uint64_t> bsgs(Montgomery& mont, const uint32_t g, const uint32_t h, const uint64_t order,
+                             uint64_t baby_steps = 0, DlogStats* stats = nullptr, const size_t num_threads = 0)
+{
+  if (baby_steps == 0) {
+    baby_steps = static_cast<uint64_t>(std::ceil(std::sqrt(static_cast<double>(order))));
+  }
+  baby_steps = std::max<uint64_t>(1, std::min(baby_steps, order));
+
+  auto start = std::chrono::steady_clock::now();
+  // Baby steps g^j, j in [0, m). Each thread starts its chunk at g^begin.
+  MontVector powers(baby_steps);
+  parallel_for(0, baby_steps, [&](const size_t begin, const size_t end) {
+    uint32_t cur = mont.pow(g, begin);
+    for (size_t j = begin; j < end; ++j) {
+      powers[j] = cur;
+      cur = mont.multiply(cur, g);
+    }
+  }, num_threads);
+  MontHashTable table(baby_steps);
+  for (uint64_t j = 0; j < baby_steps; ++j) {
+    table.insert(powers[j], j);
+  }
+  if (stats) {
+    stats->baby_steps = baby_steps;
+    stats->table_bytes = table.memory_bytes();
+    stats->baby_ms = elapsed_ms(start);
+  }
+
+  // Giant steps h * g^(-m*i)
+  start = std::chrono::steady_clock::now();
+  const uint32_t factor = mont.inverse(mont.multiply(powers[baby_steps - 1], g));
+  const uint64_t giant_steps = (order + baby_steps - 1) / baby_steps;
+  std::optional<uint64_t> result;
+  uint32_t gamma = h;
+  uint64_t i = 0;
+  for (; i < giant_steps; ++i) {
+    const auto j = table.find(gamma);
+    if (j) {
+      result = i * baby_steps + *j;
+      break;
+    }
+    gamma = mont.multiply(gamma, factor);
+  }
+  if (stats) {
+    stats->giant_steps = i;
+    stats->giant_ms = elapsed_ms(start);
+  }
+  return result;
+}
+
+/// @brief Pollard's kangaroo (lambda) method, O(1) memory, for logarithms known to lie in [lower, upper]
+/// @param[in] g generator in Montgomery form
+/// @param[in] h target in Montgomery form
+/// @return x in [lower, upper] such that g^x = h, if found
+std::optional<uint64_t> kangaroo(Montgomery& mont, const uint32_t g, const uint32_t h, const uint64_t lower,
+                                 const uint64_t upper, DlogStats* stats = nullptr)
+{
+  const uint64_t width = upper - lower;
+  const double sqrt_width = std::sqrt(static_cast<double>(width) + 1);
+  // Jumps are powers of two with mean about sqrt(width) / 2
+  uint32_t num_jumps = 1;
+  while ((std::ldexp(1.0, num_jumps) - 1) / num_jumps < sqrt_width / 2 && num_jumps < 63) {
+    ++num_jumps;
+  }
+  const auto start = std::chrono::steady_clock::now();
+  uint64_t steps = 0;
+
+  // Jump selection hashes the Montgomery form residue directly, a new salt restarts with a different walk
+  for (uint32_t salt = 0; salt < 8; ++salt) {
+    std::vector<uint32_t> jump_pow(num_jumps);
+    std::vector<uint64_t> jump_len(num_jumps);
+    for (uint32_t i = 0; i < num_jumps; ++i) {
+      jump_len[i] = uint64_t(1) << ((i + salt) % num_jumps);
+      jump_pow[i] = mont.pow(g, jump_len[i]);
+    }
+    auto jump = [&](const uint32_t x) {
+      return static_cast<uint32_t>((x * 2654435769U) >> 16) % num_jumps;
+    };
+
+    // Tame kangaroo from g^upper sets a trap
+    uint32_t tame = mont.pow(g, upper);
+    uint64_t tame_dist = 0;
+    const uint64_t tame_steps = 2 * static_cast<uint64_t>(sqrt_width) + 1;
+    for (uint64_t i = 0; i < tame_steps; ++i) {
+      const uint32_t j = jump(tame);
+      tame_dist += jump_len[j];
+      tame = mont.multiply(tame, jump_pow[j]);
+    }
+    steps += tame_steps;
+
+    // Wild kangaroo from h, stops once it has passed the trap
+    uint32_t wild = h;
+    uint64_t wild_dist = 0;
+    while (wild_dist <= width + tame_dist) {
+      if (wild == tame) {
+        const uint64_t x = upper + tame_dist - wild_dist;
+        if (x >= lower && mont.pow(g, x) == h) {
+          if (stats) {
+            stats->giant_steps = steps;
+            stats->giant_ms = elapsed_ms(start);
+          }
+          return x;
+        }
+        break;
+      }
+      const uint32_t j = jump(wild);
+      wild_dist += jump_len[j];
+      wild = mont.multiply(wild, jump_pow[j]);
+      ++steps;
+    }
+  }
+  if (stats) {
+    stats->giant_steps = steps;
+    stats->giant_ms = elapsed_ms(start);
+  }
+  return std::nullopt;
+}
+
+void test_dlog(std::mt19937& gen)
+{
+  const uint32_t primes[] = {1000003, 2147483629, 2147483647, 4294967291};
+  for (const uint32_t p : primes) {
+    Montgomery mont(p);
+    std::uniform_int_distribution<uint32_t> distr(2, p - 2);
+    for (size_t i = 0; i < 3; ++i) {
+      const uint32_t g = mont.convert_in(distr(gen));
+      const uint64_t x = distr(gen);
+      const uint32_t h = mont.pow(g, x);
+      DlogStats stats;
+      const auto y = bsgs(mont, g, h, p - 1, 0, &stats);
+      if (!y || mont.pow(g, *y) != h) {
+        std::cout << "g=" << mont.convert_out(g) << ", x=" << x << ", p=" << p << "\n";
+        throw std::runtime_error("Baby-step giant-step test failed.");
+      }
+      // Small interval around the secret
+      const uint64_t lower = x > 1000 ? x - 1000 : 0;
+      const auto z = kangaroo(mont, g, h, lower, lower + (1U << 20));
+      if (!z || mont.pow(g, *z) != h) {
+        std::cout << "g=" << mont.convert_out(g) << ", x=" << x << ", p=" << p << "\n";
+        throw std::runtime_error("Kangaroo test failed.");
+      }
+    }
+  }
+}
+
+// Memory/time tradeoff of the baby step table size in a 31-bit group
+void bench_dlog(std::mt19937& gen)
+{
+  const uint32_t p = 2147483647;
+  Montgomery mont(p);
+  const uint32_t g = mont.convert_in(7); // primitive root
+  std::uniform_int_distribution<uint32_t> distr(1, p - 2);
+  const uint32_t h = mont.pow(g, distr(gen));
+  const uint64_t sqrt_order = static_cast<uint64_t>(std::ceil(std::sqrt(p - 1.0)));
+  std::cout << "bsgs p=" << p << "\n";
+  for (const double scale : {0.25, 1.0, 4.0, 16.0}) {
+    DlogStats stats;
+    const auto start = std::chrono::steady_clock::now();
+    bsgs(mont, g, h, p - 1, static_cast<uint64_t>(sqrt_order * scale), &stats);
+    std::cout << "  baby_steps=" << stats.baby_steps << ", table_bytes=" << stats.table_bytes
+              << ", giant_steps=" << stats.giant_steps << ", baby_ms=" << stats.baby_ms
+              << ", giant_ms=" << stats.giant_ms << ", total_ms=" << elapsed_ms(start) << "\n";
+  }
+  for (const uint32_t bits : {24, 30}) {
+    DlogStats stats;
+    const uint64_t x = distr(gen) & ((1U << bits) - 1);
+    kangaroo(mont, g, mont.pow(g, x), 0, (1U << bits) - 1, &stats);
+    std::cout << "kangaroo interval=2^" << bits << ", steps=" << stats.giant_steps << ", ms=" << stats.giant_ms << "\n";
+  }
+}
+
+// Montgomery's trick: one inversion plus 3(len - 1) multiplications
+MontVector batch_inverse(Montgomery& mont, const MontVector& a)
+{
+  MontVector result(a.size());
+  if (a.empty()) {
+    return result;
+  }
+  // Prefix products
+  uint32_t acc = mont.one();
+  for (size_t i = 0; i < a.size(); ++i) {
+    result[i] = acc;
+    acc = mont.multiply(acc, a[i]);
+  }
+  if (acc == 0) {
+    throw std::invalid_argument("Batch inverse of a zero element.");
+  }
+  // Backward sweep
+  uint32_t inv = mont.inverse(acc);
+  for (size_t i = a.size(); i-- > 0;) {
+    result[i] = mont.multiply(result[i], inv);
+    inv = mont.multiply(inv, a[i]);
+  }
+  return result;
+}
+
+/// @brief Factorials, inverse factorials and binomial coefficients mod a prime p, tables in Montgomery form
+/// The tables cover [0, min(size, p - 1)] and are filled like batch_inverse(): one inversion of the largest
+/// factorial, then a backward product sweep. Table queries take two multiplies, n >= p goes through Lucas' theorem
+/// on base p digits, which needs the digits inside the tables (size = p - 1 covers every n).
+class Combinatorics {
+public:
+  // Builds over num_threads threads, 0 for all cores. 10^9 entries take 8 GB.
+  Combinatorics(Montgomery& _mont, const size_t _size, size_t num_threads = 0) : mont(_mont)
+  {
+    size = std::min<size_t>(_size, mont.modulus() - 1);
+    fact.reset(new uint32_t[size + 1]);
+    inv_fact.reset(new uint32_t[size + 1]);
+    fact[0] = mont.one();
+
+    if (num_threads == 0) {
+      num_threads = std::max(1U, std::thread::hardware_concurrency());
+    }
+    if (size < (size_t(1) << 16)) {
+      num_threads = 1;
+    }
+    // [1, size] in segments of equal length, lanes of them per thread: the products of one segment form a
+    // dependent chain, so each thread runs lanes chains side by side. Only the last segments can be shorter.
+    const size_t segments = num_threads * lanes;
+    const size_t segment_len = (size + segments - 1) / segments;
+    const auto first = [&](const size_t s) { return std::min(size + 1, 1 + s * segment_len); };
+    const uint32_t one = mont.one();
+
+    // Product of every segment, then the factorial before each segment and the inverse factorial at its end
+    std::vector<uint32_t> totals(segments);
+    parallel_for(0, num_threads, [&](const size_t thread_begin, const size_t thread_end) {
+      for (size_t t = thread_begin; t < thread_end; ++t) {
+        std::array<uint32_t, lanes> acc, x;
+        std::array<size_t, lanes> len;
+        for (size_t l = 0; l < lanes; ++l) {
+          acc[l] = one;
+          x[l] = mont.convert_in(first(t * lanes + l) % mont.modulus());
+          len[l] = first(t * lanes + l + 1) - first(t * lanes + l);
+        }
+        const size_t common = *std::min_element(len.begin(), len.end());
+        for (size_t j = 0; j < common; ++j) {
+          for (size_t l = 0; l < lanes; ++l) {
+            acc[l] = mont.multiply(acc[l], x[l]);
+            x[l] = mont.add(x[l], one);
+          }
+        }
+        for (size_t l = 0; l < lanes; ++l) {
+          for (size_t j = common; j < len[l]; ++j) {
+            acc[l] = mont.multiply(acc[l], x[l]);
+            x[l] = mont.add(x[l], one);
+          }
+        }
+        std::copy(acc.begin(), acc.end(), totals.begin() + t * lanes);
+      }
+    }, num_threads);
+    std::vector<uint32_t> before(segments), inv_last(segments);
+    uint32_t acc = one;
+    for (size_t s = 0; s < segments; ++s) {
+      before[s] = acc;
+      acc = mont.multiply(acc, totals[s]);
+    }
+    uint32_t inv = mont.inverse(acc);
+    for (size_t s = segments; s-- > 0;) {
+      inv_last[s] = inv;
+      inv = mont.multiply(inv, totals[s]);
+    }
+    inv_fact[0] = inv;
+
+    // Factorials forwards and inverse factorials backwards through each segment, 1 / (m - 1)! = m / m!. The lanes
+    // fill small blocks that are copied out one after the other, interleaved stores to 2 * lanes streams were slower.
+    parallel_for(0, num_threads, [&](const size_t thread_begin, const size_t thread_end) {
+      constexpr size_t block = 512;
+      uint32_t fact_block[lanes][block], inv_block[lanes][block];
+      for (size_t t = thread_begin; t < thread_end; ++t) {
+        std::array<uint32_t, lanes> f, x, g, y;
+        std::array<size_t, lanes> begin, end;
+        for (size_t l = 0; l < lanes; ++l) {
+          begin[l] = first(t * lanes + l);
+          end[l] = first(t * lanes + l + 1);
+          f[l] = before[t * lanes + l];
+          x[l] = mont.convert_in(begin[l] % mont.modulus());
+          g[l] = inv_last[t * lanes + l];
+          y[l] = mont.convert_in((end[l] - 1) % mont.modulus());
+        }
+        const auto step = [&](const size_t l, const size_t j) {
+          f[l] = mont.multiply(f[l], x[l]);
+          fact_block[l][j] = f[l];
+          x[l] = mont.add(x[l], one);
+          inv_block[l][j] = g[l];
+          g[l] = mont.multiply(g[l], y[l]);
+          y[l] = mont.sub(y[l], one);
+        };
+        for (size_t j = 0; j < segment_len; j += block) {
+          const size_t len = std::min(block, segment_len - j);
+          if (begin[lanes - 1] + j + len <= end[lanes - 1]) {
+            for (size_t i = 0; i < len; ++i) {
+              for (size_t l = 0; l < lanes; ++l) {
+                step(l, i);
+              }
+            }
+          } else {
+            for (size_t l = 0; l < lanes; ++l) {
+              for (size_t i = 0; begin[l] + j + i < end[l] && i < len; ++i) {
+                step(l, i);
+              }
+            }
+          }
+          for (size_t l = 0; l < lanes; ++l) {
+            const size_t count = std::min(len, end[l] - std::min(end[l], begin[l] + j));
+            std::copy(fact_block[l], fact_block[l] + count, fact.get() + begin[l] + j);
+            std::reverse_copy(inv_block[l], inv_block[l] + count, inv_fact.get() + end[l] - j - count);
+          }
+        }
+      }
+    }, num_threads);
+  }
+
+  // Largest n with table entries
+  size_t table_size()
+  {
+    return size;
+  }
+
+  // n!, 0 for n >= p
+  uint32_t factorial(const uint64_t n)
+  {
+    if (n >= mont.modulus()) {
+      return 0;
+    }
+    check_table(n);
+    return fact[n];
+  }
+
+  // 1 / n!, n < p
+  uint32_t inverse_factorial(const uint64_t n)
+  {
+    check_table(n);
+    return inv_fact[n];
+  }
+
+  // C(n, k), 0 for k > n
+  uint32_t binomial(const uint64_t n, const uint64_t k)
+  {
+    if (k > n) {
+      return 0;
+    }
+    if (n <= size) {
+      return mont.multiply(mont.multiply(fact[n], inv_fact[k]), inv_fact[n - k]);
+    }
+    return lucas(n, k);
+  }
+
+  // n! / (n - k)!, 0 for k > n. Past the tables the k factors are multiplied one by one.
+  uint32_t permutations(const uint64_t n, const uint64_t k)
+  {
+    if (k > n) {
+      return 0;
+    }
+    // With r = n mod p the k factors are r, r - 1, ..., r - k + 1 mod p: zero when k > r, else r! / (r - k)!
+    const uint64_t r = n % mont.modulus();
+    if (k > r) {
+      return 0;
+    }
+    if (r <= size) {
+      return mont.multiply(fact[r], inv_fact[r - k]);
+    }
+    return multiply_range(r - k + 1, r);
+  }
+
+  // out[i] = C(n[i], k[i]). Factors are gathered in blocks and multiplied by the batch kernels, entries that need
+  // Lucas' theorem are filled in afterwards.
+  void binomial_batch(const uint64_t* n, const uint64_t* k, uint32_t* out, const size_t len)
+  {
+    constexpr size_t block = 256;
+    uint32_t f[block], a[block], b[block];
+    for (size_t i = 0; i < len; i += block) {
+      const size_t m = std::min(block, len - i);
+      bool lucas_needed = false;
+      for (size_t j = 0; j < m; ++j) {
+        const uint64_t n_ = n[i + j], k_ = k[i + j];
+        const bool in_table = k_ <= n_ && n_ <= size;
+        f[j] = in_table ? fact[n_] : 0;
+        a[j] = in_table ? inv_fact[k_] : 0;
+        b[j] = in_table ? inv_fact[n_ - k_] : 0;
+        lucas_needed |= k_ <= n_ && n_ > size;
+      }
+      mont.multiply_batch(f, a, out + i, m);
+      mont.multiply_batch(out + i, b, out + i, m);
+      if (lucas_needed) {
+        for (size_t j = 0; j < m; ++j) {
+          if (k[i + j] <= n[i + j] && n[i + j] > size) {
+            out[i + j] = lucas(n[i + j], k[i + j]);
+          }
+        }
+      }
+    }
+  }
+
+  // out[i] = C(n, k_begin + i) for k in [k_begin, k_end), one row of Pascal's triangle
+  void binomial_row(const uint64_t n, const uint64_t k_begin, const uint64_t k_end, uint32_t* out)
+  {
+    if (n > size) {
+      for (uint64_t k = k_begin; k < k_end; ++k) {
+        out[k - k_begin] = binomial(n, k);
+      }
+      return;
+    }
+    const uint64_t valid_end = std::max(k_begin, std::min(k_end, n + 1));
+    // Both passes by the batch kernels, in blocks: n! / k! straight from the table, then times 1 / (n - k)!, which
+    // runs backwards through it
+    constexpr size_t block = 256;
+    uint32_t c[block], tail[block];
+    std::fill(c, c + block, fact[n]);
+    for (uint64_t k = k_begin; k < valid_end; k += block) {
+      const size_t m = std::min<uint64_t>(block, valid_end - k);
+      for (size_t j = 0; j < m; ++j) {
+        tail[j] = inv_fact[n - k - j];
+      }
+      mont.multiply_batch(c, inv_fact.get() + k, out + (k - k_begin), m);
+      mont.multiply_batch(out + (k - k_begin), tail, out + (k - k_begin), m);
+    }
+    std::fill(out + (valid_end - k_begin), out + (k_end > k_begin ? k_end - k_begin : 0), 0);
+  }
+
+private:
+  static constexpr size_t lanes = 4;
+
+  void check_table(const uint64_t n)
+  {
+    if (n > size) {
+      std::cout << "n=" << n << ", table_size=" << size << ", p=" << mont.modulus() << "\n";
+      throw std::out_of_range("Combinatorics tables too small, build them up to p - 1 for Lucas' theorem.");
+    }
+  }
+
+  // C(n, k) as the product of C(n_i, k_i) over base p digits
+  uint32_t lucas(uint64_t n, uint64_t k)
+  {
+    const uint32_t p = mont.modulus();
+    uint32_t result = mont.one();
+    while (k > 0) {
+      const uint64_t n_digit = n % p, k_digit = k % p;
+      if (k_digit > n_digit) {
+        return 0;
+      }
+      check_table(n_digit);
+      result = mont.multiply(result, mont.multiply(mont.multiply(fact[n_digit], inv_fact[k_digit]),
+                                                   inv_fact[n_digit - k_digit]));
+      n /= p;
+      k /= p;
+    }
+    return result;
+  }
+
+  // begin * (begin + 1) * ... * end, below p
+  uint32_t multiply_range(const uint64_t begin, const uint64_t end)
+  {
+    const uint32_t p = mont.modulus();
+    uint32_t result = mont.one();
+    uint32_t x = mont.convert_in(begin % p);
+    for (uint64_t i = begin; i <= end; ++i) {
+      result = mont.multiply(result, x);
+      x = mont.add(x, mont.one());
+    }
+    return result;
+  }
+
+  Montgomery& mont;
+  size_t size;
+  std::unique_ptr<uint32_t[]> fact;
+  std::unique_ptr<uint32_t[]> inv_fact;
+};
+
+// Tables against Pascal's triangle and Lucas' theorem past p, built on 1, 3 and 8 threads
+void test_combinatorics(std::mt19937& gen)
+{
+  const uint64_t rows = 1000;
+  for (const uint32_t p : {3U, 13U, 101U, 65537U, 998244353U, 4294967291U}) {
+    Montgomery mont(p);
+    // Pascal's triangle mod p, row by row
+    std::vector<std::vector<uint32_t>> pascal(rows, std::vector<uint32_t>(rows));
+    for (uint64_t n = 0; n < rows; ++n) {
+      pascal[n][0] = 1 % p;
+      for (uint64_t k = 1; k <= n; ++k) {
+        pascal[n][k] = (static_cast<uint64_t>(pascal[n - 1][k - 1]) + pascal[n - 1][k]) % p;
+      }
+    }
+    for (const size_t threads : {1, 3, 8}) {
+      // Past 2^16 the build splits, p - 1 for the small primes so that Lucas' theorem applies
+      Combinatorics comb(mont, 100000, threads);
+      std::uniform_int_distribution<uint64_t> distr_n(0, rows - 1);
+      std::vector<uint64_t> ns(777), ks(777);
+      for (size_t i = 0; i < ns.size(); ++i) {
+        ns[i] = distr_n(gen);
+        ks[i] = std::uniform_int_distribution<uint64_t>(0, ns[i] + 2)(gen);
+      }
+      MontVector batch(ns.size());
+      comb.binomial_batch(ns.data(), ks.data(), batch.data(), ns.size());
+      for (size_t i = 0; i < ns.size(); ++i) {
+        const uint32_t expected = ks[i] <= ns[i] ? pascal[ns[i]][ks[i]] : 0;
+        if (mont.convert_out(comb.binomial(ns[i], ks[i])) != expected || mont.convert_out(batch[i]) != expected) {
+          std::cout << "p=" << p << ", threads=" << threads << ", n=" << ns[i] << ", k=" << ks[i] << "\n";
+          throw std::runtime_error("Combinatorics binomial test failed.");
+        }
+      }
+      const uint64_t n = distr_n(gen);
+      MontVector row(n + 3);
+      comb.binomial_row(n, 0, n + 3, row.data());
+      for (uint64_t k = 0; k < n + 3; ++k) {
+        if (mont.convert_out(row[k]) != (k <= n ? pascal[n][k] : 0)) {
+          std::cout << "p=" << p << ", n=" << n << ", k=" << k << "\n";
+          throw std::runtime_error("Combinatorics binomial row test failed.");
+        }
+      }
+      // Factorials against their inverses and the previous ones: the first ones, the last one and random ones
+      std::uniform_int_distribution<uint64_t> distr_table(1, comb.table_size());
+      for (size_t i = 0; i < 1000; ++i) {
+        const uint64_t m =
+            i == 0 ? comb.table_size() : i < 500 ? std::min<uint64_t>(i, comb.table_size()) : distr_table(gen);
+        if (mont.multiply(comb.factorial(m), comb.inverse_factorial(m)) != mont.one() ||
+            comb.factorial(m) != mont.multiply(comb.factorial(m - 1), mont.convert_in(m % p)) ||
+            mont.convert_out(comb.permutations(m, 1)) != m % p) {
+          std::cout << "p=" << p << ", threads=" << threads << ", m=" << m << "\n";
+          throw std::runtime_error("Combinatorics factorial test failed.");
+        }
+      }
+      if (p < rows) {
+        // Row 999 crosses p^2 for p = 13, the scalar path takes Lucas' theorem there
+        for (uint64_t k = 0; k < rows; k += 7) {
+          const uint64_t j = k % 20;
+          if (mont.convert_out(comb.binomial(rows - 1, k)) != pascal[rows - 1][k] ||
+              comb.permutations(rows - 1, j) != mont.multiply(comb.binomial(rows - 1, j), comb.factorial(j))) {
+            std::cout << "p=" << p << ", k=" << k << "\n";
+            throw std::runtime_error("Combinatorics Lucas test failed.");
+          }
+        }
+      }
+      // n! / (n - k)! past p against the plain product, from r! / (r - k)! and, with tables up to 50, by the loop
+      Combinatorics small(mont, 50, threads);
+      for (size_t i = 0; i < 100; ++i) {
+        const uint64_t big = p + distr_n(gen) * (1 + gen() % 10000);
+        const uint64_t k = distr_n(gen);
+        uint64_t expected = 1 % p;
+        for (uint64_t j = 0; j < k; ++j) {
+          expected = expected * ((big - j) % p) % p;
+        }
+        if (mont.convert_out(comb.permutations(big, k)) != expected ||
+            mont.convert_out(small.permutations(big, k)) != expected) {
+          std::cout << "p=" << p << ", n=" << big << ", k=" << k << "\n";
+          throw std::runtime_error("Combinatorics permutations test failed.");
+        }
+      }
+      // Below p but past the tables of 50, the same loop
+      for (uint64_t m = 51; m < std::min<uint64_t>(p, rows); m += 37) {
+        const uint64_t k = m % 20;
+        if (small.permutations(m, k) != comb.permutations(m, k)) {
+          std::cout << "p=" << p << ", n=" << m << ", k=" << k << "\n";
+          throw std::runtime_error("Combinatorics permutations past the table test failed.");
+        }
+      }
+    }
+  }
+}
+
+// Table build per entry on one thread and on all of them, then scalar, batched and Lucas queries
+void bench_combinatorics(std::mt19937& gen)
+{
+  const uint32_t p = 998244353;
+  Montgomery mont(p);
+  const size_t size = 100000000;
+  const size_t all_threads = std::max(1U, std::thread::hardware_concurrency());
+  std::unique_ptr<Combinatorics> comb;
+  for (const size_t threads : {size_t(1), all_threads}) {
+    comb.reset();
+    const auto start = std::chrono::steady_clock::now();
+    comb.reset(new Combinatorics(mont, size, threads));
+    std::cout << "combinatorics size=" << size << ", threads=" << threads
+              << ", build_ns_per_entry=" << elapsed_ms(start) * 1e6 / size << "\n";
+    if (threads == all_threads) {
+      break;
+    }
+  }
+  const size_t len = size_t(1) << 20;
+  std::uniform_int_distribution<uint64_t> distr_n(0, size);
+  std::vector<uint64_t> ns(len), ks(len);
+  for (size_t i = 0; i < len; ++i) {
+    ns[i] = distr_n(gen);
+    ks[i] = std::uniform_int_distribution<uint64_t>(0, ns[i])(gen);
+  }
+  MontVector out(len);
+  const double scalar = len / best_ms([&]() {
+    for (size_t i = 0; i < len; ++i) {
+      out[i] = comb->binomial(ns[i], ks[i]);
+    }
+  }, 5) / 1000;
+  const double batch = len / best_ms([&]() { comb->binomial_batch(ns.data(), ks.data(), out.data(), len); }, 5) / 1000;
+  // Small n and k keep the tables in cache, random ones above mostly miss
+  for (size_t i = 0; i < len; ++i) {
+    ns[i] %= 4096;
+    ks[i] %= ns[i] + 1;
+  }
+  const double cached = len / best_ms([&]() { comb->binomial_batch(ns.data(), ks.data(), out.data(), len); }, 5) / 1000;
+  std::cout << "combinatorics binomial_mops=" << scalar << ", binomial_batch_mops=" << batch
+            << ", binomial_batch_cached_mops=" << cached;
+  // Lucas: p = 65537 with n up to 2^48, three digits
+  Montgomery small(65537);
+  Combinatorics lucas(small, 65536);
+  std::uniform_int_distribution<uint64_t> distr_big(0, uint64_t(1) << 48);
+  for (size_t i = 0; i < len; ++i) {
+    ns[i] = distr_big(gen);
+    ks[i] = std::uniform_int_distribution<uint64_t>(0, ns[i])(gen);
+  }
+  const double lucas_mops = len / best_ms([&]() {
+    for (size_t i = 0; i < len; ++i) {
+      out[i] = lucas.binomial(ns[i], ks[i]);
+    }
+  }, 5) / 1000;
+  const uint32_t sink = std::accumulate(out.begin(), out.end(), 0U, std::bit_xor<uint32_t>());
+  std::cout << ", lucas_mops=" << lucas_mops << (sink == 1 ? " " : "") << "\n";
+}
+
+// Smallest generator of the multiplicative group, for prime n. Returned in Montgomery form.
+uint32_t primitive_root(Montgomery& mont)
+{
+  const uint32_t n = mont.modulus();
+  std::vector<uint32_t> factors;
+  uint32_t m = n - 1;
+  for (uint32_t q = 2; static_cast<uint64_t>(q) * q <= m; ++q) {
+    if (m % q == 0) {
+      factors.push_back(q);
+      while (m % q == 0) {
+        m /= q;
+      }
+    }
+  }
+  if (m > 1) {
+    factors.push_back(m);
+  }
+  for (uint32_t g = 2; g < n; ++g) {
+    const uint32_t g_ = mont.convert_in(g);
+    bool is_root = true;
+    for (const uint32_t q : factors) {
+      if (mont.pow(g_, (n - 1) / q) == mont.one()) {
+        is_root = false;
+        break;
+      }
+    }
+    if (is_root) {
+      return g_;
+    }
+  }
+  std::cout << "n=" << n << "\n";
+  throw std::runtime_error("Primitive root not found, modulus must be prime.");
+}
+
+// Number theoretic transform over a prime modulus, values and twiddles in Montgomery form.
+// forward() takes natural order and leaves the result in a scrambled (bit-reversed) order, inverse() takes it
+// back, which is all pointwise products need. Lengths are 2^k, or 3 * 2^k when 3 divides n - 1.
+// Transforms larger than tuning().ntt_block run radix-8/4 passes (three or two radix-2 stages per trip through
+// memory, cache blocked) until the spans fit the block, then finish each block while it is in cache.
+class NTT {
+public:
+  NTT(Montgomery& _mont) : mont(_mont)
+  {
+    const uint32_t n = mont.modulus();
+    max_log = 0;
+    while (((n - 1) >> max_log) % 2 == 0) {
+      ++max_log;
+    }
+    generator = primitive_root(mont);
+    root = mont.pow(generator, (n - 1) >> max_log);
+    roots = {0, mont.one()};
+    inv_roots = roots;
+    radix3_size = 0;
+  }
+
+  Montgomery& montgomery()
+  {
+    return mont;
+  }
+
+  // Largest supported power of two length is 2^max_log_size()
+  uint32_t max_log_size()
+  {
+    return max_log;
+  }
+
+  bool supports(const size_t size)
+  {
+    const size_t pow2 = size % 3 == 0 ? size / 3 : size;
+    if (pow2 == 0 || (pow2 & (pow2 - 1)) != 0 || bit_length(pow2 - 1) > max_log) {
+      return false;
+    }
+    return size % 3 != 0 || (mont.modulus() - 1) % 3 == 0;
+  }
+
+  // Smallest supported length >= len, 0 when there is none
+  size_t transform_size(const size_t len)
+  {
+    size_t pow2 = 1;
+    while (pow2 < len) {
+      pow2 <<= 1;
+    }
+    // 3 * 2^(k-2) lies between 2^(k-1) and 2^k
+    if (pow2 >= 4 && 3 * (pow2 / 4) >= len && supports(3 * (pow2 / 4))) {
+      return 3 * (pow2 / 4);
+    }
+    return supports(pow2) ? pow2 : 0;
+  }
+
+  // Grow the twiddle tables up to length size. Not thread safe, call it before sharing the object between threads.
+  void reserve(const size_t size)
+  {
+    if (!supports(size)) {
+      std::cout << "size=" << size << ", n=" << mont.modulus() << "\n";
+      throw std::invalid_argument("Transform length not supported by the modulus.");
+    }
+    if (size % 3 == 0 && radix3_size != size / 3) {
+      // w^j and w^2j for the radix-3 pass, w of order size
+      const size_t m = size / 3;
+      const uint32_t w = mont.pow(generator, (mont.modulus() - 1) / size);
+      const uint32_t w_inv = mont.inverse(w);
+      radix3_roots.resize(2 * m);
+      radix3_inv_roots.resize(2 * m);
+      uint32_t cur = mont.one();
+      uint32_t cur_inv = mont.one();
+      for (size_t j = 0; j < m; ++j) {
+        radix3_roots[2 * j] = cur;
+        radix3_roots[2 * j + 1] = mont.multiply(cur, cur);
+        radix3_inv_roots[2 * j] = cur_inv;
+        radix3_inv_roots[2 * j + 1] = mont.multiply(cur_inv, cur_inv);
+        cur = mont.multiply(cur, w);
+        cur_inv = mont.multiply(cur_inv, w_inv);
+      }
+      omega3 = mont.pow(w, m);
+      radix3_size = m;
+    }
+    const size_t pow2 = size % 3 == 0 ? size / 3 : size;
+    if (pow2 <= roots.size()) {
+      return;
+    }
+    // roots[half + j] = w_(2*half)^j
+    const size_t old_size = roots.size();
+    roots.resize(pow2);
+    inv_roots.resize(pow2);
+    for (size_t half = old_size; half < roots.size(); half <<= 1) {
+      const uint32_t w = mont.pow(root, (uint64_t(1) << max_log) / (2 * half));
+      const uint32_t w_inv = mont.inverse(w);
+      uint32_t cur = mont.one();
+      uint32_t cur_inv = mont.one();
+      for (size_t j = 0; j < half; ++j) {
+        roots[half + j] = cur;
+        inv_roots[half + j] = cur_inv;
+        cur = mont.multiply(cur, w);
+        cur_inv = mont.multiply(cur_inv, w_inv);
+      }
+    }
+  }
+
+  // Decimation in frequency, natural order in, scrambled order out
+  void forward(MontVector& a)
+  {
+    const size_t size = a.size();
+    reserve(size);
+    if (size % 3 == 0) {
+      const size_t m = size / 3;
+      radix3_dif(a.data(), m);
+      for (size_t t = 0; t < 3; ++t) {
+        dif(a.data() + t * m, m);
+      }
+      return;
+    }
+    dif(a.data(), size);
+  }
+
+  // Decimation in time, scrambled order in, natural order out, scaled by 1/size
+  void inverse(MontVector& a)
+  {
+    const size_t size = a.size();
+    reserve(size);
+    const uint32_t size_inv = mont.inverse(mont.convert_in(size % mont.modulus()));
+    if (size % 3 == 0) {
+      const size_t m = size / 3;
+      for (size_t t = 0; t < 3; ++t) {
+        dit(a.data() + t * m, m, size_inv);
+      }
+      radix3_dit(a.data(), m);
+      return;
+    }
+    dit(a.data(), size, size_inv);
+  }
+
+  // a = a * b, cyclic convolution of length a.size() == b.size(), b is left transformed.
+  // The last forward stages, the pointwise product and the first inverse stages run block by block in cache.
+  void convolve(MontVector& a, MontVector& b)
+  {
+    const size_t size = a.size();
+    if (b.size() != size) {
+      std::cout << "a_size=" << size << ", b_size=" << b.size() << "\n";
+      throw std::invalid_argument("Convolution operands must have the same length.");
+    }
+    reserve(size);
+    const uint32_t size_inv = mont.inverse(mont.convert_in(size % mont.modulus()));
+    if (size % 3 == 0) {
+      const size_t m = size / 3;
+      radix3_dif(a.data(), m);
+      radix3_dif(b.data(), m);
+      for (size_t t = 0; t < 3; ++t) {
+        convolve_pow2(a.data() + t * m, b.data() + t * m, m, size_inv);
+      }
+      radix3_dit(a.data(), m);
+      return;
+    }
+    convolve_pow2(a.data(), b.data(), size, size_inv);
+  }
+
+  // a = a * b with b already through forward() at this length, for a fixed operand against many inputs
+  void convolve_transformed(MontVector& a, const MontVector& b)
+  {
+    const size_t size = a.size();
+    if (b.size() != size) {
+      std::cout << "a_size=" << size << ", b_size=" << b.size() << "\n";
+      throw std::invalid_argument("Convolution operands must have the same length.");
+    }
+    reserve(size);
+    const uint32_t size_inv = mont.inverse(mont.convert_in(size % mont.modulus()));
+    if (size % 3 == 0) {
+      const size_t m = size / 3;
+      radix3_dif(a.data(), m);
+      for (size_t t = 0; t < 3; ++t) {
+        convolve_transformed_pow2(a.data() + t * m, b.data() + t * m, m, size_inv);
+      }
+      radix3_dit(a.data(), m);
+      return;
+    }
+    convolve_transformed_pow2(a.data(), b.data(), size, size_inv);
+  }
+
+  // Truncated Fourier transform (van der Hoeven): the first len outputs of forward() for an input that is zero
+  // from len on, a.size() a power of two. Costs about len log a.size() instead of a.size() log a.size().
+  void forward_truncated(MontVector& a, const size_t len)
+  {
+    check_truncated(a.size(), len);
+    tft(a.data(), a.size(), len, len);
+  }
+
+  // Inverse of forward_truncated(): a[0, len) holds those outputs, the input is recovered into a[0, len) and the
+  // rest of a is zeroed
+  void inverse_truncated(MontVector& a, const size_t len)
+  {
+    check_truncated(a.size(), len);
+    std::fill(a.begin() + len, a.end(), 0);
+    itft(a.data(), a.size(), len);
+    std::fill(a.begin() + len, a.end(), 0);
+  }
+
+  // Incremental NTT: a * b mod the product of (x - w) over the first len evaluation points of forward(), which
+  // is a * b itself when a.size() + b.size() - 1 <= len. Each set bit 2^k of len (rounded up to a multiple of
+  // 64) contributes one twisted cyclic convolution of length 2^k, modulo x^(2^k) - zeta, and the pieces are
+  // joined by incremental CRT. Operands are reduced along a one sided remainder tree, so all but the
+  // convolutions is linear in the length.
+  MontVector convolve_incremental(const MontVector& a, const MontVector& b, const size_t len)
+  {
+    constexpr size_t granule = 64;
+    const size_t total = (len + granule - 1) / granule * granule;
+    size_t h = granule;
+    while (h < total) {
+      h <<= 1;
+    }
+    if (a.size() > h || b.size() > h) {
+      std::cout << "len=" << len << ", a_size=" << a.size() << ", b_size=" << b.size() << "\n";
+      throw std::invalid_argument("Operands longer than the transform.");
+    }
+    reserve(h);
+    // Current remainder modulus x^h - theta^h, theta the evaluation point w_s of the first position s it covers.
+    // acc is the partial CRT sum modulo it and lift = (product of the finished blocks) modulo it, a constant.
+    MontVector fa(a), fb(b), acc(h, 0);
+    fa.resize(h, 0);
+    fb.resize(h, 0);
+    uint32_t theta = mont.one();
+    uint32_t lift = mont.one();
+    size_t s = 0;
+    std::vector<std::pair<MontVector, uint32_t>> digits;  // u_i and zeta_i of x^|u_i| - zeta_i
+    while (s < total) {
+      if (total - s == h) {
+        digits.emplace_back(crt_digit(fa, fb, acc, h, theta, lift), mont.pow(theta, h));
+        break;
+      }
+      const size_t half = h / 2;
+      const uint32_t delta = mont.pow(theta, half);
+      // x^h - delta^2 = (x^half - delta)(x^half + delta), the first factor takes positions [s, s + half)
+      remainder_split(fa.data(), half, delta);
+      remainder_split(fb.data(), half, delta);
+      remainder_split(acc.data(), half, delta);
+      if (total - s >= half) {
+        MontVector u = crt_digit(fa, fb, acc, half, theta, lift);
+        for (size_t i = 0; i < half; ++i) {
+          fa[i] = fa[i + half];
+          fb[i] = fb[i + half];
+          acc[i] = mont.mul_add(lift, u[i], acc[i + half]);
+        }
+        digits.emplace_back(std::move(u), delta);
+        // x^half - delta = -2 delta modulo x^half + delta
+        lift = mont.multiply(lift, mont.sub(0, mont.add(delta, delta)));
+        theta = mont.multiply(theta, roots[half + 1]);
+        s += half;
+      }
+      h = half;
+      fa.resize(h);
+      fb.resize(h);
+      acc.resize(h);
+    }
+    // Mixed radix to coefficients, c = u_1 + B_1 (u_2 + B_2 (u_3 + ...)) with B_i = x^|u_i| - zeta_i
+    MontVector c = digits.back().first;
+    for (size_t i = digits.size() - 1; i-- > 0;) {
+      const MontVector& u = digits[i].first;
+      const uint32_t zeta = digits[i].second;
+      MontVector next(u.size() + c.size());
+      for (size_t j = 0; j < u.size(); ++j) {
+        next[j] = j < c.size() ? mont.sub(u[j], mont.multiply(zeta, c[j])) : u[j];
+      }
+      std::copy(c.begin(), c.end(), next.begin() + u.size());
+      c = std::move(next);
+    }
+    c.resize(len);
+    return c;
+  }
+
+private:
+  static constexpr size_t chunk = 64;
+
+  size_t block_size()
+  {
+    return std::max<size_t>(tuning().ntt_block, 2 * chunk);
+  }
+
+  // Radix-2 stages from half = size/2 down to 1, in cache
+  void dif_block(uint32_t* a, const size_t size)
+  {
+    mont.batch_kernels().ntt_dif_block(mont, a, size, roots.data());
+  }
+
+  // Radix-2 stages from half = 1 up to size/2, in cache
+  void dit_block(uint32_t* a, const size_t size)
+  {
+    mont.batch_kernels().ntt_dit_block(mont, a, size, inv_roots.data());
+  }
+
+  // Stages down to spans of block_size(), up to three per pass. Every butterfly of a radix-8 group shares
+  // j = position mod q (q the smallest half of the pass), so running the three stages on one chunk of j
+  // before moving to the next reads and writes each element once per pass.
+  void dif_passes(uint32_t* a, const size_t size)
+  {
+    const MontKernels& kernels = mont.batch_kernels();
+    const size_t block = block_size();
+    for (size_t span = size; span > block;) {
+      size_t stages = 1;
+      while (stages < 3 && (span >> (stages + 1)) >= block) {
+        ++stages;
+      }
+      const size_t q = span >> stages;
+      for (size_t b = 0; b < size; b += span) {
+        for (size_t j = 0; j < q; j += chunk) {
+          for (size_t s = 0; s < stages; ++s) {
+            const size_t half = span >> (s + 1);
+            for (size_t base = 0; base < span; base += 2 * half) {
+              for (size_t o = 0; o < half; o += q) {
+                uint32_t* x = a + b + base + o + j;
+                kernels.ntt_dif(mont, x, x + half, &roots[half + o + j], chunk);
+              }
+            }
+          }
+        }
+      }
+      span = q;
+    }
+  }
+
+  // Mirror of dif_passes from spans of block_size() up to size, the last pass also applies the 1/size scaling
+  void dit_passes(uint32_t* a, const size_t size, const uint32_t scale)
+  {
+    const MontKernels& kernels = mont.batch_kernels();
+    uint32_t scales[chunk];
+    std::fill(scales, scales + chunk, scale);
+    for (size_t q = block_size(); q < size;) {
+      size_t stages = 1;
+      while (stages < 3 && (q << stages) < size) {
+        ++stages;
+      }
+      const size_t span = q << stages;
+      for (size_t b = 0; b < size; b += span) {
+        for (size_t j = 0; j < q; j += chunk) {
+          for (size_t s = 0; s < stages; ++s) {
+            const size_t half = q << s;
+            for (size_t base = 0; base < span; base += 2 * half) {
+              for (size_t o = 0; o < half; o += q) {
+                uint32_t* x = a + b + base + o + j;
+                kernels.ntt_dit(mont, x, x + half, &inv_roots[half + o + j], chunk);
+              }
+            }
+          }
+          if (span == size) {
+            for (size_t o = 0; o < span; o += q) {
+              kernels.multiply_batch(mont, a + b + o + j, scales, a + b + o + j, chunk);
+            }
+          }
+        }
+      }
+      q = span;
+    }
+  }
+
+  void scale_block(uint32_t* a, const size_t size, const uint32_t scale)
+  {
+    uint32_t scales[chunk];
+    std::fill(scales, scales + chunk, scale);
+    for (size_t i = 0; i < size; i += chunk) {
+      mont.multiply_batch(a + i, scales, a + i, std::min(chunk, size - i));
+    }
+  }
+
+  void dif(uint32_t* a, const size_t size)
+  {
+    dif_passes(a, size);
+    const size_t block = std::min(size, block_size());
+    for (size_t i = 0; i < size; i += block) {
+      dif_block(a + i, block);
+    }
+  }
+
+  void dit(uint32_t* a, const size_t size, const uint32_t scale)
+  {
+    const size_t block = std::min(size, block_size());
+    for (size_t i = 0; i < size; i += block) {
+      dit_block(a + i, block);
+    }
+    if (size <= block) {
+      scale_block(a, size, scale);
+      return;
+    }
+    dit_passes(a, size, scale);
+  }
+
+  void convolve_pow2(uint32_t* a, uint32_t* b, const size_t size, const uint32_t scale)
+  {
+    dif_passes(a, size);
+    dif_passes(b, size);
+    const size_t block = std::min(size, block_size());
+    for (size_t i = 0; i < size; i += block) {
+      dif_block(a + i, block);
+      dif_block(b + i, block);
+      mont.multiply_batch(a + i, b + i, a + i, block);
+      dit_block(a + i, block);
+    }
+    if (size <= block) {
+      scale_block(a, size, scale);
+      return;
+    }
+    dit_passes(a, size, scale);
+  }
+
+  void convolve_transformed_pow2(uint32_t* a, const uint32_t* b, const size_t size, const uint32_t scale)
+  {
+    dif_passes(a, size);
+    const size_t block = std::min(size, block_size());
+    for (size_t i = 0; i < size; i += block) {
+      dif_block(a + i, block);
+      mont.multiply_batch(a + i, b + i, a + i, block);
+      dit_block(a + i, block);
+    }
+    if (size <= block) {
+      scale_block(a, size, scale);
+      return;
+    }
+    dit_passes(a, size, scale);
+  }
+
+  void check_truncated(const size_t size, const size_t len)
+  {
+    if (size == 0 || (size & (size - 1)) != 0 || len > size) {
+      std::cout << "size=" << size << ", len=" << len << "\n";
+      throw std::invalid_argument("Truncated transforms need a power of two length of at least len.");
+    }
+    reserve(size);
+  }
+
+  // Harvey's in-place TFT, the first out_len outputs for inputs a[0, in_len) (zero after that), in_len <= out_len.
+  // Top butterflies whose second input is zero reduce to one product and outputs past out_len are never formed.
+  void tft(uint32_t* a, const size_t size, const size_t in_len, const size_t out_len)
+  {
+    if (in_len == 0) {
+      std::fill(a, a + out_len, 0);
+      return;
+    }
+    const size_t half = size / 2;
+    if (out_len <= half && size > 1) {
+      // Only the first half is needed, its inputs are x_i + x_(i + half)
+      for (size_t i = half; i < in_len; ++i) {
+        a[i - half] = mont.add(a[i - half], a[i]);
+      }
+      tft(a, half, std::min(in_len, half), out_len);
+      return;
+    }
+    if (in_len == size) {
+      dif(a, size);
+      return;
+    }
+    const MontKernels& kernels = mont.batch_kernels();
+    const size_t full = in_len > half ? in_len - half : 0;
+    const size_t sub_len = std::min(in_len, half);
+    kernels.ntt_dif(mont, a, a + half, &roots[half], full);
+    kernels.multiply_batch(mont, a + full, &roots[half + full], a + half + full, sub_len - full);
+    tft(a, half, sub_len, half);
+    tft(a + half, half, sub_len, out_len - half);
+  }
+
+  // Harvey's in-place inverse, a[0, len) holds outputs and a[len, size) the matching inputs. Recovers the inputs
+  // into a[0, len), a[len, size) is left unspecified.
+  void itft(uint32_t* a, const size_t size, const size_t len)
+  {
+    if (len == size) {
+      dit(a, size, mont.inverse(mont.convert_in(size % mont.modulus())));
+      return;
+    }
+    if (len == 0) {
+      return;
+    }
+    const size_t half = size / 2;
+    if (len < half) {
+      // The first half transforms x_i + x_(i + half), whose tail is known
+      for (size_t i = len; i < half; ++i) {
+        a[i] = mont.add(a[i], a[i + half]);
+      }
+      itft(a, half, len);
+      for (size_t i = 0; i < len; ++i) {
+        a[i] = mont.sub(a[i], a[i + half]);
+      }
+      return;
+    }
+    // All first half outputs are known, which gives x_i + x_(i + half). Where x_(i + half) is known too the
+    // butterfly can be completed forward, leaving a smaller problem of the same kind in the second half.
+    const size_t m = len - half;
+    dit(a, half, mont.inverse(mont.convert_in(half % mont.modulus())));
+    for (size_t i = m; i < half; ++i) {
+      const uint32_t y = a[i + half];
+      a[i] = mont.sub(a[i], y);
+      a[i + half] = mont.multiply(mont.sub(a[i], y), roots[half + i]);
+    }
+    itft(a + half, half, m);
+    // x_i, x_(i + half) = (s + d w^-i) / 2, (s - d w^-i) / 2
+    mont.batch_kernels().ntt_dit(mont, a, a + half, &inv_roots[half], m);
+    const uint32_t inv2 = mont.convert_in((mont.modulus() + 1) / 2);
+    scale_block(a, m, inv2);
+    scale_block(a + half, m, inv2);
+  }
+
+  // In place a -> (a mod x^half - delta, a mod x^half + delta) for a of length 2 half
+  void remainder_split(uint32_t* a, const size_t half, const uint32_t delta)
+  {
+    uint32_t deltas[chunk];
+    std::fill(deltas, deltas + chunk, delta);
+    for (size_t i = 0; i < half; i += chunk) {
+      mont.batch_kernels().ntt_dit(mont, a + i, a + half + i, deltas, std::min(chunk, half - i));
+    }
+  }
+
+  // Next CRT digit for the block x^m - theta^m, fa, fb and acc reduced to it in their first m entries:
+  // u = (fa fb - acc) / lift, the product taken as a cyclic convolution of fa(theta y) and fb(theta y).
+  MontVector crt_digit(const MontVector& fa, const MontVector& fb, const MontVector& acc, const size_t m,
+                       const uint32_t theta, const uint32_t lift)
+  {
+    MontVector x(fa.begin(), fa.begin() + m), y(fb.begin(), fb.begin() + m);
+    const bool twisted = theta != mont.one();
+    MontVector powers;
+    if (twisted) {
+      powers.resize(m);
+      power_table(powers, theta);
+      mont.multiply_batch(x.data(), powers.data(), x.data(), m);
+      mont.multiply_batch(y.data(), powers.data(), y.data(), m);
+    }
+    convolve(x, y);
+    if (twisted) {
+      power_table(powers, mont.inverse(theta));
+      mont.multiply_batch(x.data(), powers.data(), x.data(), m);
+    }
+    for (size_t i = 0; i < m; ++i) {
+      x[i] = mont.sub(x[i], acc[i]);
+    }
+    if (lift != mont.one()) {
+      scale_block(x.data(), m, mont.inverse(lift));
+    }
+    return x;
+  }
+
+  // table[i] = w^i, doubling the filled prefix with one batch product per step
+  void power_table(MontVector& table, const uint32_t w)
+  {
+    uint32_t steps[chunk];
+    table[0] = mont.one();
+    uint32_t step = w;
+    for (size_t filled = 1; filled < table.size(); filled *= 2) {
+      const size_t count = std::min(filled, table.size() - filled);
+      std::fill(steps, steps + chunk, step);
+      for (size_t i = 0; i < count; i += chunk) {
+        mont.multiply_batch(&table[i], steps, &table[filled + i], std::min(chunk, count - i));
+      }
+      step = mont.multiply(step, step);
+    }
+  }
+
+  // x_s = a[j + s m] -> y_t = sum_s x_s omega^(s t) w^(j t), w of order 3m and omega = w^m of order 3.
+  // Each third then goes through a length m transform.
+  void radix3_dif(uint32_t* a, const size_t m)
+  {
+    for (size_t j = 0; j < m; ++j) {
+      const uint32_t x0 = a[j];
+      const uint32_t x1 = a[j + m];
+      const uint32_t x2 = a[j + 2 * m];
+      // omega^2 = -1 - omega, one product per butterfly
+      const uint32_t d = mont.multiply(omega3, mont.sub(x1, x2));
+      a[j] = mont.add(mont.add(x0, x1), x2);
+      a[j + m] = mont.multiply(mont.add(mont.sub(x0, x2), d), radix3_roots[2 * j]);
+      a[j + 2 * m] = mont.multiply(mont.sub(mont.sub(x0, x1), d), radix3_roots[2 * j + 1]);
+    }
+  }
+
+  // Inverse of radix3_dif without the 1/3, which the length m inverses fold into their scaling
+  void radix3_dit(uint32_t* a, const size_t m)
+  {
+    const uint32_t omega_inv = mont.multiply(omega3, omega3);
+    for (size_t j = 0; j < m; ++j) {
+      const uint32_t y0 = a[j];
+      const uint32_t y1 = mont.multiply(a[j + m], radix3_inv_roots[2 * j]);
+      const uint32_t y2 = mont.multiply(a[j + 2 * m], radix3_inv_roots[2 * j + 1]);
+      const uint32_t d = mont.multiply(omega_inv, mont.sub(y1, y2));
+      a[j] = mont.add(mont.add(y0, y1), y2);
+      a[j + m] = mont.add(mont.sub(y0, y2), d);
+      a[j + 2 * m] = mont.sub(mont.sub(y0, y1), d);
+    }
+  }
+
+  Montgomery& mont;
+  uint32_t max_log;
+  uint32_t generator;
+  uint32_t root;
+  MontVector roots;
+  MontVector inv_roots;
+  size_t radix3_size;
+  uint32_t omega3;
+  MontVector radix3_roots;
+  MontVector radix3_inv_roots;
+};
+
+MontVector poly_multiply_schoolbook(Montgomery& mont, const MontVector& a, const MontVector& b)
+{
+  if (a.empty() || b.empty()) {
+    return {};
+  }
+  MontVector c(a.size() + b.size() - 1, 0);
+  for (size_t i = 0; i < a.size(); ++i) {
+    for (size_t j = 0; j < b.size(); ++j) {
+      c[i + j] = mont.mul_add(a[i], b[j], c[i + j]);
+    }
+  }
+  return c;
+}
+
+// Coefficients from low to high degree
+MontVector poly_multiply(NTT& ntt, const MontVector& a, const MontVector& b)
+{
+  if (a.empty() || b.empty()) {
+    return {};
+  }
+  const size_t result_size = a.size() + b.size() - 1;
+  // 3 * 2^k lengths where the modulus has them, up to a quarter less padding than the next power of two
+  const size_t size = ntt.transform_size(result_size);
+  if (std::min(a.size(), b.size()) <= tuning().poly_schoolbook || size == 0) {
+    return poly_multiply_schoolbook(ntt.montgomery(), a, b);
+  }
+  MontVector fa(a);
+  MontVector fb(b);
+  fa.resize(size, 0);
+  fb.resize(size, 0);
+  // Power of two padding of more than half the product, truncated transforms then skip the zero tail
+  if (result_size >= 2048 && 3 * result_size < 2 * size && size % 3 != 0) {
+    ntt.forward_truncated(fa, result_size);
+    ntt.forward_truncated(fb, result_size);
+    ntt.montgomery().multiply_batch(fa.data(), fb.data(), fa.data(), result_size);
+    ntt.inverse_truncated(fa, result_size);
+  } else {
+    ntt.convolve(fa, fb);
+  }
+  fa.resize(result_size);
+  return fa;
+}
+
+// a^-1 mod x^len by Newton iteration, a[0] must be invertible
+MontVector poly_inverse_series(NTT& ntt, const MontVector& a, const size_t len)
+{
+  Montgomery& mont = ntt.montgomery();
+  MontVector g = {mont.inverse(a[0])};
+  for (size_t m = 1; m < len; m *= 2) {
+    // g = g * (2 - a*g) mod x^(2m)
+    MontVector a_low(a.begin(), a.begin() + std::min(a.size(), 2 * m));
+    MontVector e = poly_multiply(ntt, a_low, g);
+    e.resize(2 * m, 0);
+    for (auto& x : e) {
+      x = mont.sub(0, x);
+    }
+    e[0] = mont.add(e[0], mont.add(mont.one(), mont.one()));
+    g = poly_multiply(ntt, g, e);
+    g.resize(2 * m);
+  }
+  g.resize(len);
+  return g;
+}
+
+// a mod b, through the reversed quotient a_rev * b_rev^-1
+MontVector poly_mod(NTT& ntt, const MontVector& a, const MontVector& b)
+{
+  if (a.size() < b.size()) {
+    return a;
+  }
+  Montgomery& mont = ntt.montgomery();
+  const size_t q_size = a.size() - b.size() + 1;
+  MontVector a_rev(a.rbegin(), a.rbegin() + q_size);
+  MontVector b_rev(b.rbegin(), b.rbegin() + std::min(b.size(), q_size));
+  MontVector q = poly_multiply(ntt, a_rev, poly_inverse_series(ntt, b_rev, q_size));
+  q.resize(q_size);
+  std::reverse(q.begin(), q.end());
+  MontVector qb = poly_multiply(ntt, q, b);
+  MontVector r(b.size() - 1);
+  for (size_t i = 0; i < r.size(); ++i) {
+    r[i] = mont.sub(a[i], qb[i]);
+  }
+  return r;
+}
+
+// Products of many inputs against one fixed kernel, as in FIR filters. The kernel is transformed once, each block
+// of block_length() inputs then costs one forward and one inverse transform with the pointwise product fused in.
+class FixedConvolver {
+public:
+  // block_len 0 picks transforms of about four kernel lengths, at least 1024 points
+  FixedConvolver(NTT& _ntt, const MontVector& kernel, const size_t block_len = 0)
+    : ntt(_ntt), kernel_len(kernel.size())
+  {
+    if (kernel.empty()) {
+      throw std::invalid_argument("Convolution kernel must not be empty.");
+    }
+    const size_t wanted = block_len == 0 ? std::max<size_t>(4 * kernel_len, 1024) : block_len + kernel_len - 1;
+    size = ntt.transform_size(wanted);
+    if (size == 0) {
+      std::cout << "kernel_len=" << kernel_len << ", block_len=" << block_len << "\n";
+      throw std::invalid_argument("Transform length not supported by the modulus.");
+    }
+    // Whatever transform_size() rounded up to also goes to input
+    block = size - kernel_len + 1;
+    kernel_hat = kernel;
+    kernel_hat.resize(size, 0);
+    ntt.forward(kernel_hat);
+    pending.assign(kernel_len - 1, 0);
+  }
+
+  size_t block_length() const
+  {
+    return block;
+  }
+
+  size_t transform_length() const
+  {
+    return size;
+  }
+
+  // Full linear convolution, x.size() + kernel_len - 1 terms, by overlap-add
+  MontVector convolve(const MontVector& x)
+  {
+    if (x.empty()) {
+      return {};
+    }
+    Montgomery& mont = ntt.montgomery();
+    MontVector out(x.size() + kernel_len - 1, 0);
+    MontVector buf(size);
+    for (size_t begin = 0; begin < x.size(); begin += block) {
+      const size_t len = std::min(block, x.size() - begin);
+      std::copy(x.begin() + begin, x.begin() + begin + len, buf.begin());
+      std::fill(buf.begin() + len, buf.end(), 0);
+      ntt.convolve_transformed(buf, kernel_hat);
+      // Only the first kernel_len - 1 terms overlap the previous block
+      const size_t overlap = std::min(kernel_len - 1, len + kernel_len - 1);
+      for (size_t i = 0; i < overlap; ++i) {
+        out[begin + i] = mont.add(out[begin + i], buf[i]);
+      }
+      std::copy(buf.begin() + overlap, buf.begin() + len + kernel_len - 1, out.begin() + begin + overlap);
+    }
+    return out;
+  }
+
+  // convolve() on every input, inputs spread over threads. The NTT must not be used at other lengths meanwhile.
+  std::vector<MontVector> convolve_many(const std::vector<MontVector>& inputs, const size_t num_threads = 0)
+  {
+    std::vector<MontVector> outputs(inputs.size());
+    parallel_for(
+      0, inputs.size(),
+      [&](const size_t begin, const size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+          outputs[i] = convolve(inputs[i]);
+        }
+      },
+      num_threads);
+    return outputs;
+  }
+
+  // Streaming by overlap-save: out[t] = sum_k kernel[k] x[t - k] over everything pushed so far. Outputs are
+  // released a block at a time, flush() releases the rest plus the kernel_len - 1 tail and restarts the stream.
+  // Concatenated, the outputs of a stream equal convolve() of its concatenated inputs.
+  MontVector push(const uint32_t* x, const size_t len)
+  {
+    pending.insert(pending.end(), x, x + len);
+    return drain();
+  }
+
+  MontVector flush()
+  {
+    const size_t owed = pending.size();
+    pending.resize(pending.size() + kernel_len - 1, 0);
+    MontVector out = drain();
+    if (out.size() < owed) {
+      // Less than a block is left, zero padded to one last transform
+      MontVector buf = pending;
+      buf.resize(size, 0);
+      ntt.convolve_transformed(buf, kernel_hat);
+      out.insert(out.end(), buf.begin() + kernel_len - 1, buf.begin() + kernel_len - 1 + owed - out.size());
+    }
+    pending.assign(kernel_len - 1, 0);
+    return out;
+  }
+
+private:
+  // Every full window of kernel_len - 1 history and block new inputs gives block outputs, the cyclic wrap only
+  // touches the first kernel_len - 1 positions
+  MontVector drain()
+  {
+    MontVector out;
+    size_t begin = 0;
+    MontVector buf;
+    for (; pending.size() - begin >= size; begin += block) {
+      buf.assign(pending.begin() + begin, pending.begin() + begin + size);
+      ntt.convolve_transformed(buf, kernel_hat);
+      out.insert(out.end(), buf.begin() + kernel_len - 1, buf.end());
+    }
+    pending.erase(pending.begin(), pending.begin() + begin);
+    return out;
+  }
+
+  NTT& ntt;
+  size_t kernel_len;
+  size_t size;
+  size_t block;
+  MontVector kernel_hat;
+  MontVector pending;  // kernel_len - 1 inputs of history, then inputs not yet filtered
+};
+
+// Horner's rule across points, one mul_add_batch() pass per coefficient over chunks of points that stay in L1.
+// Without vector kernels the passes only add loads and stores, four interleaved points per loop hide the latency.
+void horner_many(Montgomery& mont, const MontVector& poly, const uint32_t* points, uint32_t* values, const size_t len)
+{
+  if (&mont.batch_kernels() == &portable_montgomery_kernels()) {
+    size_t i = 0;
+    for (; i + 4 <= len; i += 4) {
+      uint32_t r0 = 0, r1 = 0, r2 = 0, r3 = 0;
+      for (size_t c = poly.size(); c-- > 0;) {
+        r0 = mont.mul_add(r0, points[i], poly[c]);
+        r1 = mont.mul_add(r1, points[i + 1], poly[c]);
+        r2 = mont.mul_add(r2, points[i + 2], poly[c]);
+        r3 = mont.mul_add(r3, points[i + 3], poly[c]);
+      }
+      values[i] = r0;
+      values[i + 1] = r1;
+      values[i + 2] = r2;
+      values[i + 3] = r3;
+    }
+    for (; i < len; ++i) {
+      uint32_t r = 0;
+      for (size_t c = poly.size(); c-- > 0;) {
+        r = mont.mul_add(r, points[i], poly[c]);
+      }
+      values[i] = r;
+    }
+    return;
+  }
+  constexpr size_t chunk = 512;
+  MontVector coef(chunk);
+  for (size_t i = 0; i < len; i += chunk) {
+    const size_t m = std::min(chunk, len - i);
+    std::fill(values + i, values + i + m, 0);
+    for (size_t c = poly.size(); c-- > 0;) {
+      std::fill(coef.begin(), coef.begin() + m, poly[c]);
+      mont.mul_add_batch(values + i, points + i, coef.data(), values + i, m);
+    }
+  }
+}
+
+// Subproduct tree, level 0 holds blocks of up to leaf_size linear factors (x - x_i) multiplied together
+struct SubproductTree {
+  static constexpr size_t leaf_size = 32;
+
+  SubproductTree(NTT& ntt, const MontVector& _points) : points(_points)
+  {
+    Montgomery& mont = ntt.montgomery();
+    std::vector<MontVector> level;
+    for (size_t i = 0; i < points.size(); i += leaf_size) {
+      MontVector node = {mont.one()};
+      for (size_t j = i; j < std::min(points.size(), i + leaf_size); ++j) {
+        node = poly_multiply(ntt, node, {mont.sub(0, points[j]), mont.one()});
+      }
+      level.push_back(std::move(node));
+    }
+    levels.push_back(std::move(level));
+    while (levels.back().size() > 1) {
+      const auto& prev = levels.back();
+      std::vector<MontVector> next;
+      for (size_t i = 0; i < prev.size(); i += 2) {
+        next.push_back(i + 1 < prev.size() ? poly_multiply(ntt, prev[i], prev[i + 1]) : prev[i]);
+      }
+      levels.push_back(std::move(next));
+    }
+  }
+
+  // prod (x - x_i)
+  const MontVector& root() const
+  {
+    return levels.back()[0];
+  }
+
+  const MontVector& points;
+  std::vector<std::vector<MontVector>> levels;
+};
+
+// Below this many points the remainder tree does not pay off
+constexpr size_t multipoint_threshold = 128;
+
+/// @brief Evaluate a polynomial at many points, everything in Montgomery form
+/// @param[in] poly coefficients from low to high degree
+/// @return poly(points[i]) for each point
+MontVector evaluate_many(NTT& ntt, const MontVector& poly, const MontVector& points)
+{
+  MontVector values(points.size());
+  if (points.size() < multipoint_threshold || poly.size() < multipoint_threshold) {
+    horner_many(ntt.montgomery(), poly, points.data(), values.data(), points.size());
+    return values;
+  }
+  // Remainder tree: reduce the polynomial modulo each node going down, Horner at the leaves
+  SubproductTree tree(ntt, points);
+  std::vector<MontVector> rems = {poly_mod(ntt, poly, tree.root())};
+  for (size_t l = tree.levels.size() - 1; l-- > 0;) {
+    std::vector<MontVector> next(tree.levels[l].size());
+    for (size_t i = 0; i < next.size(); ++i) {
+      next[i] = poly_mod(ntt, rems[i / 2], tree.levels[l][i]);
+    }
+    rems = std::move(next);
+  }
+  for (size_t i = 0; i < rems.size(); ++i) {
+    const size_t begin = i * SubproductTree::leaf_size;
+    const size_t len = std::min(SubproductTree::leaf_size, points.size() - begin);
+    horner_many(ntt.montgomery(), rems[i], points.data() + begin, values.data() + begin, len);
+  }
+  return values;
+}
+
+MontVector poly_derivative(Montgomery& mont, const MontVector& a)
+{
+  MontVector d(a.size() > 1 ? a.size() - 1 : 0);
+  uint32_t i_ = 0;
+  for (size_t i = 1; i < a.size(); ++i) {
+    i_ = mont.add(i_, mont.one());
+    d[i - 1] = mont.multiply(a[i], i_);
+  }
+  return d;
+}
+
+/// @brief Lagrange interpolation, everything in Montgomery form
+/// @param[in] points distinct x_i
+/// @param[in] values y_i
+/// @return coefficients (low to high) of the polynomial of degree < len with p(x_i) = y_i
+MontVector interpolate(NTT& ntt, const MontVector& points, const MontVector& values)
+{
+  Montgomery& mont = ntt.montgomery();
+  const size_t len = points.size();
+  if (len == 0) {
+    return {};
+  }
+  SubproductTree tree(ntt, points);
+
+  // Barycentric weights w_i = 1 / prod_(j != i) (x_i - x_j) = 1 / M'(x_i)
+  MontVector denominators;
+  if (len < multipoint_threshold) {
+    denominators.assign(len, mont.one());
+    for (size_t i = 0; i < len; ++i) {
+      for (size_t j = 0; j < len; ++j) {
+        if (i != j) {
+          denominators[i] = mont.multiply(denominators[i], mont.sub(points[i], points[j]));
+        }
+      }
+    }
+  } else {
+    denominators = evaluate_many(ntt, poly_derivative(mont, tree.root()), points);
+  }
+  MontVector weights = batch_inverse(mont, denominators);
+  for (size_t i = 0; i < len; ++i) {
+    weights[i] = mont.multiply(weights[i], values[i]);
+  }
+
+  // Leaves: sum of c_i * prod_(j != i in leaf) (x - x_j), by synthetic division of the leaf product
+  std::vector<MontVector> sums;
+  for (size_t l = 0; l < tree.levels[0].size(); ++l) {
+    const MontVector& node = tree.levels[0][l];
+    MontVector sum(node.size() - 1, 0);
+    const size_t begin = l * SubproductTree::leaf_size;
+    for (size_t i = begin; i < std::min(len, begin + SubproductTree::leaf_size); ++i) {
+      // node / (x - x_i), high to low
+      uint32_t carry = 0;
+      for (size_t c = node.size() - 1; c-- > 0;) {
+        carry = mont.mul_add(carry, points[i], node[c + 1]);
+        sum[c] = mont.mul_add(carry, weights[i], sum[c]);
+      }
+    }
+    sums.push_back(std::move(sum));
+  }
+  // Going up: sum = sum_left * M_right + sum_right * M_left
+  for (size_t l = 1; l < tree.levels.size(); ++l) {
+    const auto& children = tree.levels[l - 1];
+    std::vector<MontVector> next;
+    for (size_t i = 0; i < sums.size(); i += 2) {
+      if (i + 1 == sums.size()) {
+        next.push_back(std::move(sums[i]));
+        continue;
+      }
+      MontVector left = poly_multiply(ntt, sums[i], children[i + 1]);
+      const MontVector right = poly_multiply(ntt, sums[i + 1], children[i]);
+      left.resize(std::max(left.size(), right.size()), 0);
+      for (size_t c = 0; c < right.size(); ++c) {
+        left[c] = mont.add(left[c], right[c]);
+      }
+      next.push_back(std::move(left));
+    }
+    sums = std::move(next);
+  }
+  sums[0].resize(len, 0);
+  return sums[0];
+}
+
+// Distinct random residues in Montgomery form
+MontVector random_distinct_points(Montgomery& mont, std::mt19937& gen, const size_t len)
+{
+  std::uniform_int_distribution<uint32_t> distr(0, mont.modulus() - 1);
+  MontVector points(len);
+  for (auto& x : points) {
+    x = mont.convert_in(distr(gen));
+  }
+  std::sort(points.begin(), points.end());
+  points.erase(std::unique(points.begin(), points.end()), points.end());
+  while (points.size() < len) {
+    points.push_back(mont.convert_in(distr(gen)));
+    std::sort(points.begin(), points.end());
+    points.erase(std::unique(points.begin(), points.end()), points.end());
+  }
+  std::shuffle(points.begin(), points.end(), gen);
+  return points;
+}
+
+// Cyclic convolutions against the quadratic definition, every pass layout reached through small block sizes
+void test_ntt(std::mt19937& gen)
+{
+  const size_t saved_block = tuning().ntt_block;
+  for (const uint32_t p : {998244353U, 2013265921U, 3221225473U}) {
+    Montgomery mont(p);
+    NTT ntt(mont);
+    std::uniform_int_distribution<uint32_t> distr(0, p - 1);
+    for (const size_t block : {size_t(128), size_t(4096)}) {
+      tuning().ntt_block = block;
+      for (const size_t size : {1, 2, 8, 64, 256, 1024, 2048, 3, 6, 48, 384, 1536, 3072}) {
+        if (!ntt.supports(size)) {
+          continue;
+        }
+        MontVector a(size), b(size);
+        for (size_t i = 0; i < size; ++i) {
+          a[i] = distr(gen);
+          b[i] = distr(gen);
+        }
+        MontVector expected(size, 0);
+        for (size_t i = 0; i < size; ++i) {
+          for (size_t j = 0; j < size; ++j) {
+            expected[(i + j) % size] = mont.add(expected[(i + j) % size], mont.multiply(a[i], b[j]));
+          }
+        }
+        MontVector fa = a, fb = b;
+        ntt.forward(fa);
+        ntt.forward(fb);
+        mont.multiply_batch(fa.data(), fb.data(), fa.data(), size);
+        ntt.inverse(fa);
+        MontVector c = a, d = b;
+        ntt.convolve(c, d);
+        if (fa != expected || c != expected) {
+          std::cout << "p=" << p << ", size=" << size << ", block=" << block << "\n";
+          throw std::runtime_error("NTT convolution test failed.");
+        }
+      }
+    }
+    // Larger round trips, one to three stages per pass
+    tuning().ntt_block = 128;
+    for (const size_t size : {size_t(1) << 10, size_t(1) << 11, size_t(1) << 16, size_t(3) << 14}) {
+      if (!ntt.supports(size)) {
+        continue;
+      }
+      MontVector a(size);
+      for (auto& x : a) {
+        x = distr(gen);
+      }
+      MontVector b = a;
+      ntt.forward(b);
+      ntt.inverse(b);
+      if (b != a) {
+        std::cout << "p=" << p << ", size=" << size << "\n";
+        throw std::runtime_error("NTT round trip test failed.");
+      }
+    }
+  }
+  tuning().ntt_block = saved_block;
+
+  // Split-radix block kernels against the radix-2 reference, twiddle tables built as in NTT::reserve()
+  for (const uint32_t p : {998244353U, 3221225473U}) {
+    Montgomery mont(p);
+    std::uniform_int_distribution<uint32_t> distr(0, p - 1);
+    uint32_t max_log = 0;
+    while (((p - 1) >> max_log) % 2 == 0) {
+      ++max_log;
+    }
+    const uint32_t root = mont.pow(primitive_root(mont), (p - 1) >> max_log);
+    const size_t max_size = 4096;
+    MontVector roots(max_size, 0), inv_roots(max_size, 0);
+    for (size_t half = 1; half < max_size; half <<= 1) {
+      const uint32_t w = mont.pow(root, (uint64_t(1) << max_log) / (2 * half));
+      const uint32_t w_inv = mont.inverse(w);
+      roots[half] = inv_roots[half] = mont.one();
+      for (size_t j = 1; j < half; ++j) {
+        roots[half + j] = mont.multiply(roots[half + j - 1], w);
+        inv_roots[half + j] = mont.multiply(inv_roots[half + j - 1], w_inv);
+      }
+    }
+    for (size_t size = 1; size <= max_size; size <<= 1) {
+      MontVector a(size);
+      for (auto& x : a) {
+        x = distr(gen);
+      }
+      MontVector expected = a, got = a;
+      ntt_dif_block_portable(mont, expected.data(), size, roots.data());
+      ntt_dif_block_split_radix_portable(mont, got.data(), size, roots.data());
+      bool ok = got == expected;
+      expected = got = a;
+      ntt_dit_block_portable(mont, expected.data(), size, inv_roots.data());
+      ntt_dit_block_split_radix_portable(mont, got.data(), size, inv_roots.data());
+      ok = ok && got == expected;
+      if (!ok) {
+        std::cout << "p=" << p << ", size=" << size << "\n";
+        throw std::runtime_error("Split-radix NTT block test failed.");
+      }
+    }
+  }
+
+  Montgomery mont(2013265921);
+  NTT ntt(mont);
+  if (ntt.transform_size(1000) != 1024 || ntt.transform_size(1100) != 1536 || ntt.transform_size(3) != 3) {
+    throw std::runtime_error("NTT transform size test failed.");
+  }
+}
+
+void test_truncated_ntt(std::mt19937& gen)
+{
+  const size_t saved_block = tuning().ntt_block;
+  tuning().ntt_block = 128;
+  for (const uint32_t p : {998244353U, 3221225473U}) {
+    Montgomery mont(p);
+    NTT ntt(mont);
+    std::uniform_int_distribution<uint32_t> distr(0, p - 1);
+    for (const size_t size : {1, 2, 8, 64, 1024}) {
+      for (const size_t len : {size_t(0), size_t(1), size / 2, size / 2 + 1, size * 3 / 4 - 1, size - 1, size}) {
+        if (len > size) {
+          continue;
+        }
+        MontVector a(size, 0);
+        for (size_t i = 0; i < len; ++i) {
+          a[i] = distr(gen);
+        }
+        MontVector expected = a, got = a;
+        ntt.forward(expected);
+        ntt.forward_truncated(got, len);
+        bool ok = std::equal(expected.begin(), expected.begin() + len, got.begin());
+        ntt.inverse_truncated(got, len);
+        ok = ok && got == a;
+        if (!ok) {
+          std::cout << "p=" << p << ", size=" << size << ", len=" << len << "\n";
+          throw std::runtime_error("Truncated NTT test failed.");
+        }
+      }
+    }
+    // Products exact whenever len covers them, lengths around powers of two and block boundaries
+    for (const size_t len : {1, 63, 64, 65, 127, 200, 1000, 1025, 1500, 4097, 7000}) {
+      for (const size_t a_size : {size_t(1), len / 3, len / 2}) {
+        const size_t b_size = len + 1 - std::max<size_t>(a_size, 1);
+        MontVector a(std::max<size_t>(a_size, 1)), b(b_size);
+        for (auto& x : a) {
+          x = distr(gen);
+        }
+        for (auto& x : b) {
+          x = distr(gen);
+        }
+        MontVector expected = poly_multiply_schoolbook(mont, a, b);
+        expected.resize(len, 0);
+        if (ntt.convolve_incremental(a, b, len) != expected) {
+          std::cout << "p=" << p << ", len=" << len << ", a_size=" << a.size() << "\n";
+          throw std::runtime_error("Incremental NTT test failed.");
+        }
+      }
+    }
+  }
+  tuning().ntt_block = saved_block;
+}
+
+void bench_ntt(std::mt19937& gen)
+{
+  Montgomery mont(2013265921);
+  NTT ntt(mont);
+  std::uniform_int_distribution<uint32_t> distr(0, mont.modulus() - 1);
+  for (const size_t size : {size_t(1) << 10, size_t(1) << 16, size_t(1) << 20, size_t(3) << 20, size_t(1) << 22}) {
+    MontVector a(size), b(size);
+    for (size_t i = 0; i < size; ++i) {
+      a[i] = distr(gen);
+      b[i] = distr(gen);
+    }
+    const size_t reps = std::max<size_t>(1, (size_t(1) << 24) / size);
+    ntt.reserve(size);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < reps; ++r) {
+      ntt.forward(a);
+      ntt.inverse(a);
+    }
+    std::cout << "ntt size=" << size << ", forward_inverse_us=" << elapsed_ms(start) * 1000 / reps;
+    start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < reps; ++r) {
+      ntt.convolve(a, b);
+    }
+    std::cout << ", convolve_us=" << elapsed_ms(start) * 1000 / reps << "\n";
+  }
+}
+
+// Products just past powers of two, where padding nearly doubles the transform
+void bench_truncated_ntt(std::mt19937& gen)
+{
+  Montgomery mont(998244353);
+  NTT ntt(mont);
+  std::uniform_int_distribution<uint32_t> distr(0, mont.modulus() - 1);
+  for (const size_t len : {65535, 65537, 81920, 98304, 114688, 131071}) {
+    MontVector a(len / 2), b(len + 1 - len / 2);
+    for (auto& x : a) {
+      x = distr(gen);
+    }
+    for (auto& x : b) {
+      x = distr(gen);
+    }
+    const size_t pow2 = size_t(1) << bit_length(len - 1);
+    const size_t padded = ntt.transform_size(len);
+    ntt.reserve(pow2);
+    ntt.reserve(padded);
+    const size_t reps = 20;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < reps; ++r) {
+      MontVector fa(a), fb(b);
+      fa.resize(padded, 0);
+      fb.resize(padded, 0);
+      ntt.convolve(fa, fb);
+    }
+    std::cout << "len=" << len << ", padded_" << padded << "_us=" << elapsed_ms(start) * 1000 / reps;
+    start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < reps; ++r) {
+      MontVector fa(a), fb(b);
+      fa.resize(pow2, 0);
+      fb.resize(pow2, 0);
+      ntt.forward_truncated(fa, len);
+      ntt.forward_truncated(fb, len);
+      mont.multiply_batch(fa.data(), fb.data(), fa.data(), len);
+      ntt.inverse_truncated(fa, len);
+    }
+    std::cout << ", truncated_us=" << elapsed_ms(start) * 1000 / reps;
+    start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < reps; ++r) {
+      ntt.convolve_incremental(a, b, len);
+    }
+    std::cout << ", incremental_us=" << elapsed_ms(start) * 1000 / reps << "\n";
+  }
+}
+
+// One shot, streamed in uneven pieces and threaded, all against schoolbook products
+void test_fixed_convolver(std::mt19937& gen)
+{
+  for (const uint32_t p : {998244353U, 2013265921U}) {
+    Montgomery mont(p);
+    NTT ntt(mont);
+    std::uniform_int_distribution<uint32_t> distr(0, p - 1);
+    auto random_poly = [&](const size_t len) {
+      MontVector a(len);
+      for (auto& x : a) {
+        x = distr(gen);
+      }
+      return a;
+    };
+    for (const size_t kernel_len : {1, 5, 100}) {
+      const MontVector kernel = random_poly(kernel_len);
+      for (const size_t block_len : {0, 10, 200}) {
+        FixedConvolver conv(ntt, kernel, block_len);
+        std::vector<MontVector> inputs;
+        for (const size_t len : {0, 1, 37, 1000, 5000}) {
+          inputs.push_back(random_poly(len));
+        }
+        const std::vector<MontVector> outputs = conv.convolve_many(inputs, 4);
+        for (size_t i = 0; i < inputs.size(); ++i) {
+          const MontVector expected = poly_multiply_schoolbook(mont, inputs[i], kernel);
+          MontVector streamed;
+          for (size_t begin = 0; begin < inputs[i].size();) {
+            const size_t len = std::min<size_t>(gen() % 300, inputs[i].size() - begin);
+            const MontVector out = conv.push(inputs[i].data() + begin, len);
+            streamed.insert(streamed.end(), out.begin(), out.end());
+            begin += len;
+          }
+          const MontVector tail = conv.flush();
+          streamed.insert(streamed.end(), tail.begin(), tail.end());
+          if (inputs[i].empty()) {
+            // An empty stream still flushes the kernel_len - 1 zero tail
+            streamed.clear();
+          }
+          if (conv.convolve(inputs[i]) != expected || outputs[i] != expected || streamed != expected) {
+            std::cout << "p=" << p << ", kernel_len=" << kernel_len << ", block_len=" << block_len
+                      << ", len=" << inputs[i].size() << "\n";
+            throw std::runtime_error("Fixed kernel convolution test failed.");
+          }
+        }
+      }
+    }
+  }
+}
+
+// Cached kernel transform against transforming it for every block, then inputs over threads
+void bench_fixed_convolver(std::mt19937& gen)
+{
+  Montgomery mont(998244353);
+  NTT ntt(mont);
+  std::uniform_int_distribution<uint32_t> distr(0, mont.modulus() - 1);
+  for (const size_t kernel_len : {64, 1024, 16384}) {
+    MontVector kernel(kernel_len), x(size_t(1) << 20);
+    for (auto& v : kernel) {
+      v = distr(gen);
+    }
+    for (auto& v : x) {
+      v = distr(gen);
+    }
+    FixedConvolver conv(ntt, kernel);
+    const size_t size = conv.transform_length();
+    const size_t block = conv.block_length();
+    auto start = std::chrono::steady_clock::now();
+    MontVector out(x.size() + kernel_len - 1, 0);
+    MontVector buf(size), k(size);
+    for (size_t begin = 0; begin < x.size(); begin += block) {
+      const size_t len = std::min(block, x.size() - begin);
+      std::copy(x.begin() + begin, x.begin() + begin + len, buf.begin());
+      std::fill(buf.begin() + len, buf.end(), 0);
+      std::copy(kernel.begin(), kernel.end(), k.begin());
+      std::fill(k.begin() + kernel_len, k.end(), 0);
+      ntt.convolve(buf, k);
+      for (size_t i = 0; i < len + kernel_len - 1; ++i) {
+        out[begin + i] = mont.add(out[begin + i], buf[i]);
+      }
+    }
+    const double uncached = elapsed_ms(start);
+    start = std::chrono::steady_clock::now();
+    const MontVector cached = conv.convolve(x);
+    const double cached_ms = elapsed_ms(start);
+    start = std::chrono::steady_clock::now();
+    for (size_t begin = 0; begin < x.size(); begin += 4096) {
+      conv.push(x.data() + begin, 4096);
+    }
+    conv.flush();
+    std::cout << "kernel_len=" << kernel_len << ", transform=" << size << ", uncached_ms=" << uncached
+              << ", cached_ms=" << cached_ms << ", streamed_ms=" << elapsed_ms(start);
+    if (cached != out) {
+      throw std::runtime_error("Fixed kernel convolution benchmark mismatch.");
+    }
+    std::vector<MontVector> inputs(16, MontVector(x.begin(), x.begin() + (size_t(1) << 16)));
+    start = std::chrono::steady_clock::now();
+    conv.convolve_many(inputs, 1);
+    std::cout << ", many_1_thread_ms=" << elapsed_ms(start);
+    start = std::chrono::steady_clock::now();
+    conv.convolve_many(inputs);
+    std::cout << ", many_all_threads_ms=" << elapsed_ms(start) << "\n";
+  }
+}
+
+void test_polynomials(std::mt19937& gen)
+{
+  const uint32_t primes[] = {998244353, 2013265921, 3221225473};
+  for (const uint32_t p : primes) {
+    Montgomery mont(p);
+    NTT ntt(mont);
+    std::uniform_int_distribution<uint32_t> distr(0, p - 1);
+    auto random_poly = [&](const size_t len) {
+      MontVector a(len);
+      for (auto& x : a) {
+        x = mont.convert_in(distr(gen));
+      }
+      return a;
+    };
+
+    // The second pair pads 2599 to 4096 where there is no 3 * 2^k length, through the truncated transforms
+    for (const auto& sizes : {std::make_pair(300, 200), std::make_pair(1500, 1100)}) {
+      const MontVector a = random_poly(sizes.first);
+      const MontVector b = random_poly(sizes.second);
+      if (poly_multiply(ntt, a, b) != poly_multiply_schoolbook(mont, a, b)) {
+        std::cout << "p=" << p << ", a_size=" << a.size() << "\n";
+        throw std::runtime_error("NTT polynomial multiplication test failed.");
+      }
+    }
+
+    for (const size_t len : {10, 100, 1000}) {
+      const MontVector poly = random_poly(len + 7);
+      const MontVector points = random_distinct_points(mont, gen, len);
+      const MontVector values = evaluate_many(ntt, poly, points);
+      for (size_t i = 0; i < len; ++i) {
+        uint32_t expected = 0;
+        for (size_t c = poly.size(); c-- > 0;) {
+          expected = (static_cast<uint64_t>(expected) * mont.convert_out(points[i]) + mont.convert_out(poly[c])) % p;
+        }
+        if (mont.convert_out(values[i]) != expected) {
+          std::cout << "p=" << p << ", len=" << len << ", i=" << i << "\n";
+          throw std::runtime_error("Multipoint evaluation test failed.");
+        }
+      }
+
+      const MontVector ys = random_poly(len);
+      const MontVector coeffs = interpolate(ntt, points, ys);
+      if (coeffs.size() != len || evaluate_many(ntt, coeffs, points) != ys) {
+        std::cout << "p=" << p << ", len=" << len << "\n";
+        throw std::runtime_error("Interpolation test failed.");
+      }
+    }
+  }
+}
+
+void bench_polynomials(std::mt19937& gen)
+{
+  const uint32_t p = 2013265921;
+  Montgomery mont(p);
+  NTT ntt(mont);
+  std::uniform_int_distribution<uint32_t> distr(0, p - 1);
+  for (uint32_t log = 8; log <= 20; log += 3) {
+    const size_t len = size_t(1) << log;
+    const MontVector points = random_distinct_points(mont, gen, len);
+    MontVector poly(len);
+    for (auto& x : poly) {
+      x = mont.convert_in(distr(gen));
+    }
+    auto start = std::chrono::steady_clock::now();
+    const MontVector values = evaluate_many(ntt, poly, points);
+    const double eval_ms = elapsed_ms(start);
+    start = std::chrono::steady_clock::now();
+    interpolate(ntt, points, values);
+    std::cout << "points=2^" << log << ", evaluate_many_ms=" << eval_ms << ", interpolate_ms=" << elapsed_ms(start)
+              << "\n";
+  }
+
+  // Horner at 2^14 points: per point, multiply then add with four points interleaved, against horner_many()
+  const size_t num_points = size_t(1) << 14;
+  MontVector poly(1024), points(num_points), scalar(num_points), batch(num_points);
+  for (auto& x : poly) {
+    x = distr(gen);
+  }
+  for (auto& x : points) {
+    x = distr(gen);
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < num_points; i += 4) {
+    uint32_t r0 = 0, r1 = 0, r2 = 0, r3 = 0;
+    for (size_t c = poly.size(); c-- > 0;) {
+      r0 = mont.add(mont.multiply(r0, points[i]), poly[c]);
+      r1 = mont.add(mont.multiply(r1, points[i + 1]), poly[c]);
+      r2 = mont.add(mont.multiply(r2, points[i + 2]), poly[c]);
+      r3 = mont.add(mont.multiply(r3, points[i + 3]), poly[c]);
+    }
+    scalar[i] = r0, scalar[i + 1] = r1, scalar[i + 2] = r2, scalar[i + 3] = r3;
+  }
+  const double scalar_ms = elapsed_ms(start);
+  start = std::chrono::steady_clock::now();
+  horner_many(mont, poly, points.data(), batch.data(), num_points);
+  std::cout << "horner degree=" << poly.size() << ", points=" << num_points << ", scalar_ms=" << scalar_ms
+            << ", mul_add_batch_ms=" << elapsed_ms(start) << (scalar == batch ? "" : " mismatch") << "\n";
+}
+
+// Rows of Lagrange coefficients mapping values at src points to values at dst points (all in Montgomery form).
+// Barycentric form: L_j(x) = w_j * M(x) / (x - x_j), with w_j and 1 / (x - x_j) from batch inversion.
+std::vector<MontVector> lagrange_matrix(Montgomery& mont, const MontVector& src, const MontVector& dst)
+{
+  const size_t k = src.size();
+  MontVector denominators(k, mont.one());
+  for (size_t j = 0; j < k; ++j) {
+    for (size_t l = 0; l < k; ++l) {
+      if (j != l) {
+        denominators[j] = mont.multiply(denominators[j], mont.sub(src[j], src[l]));
+      }
+    }
+  }
+  const MontVector weights = batch_inverse(mont, denominators);
+
+  std::vector<MontVector> rows;
+  for (const uint32_t x : dst) {
+    MontVector row(k, 0);
+    const auto it = std::find(src.begin(), src.end(), x);
+    if (it != src.end()) {
+      row[it - src.begin()] = mont.one();
+      rows.push_back(std::move(row));
+      continue;
+    }
+    MontVector diffs(k);
+    uint32_t m_x = mont.one();
+    for (size_t j = 0; j < k; ++j) {
+      diffs[j] = mont.sub(x, src[j]);
+      m_x = mont.multiply(m_x, diffs[j]);
+    }
+    const MontVector diffs_inv = batch_inverse(mont, diffs);
+    for (size_t j = 0; j < k; ++j) {
+      row[j] = mont.multiply(mont.multiply(weights[j], m_x), diffs_inv[j]);
+    }
+    rows.push_back(std::move(row));
+  }
+  return rows;
+}
+
+/// @brief Systematic Reed-Solomon erasure code over GF(p)
+/// Shards hold symbols < p in normal (not Montgomery) form. Data shard j is the value of a polynomial of degree < k
+/// at x = j, parity shard i its value at x = k + i, so any k shards recover the rest.
+/// Coefficients are kept in Montgomery form, REDC(c*R * d) = c*d, so symbols are never converted.
+class ReedSolomon {
+public:
+  ReedSolomon(Montgomery& _mont, const size_t _data_shards, const size_t _parity_shards)
+    : mont(_mont), data_shards(_data_shards), parity_shards(_parity_shards)
+  {
+    if (data_shards == 0 || data_shards + parity_shards >= mont.modulus()) {
+      std::cout << "data_shards=" << data_shards << ", parity_shards=" << parity_shards << "\n";
+      throw std::invalid_argument("Invalid number of shards for the modulus.");
+    }
+    if (mont.lazy_max_terms() == 0) {
+      std::cout << "n=" << mont.modulus() << "\n";
+      throw std::invalid_argument("Modulus too large for deferred reduction.");
+    }
+    for (size_t i = 0; i < data_shards + parity_shards; ++i) {
+      points.push_back(mont.convert_in(i));
+    }
+    encode_rows = lagrange_matrix(mont, MontVector(points.begin(), points.begin() + data_shards),
+                                  MontVector(points.begin() + data_shards, points.end()));
+  }
+
+  // Symbols per stripe, sized so that a stripe of every shard stays in L2 while each output row reads it
+  size_t stripe_symbols() const
+  {
+    const size_t bytes_per_symbol = (data_shards + parity_shards) * sizeof(uint32_t);
+    return std::max<size_t>(64, (256 * 1024 / bytes_per_symbol) & ~size_t(63));
+  }
+
+  void encode(const std::vector<const uint32_t*>& data, const std::vector<uint32_t*>& parity, const size_t shard_len,
+              const size_t num_threads = 0)
+  {
+    if (data.size() != data_shards || parity.size() != parity_shards) {
+      std::cout << "data=" << data.size() << ", parity=" << parity.size() << ", data_shards=" << data_shards
+                << ", parity_shards=" << parity_shards << "\n";
+      throw std::invalid_argument("Shard count does not match the code.");
+    }
+    apply(encode_rows, data, parity, shard_len, num_threads);
+  }
+
+  // shards holds data_shards + parity_shards buffers, the ones not marked present are rebuilt
+  void reconstruct(const std::vector<uint32_t*>& shards, const std::vector<bool>& present, const size_t shard_len,
+                   const size_t num_threads = 0)
+  {
+    if (shards.size() != data_shards + parity_shards || present.size() != shards.size()) {
+      std::cout << "shards=" << shards.size() << ", present=" << present.size()
+                << ", data_shards + parity_shards=" << data_shards + parity_shards << "\n";
+      throw std::invalid_argument("Shard count does not match the code.");
+    }
+    MontVector src_points;
+    MontVector dst_points;
+    std::vector<const uint32_t*> src;
+    std::vector<uint32_t*> dst;
+    for (size_t i = 0; i < shards.size(); ++i) {
+      if (present[i] && src.size() < data_shards) {
+        src_points.push_back(points[i]);
+        src.push_back(shards[i]);
+      } else if (!present[i]) {
+        dst_points.push_back(points[i]);
+        dst.push_back(shards[i]);
+      }
+    }
+    if (src.size() < data_shards) {
+      std::cout << "present=" << src.size() << ", data_shards=" << data_shards << "\n";
+      throw std::runtime_error("Not enough shards to reconstruct.");
+    }
+    if (!dst.empty()) {
+      apply(lagrange_matrix(mont, src_points, dst_points), src, dst, shard_len, num_threads);
+    }
+  }
+
+private:
+  // dst[r] = sum_j rows[r][j] * src[j] by the combine_rows kernel, stripes spread over threads
+  void apply(const std::vector<MontVector>& rows, const std::vector<const uint32_t*>& src,
+             const std::vector<uint32_t*>& dst, const size_t shard_len, const size_t num_threads)
+  {
+    const MontKernels& kernels = mont.batch_kernels();
+    const size_t stripe = stripe_symbols();
+    const size_t num_stripes = (shard_len + stripe - 1) / stripe;
+    parallel_for(0, num_stripes, [&](const size_t stripe_begin, const size_t stripe_end) {
+      for (size_t s = stripe_begin; s < stripe_end; ++s) {
+        const size_t begin = s * stripe;
+        const size_t len = std::min(stripe, shard_len - begin);
+        for (size_t r = 0; r < rows.size(); ++r) {
+          kernels.combine_rows(mont, rows[r].data(), src.data(), src.size(), begin, dst[r] + begin, len);
+        }
+      }
+    }, num_threads);
+  }
+
+  Montgomery& mont;
+  size_t data_shards;
+  size_t parity_shards;
+  MontVector points;
+  std::vector<MontVector> encode_rows;
+};
+
+void test_reed_solomon(std::mt19937& gen)
+{
+  const uint32_t primes[] = {65537, 2147483647};
+  for (const uint32_t p : primes) {
+    Montgomery mont(p);
+    std::uniform_int_distribution<uint32_t> distr(0, p - 1);
+    const uint32_t a[] = {p - 1, p - 2, 12345, p - 1, p - 1, p - 1};
+    const uint32_t b[] = {p - 1, p - 1, 67890, p - 3, p - 1, p - 1};
+    uint64_t expected = 0;
+    for (size_t i = 0; i < 6; ++i) {
+      expected = (expected + static_cast<uint64_t>(a[i]) * b[i]) % p;
+    }
+    MontVector a_(6);
+    mont.convert_in_batch(a, a_.data(), 6);
+    if (mont.dot(a_.data(), b, 6) != expected) {
+      std::cout << "p=" << p << "\n";
+      throw std::runtime_error("Deferred reduction dot product test failed.");
+    }
+
+    const size_t k = 10;
+    const size_t m = 4;
+    const size_t shard_len = 10000;
+    ReedSolomon rs(mont, k, m);
+    std::vector<std::vector<uint32_t>> shards(k + m, std::vector<uint32_t>(shard_len));
+    for (size_t j = 0; j < k; ++j) {
+      for (auto& x : shards[j]) {
+        x = distr(gen);
+      }
+    }
+    std::vector<const uint32_t*> data;
+    std::vector<uint32_t*> parity;
+    for (size_t i = 0; i < k + m; ++i) {
+      if (i < k) {
+        data.push_back(shards[i].data());
+      } else {
+        parity.push_back(shards[i].data());
+      }
+    }
+    rs.encode(data, parity, shard_len);
+
+    bool rejected = false;
+    try {
+      rs.encode(data, std::vector<uint32_t*>(parity.begin(), parity.end() - 1), shard_len);
+    } catch (const std::invalid_argument&) {
+      rejected = true;
+    }
+    if (!rejected) {
+      std::cout << "p=" << p << "\n";
+      throw std::runtime_error("Reed-Solomon encode accepted a short parity list.");
+    }
+
+    for (size_t trial = 0; trial < 5; ++trial) {
+      auto damaged = shards;
+      std::vector<uint32_t*> damaged_ptrs;
+      for (auto& shard : damaged) {
+        damaged_ptrs.push_back(shard.data());
+      }
+      std::vector<bool> present(k + m, true);
+      for (size_t e = 0; e < m; ++e) {
+        const size_t i = gen() % (k + m);
+        present[i] = false;
+        std::fill(damaged[i].begin(), damaged[i].end(), 0);
+      }
+      rs.reconstruct(damaged_ptrs, present, shard_len);
+      if (damaged != shards) {
+        std::cout << "p=" << p << ", trial=" << trial << "\n";
+        throw std::runtime_error("Reed-Solomon reconstruction test failed.");
+      }
+    }
+  }
+}
+
+// Throughput in GB/s of data shard bytes (4 bytes per stored symbol)
+void bench_reed_solomon(std::mt19937& gen)
+{
+  const uint32_t p = 2147483647;
+  Montgomery mont(p);
+  const size_t k = 10;
+  const size_t m = 4;
+  const size_t shard_len = size_t(1) << 20;
+  std::uniform_int_distribution<uint32_t> distr(0, p - 1);
+  ReedSolomon rs(mont, k, m);
+  std::vector<std::vector<uint32_t>> shards(k + m, std::vector<uint32_t>(shard_len));
+  std::vector<const uint32_t*> data;
+  std::vector<uint32_t*> parity;
+  for (size_t i = 0; i < k + m; ++i) {
+    for (auto& x : shards[i]) {
+      x = distr(gen);
+    }
+    if (i < k) {
+      data.push_back(shards[i].data());
+    } else {
+      parity.push_back(shards[i].data());
+    }
+  }
+  const double gbytes = k * shard_len * sizeof(uint32_t) / 1e9;
+  for (const size_t threads : {size_t(1), size_t(std::max(1U, std::thread::hardware_concurrency()))}) {
+    const auto start = std::chrono::steady_clock::now();
+    rs.encode(data, parity, shard_len, threads);
+    const double ms = elapsed_ms(start);
+    std::cout << "reed_solomon k=" << k << ", m=" << m << ", threads=" << threads << ", encode_gbps="
+              << gbytes / (ms / 1000) << ", per_core=" << gbytes / (ms / 1000) / threads << "\n";
+  }
+  std::vector<uint32_t*> all;
+  for (auto& shard : shards) {
+    all.push_back(shard.data());
+  }
+  std::vector<bool> present(k + m, true);
+  for (size_t i = 0; i < m; ++i) {
+    present[i] = false;
+  }
+  const auto start = std::chrono::steady_clock::now();
+  rs.reconstruct(all, present, shard_len);
+  const double ms = elapsed_ms(start);
+  std::cout << "reed_solomon reconstruct " << m << " data shards, gbps=" << gbytes / (ms / 1000) << "\n";
+}
+
+/// @brief Row echelon LU factorization P A = L U over Z_p, p prime, entries in Montgomery form, row-major
+/// Any shape and rank: row t of U starts at pivot column pivot_cols[t], the unit lower L keeps its multipliers below
+/// the pivots, in the pivot columns. The elimination recurses on column halves, so outside narrow base panels all
+/// the work is the trailing update c -= a b of kernels.matmul_sub, one REDC per entry of c per depth block, with
+/// the update split over threads.
+class ModLU {
+public:
+  ModLU(Montgomery& _mont, const size_t _rows, const size_t _cols, MontVector _a, const size_t _num_threads = 0)
+    : mont(_mont), rows(_rows), cols(_cols), lu(std::move(_a)), num_threads(_num_threads)
+  {
+    if (lu.size() != rows * cols) {
+      std::cout << "rows=" << rows << ", cols=" << cols << ", size=" << lu.size() << "\n";
+      throw std::invalid_argument("Matrix size does not match its shape.");
+    }
+    if (mont.lazy_max_terms() == 0) {
+      std::cout << "n=" << mont.modulus() << "\n";
+      throw std::invalid_argument("Modulus too large for deferred reduction.");
+    }
+    perm.resize(rows);
+    std::iota(perm.begin(), perm.end(), 0);
+    eliminate(0, 0, cols);
+  }
+
+  size_t rank() const
+  {
+    return pivot_cols.size();
+  }
+
+  // Row i of U and L is row perm[i] of the input
+  const std::vector<size_t>& permutation() const
+  {
+    return perm;
+  }
+
+  // Square matrices only, zero when singular
+  uint32_t determinant()
+  {
+    if (rows != cols) {
+      std::cout << "rows=" << rows << ", cols=" << cols << "\n";
+      throw std::invalid_argument("Determinant of a non-square matrix.");
+    }
+    if (rank() < rows) {
+      return 0;
+    }
+    uint32_t det = odd_permutation ? mont.sub(0, mont.one()) : mont.one();
+    for (size_t t = 0; t < rows; ++t) {
+      det = mont.multiply(det, at(t, t));
+    }
+    return det;
+  }
+
+  // Some x with A x = b, free variables set to zero, or nothing when the system is inconsistent
+  std::optional<MontVector> solve(const MontVector& b)
+  {
+    if (b.size() != rows) {
+      std::cout << "rows=" << rows << ", b=" << b.size() << "\n";
+      throw std::invalid_argument("Right-hand side does not match the matrix.");
+    }
+    // L y = P b. z holds y scattered to the pivot columns, so row i of L dots it straight out of the matrix:
+    // the other columns of that prefix are zero in z.
+    const size_t r = rank();
+    MontVector y(rows), z(cols);
+    for (size_t i = 0; i < rows; ++i) {
+      const size_t t = std::min(i, r);
+      y[i] = b[perm[i]];
+      if (t > 0) {
+        y[i] = mont.sub(y[i], mont.dot(&at(i, 0), z.data(), pivot_cols[t - 1] + 1));
+      }
+      if (i < r) {
+        z[pivot_cols[i]] = y[i];
+      } else if (y[i] != 0) {
+        return std::nullopt;
+      }
+    }
+    MontVector x(cols);
+    back_substitute(y, x, r);
+    return x;
+  }
+
+  // One vector per non-pivot column f, one at f and zero at the other non-pivot columns
+  std::vector<MontVector> nullspace()
+  {
+    const size_t r = rank();
+    std::vector<MontVector> basis;
+    const MontVector zero(r);
+    size_t t = 0;
+    for (size_t f = 0; f < cols; ++f) {
+      if (t < r && pivot_cols[t] == f) {
+        ++t;
+        continue;
+      }
+      MontVector x(cols);
+      x[f] = mont.one();
+      back_substitute(zero, x, t);
+      basis.push_back(std::move(x));
+    }
+    return basis;
+  }
+
+private:
+  // Base panels are eliminated column by column, narrow enough that the scalar row operations stay cheap
+  static constexpr size_t base_width = 8;
+  // The trailing update keeps a row block of a (height x depth) in L2 while the kernel sweeps every column tile
+  static constexpr size_t update_depth = 512;
+  static constexpr size_t update_height = 64;
+
+  uint32_t& at(const size_t i, const size_t j)
+  {
+    return lu[i * cols + j];
+  }
+
+  // Pivot variables from U x = y for pivots [0, count), x holding the non-pivot values
+  void back_substitute(const MontVector& y, MontVector& x, const size_t count)
+  {
+    for (size_t t = count; t-- > 0;) {
+      const size_t c = pivot_cols[t];
+      const uint32_t s = mont.dot(&at(t, c + 1), &x[c + 1], cols - c - 1);
+      x[c] = mont.multiply(mont.sub(y[t], s), pivot_inv[t]);
+    }
+  }
+
+  // Echelon form of rows [r0, rows) over columns [c0, c1), returns the number of pivots found
+  size_t eliminate(const size_t r0, const size_t c0, const size_t c1)
+  {
+    if (r0 == rows || c0 == c1) {
+      return 0;
+    }
+    if (c1 - c0 <= base_width) {
+      return eliminate_base(r0, c0, c1);
+    }
+    const size_t mid = c0 + (c1 - c0) / 2;
+    const size_t p = eliminate(r0, c0, mid);
+    if (p > 0) {
+      // U12 = L11^-1 A12 on the new pivot rows, then A22 -= L21 U12 below them
+      solve_lower(r0, p, mid, c1);
+      if (r0 + p < rows) {
+        MontVector buffer;
+        size_t ld = 0;
+        const uint32_t* l21 = multipliers(r0 + p, rows, r0, r0 + p, buffer, ld);
+        update(l21, ld, &at(r0, mid), &at(r0 + p, mid), rows - r0 - p, c1 - mid, p);
+      }
+    }
+    return p + eliminate(r0 + p, mid, c1);
+  }
+
+  // Gaussian elimination on a packed copy of the panel, row swaps applied to the rest of the matrix afterwards
+  size_t eliminate_base(const size_t r0, const size_t c0, const size_t c1)
+  {
+    const size_t width = c1 - c0;
+    const size_t height = rows - r0;
+    MontVector panel(height * width);
+    for (size_t i = 0; i < height; ++i) {
+      std::copy(&at(r0 + i, c0), &at(r0 + i, c0) + width, &panel[i * width]);
+    }
+    std::vector<std::pair<size_t, size_t>> swaps;
+    size_t r = 0;
+    for (size_t c = 0; c < width && r < height; ++c) {
+      size_t i = r;
+      while (i < height && panel[i * width + c] == 0) {
+        ++i;
+      }
+      if (i == height) {
+        continue;
+      }
+      if (i != r) {
+        std::swap_ranges(&panel[i * width], &panel[i * width] + width, &panel[r * width]);
+        swaps.emplace_back(r0 + r, r0 + i);
+      }
+      const uint32_t* pivot_row = &panel[r * width];
+      const uint32_t inv = mont.inverse(pivot_row[c]);
+      for (i = r + 1; i < height; ++i) {
+        uint32_t* row = &panel[i * width];
+        if (row[c] == 0) {
+          continue;
+        }
+        const uint32_t l = mont.multiply(row[c], inv);
+        row[c] = l;
+        for (size_t j = c + 1; j < width; ++j) {
+          row[j] = mont.sub(row[j], mont.multiply(l, pivot_row[j]));
+        }
+      }
+      pivot_cols.push_back(c0 + c);
+      pivot_inv.push_back(inv);
+      ++r;
+    }
+    for (size_t i = 0; i < height; ++i) {
+      std::copy(&panel[i * width], &panel[i * width] + width, &at(r0 + i, c0));
+    }
+    for (const auto& [x, y] : swaps) {
+      std::swap_ranges(&at(x, 0), &at(x, 0) + c0, &at(y, 0));
+      std::swap_ranges(&at(x, c1), &at(x, 0) + cols, &at(y, c1));
+      std::swap(perm[x], perm[y]);
+      odd_permutation = !odd_permutation;
+    }
+    return r;
+  }
+
+  // Rows [r0, r0 + p) over columns [c0, c1) times L11^-1, L11 the unit lower block of pivots [r0, r0 + p)
+  void solve_lower(const size_t r0, const size_t p, const size_t c0, const size_t c1)
+  {
+    MontVector buffer;
+    size_t ld = 0;
+    if (p <= base_width) {
+      for (size_t t = 1; t < p; ++t) {
+        const uint32_t* l = multipliers(r0 + t, r0 + t + 1, r0, r0 + t, buffer, ld);
+        update(l, ld, &at(r0, c0), &at(r0 + t, c0), 1, c1 - c0, t);
+      }
+      return;
+    }
+    const size_t h = p / 2;
+    solve_lower(r0, h, c0, c1);
+    const uint32_t* l21 = multipliers(r0 + h, r0 + p, r0, r0 + h, buffer, ld);
+    update(l21, ld, &at(r0, c0), &at(r0 + h, c0), p - h, c1 - c0, h);
+    solve_lower(r0 + h, p - h, c0, c1);
+  }
+
+  // L[i][t] for rows [i0, i1) and pivots [t0, t1), read in place when the pivot columns are adjacent
+  const uint32_t* multipliers(const size_t i0, const size_t i1, const size_t t0, const size_t t1, MontVector& buffer,
+                              size_t& ld)
+  {
+    const size_t count = t1 - t0;
+    if (pivot_cols[t1 - 1] - pivot_cols[t0] == count - 1) {
+      ld = cols;
+      return &at(i0, pivot_cols[t0]);
+    }
+    buffer.resize((i1 - i0) * count);
+    for (size_t i = i0; i < i1; ++i) {
+      for (size_t t = t0; t < t1; ++t) {
+        buffer[(i - i0) * count + t - t0] = at(i, pivot_cols[t]);
+      }
+    }
+    ld = count;
+    return buffer.data();
+  }
+
+  // c -= a b, a (m x k) with leading dimension lda, b (k x n) and c (m x n) inside the matrix.
+  // Threads take row blocks, or column blocks when the update is wide and short.
+  void update(const uint32_t* a, const size_t lda, const uint32_t* b, uint32_t* c, const size_t m, const size_t n,
+              const size_t k)
+  {
+    const MontKernels& kernels = mont.batch_kernels();
+    const bool by_rows = m >= n;
+    const size_t unit = by_rows ? update_height : 64;
+    const size_t units = ((by_rows ? m : n) + unit - 1) / unit;
+    // Thread start-up costs about as much as a 2^22 multiply-add update
+    const size_t threads = static_cast<double>(m) * n * k < (1 << 22) ? 1 : num_threads;
+    parallel_for(0, units, [&](const size_t begin, const size_t end) {
+      const size_t i0 = by_rows ? begin * unit : 0;
+      const size_t i1 = by_rows ? std::min(m, end * unit) : m;
+      const size_t j0 = by_rows ? 0 : begin * unit;
+      const size_t j1 = by_rows ? n : std::min(n, end * unit);
+      for (size_t t = 0; t < k; t += update_depth) {
+        const size_t depth = std::min(update_depth, k - t);
+        for (size_t i = i0; i < i1; i += update_height) {
+          kernels.matmul_sub(mont, a + i * lda + t, lda, b + t * cols + j0, cols, c + i * cols + j0, cols,
+                             std::min(update_height, i1 - i), j1 - j0, depth);
+        }
+      }
+    }, threads);
+  }
+
+  Montgomery& mont;
+  size_t rows;
+  size_t cols;
+  MontVector lu;
+  size_t num_threads;
+  std::vector<size_t> perm;
+  bool odd_permutation = false;
+  std::vector<size_t> pivot_cols;
+  MontVector pivot_inv;
+};
+
+// Reference for the ModLU tests, plain % arithmetic on normal-form values. Reduces a to row echelon form in place,
+// returns the rank and sets det for square matrices.
+size_t reference_echelon(std::vector<uint64_t>& a, const size_t rows, const size_t cols, const uint64_t p,
+                         uint64_t& det)
+{
+  auto pow_mod = [p](uint64_t x, uint64_t e) {
+    uint64_t result = 1;
+    for (; e > 0; e >>= 1, x = x * x % p) {
+      if (e & 1) {
+        result = result * x % p;
+      }
+    }
+    return result;
+  };
+  det = 1;
+  size_t r = 0;
+  for (size_t c = 0; c < cols && r < rows; ++c) {
+    size_t i = r;
+    while (i < rows && a[i * cols + c] == 0) {
+      ++i;
+    }
+    if (i == rows) {
+      det = 0;
+      continue;
+    }
+    if (i != r) {
+      std::swap_ranges(&a[i * cols], &a[i * cols] + cols, &a[r * cols]);
+      det = (p - det) % p;
+    }
+    det = det * a[r * cols + c] % p;
+    const uint64_t inv = pow_mod(a[r * cols + c], p - 2);
+    for (i = r + 1; i < rows; ++i) {
+      const uint64_t l = a[i * cols + c] * inv % p;
+      for (size_t j = c; j < cols; ++j) {
+        a[i * cols + j] = (a[i * cols + j] + (p - l) * a[r * cols + j]) % p;
+      }
+    }
+    ++r;
+  }
+  if (r < rows) {
+    det = 0;
+  }
+  return r;
+}
+
+void test_mod_lu(std::mt19937& gen)
+{
+  struct Shape {
+    size_t rows;
+    size_t cols;
+    size_t rank;
+  };
+  // rank == 0 means a full random matrix, otherwise a product of rows x rank and rank x cols factors
+  const std::vector<Shape> shapes = {{1, 1, 0},     {3, 3, 0},    {8, 8, 0},   {9, 9, 0},   {40, 40, 0},
+                                     {70, 33, 0},   {33, 70, 0},  {150, 150, 0}, {150, 150, 149},
+                                     {120, 90, 37}, {90, 120, 5}, {64, 64, 1}};
+  for (const uint32_t p : {7U, 998244353U, 2147483647U}) {
+    Montgomery mont(p);
+    std::uniform_int_distribution<uint32_t> distr(0, p - 1);
+    for (const Shape& shape : shapes) {
+      const size_t rows = shape.rows, cols = shape.cols;
+      std::vector<uint64_t> a(rows * cols);
+      if (shape.rank == 0) {
+        for (auto& x : a) {
+          x = distr(gen);
+        }
+      } else {
+        std::vector<uint64_t> f(rows * shape.rank), g(shape.rank * cols);
+        for (auto& x : f) {
+          x = distr(gen);
+        }
+        for (auto& x : g) {
+          x = distr(gen);
+        }
+        for (size_t i = 0; i < rows; ++i) {
+          for (size_t j = 0; j < cols; ++j) {
+            for (size_t t = 0; t < shape.rank; ++t) {
+              a[i * cols + j] = (a[i * cols + j] + f[i * shape.rank + t] * g[t * cols + j]) % p;
+            }
+          }
+        }
+      }
+      // A zero column, so every shape also has a non-pivot column in the middle of a panel
+      if (cols > 4) {
+        for (size_t i = 0; i < rows; ++i) {
+          a[i * cols + 3] = 0;
+        }
+      }
+      MontVector a_(rows * cols);
+      for (size_t i = 0; i < a.size(); ++i) {
+        a_[i] = mont.convert_in(a[i]);
+      }
+      ModLU lu(mont, rows, cols, a_);
+
+      auto echelon = a;
+      uint64_t det = 0;
+      const size_t rank = reference_echelon(echelon, rows, cols, p, det);
+      bool ok = lu.rank() == rank;
+      if (rows == cols) {
+        ok = ok && mont.convert_out(lu.determinant()) == det;
+      }
+      // A x with % arithmetic, x in normal form
+      auto apply = [&](const MontVector& x) {
+        std::vector<uint64_t> y(rows);
+        for (size_t i = 0; i < rows; ++i) {
+          for (size_t j = 0; j < cols; ++j) {
+            y[i] = (y[i] + a[i * cols + j] * mont.convert_out(x[j])) % p;
+          }
+        }
+        return y;
+      };
+      // A consistent right-hand side must be solved, a random one only when the rank allows it
+      MontVector x0(cols);
+      for (auto& x : x0) {
+        x = mont.convert_in(distr(gen));
+      }
+      const std::vector<uint64_t> b = apply(x0);
+      MontVector b_(rows);
+      for (size_t i = 0; i < rows; ++i) {
+        b_[i] = mont.convert_in(b[i]);
+      }
+      const auto x = lu.solve(b_);
+      ok = ok && x && apply(*x) == b;
+      for (size_t i = 0; i < rows; ++i) {
+        b_[i] = mont.convert_in(distr(gen));
+      }
+      const auto x_random = lu.solve(b_);
+      if (x_random) {
+        const std::vector<uint64_t> y = apply(*x_random);
+        for (size_t i = 0; i < rows; ++i) {
+          ok = ok && y[i] == mont.convert_out(b_[i]);
+        }
+      } else {
+        ok = ok && rank < rows;
+      }
+      const auto basis = lu.nullspace();
+      ok = ok && basis.size() == cols - rank;
+      for (const auto& v : basis) {
+        const std::vector<uint64_t> y = apply(v);
+        ok = ok && std::all_of(y.begin(), y.end(), [](const uint64_t e) { return e == 0; });
+      }
+      if (!ok) {
+        std::cout << "p=" << p << ", rows=" << rows << ", cols=" << cols << ", rank=" << lu.rank()
+                  << ", expected_rank=" << rank << "\n";
+        throw std::runtime_error("Modular LU test failed.");
+      }
+    }
+
+    // 400 x 400 has trailing updates past the single-thread threshold, three threads split them even on one core
+    const size_t n = 400;
+    MontVector a(n * n), x0(n);
+    for (auto& x : a) {
+      x = distr(gen);
+    }
+    for (auto& x : x0) {
+      x = distr(gen);
+    }
+    MontVector b(n);
+    for (size_t i = 0; i < n; ++i) {
+      b[i] = mont.dot(a.data() + i * n, x0.data(), n);
+    }
+    ModLU serial(mont, n, n, a, 1);
+    ModLU threaded(mont, n, n, a, 3);
+    const auto x = threaded.solve(b);
+    bool ok = threaded.rank() == serial.rank() && threaded.determinant() == serial.determinant() &&
+              threaded.permutation() == serial.permutation() && x;
+    for (size_t i = 0; ok && i < n; ++i) {
+      ok = mont.dot(a.data() + i * n, x->data(), n) == b[i];
+    }
+    if (!ok) {
+      std::cout << "p=" << p << ", n=" << n << ", rank=" << threaded.rank() << ", serial_rank=" << serial.rank()
+                << "\n";
+      throw std::runtime_error("Threaded modular LU test failed.");
+    }
+  }
+}
+
+// Factorization time of a random n x n matrix over a 31-bit prime, and one solve with it
+void bench_mod_lu(std::mt19937& gen)
+{
+  const uint32_t p = 2147483647;
+  Montgomery mont(p);
+  std::uniform_int_distribution<uint32_t> distr(0, p - 1);
+  for (const size_t n : {500, 1000, 2000, 4000}) {
+    MontVector a(n * n), b(n);
+    for (auto& x : a) {
+      x = distr(gen);
+    }
+    for (auto& x : b) {
+      x = distr(gen);
+    }
+    auto start = std::chrono::steady_clock::now();
+    ModLU lu(mont, n, n, std::move(a));
+    const double lu_ms = elapsed_ms(start);
+    start = std::chrono::steady_clock::now();
+    const auto x = lu.solve(b);
+    const double solve_ms = elapsed_ms(start);
+    // n^3 / 3 multiply-adds in the factorization
+    std::cout << "mod_lu n=" << n << ", rank=" << lu.rank() << ", lu_ms=" << lu_ms << ", solve_ms=" << solve_ms
+              << ", gmacs=" << n * n * (n / 3.0) / (lu_ms * 1e6) << (x ? "" : " (singular)") << "\n";
+  }
+}
+
+/// @brief Sparse matrix over Z_n in sliced ELL layout (SELL-16-sigma), coefficients in Montgomery form
+/// Rows go 16 to a slice, each slice padded to its longest row and stored lane-interleaved so one vector lane walks
+/// one row. Rows are sorted by length inside windows of sort_window rows, which keeps padding low while the
+/// x accesses of neighbouring slices stay local. Every row accumulates in 64 bits, one REDC per row.
+class SparseMatrix {
+public:
+  // Coefficient in normal form, duplicates are summed
+  struct Entry {
+    uint32_t row;
+    uint32_t col;
+    uint32_t value;
+  };
+
+  SparseMatrix(Montgomery& _mont, const size_t _rows, const size_t _cols, std::vector<Entry> entries)
+    : mont(_mont), rows(_rows), cols(_cols)
+  {
+    if (rows == 0 || cols == 0 || cols > UINT32_MAX) {
+      std::cout << "rows=" << rows << ", cols=" << cols << "\n";
+      throw std::invalid_argument("Invalid sparse matrix shape.");
+    }
+    if (mont.lazy_max_terms() == 0) {
+      std::cout << "n=" << mont.modulus() << "\n";
+      throw std::invalid_argument("Modulus too large for deferred reduction.");
+    }
+    // CSR first, merging duplicates and dropping zeros
+    std::sort(entries.begin(), entries.end(), [](const Entry& x, const Entry& y) {
+      return x.row != y.row ? x.row < y.row : x.col < y.col;
+    });
+    std::vector<size_t> row_ptr(rows + 1);
+    std::vector<uint32_t> csr_cols;
+    MontVector csr_values;
+    for (size_t i = 0; i < entries.size();) {
+      const Entry& entry = entries[i];
+      if (entry.row >= rows || entry.col >= cols) {
+        std::cout << "row=" << entry.row << ", col=" << entry.col << "\n";
+        throw std::invalid_argument("Sparse matrix entry out of range.");
+      }
+      uint32_t value = 0;
+      for (; i < entries.size() && entries[i].row == entry.row && entries[i].col == entry.col; ++i) {
+        value = mont.add(value, mont.convert_in(entries[i].value));
+      }
+      if (value != 0) {
+        csr_cols.push_back(entry.col);
+        csr_values.push_back(value);
+        ++row_ptr[entry.row + 1];
+      }
+    }
+    std::partial_sum(row_ptr.begin(), row_ptr.end(), row_ptr.begin());
+    nnz = csr_values.size();
+
+    // Longest rows first inside each window
+    order.resize((rows + 15) / 16 * 16);
+    std::iota(order.begin(), order.end(), 0);
+    auto length = [&](const size_t i) { return i < rows ? row_ptr[i + 1] - row_ptr[i] : 0; };
+    for (size_t w = 0; w < order.size(); w += sort_window) {
+      std::stable_sort(order.begin() + w, order.begin() + std::min(order.size(), w + sort_window),
+                       [&](const size_t x, const size_t y) { return length(x) > length(y); });
+    }
+    const size_t num_slices = order.size() / 16;
+    slice_ptr.assign(num_slices + 1, 0);
+    for (size_t s = 0; s < num_slices; ++s) {
+      size_t width = 0;
+      for (size_t l = 0; l < 16; ++l) {
+        width = std::max(width, length(order[16 * s + l]));
+      }
+      slice_ptr[s + 1] = slice_ptr[s] + 16 * width;
+    }
+    values.assign(slice_ptr.back(), 0);
+    col_idx.assign(slice_ptr.back(), 0);
+    for (size_t s = 0; s < num_slices; ++s) {
+      for (size_t l = 0; l < 16; ++l) {
+        const size_t row = order[16 * s + l];
+        for (size_t j = 0; j < length(row); ++j) {
+          values[slice_ptr[s] + 16 * j + l] = csr_values[row_ptr[row] + j];
+          col_idx[slice_ptr[s] + 16 * j + l] = csr_cols[row_ptr[row] + j];
+        }
+      }
+    }
+  }
+
+  size_t num_rows() const
+  {
+    return rows;
+  }
+
+  size_t num_cols() const
+  {
+    return cols;
+  }
+
+  size_t nonzeros() const
+  {
+    return nnz;
+  }
+
+  // Stored entries over nonzeros, the cost of the slice padding
+  double fill_ratio() const
+  {
+    return nnz == 0 ? 1.0 : static_cast<double>(values.size()) / nnz;
+  }
+
+  // y = A x, Montgomery form in and out, slices spread over threads
+  void multiply(const MontVector& x, MontVector& y, const size_t num_threads = 0)
+  {
+    if (x.size() != cols) {
+      std::cout << "cols=" << cols << ", x=" << x.size() << "\n";
+      throw std::invalid_argument("Vector does not match the matrix.");
+    }
+    const MontKernels& kernels = mont.batch_kernels();
+    const size_t num_slices = slice_ptr.size() - 1;
+    MontVector sorted(order.size());
+    // Thread start-up costs about as much as 2^18 nonzeros
+    parallel_for(0, num_slices, [&](const size_t begin, const size_t end) {
+      kernels.sell_matvec(mont, values.data(), col_idx.data(), slice_ptr.data() + begin, end - begin, x.data(),
+                          sorted.data() + 16 * begin);
+    }, values.size() < (1 << 18) ? 1 : num_threads);
+    y.resize(rows);
+    for (size_t i = 0; i < order.size(); ++i) {
+      if (order[i] < rows) {
+        y[order[i]] = sorted[i];
+      }
+    }
+  }
+
+private:
+  static constexpr size_t sort_window = 1024;
+
+  Montgomery& mont;
+  size_t rows;
+  size_t cols;
+  size_t nnz;
+  // order[i] is the matrix row in slice lane i, padding rows are >= rows
+  std::vector<size_t> order;
+  std::vector<size_t> slice_ptr;
+  std::vector<uint32_t> col_idx;
+  MontVector values;
+};
+
+/// @brief Wiedemann solver for sparse nonsingular square systems over Z_p, p prime
+/// The minimal polynomial f of A comes from Berlekamp-Massey on s_i = u^T A^i v for random u, v. With it every
+/// right-hand side is solved by Horner, x = -f_0^-1 (f_1 b + f_2 A b + ... + f_d A^(d-1) b). About 2d + d mat-vecs,
+/// d <= rows. Scalar Wiedemann only: the 2d-term sequence and Berlekamp-Massey are one serial chain, threads only
+/// split each mat-vec and, with several right-hand sides, the Horner solves. Block Wiedemann (matrix generator)
+/// would split the sequence itself and is not implemented.
+class Wiedemann {
+public:
+  Wiedemann(Montgomery& _mont, SparseMatrix& _a, const size_t _num_threads = 0)
+    : mont(_mont), a(_a), num_threads(_num_threads)
+  {
+    if (a.num_rows() != a.num_cols()) {
+      std::cout << "rows=" << a.num_rows() << ", cols=" << a.num_cols() << "\n";
+      throw std::invalid_argument("Wiedemann needs a square matrix.");
+    }
+  }
+
+  // Coefficients f_0 ... f_d, monic, empty until the first solve
+  const MontVector& minimal_polynomial() const
+  {
+    return minpoly;
+  }
+
+  MontVector solve(const MontVector& b, std::mt19937& gen)
+  {
+    return solve(std::vector<MontVector>{b}, gen)[0];
+  }
+
+  // A x_j = b_j for every j. Each solution is checked, a failure (an unlucky projection gave a proper factor of
+  // the minimal polynomial) reruns once with fresh randomness.
+  std::vector<MontVector> solve(const std::vector<MontVector>& b, std::mt19937& gen)
+  {
+    for (size_t attempt = 0; attempt < 2; ++attempt) {
+      if (minpoly.empty() || attempt > 0) {
+        minpoly = find_minimal_polynomial(gen);
+      }
+      // Only a projection orthogonal to the whole Krylov space gives a constant
+      if (minpoly.size() < 2) {
+        continue;
+      }
+      if (minpoly[0] == 0) {
+        throw std::runtime_error("Wiedemann: singular matrix.");
+      }
+      std::vector<MontVector> x(b.size());
+      // One flag per byte, threads write them concurrently
+      std::vector<uint8_t> ok(b.size());
+      // One thread per right-hand side when there are several, otherwise the mat-vec takes them
+      const size_t inner_threads = b.size() > 1 ? 1 : num_threads;
+      parallel_for(0, b.size(), [&](const size_t begin, const size_t end) {
+        for (size_t j = begin; j < end; ++j) {
+          x[j] = horner(b[j], inner_threads);
+          MontVector check;
+          a.multiply(x[j], check, inner_threads);
+          ok[j] = check == b[j];
+        }
+      }, num_threads);
+      if (std::all_of(ok.begin(), ok.end(), [](const uint8_t v) { return v != 0; })) {
+        return x;
+      }
+    }
+    throw std::runtime_error("Wiedemann: no solution found, matrix is probably singular.");
+  }
+
+private:
+  // Stop once the generator has predicted this many further terms, each accepted by chance with probability 1/p
+  static constexpr size_t margin = 8;
+
+  // -f_0^-1 (f_1 b + f_2 A b + ... + f_d A^(d-1) b)
+  MontVector horner(const MontVector& b, const size_t threads)
+  {
+    const size_t d = minpoly.size() - 1;
+    const size_t len = b.size();
+    MontVector y(len), t;
+    for (size_t i = 0; i < len; ++i) {
+      y[i] = mont.multiply(minpoly[d], b[i]);
+    }
+    for (size_t k = d - 1; k >= 1; --k) {
+      a.multiply(y, t, threads);
+      for (size_t i = 0; i < len; ++i) {
+        y[i] = mont.mul_add(minpoly[k], b[i], t[i]);
+      }
+    }
+    const uint32_t scale = mont.sub(0, mont.inverse(minpoly[0]));
+    for (size_t i = 0; i < len; ++i) {
+      y[i] = mont.multiply(y[i], scale);
+    }
+    return y;
+  }
+
+  // Berlekamp-Massey on the projected Krylov sequence, one term per mat-vec
+  MontVector find_minimal_polynomial(std::mt19937& gen)
+  {
+    const size_t n = a.num_rows();
+    std::uniform_int_distribution<uint32_t> distr(0, mont.modulus() - 1);
+    MontVector u(n), w(n), next;
+    for (size_t i = 0; i < n; ++i) {
+      u[i] = distr(gen);
+      w[i] = distr(gen);
+    }
+    // Connection polynomial c (c[0] = 1) of length l, prev the one before the last length change
+    MontVector seq, c = {mont.one()}, prev = {mont.one()};
+    size_t l = 0, shift = 1;
+    uint32_t prev_disc = mont.one();
+    for (size_t i = 0; i < 2 * n && i < 2 * l + margin; ++i) {
+      seq.push_back(mont.dot(u.data(), w.data(), n));
+      a.multiply(w, next, num_threads);
+      std::swap(w, next);
+      // Discrepancy sum_j c[j] seq[i - j], one REDC
+      uint64_t acc = 0;
+      for (size_t j = 0; j <= l; ++j) {
+        acc = mont.lazy_fold(acc + static_cast<uint64_t>(c[j]) * seq[i - j]);
+      }
+      const uint32_t disc = mont.REDC_wide(acc);
+      if (disc == 0) {
+        ++shift;
+        continue;
+      }
+      const uint32_t coef = mont.multiply(disc, mont.inverse(prev_disc));
+      const MontVector old = c;
+      c.resize(std::max(c.size(), prev.size() + shift), 0);
+      for (size_t j = 0; j < prev.size(); ++j) {
+        c[j + shift] = mont.sub(c[j + shift], mont.multiply(coef, prev[j]));
+      }
+      if (2 * l <= i) {
+        l = i + 1 - l;
+        prev = old;
+        prev_disc = disc;
+        shift = 1;
+      } else {
+        ++shift;
+      }
+    }
+    // f(x) = x^l c(1/x)
+    c.resize(l + 1, 0);
+    return MontVector(c.rbegin(), c.rend());
+  }
+
+  Montgomery& mont;
+  SparseMatrix& a;
+  size_t num_threads;
+  MontVector minpoly;
+};
+
+void test_sparse(std::mt19937& gen)
+{
+  for (const uint32_t p : {998244353U, 2147483647U}) {
+    Montgomery mont(p);
+    std::uniform_int_distribution<uint32_t> distr(0, p - 1);
+    // Rectangular, with empty rows, duplicate and zero entries, rows of very different lengths
+    const size_t rows = 300, cols = 170;
+    std::vector<SparseMatrix::Entry> entries;
+    for (uint32_t i = 0; i < rows; ++i) {
+      const size_t count = i % 7 == 3 ? 0 : i % 50 == 0 ? 120 : gen() % 9;
+      for (size_t t = 0; t < count; ++t) {
+        entries.push_back({i, static_cast<uint32_t>(gen() % cols), distr(gen)});
+      }
+    }
+    entries.push_back(entries.front());
+    entries.push_back({1, 0, 0});
+    SparseMatrix a(mont, rows, cols, entries);
+    std::vector<uint64_t> x(cols);
+    MontVector x_(cols);
+    for (size_t j = 0; j < cols; ++j) {
+      x[j] = distr(gen);
+      x_[j] = mont.convert_in(x[j]);
+    }
+    std::vector<uint64_t> expected(rows);
+    for (const auto& e : entries) {
+      expected[e.row] = (expected[e.row] + e.value * x[e.col]) % p;
+    }
+    MontVector y;
+    a.multiply(x_, y);
+    for (size_t i = 0; i < rows; ++i) {
+      if (mont.convert_out(y[i]) != expected[i]) {
+        std::cout << "p=" << p << ", row=" << i << "\n";
+        throw std::runtime_error("Sparse mat-vec test failed.");
+      }
+    }
+
+    // Random sparse system, nonzero diagonal, three right-hand sides
+    const size_t n = 200;
+    entries.clear();
+    for (uint32_t i = 0; i < n; ++i) {
+      entries.push_back({i, i, 1 + distr(gen) % (p - 1)});
+      for (size_t t = 0; t < 4; ++t) {
+        entries.push_back({i, static_cast<uint32_t>(gen() % n), distr(gen)});
+      }
+    }
+    SparseMatrix m(mont, n, n, entries);
+    std::vector<MontVector> b(3, MontVector(n));
+    for (auto& v : b) {
+      for (auto& e : v) {
+        e = distr(gen);
+      }
+    }
+    // Three threads take the right-hand sides side by side even on one core
+    for (const size_t threads : {1, 3}) {
+      Wiedemann solver(mont, m, threads);
+      const auto solutions = solver.solve(b, gen);
+      for (size_t j = 0; j < b.size(); ++j) {
+        std::vector<uint64_t> lhs(n);
+        for (const auto& e : entries) {
+          lhs[e.row] = (lhs[e.row] + static_cast<uint64_t>(e.value) * mont.convert_out(solutions[j][e.col])) % p;
+        }
+        for (size_t i = 0; i < n; ++i) {
+          if (lhs[i] != mont.convert_out(b[j][i])) {
+            std::cout << "p=" << p << ", threads=" << threads << ", rhs=" << j << ", row=" << i << "\n";
+            throw std::runtime_error("Wiedemann solver test failed.");
+          }
+        }
+      }
+    }
+  }
+}
+
+// Nonzeros per second of y = A x, and one Wiedemann solve
+void bench_sparse(std::mt19937& gen)
+{
+  const uint32_t p = 2147483647;
+  Montgomery mont(p);
+  std::uniform_int_distribution<uint32_t> distr(0, p - 1);
+  const size_t n = size_t(1) << 20;
+  const size_t per_row = 16;
+  std::vector<SparseMatrix::Entry> entries;
+  for (uint32_t i = 0; i < n; ++i) {
+    // Mostly near the diagonal with some far columns, lengths varying from 8 to 24
+    const size_t count = per_row / 2 + gen() % per_row;
+    for (size_t t = 0; t < count; ++t) {
+      const uint32_t col = t % 4 == 0 ? gen() % n : (i + gen() % 4096) % n;
+      entries.push_back({i, col, distr(gen)});
+    }
+  }
+  SparseMatrix a(mont, n, n, entries);
+  MontVector x(n), y;
+  for (auto& e : x) {
+    e = distr(gen);
+  }
+  const size_t reps = 20;
+  for (const size_t threads : {size_t(1), size_t(std::max(1U, std::thread::hardware_concurrency()))}) {
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < reps; ++r) {
+      a.multiply(x, y, threads);
+    }
+    std::cout << "sparse isa=" << montgomery_kernels().isa << ", threads=" << threads << ", nnz=" << a.nonzeros()
+              << ", fill=" << a.fill_ratio() << ", gnnz_per_s=" << a.nonzeros() * reps / elapsed_ms(start) / 1e6
+              << "\n";
+  }
+
+  const size_t m = 3000;
+  entries.clear();
+  for (uint32_t i = 0; i < m; ++i) {
+    entries.push_back({i, i, 1 + distr(gen) % (p - 1)});
+    for (size_t t = 0; t < 10; ++t) {
+      entries.push_back({i, static_cast<uint32_t>(gen() % m), distr(gen)});
+    }
+  }
+  SparseMatrix s(mont, m, m, entries);
+  Wiedemann solver(mont, s);
+  MontVector b(m);
+  for (auto& e : b) {
+    e = distr(gen);
+  }
+  const auto start = std::chrono::steady_clock::now();
+  solver.solve(b, gen);
+  std::cout << "wiedemann n=" << m << ", nnz=" << s.nonzeros() << ", degree=" << solver.minimal_polynomial().size() - 1
+            << ", ms=" << elapsed_ms(start) << "\n";
+}
+
+/// @brief Chinese remainder reconstruction for a fixed set of pairwise coprime moduli (Garner's algorithm)
+/// x = v_0 + v_1 p_0 + v_2 p_0 p_1 + ..., v_i = (r_i - (v_0 + v_1 p_0 + ...)) * (p_0 ... p_(i-1))^-1 mod p_i
+/// Every Garner coefficient is precomputed in Montgomery form, so reconstruction never inverts anything.
+/// Residues are taken in Montgomery form, as they come out of NTT or RNS arithmetic, one array per modulus.
+class CRT {
+public:
+  CRT(const std::vector<uint32_t>& _primes) : primes(_primes)
+  {
+    if (primes.empty()) {
+      throw std::invalid_argument("CRT needs at least one modulus.");
+    }
+    for (const uint32_t p : primes) {
+      // A deferred sum adds digits of one modulus times coefficients of another, both must stay below 2^31
+      if (p > INT32_MAX) {
+        std::cout << "p=" << p << "\n";
+        throw std::invalid_argument("CRT moduli must be less than 2^31.");
+      }
+      monts.emplace_back(p);
+    }
+    const size_t k = primes.size();
+    coeffs.resize(k);
+    inv.resize(k);
+    for (size_t i = 0; i < k; ++i) {
+      Montgomery& mont = monts[i];
+      // coeffs[i][j] = p_0 ... p_(j-1) mod p_i, times R^2 so that dot() lands in Montgomery form
+      uint32_t prod = mont.one();
+      for (size_t j = 0; j < i; ++j) {
+        coeffs[i].push_back(mont.convert_in(prod));
+        prod = mont.multiply(prod, mont.convert_in(primes[j]));
+      }
+      // (p_0 ... p_(i-1))^-1 mod p_i in normal form, multiply() with a Montgomery form value gives normal form
+      inv[i] = mont.convert_out(mont.inverse(prod));
+    }
+    bits = 0;
+    for (const uint32_t p : primes) {
+      bits += bit_length(p);
+    }
+  }
+
+  // 64-bit limbs needed for any value below p_0 ... p_(k-1)
+  size_t limbs() const
+  {
+    return (bits + 63) / 64;
+  }
+
+  // Mixed radix digits v_i, digits[i * count + idx] for tuple idx
+  void mixed_radix(const std::vector<const uint32_t*>& residues, uint32_t* digits, const size_t count)
+  {
+    check_residues(residues);
+    mixed_radix_rows(residues, digits, count);
+  }
+
+  // Exact when the product of the moduli is below 2^64, otherwise the result mod 2^64
+  void reconstruct_u64(const std::vector<const uint32_t*>& residues, uint64_t* out, const size_t count)
+  {
+    for_each_block(residues, count, [&](const uint32_t* digits, const size_t block, const size_t begin) {
+      for (size_t idx = 0; idx < block; ++idx) {
+        uint64_t x = 0;
+        for (size_t i = primes.size(); i-- > 0;) {
+          x = x * primes[i] + digits[i * block + idx];
+        }
+        out[begin + idx] = x;
+      }
+    });
+  }
+
+  void reconstruct_u128(const std::vector<const uint32_t*>& residues, unsigned __int128* out, const size_t count)
+  {
+    for_each_block(residues, count, [&](const uint32_t* digits, const size_t block, const size_t begin) {
+      for (size_t idx = 0; idx < block; ++idx) {
+        unsigned __int128 x = 0;
+        for (size_t i = primes.size(); i-- > 0;) {
+          x = x * primes[i] + digits[i * block + idx];
+        }
+        out[begin + idx] = x;
+      }
+    });
+  }
+
+  // limbs() little endian 64-bit limbs per value, out[idx * limbs() + l]
+  void reconstruct_limbs(const std::vector<const uint32_t*>& residues, uint64_t* out, const size_t count)
+  {
+    const size_t num_limbs = limbs();
+    for_each_block(residues, count, [&](const uint32_t* digits, const size_t block, const size_t begin) {
+      for (size_t idx = 0; idx < block; ++idx) {
+        uint64_t* x = out + (begin + idx) * num_limbs;
+        std::fill(x, x + num_limbs, 0);
+        for (size_t i = primes.size(); i-- > 0;) {
+          // x = x * p_i + v_i
+          unsigned __int128 carry = digits[i * block + idx];
+          for (size_t l = 0; l < num_limbs; ++l) {
+            carry += static_cast<unsigned __int128>(x[l]) * primes[i];
+            x[l] = static_cast<uint64_t>(carry);
+            carry >>= 64;
+          }
+        }
+      }
+    });
+  }
+
+  // x mod q straight from the mixed radix digits, in Montgomery form of target
+  void reconstruct_mod(const std::vector<const uint32_t*>& residues, Montgomery& target, uint32_t* out,
+                       const size_t count)
+  {
+    if (target.modulus() > INT32_MAX) {
+      std::cout << "q=" << target.modulus() << "\n";
+      throw std::invalid_argument("CRT target modulus must be less than 2^31.");
+    }
+    // p_0 ... p_(i-1) mod q, times R^2
+    MontVector radix;
+    uint32_t prod = target.one();
+    for (const uint32_t p : primes) {
+      radix.push_back(target.convert_in(prod));
+      prod = target.multiply(prod, target.convert_in(p));
+    }
+    for_each_block(residues, count, [&](const uint32_t* digits, const size_t block, const size_t begin) {
+      for (size_t idx = 0; idx < block; ++idx) {
+        uint64_t acc = 0;
+        for (size_t i = 0; i < primes.size(); ++i) {
+          acc = target.lazy_fold(acc + static_cast<uint64_t>(radix[i]) * digits[i * block + idx]);
+        }
+        out[begin + idx] = target.REDC_wide(acc);
+      }
+    });
+  }
+
+private:
+  // Mixed radix conversion in blocks that keep the digits in L1
+  template <typename F>
+  void for_each_block(const std::vector<const uint32_t*>& residues, const size_t count, F fn)
+  {
+    check_residues(residues);
+    const size_t k = primes.size();
+    const size_t block_size = tuning().crt_block;
+    std::vector<uint32_t> digits(k * block_size);
+    std::vector<const uint32_t*> block_residues(k);
+    for (size_t begin = 0; begin < count; begin += block_size) {
+      const size_t block = std::min(block_size, count - begin);
+      for (size_t i = 0; i < k; ++i) {
+        block_residues[i] = residues[i] + begin;
+      }
+      mixed_radix_rows(block_residues, digits.data(), block);
+      fn(digits.data(), block, begin);
+    }
+  }
+
+  // One digit row at a time across all tuples, every step a kernel table batch op:
+  // t = sum_j coeffs[i][j] v_j by combine_rows, then v_i = r_i inv_i - t inv_i by multiply_batch and mul_sub_batch
+  void mixed_radix_rows(const std::vector<const uint32_t*>& residues, uint32_t* digits, const size_t count)
+  {
+    const size_t k = primes.size();
+    std::vector<uint32_t> reduced((k - 1) * count);
+    std::vector<const uint32_t*> rows(k);
+    std::vector<uint32_t> t(count);
+    std::vector<uint32_t> inv_row(count);
+    for (size_t i = 0; i < k; ++i) {
+      Montgomery& mont = monts[i];
+      const uint32_t p = primes[i];
+      const MontKernels& kernels = mont.batch_kernels();
+      // Digits of the other moduli may exceed p_i, the deferred sum needs them below it
+      for (size_t j = 0; j < i; ++j) {
+        const uint32_t* v = digits + j * count;
+        if (primes[j] <= p) {
+          rows[j] = v;
+          continue;
+        }
+        uint32_t* w = reduced.data() + j * count;
+        if (primes[j] - p < p) {
+          for (size_t idx = 0; idx < count; ++idx) {
+            w[idx] = v[idx] >= p ? v[idx] - p : v[idx];
+          }
+        } else {
+          for (size_t idx = 0; idx < count; ++idx) {
+            w[idx] = v[idx] % p;
+          }
+        }
+        rows[j] = w;
+      }
+      uint32_t* v = digits + i * count;
+      kernels.combine_rows(mont, coeffs[i].data(), rows.data(), i, 0, t.data(), count);
+      std::fill(inv_row.begin(), inv_row.end(), inv[i]);
+      kernels.multiply_batch(mont, t.data(), inv_row.data(), t.data(), count);
+      kernels.mul_sub_batch(mont, residues[i], inv_row.data(), t.data(), v, count);
+    }
+  }
+
+  // One residue array per modulus
+  void check_residues(const std::vector<const uint32_t*>& residues) const
+  {
+    if (residues.size() != primes.size()) {
+      std::cout << "residues=" << residues.size() << ", primes=" << primes.size() << "\n";
+      throw std::invalid_argument("Residue count does not match the CRT moduli.");
+    }
+  }
+
+  std::vector<uint32_t> primes;
+  std::vector<Montgomery> monts;
+  std::vector<MontVector> coeffs;
+  MontVector inv;
+  uint32_t bits;
+};
+
+// x mod p for a little endian multi-limb x
+uint32_t limbs_mod(const uint64_t* x, const size_t num_limbs, const uint32_t p)
+{
+  unsigned __int128 rem = 0;
+  for (size_t l = num_limbs; l-- > 0;) {
+    rem = ((rem << 64) | x[l]) % p;
+  }
+  return static_cast<uint32_t>(rem);
+}
+
+void test_crt(std::mt19937& gen)
+{
+  const std::vector<uint32_t> primes = {2013265921, 469762049, 998244353, 167772161, 754974721};
+  const size_t count = 3000;
+  CRT crt(primes);
+  const size_t num_limbs = crt.limbs();
+  std::uniform_int_distribution<uint64_t> distr;
+
+  // Random values below 2^140 < p_0 ... p_4
+  std::vector<uint64_t> values(count * num_limbs);
+  for (size_t idx = 0; idx < count; ++idx) {
+    for (size_t l = 0; l < num_limbs; ++l) {
+      values[idx * num_limbs + l] = distr(gen);
+    }
+    values[idx * num_limbs + 2] &= (1U << 12) - 1;
+  }
+  std::vector<MontVector> residues(primes.size(), MontVector(count));
+  std::vector<const uint32_t*> residue_ptrs;
+  for (size_t i = 0; i < primes.size(); ++i) {
+    Montgomery mont(primes[i]);
+    for (size_t idx = 0; idx < count; ++idx) {
+      residues[i][idx] = mont.convert_in(limbs_mod(&values[idx * num_limbs], num_limbs, primes[i]));
+    }
+    residue_ptrs.push_back(residues[i].data());
+  }
+
+  std::vector<uint64_t> limbs(count * num_limbs);
+  crt.reconstruct_limbs(residue_ptrs, limbs.data(), count);
+  if (limbs != values) {
+    throw std::runtime_error("CRT multi-limb reconstruction test failed.");
+  }
+  bool rejected = false;
+  try {
+    crt.reconstruct_limbs({residue_ptrs.begin(), residue_ptrs.end() - 1}, limbs.data(), count);
+  } catch (const std::invalid_argument&) {
+    rejected = true;
+  }
+  if (!rejected) {
+    throw std::runtime_error("CRT reconstruction accepted a short residue list.");
+  }
+
+  Montgomery target(1000003);
+  MontVector mod_out(count);
+  crt.reconstruct_mod(residue_ptrs, target, mod_out.data(), count);
+  for (size_t idx = 0; idx < count; ++idx) {
+    if (target.convert_out(mod_out[idx]) != limbs_mod(&values[idx * num_limbs], num_limbs, 1000003)) {
+      std::cout << "idx=" << idx << "\n";
+      throw std::runtime_error("CRT reconstruction to another modulus test failed.");
+    }
+  }
+
+  // The first three moduli with values below 2^88, and the first two below 2^59
+  CRT crt3(std::vector<uint32_t>(primes.begin(), primes.begin() + 3));
+  CRT crt2(std::vector<uint32_t>(primes.begin(), primes.begin() + 2));
+  for (size_t idx = 0; idx < count; ++idx) {
+    values[idx * num_limbs + 1] &= (1U << 24) - 1;
+    values[idx * num_limbs + 2] = 0;
+    for (size_t i = 0; i < primes.size(); ++i) {
+      Montgomery mont(primes[i]);
+      residues[i][idx] = mont.convert_in(limbs_mod(&values[idx * num_limbs], num_limbs, primes[i]));
+    }
+  }
+  std::vector<unsigned __int128> out128(count);
+  crt3.reconstruct_u128({residue_ptrs.begin(), residue_ptrs.begin() + 3}, out128.data(), count);
+  for (size_t idx = 0; idx < count; ++idx) {
+    const uint64_t* x = &values[idx * num_limbs];
+    if (out128[idx] != ((static_cast<unsigned __int128>(x[1]) << 64) | x[0])) {
+      std::cout << "idx=" << idx << "\n";
+      throw std::runtime_error("CRT 128-bit reconstruction test failed.");
+    }
+  }
+  for (size_t idx = 0; idx < count; ++idx) {
+    values[idx * num_limbs] >>= 5;
+  }
+  for (size_t i = 0; i < 2; ++i) {
+    Montgomery mont(primes[i]);
+    for (size_t idx = 0; idx < count; ++idx) {
+      residues[i][idx] = mont.convert_in(values[idx * num_limbs] % primes[i]);
+    }
+  }
+  std::vector<uint64_t> out64(count);
+  crt2.reconstruct_u64({residue_ptrs.begin(), residue_ptrs.begin() + 2}, out64.data(), count);
+  for (size_t idx = 0; idx < count; ++idx) {
+    if (out64[idx] != values[idx * num_limbs]) {
+      std::cout << "idx=" << idx << "\n";
+      throw std::runtime_error("CRT 64-bit reconstruction test failed.");
+    }
+  }
+}
+
+void bench_crt(std::mt19937& gen)
+{
+  const std::vector<uint32_t> primes = {2013265921, 469762049, 998244353};
+  const size_t count = size_t(1) << 22;
+  CRT crt(primes);
+  std::vector<MontVector> residues;
+  std::vector<const uint32_t*> residue_ptrs;
+  for (const uint32_t p : primes) {
+    std::uniform_int_distribution<uint32_t> distr(0, p - 1);
+    MontVector r(count);
+    for (auto& x : r) {
+      x = distr(gen);
+    }
+    residues.push_back(std::move(r));
+    residue_ptrs.push_back(residues.back().data());
+  }
+  std::vector<unsigned __int128> out128(count);
+  auto start = std::chrono::steady_clock::now();
+  crt.reconstruct_u128(residue_ptrs, out128.data(), count);
+  std::cout << "crt 3 primes to u128, mtuples_per_s=" << count / elapsed_ms(start) / 1000 << "\n";
+  Montgomery target(1000003);
+  MontVector out(count);
+  start = std::chrono::steady_clock::now();
+  crt.reconstruct_mod(residue_ptrs, target, out.data(), count);
+  std::cout << "crt 3 primes to another modulus, mtuples_per_s=" << count / elapsed_ms(start) / 1000 << "\n";
+}
+
+// Unsigned big integer, little endian 64-bit limbs
+using BigInt = std::vector<uint64_t>;
+
+void bigint_trim(BigInt& a)
+{
+  while (!a.empty() && a.back() == 0) {
+    a.pop_back();
+  }
+}
+
+// out[0, a_len + b_len) = a * b
+void bigint_mul_schoolbook(const uint64_t* a, const size_t a_len, const uint64_t* b, const size_t b_len, uint64_t* out)
+{
+  std::fill(out, out + a_len + b_len, 0);
+  for (size_t i = 0; i < a_len; ++i) {
+    unsigned __int128 carry = 0;
+    for (size_t j = 0; j < b_len; ++j) {
+      carry += static_cast<unsigned __int128>(a[i]) * b[j] + out[i + j];
+      out[i + j] = static_cast<uint64_t>(carry);
+      carry >>= 64;
+    }
+    out[i + b_len] = static_cast<uint64_t>(carry);
+  }
+}
+
+// a[0, len) += b[0, b_len), returns the carry out
+uint64_t bigint_add_into(uint64_t* a, const size_t len, const uint64_t* b, const size_t b_len)
+{
+  unsigned __int128 carry = 0;
+  for (size_t i = 0; i < len; ++i) {
+    carry += a[i];
+    if (i < b_len) {
+      carry += b[i];
+    } else if (carry >> 64 == 0) {
+      a[i] = static_cast<uint64_t>(carry);
+      return 0;
+    }
+    a[i] = static_cast<uint64_t>(carry);
+    carry >>= 64;
+  }
+  return static_cast<uint64_t>(carry);
+}
+
+// a[0, len) -= b[0, b_len), a >= b
+void bigint_sub_from(uint64_t* a, const size_t len, const uint64_t* b, const size_t b_len)
+{
+  uint64_t borrow = 0;
+  for (size_t i = 0; i < len && (i < b_len || borrow); ++i) {
+    const uint64_t bi = i < b_len ? b[i] : 0;
+    const uint64_t d = a[i] - bi - borrow;
+    borrow = (a[i] < bi) || (a[i] - bi < borrow);
+    a[i] = d;
+  }
+}
+
+// out[0, 2n) = a[0, n) * b[0, n)
+void bigint_mul_karatsuba(const uint64_t* a, const uint64_t* b, const size_t n, uint64_t* out)
+{
+  if (n <= tuning().karatsuba_threshold) {
+    bigint_mul_schoolbook(a, n, b, n, out);
+    return;
+  }
+  const size_t low = n / 2;
+  const size_t high = n - low;
+  // z0 = a0 b0, z2 = a1 b1 straight into out, z1 = (a0 + a1)(b0 + b1) - z0 - z2
+  bigint_mul_karatsuba(a, b, low, out);
+  std::fill(out + 2 * low, out + 2 * n, 0);
+  BigInt z2(2 * high);
+  bigint_mul_karatsuba(a + low, b + low, high, z2.data());
+  BigInt sa(a + low, a + n);
+  BigInt sb(b + low, b + n);
+  sa.push_back(bigint_add_into(sa.data(), high, a, low));
+  sb.push_back(bigint_add_into(sb.data(), high, b, low));
+  BigInt z1(2 * high + 2);
+  bigint_mul_karatsuba(sa.data(), sb.data(), high + 1, z1.data());
+  bigint_sub_from(z1.data(), z1.size(), out, 2 * low);
+  bigint_sub_from(z1.data(), z1.size(), z2.data(), z2.size());
+  bigint_add_into(out + 2 * low, 2 * n - 2 * low, z2.data(), z2.size());
+  bigint_add_into(out + low, 2 * n - low, z1.data(), std::min(z1.size(), 2 * n - low));
+}
+
+BigInt bigint_mul_schoolbook(const BigInt& a, const BigInt& b)
+{
+  BigInt c(a.size() + b.size());
+  bigint_mul_schoolbook(a.data(), a.size(), b.data(), b.size(), c.data());
+  bigint_trim(c);
+  return c;
+}
+
+BigInt bigint_mul_karatsuba(BigInt a, BigInt b)
+{
+  const size_t n = std::max(a.size(), b.size());
+  a.resize(n, 0);
+  b.resize(n, 0);
+  BigInt c(2 * n);
+  bigint_mul_karatsuba(a.data(), b.data(), n, c.data());
+  bigint_trim(c);
+  return c;
+}
+
+// Split into chunk_bits wide digits, each one converted to Montgomery form of mont
+MontVector bigint_to_chunks(Montgomery& mont, const BigInt& a, const uint32_t chunk_bits, const size_t size)
+{
+  MontVector chunks(size, 0);
+  const uint64_t mask = (uint64_t(1) << chunk_bits) - 1;
+  const size_t bits = a.size() * 64;
+  for (size_t i = 0, pos = 0; pos < bits; ++i, pos += chunk_bits) {
+    uint64_t x = a[pos / 64] >> (pos % 64);
+    if (pos % 64 + chunk_bits > 64 && pos / 64 + 1 < a.size()) {
+      x |= a[pos / 64 + 1] << (64 - pos % 64);
+    }
+    chunks[i] = x & mask;
+  }
+  mont.convert_in_batch(chunks.data(), chunks.data(), size);
+  return chunks;
+}
+
+// NTT friendly primes below 2^31 with transforms up to 2^25, product about 2^88
+const std::vector<uint32_t> bigint_ntt_primes = {2013265921, 469762049, 167772161};
+constexpr size_t bigint_ntt_max_size = size_t(1) << 25;
+
+// Transform length of bigint_mul_ntt() for a_limbs x b_limbs limbs
+size_t bigint_ntt_size(const size_t a_limbs, const size_t b_limbs, const uint32_t chunk_bits)
+{
+  const size_t a_chunks = (a_limbs * 64 + chunk_bits - 1) / chunk_bits;
+  const size_t b_chunks = (b_limbs * 64 + chunk_bits - 1) / chunk_bits;
+  size_t size = 1;
+  while (size < a_chunks + b_chunks - 1) {
+    size <<= 1;
+  }
+  return size;
+}
+
+/// @brief Big integer multiplication through three 31-bit prime NTTs, one thread per prime, CRT and carries
+/// @param[in] chunk_bits 16 or 20, convolution terms stay below 2^(2*chunk_bits + 25) < p_0 p_1 p_2
+BigInt bigint_mul_ntt(const BigInt& a, const BigInt& b, const uint32_t chunk_bits = 20)
+{
+  if (a.empty() || b.empty()) {
+    return {};
+  }
+  if (chunk_bits != 16 && chunk_bits != 20) {
+    throw std::invalid_argument("Chunk size must be 16 or 20 bits.");
+  }
+  const size_t size = bigint_ntt_size(a.size(), b.size(), chunk_bits);
+  if (size > bigint_ntt_max_size) {
+    std::cout << "a_limbs=" << a.size() << ", b_limbs=" << b.size() << "\n";
+    throw std::invalid_argument("Operands too large for the three-prime NTT.");
+  }
+
+  std::vector<MontVector> products(bigint_ntt_primes.size());
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < bigint_ntt_primes.size(); ++i) {
+    threads.emplace_back([&, i]() {
+      Montgomery mont(bigint_ntt_primes[i]);
+      NTT ntt(mont);
+      MontVector fa = bigint_to_chunks(mont, a, chunk_bits, size);
+      MontVector fb = bigint_to_chunks(mont, b, chunk_bits, size);
+      ntt.convolve(fa, fb);
+      products[i] = std::move(fa);
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  // CRT to 128 bits and carry propagation, chunk_bits at a time
+  CRT crt(bigint_ntt_primes);
+  std::vector<const uint32_t*> residues;
+  for (const auto& p : products) {
+    residues.push_back(p.data());
+  }
+  std::vector<unsigned __int128> coeffs(size);
+  crt.reconstruct_u128(residues, coeffs.data(), size);
+  BigInt c(a.size() + b.size(), 0);
+  unsigned __int128 carry = 0;
+  const uint64_t mask = (uint64_t(1) << chunk_bits) - 1;
+  for (size_t i = 0, pos = 0; i < size && pos < c.size() * 64; ++i, pos += chunk_bits) {
+    carry += coeffs[i];
+    const uint64_t chunk = static_cast<uint64_t>(carry) & mask;
+    carry >>= chunk_bits;
+    c[pos / 64] |= chunk << (pos % 64);
+    if (pos % 64 + chunk_bits > 64 && pos / 64 + 1 < c.size()) {
+      c[pos / 64 + 1] |= chunk >> (64 - pos % 64);
+    }
+  }
+  bigint_trim(c);
+  return c;
+}
+
+// Schoolbook, Karatsuba or NTT by the size of the operands, crossovers from tuning(). Products past the largest
+// transform (max_ntt_size, lowered only by the test) split the longer operand in halves until they fit.
+BigInt bigint_mul(const BigInt& a, const BigInt& b, const size_t max_ntt_size = bigint_ntt_max_size)
+{
+  const size_t small = std::min(a.size(), b.size());
+  const size_t large = std::max(a.size(), b.size());
+  if (small <= tuning().karatsuba_threshold) {
+    return bigint_mul_schoolbook(a, b);
+  }
+  // Karatsuba pads both operands to the larger size, only worth it when they are close
+  if (small < tuning().ntt_threshold && large <= 2 * small) {
+    return bigint_mul_karatsuba(a, b);
+  }
+  if (bigint_ntt_size(a.size(), b.size(), tuning().ntt_chunk_bits) > max_ntt_size) {
+    // x y = x_0 y + x_1 y 2^(64 half)
+    const BigInt& x = a.size() >= b.size() ? a : b;
+    const BigInt& y = a.size() >= b.size() ? b : a;
+    const size_t half = x.size() / 2;
+    BigInt x0(x.begin(), x.begin() + half);
+    bigint_trim(x0);
+    const BigInt low = bigint_mul(x0, y, max_ntt_size);
+    const BigInt high = bigint_mul(BigInt(x.begin() + half, x.end()), y, max_ntt_size);
+    BigInt c(x.size() + y.size(), 0);
+    std::copy(low.begin(), low.end(), c.begin());
+    bigint_add_into(c.data() + half, c.size() - half, high.data(), high.size());
+    bigint_trim(c);
+    return c;
+  }
+  return bigint_mul_ntt(a, b, tuning().ntt_chunk_bits);
+}
+
+BigInt random_bigint(std::mt19937& gen, const size_t limbs)
+{
+  std::uniform_int_distribution<uint64_t> distr;
+  BigInt a(limbs);
+  for (auto& x : a) {
+    x = distr(gen);
+  }
+  a.back() |= 1;
+  return a;
+}
+
+void test_bigint(std::mt19937& gen)
+{
+  for (const size_t limbs : {1, 5, 33, 100, 1000, 3001}) {
+    const BigInt a = random_bigint(gen, limbs);
+    const BigInt b = random_bigint(gen, limbs / 2 + 1);
+    const BigInt expected = bigint_mul_schoolbook(a, b);
+    if (bigint_mul_karatsuba(a, b) != expected) {
+      std::cout << "limbs=" << limbs << "\n";
+      throw std::runtime_error("Karatsuba multiplication test failed.");
+    }
+    if (bigint_mul(a, b) != expected) {
+      std::cout << "limbs=" << limbs << "\n";
+      throw std::runtime_error("Big integer multiplication test failed.");
+    }
+    for (const uint32_t chunk_bits : {16, 20}) {
+      if (bigint_mul_ntt(a, b, chunk_bits) != expected) {
+        std::cout << "limbs=" << limbs << ", chunk_bits=" << chunk_bits << "\n";
+        throw std::runtime_error("NTT big integer multiplication test failed.");
+      }
+    }
+  }
+  // All ones, the largest convolution terms
+  const BigInt ones(2000, UINT64_MAX);
+  if (bigint_mul_ntt(ones, ones) != bigint_mul_schoolbook(ones, ones)) {
+    throw std::runtime_error("NTT big integer multiplication test failed.");
+  }
+  // Lopsided, so NTT rather than Karatsuba, with transforms capped at 2^10: the product splits twice, zero limbs
+  // around the first split point
+  BigInt a = random_bigint(gen, 3001), b = random_bigint(gen, 600);
+  std::fill(a.begin() + 1400, a.begin() + 1600, 0);
+  if (bigint_mul(a, b, 1024) != bigint_mul_schoolbook(a, b) || bigint_mul(b, a, 1024) != bigint_mul(a, b)) {
+    throw std::runtime_error("Split big integer multiplication test failed.");
+  }
+}
+
+void bench_bigint(std::mt19937& gen)
+{
+  for (const size_t digits : {10000, 100000, 1000000, 10000000, 100000000}) {
+    // log2(10) bits per decimal digit
+    const size_t limbs = static_cast<size_t>(digits * 3.3219280948873623 / 64) + 1;
+    const BigInt a = random_bigint(gen, limbs);
+    const BigInt b = random_bigint(gen, limbs);
+    std::cout << "digits=" << digits;
+    auto start = std::chrono::steady_clock::now();
+    bigint_mul_ntt(a, b);
+    std::cout << ", ntt_ms=" << elapsed_ms(start);
+    if (digits <= 1000000) {
+      start = std::chrono::steady_clock::now();
+      bigint_mul_karatsuba(a, b);
+      std::cout << ", karatsuba_ms=" << elapsed_ms(start);
+    }
+    if (digits <= 100000) {
+      start = std::chrono::steady_clock::now();
+      bigint_mul_schoolbook(a, b);
+      std::cout << ", schoolbook_ms=" << elapsed_ms(start);
+    }
+    std::cout << "\n";
+  }
+}
+
+// -1 if a < b, 0 if equal, 1 if a > b, missing high limbs count as zero
+int bigint_cmp(const uint64_t* a, const size_t a_len, const uint64_t* b, const size_t b_len)
+{
+  for (size_t i = std::max(a_len, b_len); i-- > 0;) {
+    const uint64_t x = i < a_len ? a[i] : 0;
+    const uint64_t y = i < b_len ? b[i] : 0;
+    if (x != y) {
+      return x < y ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+int bigint_cmp(const BigInt& a, const BigInt& b)
+{
+  return bigint_cmp(a.data(), a.size(), b.data(), b.size());
+}
+
+// a mod m by binary long division, only used for precomputation
+BigInt bigint_mod(const BigInt& a, const BigInt& m)
+{
+  BigInt r(m.size() + 1, 0);
+  for (size_t i = a.size() * 64; i-- > 0;) {
+    // r = 2r + bit
+    uint64_t carry = (a[i / 64] >> (i % 64)) & 1;
+    for (auto& limb : r) {
+      const uint64_t next = limb >> 63;
+      limb = (limb << 1) | carry;
+      carry = next;
+    }
+    if (bigint_cmp(r, m) >= 0) {
+      bigint_sub_from(r.data(), r.size(), m.data(), m.size());
+    }
+  }
+  bigint_trim(r);
+  return r;
+}
+
+// a / d and a % d for a single limb divisor
+BigInt bigint_div_small(const BigInt& a, const uint64_t d, uint64_t* rem = nullptr)
+{
+  BigInt q(a.size());
+  unsigned __int128 r = 0;
+  for (size_t i = a.size(); i-- > 0;) {
+    r = (r << 64) | a[i];
+    q[i] = static_cast<uint64_t>(r / d);
+    r %= d;
+  }
+  if (rem) {
+    *rem = static_cast<uint64_t>(r);
+  }
+  bigint_trim(q);
+  return q;
+}
+
+/// @brief Multi-limb Montgomery arithmetic, R = 2^(64*limbs), CIOS (coarsely integrated operand scanning) REDC
+/// Residues are vectors of exactly limbs() 64-bit limbs.
+class MontgomeryMulti {
+public:
+  MontgomeryMulti(const BigInt& _n) : n(_n)
+  {
+    bigint_trim(n);
+    if (n.empty() || (n.size() == 1 && n[0] < 3)) {
+      throw std::invalid_argument("Modulus must be >= 3.");
+    }
+    if (n[0] % 2 == 0) {
+      throw std::invalid_argument("Modulus must be odd.");
+    }
+    s = n.size();
+    n_inv_mod = HenselLemma2adicRoot(64, n[0]); // -n^-1 mod 2^64
+
+    // R mod n and R^2 mod n by doubling
+    BigInt x(s + 1, 0);
+    x[0] = 1;
+    for (size_t i = 0; i < 2 * 64 * s; ++i) {
+      uint64_t carry = 0;
+      for (auto& limb : x) {
+        const uint64_t next = limb >> 63;
+        limb = (limb << 1) | carry;
+        carry = next;
+      }
+      if (bigint_cmp(x, n) >= 0) {
+        bigint_sub_from(x.data(), x.size(), n.data(), s);
+      }
+      if (i + 1 == 64 * s) {
+        r_mod_n.assign(x.begin(), x.begin() + s);
+      }
+    }
+    r2_mod_n.assign(x.begin(), x.begin() + s);
+  }
+
+  size_t limbs()
+  {
+    return s;
+  }
+
+  const BigInt& modulus()
+  {
+    return n;
+  }
+
+  const BigInt& one()
+  {
+    return r_mod_n;
+  }
+
+  // x mod n in Montgomery form, for any length of x: Horner over limbs() sized digits of x in base R
+  BigInt convert_in(const BigInt& x)
+  {
+    BigInt acc(s, 0);
+    BigInt digit(s, 0);
+    BigInt t(s + 2);
+    for (size_t top = (x.size() + s - 1) / s; top-- > 0;) {
+      // acc = acc * R + digit * R
+      mul_into(acc.data(), r2_mod_n.data(), acc.data(), t.data());
+      std::fill(digit.begin(), digit.end(), 0);
+      for (size_t i = 0; i < s && top * s + i < x.size(); ++i) {
+        digit[i] = x[top * s + i];
+      }
+      mul_into(digit.data(), r2_mod_n.data(), digit.data(), t.data());
+      add_into(acc.data(), digit.data());
+    }
+    return acc;
+  }
+
+  BigInt convert_out(const BigInt& x)
+  {
+    BigInt one_(s, 0);
+    one_[0] = 1;
+    BigInt result = multiply(x, one_);
+    bigint_trim(result);
+    return result;
+  }
+
+  BigInt multiply(const BigInt& a, const BigInt& b)
+  {
+    BigInt out(s);
+    BigInt t(s + 2);
+    mul_into(a.data(), b.data(), out.data(), t.data());
+    return out;
+  }
+
+  // Fixed window exponentiation, a and the result in Montgomery form, window 0 takes tuning().pow_window
+  BigInt pow(const BigInt& a, const BigInt& e, uint32_t window = 0)
+  {
+    if (window == 0) {
+      window = tuning().pow_window;
+    }
+    BigInt t(s + 2);
+    std::vector<BigInt> table(size_t(1) << window, BigInt(s));
+    table[0] = r_mod_n;
+    for (size_t i = 1; i < table.size(); ++i) {
+      mul_into(table[i - 1].data(), a.data(), table[i].data(), t.data());
+    }
+    BigInt result = r_mod_n;
+    const size_t bits = e.size() * 64;
+    const size_t top = (bits + window - 1) / window * window;
+    for (size_t pos = top; pos > 0;) {
+      pos -= window;
+      for (uint32_t i = 0; i < window; ++i) {
+        mul_into(result.data(), result.data(), result.data(), t.data());
+      }
+      uint32_t w = 0;
+      for (uint32_t i = 0; i < window; ++i) {
+        if (pos + i < bits && ((e[(pos + i) / 64] >> ((pos + i) % 64)) & 1)) {
+          w |= 1U << i;
+        }
+      }
+      mul_into(result.data(), table[w].data(), result.data(), t.data());
+    }
+    return result;
+  }
+
+  // out = a * b * R^-1 mod n, out may alias a or b, t holds limbs() + 2 limbs of scratch
+  void mul_into(const uint64_t* a, const uint64_t* b, uint64_t* out, uint64_t* t)
+  {
+    std::fill(t, t + s + 2, 0);
+    for (size_t i = 0; i < s; ++i) {
+      unsigned __int128 c = 0;
+      for (size_t j = 0; j < s; ++j) {
+        c += static_cast<unsigned __int128>(a[j]) * b[i] + t[j];
+        t[j] = static_cast<uint64_t>(c);
+        c >>= 64;
+      }
+      c += t[s];
+      t[s] = static_cast<uint64_t>(c);
+      t[s + 1] = static_cast<uint64_t>(c >> 64);
+
+      const uint64_t m = t[0] * n_inv_mod;
+      c = static_cast<unsigned __int128>(m) * n[0] + t[0];
+      c >>= 64;
+      for (size_t j = 1; j < s; ++j) {
+        c += static_cast<unsigned __int128>(m) * n[j] + t[j];
+        t[j - 1] = static_cast<uint64_t>(c);
+        c >>= 64;
+      }
+      c += t[s];
+      t[s - 1] = static_cast<uint64_t>(c);
+      t[s] = t[s + 1] + static_cast<uint64_t>(c >> 64);
+    }
+    if (t[s] != 0 || bigint_cmp(t, s, n.data(), s) >= 0) {
+      bigint_sub_from(t, s + 1, n.data(), s);
+    }
+    std::copy(t, t + s, out);
+  }
+
+private:
+  // a = a + b mod n
+  void add_into(uint64_t* a, const uint64_t* b)
+  {
+    const uint64_t carry = bigint_add_into(a, s, b, s);
+    if (carry || bigint_cmp(a, s, n.data(), s) >= 0) {
+      bigint_sub_from(a, s, n.data(), s);
+    }
+  }
+
+  BigInt n;
+  size_t s;
+  uint64_t n_inv_mod;
+  BigInt r_mod_n;
+  BigInt r2_mod_n;
+};
+
+// Miller-Rabin after trial division by small primes
+bool is_probable_prime(const BigInt& p, std::mt19937& gen, const uint32_t rounds = 20)
+{
+  if (p.empty() || (p.size() == 1 && p[0] < 2)) {
+    return false;
+  }
+  for (const uint32_t q : {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61, 67, 71, 73, 79, 83,
+                           89, 97, 101, 103, 107, 109, 113, 127, 131, 137, 139, 149, 151, 157, 163, 167, 173, 179}) {
+    if (limbs_mod(p.data(), p.size(), q) == 0) {
+      return p.size() == 1 && p[0] == q;
+    }
+  }
+  MontgomeryMulti mont(p);
+  BigInt p_minus_1 = p;
+  p_minus_1[0] -= 1; // p is odd
+  BigInt d = p_minus_1;
+  uint32_t r = 0;
+  while ((d[r / 64] >> (r % 64) & 1) == 0) {
+    ++r;
+  }
+  for (uint32_t i = 0; i < r; ++i) {
+    d = bigint_div_small(d, 2);
+  }
+  const BigInt minus_one = mont.convert_in(p_minus_1);
+  std::uniform_int_distribution<uint64_t> distr;
+  for (uint32_t round = 0; round < rounds; ++round) {
+    BigInt a(p.size());
+    for (auto& limb : a) {
+      limb = distr(gen);
+    }
+    BigInt x = mont.pow(mont.convert_in(a), d);
+    if (x == mont.one() || x == minus_one) {
+      continue;
+    }
+    bool composite = true;
+    for (uint32_t i = 1; i < r && composite; ++i) {
+      x = mont.multiply(x, x);
+      composite = x != minus_one;
+    }
+    if (composite) {
+      return false;
+    }
+  }
+  return true;
+}
+
+BigInt random_prime(std::mt19937& gen, const size_t bits)
+{
+  while (true) {
+    BigInt p = random_bigint(gen, (bits + 63) / 64);
+    if (bits % 64) {
+      p.back() &= (uint64_t(1) << (bits % 64)) - 1;
+    }
+    p.back() |= uint64_t(1) << ((bits - 1) % 64);
+    p[0] |= 1;
+    if (is_probable_prime(p, gen)) {
+      return p;
+    }
+  }
+}
+
+// d_i = e^-1 mod (p - 1) for a small public exponent e: (1 + k (p - 1)) / e with k = -(p - 1)^-1 mod e
+BigInt rsa_crt_exponent(const BigInt& p, const uint32_t e)
+{
+  BigInt p_minus_1 = p;
+  p_minus_1[0] -= 1;
+  const uint32_t k = e - mod_mult_inv(e, limbs_mod(p_minus_1.data(), p_minus_1.size(), e));
+  BigInt d = bigint_mul_schoolbook(p_minus_1, {k});
+  d.push_back(0);
+  bigint_add_into(d.data(), d.size(), BigInt{1}.data(), 1);
+  return bigint_div_small(d, e);
+}
+
+// Radix 2^52 kernel: out = a * b * 2^(-52 L) mod n for 8 independent lanes sharing n.
+// Residues are lane interleaved, x[k * 8 + lane] is 52-bit limb k of lane lane.
+struct Kernel52 {
+  const char* name;
+  void (*multiply)(const uint64_t* a, const uint64_t* b, uint64_t* out, const uint64_t* n, uint64_t k0, size_t L);
+};
+
+constexpr uint64_t mask52 = (uint64_t(1) << 52) - 1;
+
+// Accumulators live on the stack, enough for 8192-bit moduli
+constexpr size_t max_limbs52 = 160;
+
+// Portable fallback, same operand scanning as the SIMD kernels
+void multiply52_portable(const uint64_t* a, const uint64_t* b, uint64_t* out, const uint64_t* n, const uint64_t k0,
+                         const size_t L)
+{
+  std::vector<uint64_t> acc(L + 1);
+  for (size_t lane = 0; lane < 8; ++lane) {
+    std::fill(acc.begin(), acc.end(), 0);
+    for (size_t i = 0; i < L; ++i) {
+      const uint64_t bi = b[i * 8 + lane];
+      for (size_t j = 0; j < L; ++j) {
+        const unsigned __int128 p = static_cast<unsigned __int128>(a[j * 8 + lane]) * bi;
+        acc[j] += static_cast<uint64_t>(p) & mask52;
+        acc[j + 1] += static_cast<uint64_t>(p >> 52) & mask52;
+      }
+      const uint64_t m = ((acc[0] & mask52) * k0) & mask52;
+      for (size_t j = 0; j < L; ++j) {
+        const unsigned __int128 p = static_cast<unsigned __int128>(m) * n[j * 8];
+        acc[j] += static_cast<uint64_t>(p) & mask52;
+        acc[j + 1] += static_cast<uint64_t>(p >> 52) & mask52;
+      }
+      const uint64_t carry = acc[0] >> 52;
+      std::copy(acc.begin() + 1, acc.begin() + L + 1, acc.begin());
+      acc[L] = 0;
+      acc[0] += carry;
+    }
+    for (size_t j = 0; j < L; ++j) {
+      acc[j + 1] += acc[j] >> 52;
+      out[j * 8 + lane] = acc[j] & mask52;
+    }
+  }
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx512f,avx512ifma")))
+void multiply52_ifma(const uint64_t* a, const uint64_t* b, uint64_t* out, const uint64_t* n, const uint64_t k0,
+                     const size_t L)
+{
+  __m512i acc[max_limbs52 + 1];
+  const __m512i zero = _mm512_setzero_si512();
+  const __m512i k0_ = _mm512_set1_epi64(k0);
+  std::fill(acc, acc + L + 1, zero);
+  for (size_t i = 0; i < L; ++i) {
+    const __m512i bi = _mm512_loadu_si512(b + i * 8);
+    for (size_t j = 0; j < L; ++j) {
+      const __m512i aj = _mm512_loadu_si512(a + j * 8);
+      acc[j] = _mm512_madd52lo_epu64(acc[j], aj, bi);
+      acc[j + 1] = _mm512_madd52hi_epu64(acc[j + 1], aj, bi);
+    }
+    const __m512i m = _mm512_madd52lo_epu64(zero, acc[0], k0_);
+    for (size_t j = 0; j < L; ++j) {
+      const __m512i nj = _mm512_loadu_si512(n + j * 8);
+      acc[j] = _mm512_madd52lo_epu64(acc[j], m, nj);
+      acc[j + 1] = _mm512_madd52hi_epu64(acc[j + 1], m, nj);
+    }
+    // maskz form of the shift, the unmasked one trips -Wmaybe-uninitialized in the GCC 12 headers
+    const __m512i carry = _mm512_maskz_srli_epi64(0xFF, acc[0], 52);
+    for (size_t j = 0; j < L; ++j) {
+      acc[j] = acc[j + 1];
+    }
+    acc[L] = zero;
+    acc[0] = _mm512_add_epi64(acc[0], carry);
+  }
+  const __m512i mask = _mm512_set1_epi64(mask52);
+  for (size_t j = 0; j < L; ++j) {
+    acc[j + 1] = _mm512_add_epi64(acc[j + 1], _mm512_maskz_srli_epi64(0xFF, acc[j], 52));
+    _mm512_storeu_si512(out + j * 8, _mm512_and_si512(acc[j], mask));
+  }
+}
+
+// vpmadd52luq/huq emulated with 26-bit halves and 32x32->64 multiplies
+__attribute__((target("avx2")))
+inline void mul52_avx2(const __m256i a, const __m256i b, __m256i& lo, __m256i& hi)
+{
+  const __m256i mask26 = _mm256_set1_epi64x((1 << 26) - 1);
+  const __m256i a0 = _mm256_and_si256(a, mask26);
+  const __m256i a1 = _mm256_srli_epi64(a, 26);
+  const __m256i b0 = _mm256_and_si256(b, mask26);
+  const __m256i b1 = _mm256_srli_epi64(b, 26);
+  const __m256i mid = _mm256_add_epi64(_mm256_mul_epu32(a0, b1), _mm256_mul_epu32(a1, b0));
+  const __m256i lo_full = _mm256_add_epi64(_mm256_mul_epu32(a0, b0),
+                                           _mm256_slli_epi64(_mm256_and_si256(mid, mask26), 26));
+  lo = _mm256_and_si256(lo_full, _mm256_set1_epi64x(mask52));
+  hi = _mm256_add_epi64(_mm256_add_epi64(_mm256_mul_epu32(a1, b1), _mm256_srli_epi64(mid, 26)),
+                        _mm256_srli_epi64(lo_full, 52));
+}
+
+__attribute__((target("avx2")))
+void multiply52_avx2(const uint64_t* a, const uint64_t* b, uint64_t* out, const uint64_t* n, const uint64_t k0,
+                     const size_t L)
+{
+  // Two registers of four lanes each
+  __m256i acc[2 * (max_limbs52 + 1)];
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i k0_ = _mm256_set1_epi64x(k0);
+  std::fill(acc, acc + 2 * (L + 1), zero);
+  for (size_t i = 0; i < L; ++i) {
+    for (size_t h = 0; h < 2; ++h) {
+      const __m256i bi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i * 8 + h * 4));
+      __m256i* acc_h = acc + h * (L + 1);
+      __m256i lo, hi;
+      for (size_t j = 0; j < L; ++j) {
+        mul52_avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + j * 8 + h * 4)), bi, lo, hi);
+        acc_h[j] = _mm256_add_epi64(acc_h[j], lo);
+        acc_h[j + 1] = _mm256_add_epi64(acc_h[j + 1], hi);
+      }
+      __m256i m;
+      mul52_avx2(_mm256_and_si256(acc_h[0], _mm256_set1_epi64x(mask52)), k0_, m, hi);
+      for (size_t j = 0; j < L; ++j) {
+        mul52_avx2(m, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(n + j * 8 + h * 4)), lo, hi);
+        acc_h[j] = _mm256_add_epi64(acc_h[j], lo);
+        acc_h[j + 1] = _mm256_add_epi64(acc_h[j + 1], hi);
+      }
+      const __m256i carry = _mm256_srli_epi64(acc_h[0], 52);
+      for (size_t j = 0; j < L; ++j) {
+        acc_h[j] = acc_h[j + 1];
+      }
+      acc_h[L] = zero;
+      acc_h[0] = _mm256_add_epi64(acc_h[0], carry);
+    }
+  }
+  const __m256i mask = _mm256_set1_epi64x(mask52);
+  for (size_t h = 0; h < 2; ++h) {
+    __m256i* acc_h = acc + h * (L + 1);
+    for (size_t j = 0; j < L; ++j) {
+      acc_h[j + 1] = _mm256_add_epi64(acc_h[j + 1], _mm256_srli_epi64(acc_h[j], 52));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + j * 8 + h * 4), _mm256_and_si256(acc_h[j], mask));
+    }
+  }
+}
+#endif
+
+// Kernels the running CPU supports, best first
+std::vector<Kernel52> available_kernels52()
+{
+  std::vector<Kernel52> kernels;
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512ifma")) {
+    kernels.push_back({"avx512ifma", multiply52_ifma});
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    kernels.push_back({"avx2", multiply52_avx2});
+  }
+#endif
+  kernels.push_back({"portable", multiply52_portable});
+  return kernels;
+}
+
+/// @brief Multi-limb Montgomery arithmetic in radix 2^52, 8 independent lanes sharing one modulus
+/// R = 2^(52 L) with R > 4n, so products of values below 2n stay below 2n without a final subtraction
+/// (almost Montgomery multiplication), the exact residue is only produced by convert_out.
+class MontgomeryBatch52 {
+public:
+  static constexpr size_t lanes = 8;
+
+  MontgomeryBatch52(const BigInt& _n) : n(_n)
+  {
+    bigint_trim(n);
+    if (n.empty() || n[0] % 2 == 0) {
+      throw std::invalid_argument("Modulus must be odd.");
+    }
+    const size_t bits = n.size() * 64 - __builtin_clzll(n.back());
+    L = (bits + 2 + 51) / 52;
+    if (L > max_limbs52) {
+      throw std::invalid_argument("Modulus too large for the radix 2^52 kernels.");
+    }
+    n52 = broadcast(split52(n));
+    k0 = HenselLemma2adicRoot(52, n[0] & mask52); // -n^-1 mod 2^52
+    BigInt r2(2 * 52 * L / 64 + 1, 0);
+    r2.back() = uint64_t(1) << (2 * 52 * L % 64);
+    r2_mod_n = broadcast(split52(bigint_mod(r2, n)));
+    BigInt one_(1, 1);
+    one_limbs = broadcast(split52(one_));
+    // Follow the instruction set picked for the single-word kernels, so MONTGOMERY_ISA caps this engine too
+    const std::string isa = montgomery_kernels().isa;
+    for (const auto& k : available_kernels52()) {
+      if (isa == "avx512" || isa == k.name || std::string(k.name) == "portable") {
+        kernel = k;
+        break;
+      }
+    }
+  }
+
+  size_t limbs()
+  {
+    return L;
+  }
+
+  const char* kernel_name()
+  {
+    return kernel.name;
+  }
+
+  // Select one of available_kernels52() by name
+  void use_kernel(const std::string& name)
+  {
+    for (const auto& k : available_kernels52()) {
+      if (name == k.name) {
+        kernel = k;
+        return;
+      }
+    }
+    throw std::invalid_argument("Kernel not available on this CPU.");
+  }
+
+  // Up to 8 values below n into Montgomery form, missing lanes are zero
+  std::vector<uint64_t> convert_in(const std::vector<BigInt>& x)
+  {
+    std::vector<uint64_t> packed(L * lanes, 0);
+    for (size_t lane = 0; lane < x.size(); ++lane) {
+      const std::vector<uint64_t> limbs52 = split52(x[lane]);
+      for (size_t k = 0; k < L; ++k) {
+        packed[k * lanes + lane] = limbs52[k];
+      }
+    }
+    multiply(packed.data(), r2_mod_n.data(), packed.data());
+    return packed;
+  }
+
+  std::vector<BigInt> convert_out(const std::vector<uint64_t>& x)
+  {
+    std::vector<uint64_t> y(L * lanes);
+    multiply(x.data(), one_limbs.data(), y.data());
+    std::vector<BigInt> result(lanes);
+    for (size_t lane = 0; lane < lanes; ++lane) {
+      BigInt v((L * 52 + 63) / 64 + 1, 0);
+      for (size_t k = 0; k < L; ++k) {
+        const size_t pos = k * 52;
+        v[pos / 64] |= y[k * lanes + lane] << (pos % 64);
+        if (pos % 64 > 12) {
+          v[pos / 64 + 1] |= y[k * lanes + lane] >> (64 - pos % 64);
+        }
+      }
+      if (bigint_cmp(v, n) >= 0) {
+        bigint_sub_from(v.data(), v.size(), n.data(), n.size());
+      }
+      bigint_trim(v);
+      result[lane] = std::move(v);
+    }
+    return result;
+  }
+
+  void multiply(const uint64_t* a, const uint64_t* b, uint64_t* out)
+  {
+    kernel.multiply(a, b, out, n52.data(), k0, L);
+  }
+
+  // Fixed window exponentiation with the same exponent in every lane, window 0 takes tuning().batch_pow_window
+  std::vector<uint64_t> pow(const std::vector<uint64_t>& a, const BigInt& e, uint32_t window = 0)
+  {
+    if (window == 0) {
+      window = tuning().batch_pow_window;
+    }
+    std::vector<std::vector<uint64_t>> table(size_t(1) << window, std::vector<uint64_t>(L * lanes));
+    table[0] = convert_in(std::vector<BigInt>(lanes, BigInt(1, 1)));
+    for (size_t i = 1; i < table.size(); ++i) {
+      multiply(table[i - 1].data(), a.data(), table[i].data());
+    }
+    std::vector<uint64_t> result = table[0];
+    const size_t bits = e.size() * 64;
+    const size_t top = (bits + window - 1) / window * window;
+    for (size_t pos = top; pos > 0;) {
+      pos -= window;
+      for (uint32_t i = 0; i < window; ++i) {
+        multiply(result.data(), result.data(), result.data());
+      }
+      uint32_t w = 0;
+      for (uint32_t i = 0; i < window; ++i) {
+        if (pos + i < bits && ((e[(pos + i) / 64] >> ((pos + i) % 64)) & 1)) {
+          w |= 1U << i;
+        }
+      }
+      multiply(result.data(), table[w].data(), result.data());
+    }
+    return result;
+  }
+
+private:
+  std::vector<uint64_t> split52(const BigInt& x)
+  {
+    std::vector<uint64_t> limbs52(L, 0);
+    for (size_t k = 0; k < L; ++k) {
+      const size_t pos = k * 52;
+      if (pos / 64 >= x.size()) {
+        break;
+      }
+      uint64_t v = x[pos / 64] >> (pos % 64);
+      if (pos % 64 > 12 && pos / 64 + 1 < x.size()) {
+        v |= x[pos / 64 + 1] << (64 - pos % 64);
+      }
+      limbs52[k] = v & mask52;
+    }
+    return limbs52;
+  }
+
+  std::vector<uint64_t> broadcast(const std::vector<uint64_t>& limbs52)
+  {
+    std::vector<uint64_t> packed(L * lanes);
+    for (size_t k = 0; k < L; ++k) {
+      std::fill(packed.begin() + k * lanes, packed.begin() + (k + 1) * lanes, limbs52[k]);
+    }
+    return packed;
+  }
+
+  BigInt n;
+  size_t L;
+  std::vector<uint64_t> n52;
+  uint64_t k0;
+  std::vector<uint64_t> r2_mod_n;
+  std::vector<uint64_t> one_limbs;
+  Kernel52 kernel;
+};
+
+/// @brief RSA private key in CRT form, two or more primes p_i with exponents d_i = d mod (p_i - 1)
+/// Garner coefficients (p_0 ... p_(i-1))^-1 mod p_i are precomputed in Montgomery form (Fermat inversion).
+class RsaPrivateKey {
+public:
+  RsaPrivateKey(const std::vector<BigInt>& _primes, const std::vector<BigInt>& _exponents, const uint32_t _window = 0)
+    : primes(_primes), exponents(_exponents), window(_window)
+  {
+    if (primes.size() < 2 || primes.size() != exponents.size()) {
+      throw std::invalid_argument("RSA key needs at least two primes and one exponent per prime.");
+    }
+    for (const auto& p : primes) {
+      monts.emplace_back(p);
+      batch_monts.emplace_back(p);
+    }
+    BigInt prod = {1};
+    for (size_t i = 0; i < primes.size(); ++i) {
+      MontgomeryMulti& mont = monts[i];
+      BigInt p_minus_2 = primes[i];
+      p_minus_2[0] -= 2;
+      garner.push_back(mont.pow(mont.convert_in(prod), p_minus_2));
+      radix.push_back(prod);
+      prod = bigint_mul_schoolbook(prod, primes[i]);
+    }
+    n = prod;
+  }
+
+  const BigInt& modulus()
+  {
+    return n;
+  }
+
+  // m^d mod n: one fixed window exponentiation per prime, then Garner recombination
+  BigInt private_op(const BigInt& m)
+  {
+    std::vector<BigInt> s;
+    for (size_t i = 0; i < primes.size(); ++i) {
+      MontgomeryMulti& mont = monts[i];
+      s.push_back(mont.pow(mont.convert_in(m), exponents[i], window));
+    }
+    return recombine(s);
+  }
+
+  // Up to MontgomeryBatch52::lanes messages at once, one SIMD lane per message
+  std::vector<BigInt> private_op_lanes(const std::vector<BigInt>& messages)
+  {
+    std::vector<std::vector<BigInt>> s(messages.size());
+    for (size_t i = 0; i < primes.size(); ++i) {
+      MontgomeryMulti& mont = monts[i];
+      std::vector<BigInt> reduced;
+      for (const auto& m : messages) {
+        reduced.push_back(mont.convert_out(mont.convert_in(m)));
+      }
+      MontgomeryBatch52& batch = batch_monts[i];
+      const std::vector<BigInt> out = batch.convert_out(batch.pow(batch.convert_in(reduced), exponents[i], window));
+      for (size_t lane = 0; lane < messages.size(); ++lane) {
+        s[lane].push_back(mont.convert_in(out[lane]));
+      }
+    }
+    std::vector<BigInt> results;
+    for (const auto& s_lane : s) {
+      results.push_back(recombine(s_lane));
+    }
+    return results;
+  }
+
+  void use_kernel(const std::string& name)
+  {
+    for (auto& batch : batch_monts) {
+      batch.use_kernel(name);
+    }
+  }
+
+private:
+  // Garner recombination of s_i = m^d_i mod p_i (Montgomery form of monts[i])
+  BigInt recombine(const std::vector<BigInt>& s)
+  {
+    BigInt x = monts[0].convert_out(s[0]);
+    for (size_t i = 1; i < primes.size(); ++i) {
+      MontgomeryMulti& mont = monts[i];
+      // v_i = (s_i - x) * (p_0 ... p_(i-1))^-1 mod p_i, x += v_i p_0 ... p_(i-1)
+      const BigInt x_ = mont.convert_in(x);
+      BigInt diff = s[i];
+      if (bigint_cmp(diff, x_) < 0) {
+        bigint_add_into(diff.data(), diff.size(), mont.modulus().data(), mont.limbs());
+      }
+      bigint_sub_from(diff.data(), diff.size(), x_.data(), x_.size());
+      const BigInt v = mont.convert_out(mont.multiply(diff, garner[i]));
+      BigInt term = bigint_mul_schoolbook(v, radix[i]);
+      term.resize(std::max(term.size(), x.size()) + 1, 0);
+      bigint_add_into(term.data(), term.size(), x.data(), x.size());
+      bigint_trim(term);
+      x = std::move(term);
+    }
+    return x;
+  }
+
+  std::vector<BigInt> primes;
+  std::vector<BigInt> exponents;
+  uint32_t window;
+  std::vector<MontgomeryMulti> monts;
+  std::vector<MontgomeryBatch52> batch_monts;
+  std::vector<BigInt> garner;
+  std::vector<BigInt> radix;
+  BigInt n;
+};
+
+BigInt rsa_private_op(RsaPrivateKey& key, const BigInt& m)
+{
+  return key.private_op(m);
+}
+
+// Independent messages in groups of MontgomeryBatch52::lanes, groups spread over threads
+std::vector<BigInt> rsa_private_op_batch(RsaPrivateKey& key, const std::vector<BigInt>& messages,
+                                         const size_t num_threads = 0)
+{
+  const size_t lanes = MontgomeryBatch52::lanes;
+  std::vector<BigInt> results(messages.size());
+  parallel_for(0, (messages.size() + lanes - 1) / lanes, [&](const size_t begin, const size_t end) {
+    for (size_t g = begin; g < end; ++g) {
+      const size_t first = g * lanes;
+      const size_t last = std::min(messages.size(), first + lanes);
+      const std::vector<BigInt> out =
+        key.private_op_lanes(std::vector<BigInt>(messages.begin() + first, messages.begin() + last));
+      std::copy(out.begin(), out.end(), results.begin() + first);
+    }
+  }, num_threads);
+  return results;
+}
+
+void test_rsa(std::mt19937& gen)
+{
+  const uint32_t e = 65537;
+  const BigInt e_ = {e};
+  for (const size_t num_primes : {2, 3}) {
+    std::vector<BigInt> primes;
+    std::vector<BigInt> exponents;
+    while (primes.size() < num_primes) {
+      const BigInt p = random_prime(gen, 1024 / num_primes);
+      if (limbs_mod(p.data(), p.size(), e) != 1) {
+        primes.push_back(p);
+        exponents.push_back(rsa_crt_exponent(p, e));
+      }
+    }
+    RsaPrivateKey key(primes, exponents);
+    MontgomeryMulti mont(key.modulus());
+
+    const BigInt a = bigint_mod(random_bigint(gen, mont.limbs()), key.modulus());
+    const BigInt b = bigint_mod(random_bigint(gen, mont.limbs()), key.modulus());
+    if (mont.convert_out(mont.multiply(mont.convert_in(a), mont.convert_in(b))) !=
+        bigint_mod(bigint_mul_schoolbook(a, b), key.modulus())) {
+      throw std::runtime_error("Multi-limb Montgomery multiplication test failed.");
+    }
+
+    std::vector<BigInt> messages;
+    for (size_t i = 0; i < 4; ++i) {
+      messages.push_back(bigint_mod(random_bigint(gen, mont.limbs()), key.modulus()));
+    }
+    const std::vector<BigInt> signatures = rsa_private_op_batch(key, messages);
+    for (size_t i = 0; i < messages.size(); ++i) {
+      // s^e = m mod n
+      if (signatures[i] != rsa_private_op(key, messages[i]) ||
+          mont.convert_out(mont.pow(mont.convert_in(signatures[i]), e_)) != messages[i]) {
+        std::cout << "num_primes=" << num_primes << ", i=" << i << "\n";
+        throw std::runtime_error("RSA private operation test failed.");
+      }
+    }
+  }
+}
+
+// Every available radix 2^52 kernel against the scalar CIOS engine
+void test_batch52(std::mt19937& gen)
+{
+  for (const size_t bits : {256, 1024, 2048}) {
+    BigInt n = random_bigint(gen, bits / 64);
+    n[0] |= 1;
+    MontgomeryMulti mont(n);
+    MontgomeryBatch52 batch(n);
+    std::vector<BigInt> a;
+    std::vector<BigInt> b;
+    std::vector<BigInt> expected;
+    for (size_t lane = 0; lane < MontgomeryBatch52::lanes; ++lane) {
+      a.push_back(bigint_mod(random_bigint(gen, n.size()), n));
+      b.push_back(bigint_mod(random_bigint(gen, n.size()), n));
+      expected.push_back(mont.convert_out(mont.multiply(mont.convert_in(a[lane]), mont.convert_in(b[lane]))));
+    }
+    const BigInt e = random_bigint(gen, 2);
+    const BigInt expected_pow = mont.convert_out(mont.pow(mont.convert_in(a[0]), e));
+    for (const auto& kernel : available_kernels52()) {
+      batch.use_kernel(kernel.name);
+      const std::vector<uint64_t> a_ = batch.convert_in(a);
+      std::vector<uint64_t> c_(a_.size());
+      batch.multiply(a_.data(), batch.convert_in(b).data(), c_.data());
+      if (batch.convert_out(c_) != expected || batch.convert_out(batch.pow(a_, e))[0] != expected_pow) {
+        std::cout << "bits=" << bits << ", kernel=" << kernel.name << "\n";
+        throw std::runtime_error("Radix 2^52 Montgomery multiplication test failed.");
+      }
+    }
+  }
+}
+
+void bench_rsa(std::mt19937& gen)
+{
+  const uint32_t e = 65537;
+  for (const auto& config : {std::make_pair(2048, 2), std::make_pair(2048, 3), std::make_pair(4096, 2)}) {
+    std::vector<BigInt> primes;
+    std::vector<BigInt> exponents;
+    while (primes.size() < size_t(config.second)) {
+      const BigInt p = random_prime(gen, config.first / config.second);
+      if (limbs_mod(p.data(), p.size(), e) != 1) {
+        primes.push_back(p);
+        exponents.push_back(rsa_crt_exponent(p, e));
+      }
+    }
+    RsaPrivateKey key(primes, exponents);
+    const size_t count = config.first == 4096 ? 20 : 100;
+    std::vector<BigInt> messages;
+    for (size_t i = 0; i < count; ++i) {
+      messages.push_back(bigint_mod(random_bigint(gen, key.modulus().size()), key.modulus()));
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& m : messages) {
+      rsa_private_op(key, m);
+    }
+    std::cout << "rsa bits=" << config.first << ", primes=" << config.second
+              << ", cios signs_per_s_per_core=" << count / (elapsed_ms(start) / 1000);
+    for (const auto& kernel : available_kernels52()) {
+      key.use_kernel(kernel.name);
+      start = std::chrono::steady_clock::now();
+      rsa_private_op_batch(key, messages, 1);
+      std::cout << ", " << kernel.name << "_x8=" << count / (elapsed_ms(start) / 1000);
+    }
+    std::cout << "\n";
+  }
+}
+
+class Montgomery128;
+
+// Kernels of Montgomery128. The scalar product goes through the table as well, it is where the ADX chains pay off.
+struct MontKernels128 {
+  const char* isa;
+  unsigned __int128 (*multiply)(const Montgomery128&, unsigned __int128, unsigned __int128);
+  void (*multiply_batch)(const Montgomery128&, const unsigned __int128*, const unsigned __int128*,
+                         unsigned __int128*, size_t);
+  void (*pow_batch)(const Montgomery128&, const unsigned __int128*, unsigned __int128, unsigned __int128*, size_t);
+};
+
+const MontKernels128& montgomery128_kernels();
+
+/// @brief Montgomery arithmetic for odd moduli 3 <= n < 2^128 on two 64-bit limbs, R = 2^128
+/// MontgomeryMulti fixed at two limbs, fully unrolled: the 2x2 product and both word-by-word REDC rounds stay in
+/// registers. Same interface as Montgomery with unsigned __int128 residues.
+class Montgomery128 {
+public:
+  Montgomery128(const unsigned __int128 _n) : n(_n)
   {
     if (n < 3) {
-      std::cout << "n=" << n << "\n";
+      std::cout << "n=" << uint64_t(n >> 64) << ":" << uint64_t(n) << "\n";
       throw std::invalid_argument("Modulus must be >= 3.");
     }
     if (n % 2 == 0) {
-      std::cout << "n=" << n << "\n";
+      std::cout << "n=" << uint64_t(n >> 64) << ":" << uint64_t(n) << "\n";
       throw std::invalid_argument("Modulus must be odd.");
     }
-    if (n > INT32_MAX) {
-      std::cout << "n=" << n << "\n";
-      throw std::invalid_argument("Modulus must be less than 2^31.");
+    n0 = static_cast<uint64_t>(n);
+    n1 = static_cast<uint64_t>(n >> 64);
+    n_inv_mod = HenselLemma2adicRoot(64, n0); // -n^-1 mod 2^64
+
+    // 2^128 = 2^128 - n mod n, then R^2 by doubling
+    r_mod_n = (0 - n) % n;
+    r2_mod_n = r_mod_n;
+    for (uint32_t i = 0; i < 128; ++i) {
+      r2_mod_n = add(r2_mod_n, r2_mod_n);
     }
 
-    r_bit_len = bit_length(n);
-    assert(r_bit_len <= 31);
+    kernels = &montgomery128_kernels();
+  }
 
-    uint32_t r = 1U << r_bit_len;
-    r_mask = r - 1;
-    r_inv_mod = mod_mult_inv(n, r); // r^-1 mod n
+  unsigned __int128 convert_in(unsigned __int128 x) const
+  {
+    if (x >= n) {
+      x %= n;
+    }
+    return multiply(x, r2_mod_n);
+  }
+
+  unsigned __int128 convert_out(const unsigned __int128 x) const
+  {
+    return REDC(x, 0);
+  }
 
-    n_inv_mod = (static_cast<uint64_t>(r) * static_cast<uint64_t>(r_inv_mod) - 1) / n;
+  unsigned __int128 multiply(const unsigned __int128 a, const unsigned __int128 b) const
+  {
+    return kernels->multiply(*this, a, b);
+  }
 
-    r2_mod_n = (static_cast<uint64_t>(r) * static_cast<uint64_t>(r)) % n;
+  unsigned __int128 mul_add(const unsigned __int128 a, const unsigned __int128 b, const unsigned __int128 c) const
+  {
+    return add(multiply(a, b), c);
+  }
 
-    // std::cout << "r_bit_len=" << r_bit_len << "\n";
-    // std::cout << "r=" << r << "\n";
-    // std::cout << "r_inv_mod=" << r_inv_mod << "\n";
-    // std::cout << "r_mask=" << r_mask << "\n";
-    // std::cout << "k=" << k << "\n\n";
+  unsigned __int128 mul_sub(const unsigned __int128 a, const unsigned __int128 b, const unsigned __int128 c) const
+  {
+    return sub(multiply(a, b), c);
   }
 
-  uint32_t convert_in(uint32_t x)
+  void multiply_batch(const unsigned __int128* a, const unsigned __int128* b, unsigned __int128* out,
+                      const size_t len) const
   {
-    if (x >= n) {
-      x %= n; // Maybe this should be a warning or an error...
+    kernels->multiply_batch(*this, a, b, out, len);
+  }
+
+  void convert_in_batch(const unsigned __int128* x, unsigned __int128* out, const size_t len) const
+  {
+    for (size_t i = 0; i < len; ++i) {
+      out[i] = convert_in(x[i]);
     }
-    return REDC(static_cast<uint64_t>(x) * static_cast<uint64_t>(r2_mod_n));
   }
 
-  uint32_t convert_out(const uint32_t x)
+  void convert_out_batch(const unsigned __int128* x, unsigned __int128* out, const size_t len) const
   {
-    return REDC(x);
+    for (size_t i = 0; i < len; ++i) {
+      out[i] = convert_out(x[i]);
+    }
   }
 
-  uint32_t multiply(const uint32_t a, const uint32_t b)
+  void mul_add_batch(const unsigned __int128* a, const unsigned __int128* b, const unsigned __int128* c,
+                     unsigned __int128* out, const size_t len) const
   {
-    return REDC(static_cast<uint64_t>(a) * static_cast<uint64_t>(b));
+    for (size_t i = 0; i < len; ++i) {
+      out[i] = mul_add(a[i], b[i], c[i]);
+    }
   }
 
-  uint32_t REDC(const uint64_t x)
+  void mul_sub_batch(const unsigned __int128* a, const unsigned __int128* b, const unsigned __int128* c,
+                     unsigned __int128* out, const size_t len) const
   {
-    const uint32_t s = ((x & r_mask) * static_cast<uint64_t>(n_inv_mod)) & r_mask;
-    const uint64_t t = x + static_cast<uint64_t>(s) * static_cast<uint64_t>(n);
-    uint32_t u = t >> r_bit_len;
-    if (u >= n) {
-      u -= n;
+    for (size_t i = 0; i < len; ++i) {
+      out[i] = mul_sub(a[i], b[i], c[i]);
     }
-    return u;
+  }
+
+  // sum(a[i] * b[i]) * R^-1. Full 128-bit limbs leave no headroom for deferred reduction, every product is reduced.
+  unsigned __int128 dot(const unsigned __int128* a, const unsigned __int128* b, const size_t len) const
+  {
+    unsigned __int128 result = 0;
+    for (size_t i = 0; i < len; ++i) {
+      result = add(result, multiply(a[i], b[i]));
+    }
+    return result;
+  }
+
+  // out[i] = a[i]^e, Montgomery form in and out
+  void pow_batch(const unsigned __int128* a, const unsigned __int128 e, unsigned __int128* out, const size_t len) const
+  {
+    kernels->pow_batch(*this, a, e, out, len);
+  }
+
+  const MontKernels128& batch_kernels() const
+  {
+    return *kernels;
+  }
+
+  // a + b can wrap 128 bits, compare against n - b instead
+  unsigned __int128 add(const unsigned __int128 a, const unsigned __int128 b) const
+  {
+    const unsigned __int128 t = n - b;
+    return a >= t ? a - t : a + b;
+  }
+
+  unsigned __int128 sub(const unsigned __int128 a, const unsigned __int128 b) const
+  {
+    return a >= b ? a - b : a + (n - b);
+  }
+
+  // Square-and-multiply, a and the result are in Montgomery form
+  unsigned __int128 pow(const unsigned __int128 a, unsigned __int128 e) const
+  {
+    unsigned __int128 result = one();
+    unsigned __int128 base = a;
+    while (e > 0) {
+      if (e & 1) {
+        result = multiply(result, base);
+      }
+      base = multiply(base, base);
+      e >>= 1;
+    }
+    return result;
+  }
+
+  // (aR)^-1 = a^-1 R^-1, two conversions bring it back to a^-1 R. The plain inverse comes from the binary extended
+  // Euclidean algorithm, which only halves and subtracts and so never leaves 128 bits.
+  unsigned __int128 inverse(const unsigned __int128 a) const
+  {
+    // x1 a = u and x2 a = v mod n throughout
+    unsigned __int128 u = a, v = n, x1 = 1, x2 = 0;
+    const auto half = [&](const unsigned __int128 x) { return x % 2 == 0 ? x >> 1 : (x >> 1) + (n >> 1) + 1; };
+    while (u != 1 && v != 1 && u != 0) {
+      while (u % 2 == 0) {
+        u >>= 1;
+        x1 = half(x1);
+      }
+      while (v % 2 == 0) {
+        v >>= 1;
+        x2 = half(x2);
+      }
+      if (u >= v) {
+        u -= v;
+        x1 = sub(x1, x2);
+      } else {
+        v -= u;
+        x2 = sub(x2, x1);
+      }
+    }
+    if (u != 1 && v != 1) {
+      std::cout << "n=" << uint64_t(n >> 64) << ":" << uint64_t(n) << ", a=" << uint64_t(a >> 64) << ":"
+                << uint64_t(a) << "\n";
+      throw std::runtime_error("Reciprocal does not exist.");
+    }
+    return convert_in(convert_in(u == 1 ? x1 : x2));
+  }
+
+  unsigned __int128 one() const
+  {
+    return r_mod_n;
+  }
+
+  unsigned __int128 modulus() const
+  {
+    return n;
+  }
+
+  uint64_t inverse_modulus() const
+  {
+    return n_inv_mod;
+  }
+
+  // T R^-1 mod n for T = hi 2^128 + lo < n R, two word-by-word rounds as in MontgomeryMulti::mul_into
+  unsigned __int128 REDC(const unsigned __int128 lo, const unsigned __int128 hi) const
+  {
+    uint64_t t[5] = {uint64_t(lo), uint64_t(lo >> 64), uint64_t(hi), uint64_t(hi >> 64), 0};
+    for (size_t i = 0; i < 2; ++i) {
+      const uint64_t m = t[i] * n_inv_mod;
+      unsigned __int128 c = (static_cast<unsigned __int128>(m) * n0 + t[i]) >> 64;
+      c += static_cast<unsigned __int128>(m) * n1 + t[i + 1];
+      t[i + 1] = static_cast<uint64_t>(c);
+      for (size_t j = i + 2; j < 5; ++j) {
+        c = (c >> 64) + t[j];
+        t[j] = static_cast<uint64_t>(c);
+      }
+    }
+    return final_subtract(t[2], t[3], t[4]);
+  }
+
+  // t2 + t3 2^64 + t4 2^128 < 2n reduced below n
+  unsigned __int128 final_subtract(const uint64_t t2, const uint64_t t3, const uint64_t t4) const
+  {
+    const unsigned __int128 r = (static_cast<unsigned __int128>(t3) << 64) | t2;
+    return t4 || r >= n ? r - n : r;
   }
 
 private:
-  uint32_t n;
-  uint32_t r_bit_len;
-  uint32_t r_inv_mod;
-  uint32_t r_mask;
-  uint32_t n_inv_mod;
-  uint32_t r2_mod_n;
+  unsigned __int128 n;
+  uint64_t n0;
+  uint64_t n1;
+  uint64_t n_inv_mod;
+  unsigned __int128 r_mod_n;
+  unsigned __int128 r2_mod_n;
+  const MontKernels128* kernels;
 };
 
-int main()
+// a * b * 2^-128 on __int128 halves: 2x2 product, then two REDC rounds of m = t_i (-n^-1) mod 2^64. A product
+// close to n^2 plus m n can carry out of the fourth limb once n is close to 2^128, hence the fifth.
+unsigned __int128 multiply128_portable(const Montgomery128& mont, const unsigned __int128 a,
+                                       const unsigned __int128 b)
+{
+  const uint64_t a0 = uint64_t(a), a1 = uint64_t(a >> 64), b0 = uint64_t(b), b1 = uint64_t(b >> 64);
+  const unsigned __int128 lo = static_cast<unsigned __int128>(a0) * b0;
+  const unsigned __int128 mid0 = static_cast<unsigned __int128>(a0) * b1;
+  const unsigned __int128 mid1 = static_cast<unsigned __int128>(a1) * b0;
+  const unsigned __int128 hi = static_cast<unsigned __int128>(a1) * b1;
+  unsigned __int128 c = (lo >> 64) + uint64_t(mid0) + uint64_t(mid1);
+  const uint64_t t1 = uint64_t(c);
+  c = (c >> 64) + (mid0 >> 64) + (mid1 >> 64) + uint64_t(hi);
+  const uint64_t t2 = uint64_t(c);
+  const uint64_t t3 = uint64_t((c >> 64) + (hi >> 64));
+  return mont.REDC((static_cast<unsigned __int128>(t1) << 64) | uint64_t(lo),
+                   (static_cast<unsigned __int128>(t3) << 64) | t2);
+}
+
+void multiply128_batch_portable(const Montgomery128& mont, const unsigned __int128* a, const unsigned __int128* b,
+                                unsigned __int128* out, const size_t len)
+{
+  for (size_t i = 0; i < len; ++i) {
+    out[i] = multiply128_portable(mont, a[i], b[i]);
+  }
+}
+
+void pow128_batch_portable(const Montgomery128& mont, const unsigned __int128* a, const unsigned __int128 e,
+                           unsigned __int128* out, const size_t len)
+{
+  for (size_t i = 0; i < len; ++i) {
+    unsigned __int128 result = mont.one();
+    unsigned __int128 base = a[i];
+    for (unsigned __int128 k = e; k > 0; k >>= 1) {
+      if (k & 1) {
+        result = multiply128_portable(mont, result, base);
+      }
+      base = multiply128_portable(mont, base, base);
+    }
+    out[i] = result;
+  }
+}
+
+#if defined(__x86_64__)
+// The same product and rounds with MULX, which leaves the flags alone, and two independent carry chains: ADCX
+// through CF and ADOX through OF. Each row of partial products is added on both chains at once, GCC does not
+// schedule the intrinsics this way so it is written out.
+__attribute__((target("bmi2,adx")))
+inline unsigned __int128 multiply128_adx(const Montgomery128& mont, const unsigned __int128 a,
+                                         const unsigned __int128 b)
+{
+  const uint64_t a0 = uint64_t(a), a1 = uint64_t(a >> 64), b0 = uint64_t(b), b1 = uint64_t(b >> 64);
+  const uint64_t n0 = uint64_t(mont.modulus()), n1 = uint64_t(mont.modulus() >> 64), k0 = mont.inverse_modulus();
+  uint64_t t0, t1, t2, t3, t4, lo0, hi0, lo1, hi1, zero;
+  __asm__(
+      // t = a * b: row a0 on CF, row a1 added on OF
+      "movq %[a0], %%rdx\n\t"
+      "mulxq %[b0], %[t0], %[t1]\n\t"
+      "mulxq %[b1], %[lo0], %[t2]\n\t"
+      "xorl %k[zero], %k[zero]\n\t"
+      "adcxq %[lo0], %[t1]\n\t"
+      "movq %[a1], %%rdx\n\t"
+      "mulxq %[b0], %[lo1], %[hi1]\n\t"
+      "adoxq %[lo1], %[t1]\n\t"
+      "mulxq %[b1], %[lo0], %[t3]\n\t"
+      "adcxq %[lo0], %[t2]\n\t"
+      "adoxq %[hi1], %[t2]\n\t"
+      "adcxq %[zero], %[t3]\n\t"
+      "adoxq %[zero], %[t3]\n\t"
+      "movq %[zero], %[t4]\n\t"
+      // Round 0: t += (t0 k0 mod 2^64) n, t0 becomes 0
+      "movq %[t0], %%rdx\n\t"
+      "imulq %[k0], %%rdx\n\t"
+      "mulxq %[n0], %[lo0], %[hi0]\n\t"
+      "mulxq %[n1], %[lo1], %[hi1]\n\t"
+      "xorl %k[zero], %k[zero]\n\t"
+      "adcxq %[lo0], %[t0]\n\t"
+      "adoxq %[hi0], %[t1]\n\t"
+      "adcxq %[lo1], %[t1]\n\t"
+      "adoxq %[hi1], %[t2]\n\t"
+      "adcxq %[zero], %[t2]\n\t"
+      "adoxq %[zero], %[t3]\n\t"
+      "adcxq %[zero], %[t3]\n\t"
+      "adoxq %[zero], %[t4]\n\t"
+      "adcxq %[zero], %[t4]\n\t"
+      // Round 1 on t1..t4
+      "movq %[t1], %%rdx\n\t"
+      "imulq %[k0], %%rdx\n\t"
+      "mulxq %[n0], %[lo0], %[hi0]\n\t"
+      "mulxq %[n1], %[lo1], %[hi1]\n\t"
+      "xorl %k[zero], %k[zero]\n\t"
+      "adcxq %[lo0], %[t1]\n\t"
+      "adoxq %[hi0], %[t2]\n\t"
+      "adcxq %[lo1], %[t2]\n\t"
+      "adoxq %[hi1], %[t3]\n\t"
+      "adcxq %[zero], %[t3]\n\t"
+      "adoxq %[zero], %[t4]\n\t"
+      "adcxq %[zero], %[t4]\n\t"
+      : [t0] "=&r"(t0), [t1] "=&r"(t1), [t2] "=&r"(t2), [t3] "=&r"(t3), [t4] "=&r"(t4), [lo0] "=&r"(lo0),
+        [hi0] "=&r"(hi0), [lo1] "=&r"(lo1), [hi1] "=&r"(hi1), [zero] "=&r"(zero)
+      : [a0] "rm"(a0), [a1] "rm"(a1), [b0] "rm"(b0), [b1] "rm"(b1), [n0] "rm"(n0), [n1] "rm"(n1), [k0] "rm"(k0)
+      : "rdx", "cc");
+  return mont.final_subtract(t2, t3, t4);
+}
+
+__attribute__((target("bmi2,adx")))
+unsigned __int128 multiply128_adx_call(const Montgomery128& mont, const unsigned __int128 a, const unsigned __int128 b)
+{
+  return multiply128_adx(mont, a, b);
+}
+
+__attribute__((target("bmi2,adx")))
+void multiply128_batch_adx(const Montgomery128& mont, const unsigned __int128* a, const unsigned __int128* b,
+                           unsigned __int128* out, const size_t len)
+{
+  for (size_t i = 0; i < len; ++i) {
+    out[i] = multiply128_adx(mont, a[i], b[i]);
+  }
+}
+
+__attribute__((target("bmi2,adx")))
+void pow128_batch_adx(const Montgomery128& mont, const unsigned __int128* a, const unsigned __int128 e,
+                      unsigned __int128* out, const size_t len)
+{
+  for (size_t i = 0; i < len; ++i) {
+    unsigned __int128 result = mont.one();
+    unsigned __int128 base = a[i];
+    for (unsigned __int128 k = e; k > 0; k >>= 1) {
+      if (k & 1) {
+        result = multiply128_adx(mont, result, base);
+      }
+      base = multiply128_adx(mont, base, base);
+    }
+    out[i] = result;
+  }
+}
+#endif
+
+const MontKernels128& portable_montgomery128_kernels()
+{
+  static const MontKernels128 portable = {"portable", multiply128_portable, multiply128_batch_portable,
+                                          pow128_batch_portable};
+  return portable;
+}
+
+// Kernel tables the running CPU supports, best first
+std::vector<const MontKernels128*> available_montgomery128_kernels()
+{
+  std::vector<const MontKernels128*> kernels;
+#if defined(__x86_64__)
+  static const MontKernels128 adx = {"adx", multiply128_adx_call, multiply128_batch_adx, pow128_batch_adx};
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("bmi2") && __builtin_cpu_supports("adx")) {
+    kernels.push_back(&adx);
+  }
+#endif
+  kernels.push_back(&portable_montgomery128_kernels());
+  return kernels;
+}
+
+// Follows the instruction set picked for Montgomery like montgomery16_kernels(), anything but portable allows ADX
+const MontKernels128& montgomery128_kernels()
+{
+  static const MontKernels128* selected = []() {
+    const std::string isa = montgomery_kernels().isa;
+    for (const auto* k : available_montgomery128_kernels()) {
+      if (isa != "portable" || k == &portable_montgomery128_kernels()) {
+        return k;
+      }
+    }
+    return &portable_montgomery128_kernels();
+  }();
+  return *selected;
+}
+
+// Every kernel against a * b mod n from the schoolbook 256-bit product and BigInt long division
+void test_montgomery128(std::mt19937& gen)
+{
+  const auto to_bigint = [](const unsigned __int128 x) { return BigInt{uint64_t(x), uint64_t(x >> 64)}; };
+  const auto from_bigint = [](BigInt x) {
+    x.resize(2, 0);
+    return (static_cast<unsigned __int128>(x[1]) << 64) | x[0];
+  };
+  std::uniform_int_distribution<uint64_t> distr;
+  const auto random128 = [&](const uint32_t bits) {
+    const unsigned __int128 x = (static_cast<unsigned __int128>(distr(gen)) << 64) | distr(gen);
+    return bits == 128 ? x : x & ((static_cast<unsigned __int128>(1) << bits) - 1);
+  };
+  const unsigned __int128 max = ~static_cast<unsigned __int128>(0);
+  // Mersenne 2^127 - 1 and 2^128 - 159 are prime, the all ones modulus pushes every carry to the fifth limb
+  std::vector<unsigned __int128> moduli = {3, (static_cast<unsigned __int128>(1) << 64) + 13, max >> 1, max - 158, max};
+  for (const uint32_t bits : {65, 96, 100, 127, 128}) {
+    for (size_t i = 0; i < 4; ++i) {
+      moduli.push_back(random128(bits) | 1 | (static_cast<unsigned __int128>(1) << (bits - 1)));
+    }
+  }
+  for (const unsigned __int128 n : moduli) {
+    Montgomery128 mont(n);
+    const size_t len = 200;
+    std::vector<unsigned __int128> a(len), b(len), a_(len), b_(len), expected(len), out(len);
+    for (size_t i = 0; i < len; ++i) {
+      // Operands just below n make a * b + m n overflow four limbs when n is close to 2^128
+      a[i] = (i < 16 ? n - 1 - i : random128(128)) % n;
+      b[i] = (i < 16 ? n - 1 - 5 * i : random128(128)) % n;
+      a_[i] = mont.convert_in(a[i]);
+      b_[i] = mont.convert_in(b[i]);
+      expected[i] = from_bigint(bigint_mod(bigint_mul_schoolbook(to_bigint(a[i]), to_bigint(b[i])), to_bigint(n)));
+    }
+    for (const auto* k : available_montgomery128_kernels()) {
+      k->multiply_batch(mont, a_.data(), b_.data(), out.data(), len);
+      for (size_t i = 0; i < len; ++i) {
+        if (mont.convert_out(out[i]) != expected[i] ||
+            mont.convert_out(k->multiply(mont, a_[i], b_[i])) != expected[i]) {
+          std::cout << "n=" << uint64_t(n >> 64) << ":" << uint64_t(n) << ", i=" << i << ", isa=" << k->isa << "\n";
+          throw std::runtime_error("Montgomery128 multiplication test failed.");
+        }
+      }
+      const unsigned __int128 e = random128(128);
+      k->pow_batch(mont, a_.data(), e, out.data(), 4);
+      for (size_t i = 0; i < 4; ++i) {
+        if (out[i] != mont.pow(a_[i], e)) {
+          std::cout << "n=" << uint64_t(n >> 64) << ":" << uint64_t(n) << ", i=" << i << ", isa=" << k->isa << "\n";
+          throw std::runtime_error("Montgomery128 pow test failed.");
+        }
+      }
+    }
+    for (size_t i = 0; i < len; ++i) {
+      const BigInt a_big = to_bigint(a[i]), b_big = to_bigint(b[i]), n_big = to_bigint(n);
+      BigInt sum = a_big;
+      sum.push_back(0);
+      bigint_add_into(sum.data(), sum.size(), b_big.data(), b_big.size());
+      BigInt diff = a_big;
+      diff.push_back(0);
+      bigint_add_into(diff.data(), diff.size(), n_big.data(), n_big.size());
+      bigint_sub_from(diff.data(), diff.size(), b_big.data(), b_big.size());
+      if (mont.convert_out(mont.add(a_[i], b_[i])) != from_bigint(bigint_mod(sum, n_big)) ||
+          mont.convert_out(mont.sub(a_[i], b_[i])) != from_bigint(bigint_mod(diff, n_big))) {
+        std::cout << "n=" << uint64_t(n >> 64) << ":" << uint64_t(n) << ", i=" << i << "\n";
+        throw std::runtime_error("Montgomery128 addition test failed.");
+      }
+    }
+    // Fermat on the primes, the inverse wherever it exists
+    if (n == max >> 1 || n == max - 158) {
+      for (size_t i = 1; i < 10; ++i) {
+        if (mont.pow(a_[i], n - 1) != mont.one() || mont.multiply(a_[i], mont.inverse(a_[i])) != mont.one()) {
+          std::cout << "n=" << uint64_t(n >> 64) << ":" << uint64_t(n) << ", i=" << i << "\n";
+          throw std::runtime_error("Montgomery128 inverse test failed.");
+        }
+      }
+    }
+  }
+}
+
+// The unrolled kernels against MontgomeryMulti at two limbs, throughput and a dependent chain
+void bench_montgomery128(std::mt19937& gen)
+{
+  const size_t len = 4096;
+  const size_t reps = 500;
+  std::uniform_int_distribution<uint64_t> distr;
+  for (const uint32_t bits : {96, 127, 128}) {
+    unsigned __int128 n = (static_cast<unsigned __int128>(distr(gen)) << 64) | distr(gen) | 1;
+    if (bits < 128) {
+      n &= (static_cast<unsigned __int128>(1) << bits) - 1;
+    }
+    n |= static_cast<unsigned __int128>(1) << (bits - 1);
+    Montgomery128 mont(n);
+    MontgomeryMulti multi({uint64_t(n), uint64_t(n >> 64)});
+    std::vector<unsigned __int128> a(len), b(len), out(len);
+    for (size_t i = 0; i < len; ++i) {
+      a[i] = ((static_cast<unsigned __int128>(distr(gen)) << 64) | distr(gen)) % n;
+      b[i] = ((static_cast<unsigned __int128>(distr(gen)) << 64) | distr(gen)) % n;
+    }
+    std::cout << "bits=" << bits;
+    uint64_t t[4];
+    const double multi_batch = len * reps / best_ms([&]() {
+      for (size_t r = 0; r < reps; ++r) {
+        for (size_t i = 0; i < len; ++i) {
+          multi.mul_into(reinterpret_cast<const uint64_t*>(&a[i]), reinterpret_cast<const uint64_t*>(&b[i]),
+                         reinterpret_cast<uint64_t*>(&out[i]), t);
+        }
+      }
+    }, 5) / 1000;
+    unsigned __int128 x = a[0];
+    const double multi_chain = len * reps / best_ms([&]() {
+      for (size_t r = 0; r < len * reps; ++r) {
+        multi.mul_into(reinterpret_cast<const uint64_t*>(&x), reinterpret_cast<const uint64_t*>(&b[r % len]),
+                       reinterpret_cast<uint64_t*>(&x), t);
+      }
+    }, 5) / 1000;
+    std::cout << ", cios multiply_mops=" << multi_batch << ", cios chain_mops=" << multi_chain;
+    for (const auto* k : available_montgomery128_kernels()) {
+      const double batch = len * reps / best_ms([&]() {
+        for (size_t r = 0; r < reps; ++r) {
+          k->multiply_batch(mont, a.data(), b.data(), out.data(), len);
+        }
+      }, 5) / 1000;
+      const double chain = len * reps / best_ms([&]() {
+        for (size_t r = 0; r < len * reps; ++r) {
+          x = k->multiply(mont, x, b[r % len]);
+        }
+      }, 5) / 1000;
+      std::cout << ", " << k->isa << " multiply_batch_mops=" << batch << ", " << k->isa << " chain_mops=" << chain;
+    }
+    std::cout << (x == n ? "!" : "") << "\n";
+  }
+}
+
+// Times every candidate with cfg_field set to it and leaves the fastest one in place
+template <typename T, typename F>
+T tune_field(T& cfg_field, const std::vector<T>& candidates, const char* name, F fn)
+{
+  T best = candidates[0];
+  double best_time = 1e300;
+  for (const T c : candidates) {
+    cfg_field = c;
+    const double t = best_ms(fn);
+    std::cout << name << "=" << c << ", ms=" << t << "\n";
+    if (t < best_time) {
+      best_time = t;
+      best = c;
+    }
+  }
+  cfg_field = best;
+  return best;
+}
+
+/// @brief Measures the candidate configurations on this host and writes the winners to path.
+/// Takes a few seconds. The kernel ISA only takes effect on the next start, everything else right away.
+TuningConfig autotune(std::mt19937& gen, const std::string& path)
+{
+  TuningConfig& cfg = tuning();
+  cfg = TuningConfig();
+
+  // Batch kernels, scored on products plus butterflies since the NTT dominates most callers
+  {
+    Montgomery mont(2013265921);
+    std::uniform_int_distribution<uint32_t> distr(0, mont.modulus() - 1);
+    const size_t len = size_t(1) << 14;
+    MontVector a(len), b(len), out(len);
+    for (size_t i = 0; i < len; ++i) {
+      a[i] = distr(gen);
+      b[i] = distr(gen);
+    }
+    double best_time = 1e300;
+    for (const auto* k : available_montgomery_kernels()) {
+      const double t = best_ms([&]() {
+        for (size_t r = 0; r < 200; ++r) {
+          k->multiply_batch(mont, a.data(), b.data(), out.data(), len);
+          k->ntt_dif(mont, a.data(), out.data(), b.data(), len);
+        }
+      });
+      std::cout << "isa=" << k->isa << ", ms=" << t << "\n";
+      if (t < best_time) {
+        best_time = t;
+        cfg.isa = k->isa;
+      }
+    }
+  }
+
+  // Polynomial schoolbook cutoff, balanced products at a few sizes past the candidate
+  {
+    Montgomery mont(998244353);
+    NTT ntt(mont);
+    std::uniform_int_distribution<uint32_t> distr(0, mont.modulus() - 1);
+    std::vector<MontVector> polys;
+    for (const size_t size : {12, 24, 48, 96, 192}) {
+      MontVector p(size);
+      for (auto& x : p) {
+        x = distr(gen);
+      }
+      polys.push_back(std::move(p));
+    }
+    ntt.reserve(512);
+    tune_field(cfg.poly_schoolbook, std::vector<size_t>{8, 16, 32, 64, 128}, "poly_schoolbook", [&]() {
+      for (size_t r = 0; r < 20; ++r) {
+        for (const auto& p : polys) {
+          poly_multiply(ntt, p, p);
+        }
+      }
+    });
+  }
+
+  // In-cache span of the NTT, forward and inverse at 2^20
+  {
+    Montgomery mont(998244353);
+    NTT ntt(mont);
+    std::uniform_int_distribution<uint32_t> distr(0, mont.modulus() - 1);
+    MontVector a(size_t(1) << 20);
+    for (auto& x : a) {
+      x = distr(gen);
+    }
+    ntt.reserve(a.size());
+    tune_field(cfg.ntt_block, std::vector<size_t>{1024, 2048, 4096, 8192, 16384, 32768}, "ntt_block", [&]() {
+      ntt.forward(a);
+      ntt.inverse(a);
+    });
+  }
+
+  // Karatsuba base case first, then the NTT crossover with it in place
+  tune_field(cfg.karatsuba_threshold, std::vector<size_t>{16, 24, 32, 48, 64, 96, 128, 192}, "karatsuba_threshold",
+             [&, a = random_bigint(gen, 2048), b = random_bigint(gen, 2048)]() { bigint_mul_karatsuba(a, b); });
+  cfg.ntt_threshold = size_t(1) << 16;
+  for (size_t limbs = 64; limbs <= (size_t(1) << 15); limbs *= 2) {
+    const BigInt a = random_bigint(gen, limbs);
+    const BigInt b = random_bigint(gen, limbs);
+    const double karatsuba = best_ms([&]() { bigint_mul_karatsuba(a, b); });
+    const double ntt = best_ms([&]() { bigint_mul_ntt(a, b, cfg.ntt_chunk_bits); });
+    std::cout << "limbs=" << limbs << ", karatsuba_ms=" << karatsuba << ", ntt_ms=" << ntt << "\n";
+    if (ntt < karatsuba) {
+      cfg.ntt_threshold = limbs;
+      break;
+    }
+  }
+  tune_field(cfg.ntt_chunk_bits, std::vector<uint32_t>{16, 20}, "ntt_chunk_bits",
+             [&, a = random_bigint(gen, 50000), b = random_bigint(gen, 50000)]() {
+               bigint_mul_ntt(a, b, cfg.ntt_chunk_bits);
+             });
+
+  // CRT blocks, three primes to 128 bits
+  {
+    const std::vector<uint32_t> primes = {2013265921, 469762049, 998244353};
+    const size_t count = size_t(1) << 18;
+    CRT crt(primes);
+    std::vector<MontVector> residues(primes.size(), MontVector(count));
+    std::vector<const uint32_t*> residue_ptrs;
+    for (size_t i = 0; i < primes.size(); ++i) {
+      std::uniform_int_distribution<uint32_t> distr(0, primes[i] - 1);
+      for (auto& x : residues[i]) {
+        x = distr(gen);
+      }
+      residue_ptrs.push_back(residues[i].data());
+    }
+    std::vector<unsigned __int128> out(count);
+    tune_field(cfg.crt_block, std::vector<size_t>{256, 1024, 4096, 16384}, "crt_block",
+               [&]() { crt.reconstruct_u128(residue_ptrs, out.data(), count); });
+  }
+
+  // Exponentiation windows at RSA-2048 CRT size, 1024-bit modulus and exponent
+  {
+    BigInt n = random_bigint(gen, 16);
+    n[0] |= 1;
+    n[15] |= uint64_t(1) << 63;
+    const BigInt e = random_bigint(gen, 16);
+    MontgomeryMulti mont(n);
+    const BigInt a = mont.convert_in(bigint_mod(random_bigint(gen, 16), n));
+    tune_field(cfg.pow_window, std::vector<uint32_t>{3, 4, 5, 6, 7}, "pow_window", [&]() { mont.pow(a, e); });
+    MontgomeryBatch52 batch(n);
+    std::vector<BigInt> values;
+    for (size_t lane = 0; lane < MontgomeryBatch52::lanes; ++lane) {
+      values.push_back(bigint_mod(random_bigint(gen, 16), n));
+    }
+    const std::vector<uint64_t> x = batch.convert_in(values);
+    tune_field(cfg.batch_pow_window, std::vector<uint32_t>{3, 4, 5, 6, 7}, "batch_pow_window",
+               [&]() { batch.pow(x, e); });
+  }
+
+  save_tuning(cfg, path);
+  std::cout << "tuning written to " << path << "\n";
+  return cfg;
+}
+
+int main(int argc, char** argv)
 {
   // uint32_t n = 1280541179;
   // uint32_t a = 1115177062;
@@ -184,7 +10735,80 @@ int main()
 
   std::random_device rd;
   std::mt19937 gen(rd());
-  for (uint32_t bitlen = 1; bitlen <= 30; ++bitlen) {
+
+  // main2 tune [path], measures this host and writes the config loaded by later runs
+  if (argc > 1 && std::string(argv[1]) == "tune") {
+    autotune(gen, argc > 2 ? argv[2] : tuning_path());
+    return 0;
+  }
+
+  // main2 bench [name], runs every benchmark when no name is given
+  if (argc > 1 && std::string(argv[1]) == "bench") {
+    const std::string only = argc > 2 ? argv[2] : "";
+    if (only.empty() || only == "kernels") {
+      bench_montgomery_kernels(gen);
+    }
+    if (only.empty() || only == "kernels16") {
+      bench_montgomery16(gen);
+    }
+    if (only.empty() || only == "random") {
+      bench_mont_random(gen);
+    }
+    if (only.empty() || only == "gf2m") {
+      bench_gf2m(gen);
+    }
+    if (only.empty() || only == "jit") {
+      bench_mont_jit(gen);
+    }
+    if (only.empty() || only == "special_moduli") {
+      bench_special_moduli(gen);
+    }
+    if (only.empty() || only == "tower") {
+      bench_extension_tower(gen);
+    }
+    if (only.empty() || only == "dlog") {
+      bench_dlog(gen);
+    }
+    if (only.empty() || only == "ntt") {
+      bench_ntt(gen);
+    }
+    if (only.empty() || only == "truncated_ntt") {
+      bench_truncated_ntt(gen);
+    }
+    if (only.empty() || only == "fixed_convolver") {
+      bench_fixed_convolver(gen);
+    }
+    if (only.empty() || only == "polynomials") {
+      bench_polynomials(gen);
+    }
+    if (only.empty() || only == "reed_solomon") {
+      bench_reed_solomon(gen);
+    }
+    if (only.empty() || only == "mod_lu") {
+      bench_mod_lu(gen);
+    }
+    if (only.empty() || only == "sparse") {
+      bench_sparse(gen);
+    }
+    if (only.empty() || only == "crt") {
+      bench_crt(gen);
+    }
+    if (only.empty() || only == "bigint") {
+      bench_bigint(gen);
+    }
+    if (only.empty() || only == "rsa") {
+      bench_rsa(gen);
+    }
+    if (only.empty() || only == "montgomery128") {
+      bench_montgomery128(gen);
+    }
+    if (only.empty() || only == "combinatorics") {
+      bench_combinatorics(gen);
+    }
+    return 0;
+  }
+
+  for (uint32_t bitlen = 1; bitlen <= 31; ++bitlen) {
     std::cout << "bitlen=" << bitlen+1 << "\n";
     const uint32_t min_n = (1U << bitlen) + 1;
     const uint32_t max_n = UINT32_MAX >> (31 - bitlen);
@@ -208,9 +10832,43 @@ int main()
         std::cout << "a=" << a << ", b=" << b << ", n=" << n << "\n";
         throw std::runtime_error("Montgomery multiplication test failed.");
       }
+      const uint32_t sum = mont.convert_out(mont.add(a_, b_));
+      const uint32_t diff = mont.convert_out(mont.sub(a_, b_));
+      if (sum != (static_cast<uint64_t>(a) + b) % n || diff != (static_cast<uint64_t>(a) + n - b) % n) {
+        std::cout << "a=" << a << ", b=" << b << ", n=" << n << "\n";
+        throw std::runtime_error("Montgomery addition test failed.");
+      }
+      const uint32_t fma = mont.convert_out(mont.mul_add(a_, b_, b_));
+      const uint32_t fms = mont.convert_out(mont.mul_sub(a_, b_, a_));
+      if (fma != (static_cast<uint64_t>(expected) + b) % n || fms != (static_cast<uint64_t>(expected) + n - a) % n) {
+        std::cout << "a=" << a << ", b=" << b << ", n=" << n << "\n";
+        throw std::runtime_error("Montgomery multiply-accumulate test failed.");
+      }
     }
   }
 
+  test_montgomery_kernels(gen);
+  test_montgomery16(gen);
+  test_mont_random(gen);
+  test_gf2m(gen);
+  test_mont_jit(gen);
+  test_special_moduli(gen);
+  test_extension_tower(gen);
+  test_dlog(gen);
+  test_ntt(gen);
+  test_truncated_ntt(gen);
+  test_fixed_convolver(gen);
+  test_polynomials(gen);
+  test_reed_solomon(gen);
+  test_mod_lu(gen);
+  test_sparse(gen);
+  test_crt(gen);
+  test_bigint(gen);
+  test_rsa(gen);
+  test_batch52(gen);
+  test_montgomery128(gen);
+  test_combinatorics(gen);
+
   // int32_t n1 = 2345;
   // int32_t bl = bit_length(n1);
   // int32_t n2 = 1U << bl;